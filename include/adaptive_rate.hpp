@@ -0,0 +1,210 @@
+/**
+ * @file adaptive_rate.hpp
+ * @brief Adapts task periods to how fast the wired readings change and to the battery charge.
+ *
+ * The periods in config.hpp are the rates used while readings change normally.
+ * After every `ReadWired()` the sample is compared with the previous one:
+ *
+ *  * if any VWC channel moved by at least `ADAPTIVE_VWC_DELTA` counts or any pH
+ *    reading by `ADAPTIVE_PH_DELTA` hundredths (eg. during irrigation) the wired
+ *    period is halved, down to `ADAPTIVE_MIN_FREQ` ticks,
+ *  * if every reading moved by less than half of that the period is doubled, up
+ *    to `ADAPTIVE_MAX_SCALE` times `VWC_FREQ`. Doubling keeps wired reads on the
+ *    same wakes as the other tasks when their periods are equal,
+ *  * otherwise it is left alone.
+ *
+ * Independently, every period is doubled while the battery is below
+ * `BATT_LOW_PERCENT` and quadrupled below `BATT_CRITICAL_PERCENT`. The charge is
+ * updated whenever `SendTLM()` reads the fuel gauge.
+ *
+ * State is kept in RTC memory. It is saved to NVS by `adaptive_save()` at the end
+ * of `Scheduler()` after the first wired sample and whenever the wired period or the
+ * battery scale changed, so a cold boot, eg. after a watchdog reset, carries on with
+ * the same periods.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef ADAPTIVE_RATE_HPP
+#define ADAPTIVE_RATE_HPP
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <cstddef>
+#include <cstdlib>
+#include <rtc_state.hpp>
+#include <wired_buffer.hpp>
+
+/**
+ * @brief Sampling policy state, kept in RTC memory.
+ */
+struct adaptive_state{
+    /** current period of the wired sensor task in ticks */
+    int wired_period;
+    /** last battery charge in percent, negative if unknown */
+    int battery_percent;
+    /** `false` until the first wired sample was seen */
+    bool have_last;
+    /** ADS1115 counts of the last wired sample */
+    int16_t last_raw[4];
+    /** pH of the last wired sample in hundredths, negative if no sensor */
+    int last_pH[WIRED_PH_SENSORS];
+    /** the periods changed since the state was last saved to NVS, which keeps the members above */
+    bool unsaved;
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct adaptive_state adaptive;
+
+extern Preferences gator_prefs;
+
+/** Bytes of `adaptive` saved to NVS under the key "adaptive". */
+#define ADAPTIVE_SAVED_LEN offsetof(struct adaptive_state, unsaved)
+
+/**
+ * @brief Update the checksum after changing the policy state.
+ */
+void adaptive_seal(){
+    adaptive.checksum = rtc_checksum(&adaptive, offsetof(struct adaptive_state, checksum));
+}
+
+/**
+ * @brief Check a policy state read back from RTC memory or NVS.
+ */
+bool adaptive_valid(){
+    return adaptive.wired_period >= 1 && adaptive.wired_period <= VWC_FREQ * ADAPTIVE_MAX_SCALE;
+}
+
+/**
+ * @brief Check the policy state left in RTC memory, load it from NVS if it was lost.
+ *
+ * Starts over from the configured periods if neither holds a valid state. Must be
+ * called once per boot before any period is used.
+ */
+void adaptive_init(){
+    bool valid = adaptive_valid() &&
+        adaptive.checksum == rtc_checksum(&adaptive, offsetof(struct adaptive_state, checksum));
+    if(valid) return;
+
+    memset(&adaptive, 0, sizeof(adaptive));
+    if(gator_prefs.getBytesLength("adaptive") == ADAPTIVE_SAVED_LEN){
+        gator_prefs.getBytes("adaptive", &adaptive, ADAPTIVE_SAVED_LEN);
+    }
+    if(!adaptive_valid()){
+        memset(&adaptive, 0, sizeof(adaptive));
+        adaptive.wired_period = VWC_FREQ;
+        adaptive.battery_percent = -1;
+    }
+    adaptive_seal();
+}
+
+/**
+ * @brief Save the policy state to NVS for the next cold boot, if it changed.
+ */
+void adaptive_save(){
+    if(!adaptive.unsaved) return;
+    if(gator_prefs.putBytes("adaptive", &adaptive, ADAPTIVE_SAVED_LEN) != ADAPTIVE_SAVED_LEN){
+        if(DEBUG) Serial.println("[ERROR] failed to save the sampling policy to NVS");
+        return;
+    }
+    adaptive.unsaved = false;
+    adaptive_seal();
+}
+
+/**
+ * @brief Multiplier applied to every period for the last known battery charge.
+ *
+ * @returns 1, 2 below `BATT_LOW_PERCENT` or 4 below `BATT_CRITICAL_PERCENT`
+ */
+int adaptive_battery_scale(){
+    if(adaptive.battery_percent < 0) return 1;
+    if(adaptive.battery_percent < BATT_CRITICAL_PERCENT) return 4;
+    if(adaptive.battery_percent < BATT_LOW_PERCENT) return 2;
+    return 1;
+}
+
+/**
+ * @brief Period to use for a task.
+ *
+ * Stretched periods are kept below `MAX_COUNT / 2` so the task still runs before
+ * the reset count wraps, unless the configured period is already longer.
+ *
+ * @param[in] period The configured period in ticks.
+ * @param[in] wired `true` for the wired sensor task, which follows the signal.
+ *
+ * @returns the period in ticks
+ */
+int adaptive_period(int period, bool wired){
+    int adapted = (wired ? adaptive.wired_period : period) * adaptive_battery_scale();
+    int limit = period > MAX_COUNT / 2 ? period : MAX_COUNT / 2;
+    return adapted > limit ? limit : adapted;
+}
+
+/**
+ * @brief Record the battery charge read from the fuel gauge.
+ *
+ * @param[in] percent State of charge in percent.
+ */
+void adaptive_update_battery(float percent){
+    int p = (int)percent;
+    if(p == adaptive.battery_percent) return;
+
+    int scale = adaptive_battery_scale();
+    adaptive.battery_percent = p;
+    if(adaptive_battery_scale() != scale) adaptive.unsaved = true;
+    adaptive_seal();
+    if(DEBUG) Serial.printf("[ADAPTIVE] battery %d%%, periods x%d\n", p, adaptive_battery_scale());
+}
+
+/**
+ * @brief Compare a wired sample with the previous one and adjust the wired period.
+ *
+ * @param[in] sample The sample just taken.
+ */
+void adaptive_update_wired(const struct wired_sample* sample){
+    int vwc_delta = 0;
+    int pH_delta = 0;
+    int pH[WIRED_PH_SENSORS];
+    int period = adaptive.wired_period;
+    bool baseline = adaptive.have_last;
+
+    for(int i = 0; i < WIRED_PH_SENSORS; i++){
+        pH[i] = sample->pH[i][0] == '\0' ? -1 : (int)(atof(sample->pH[i]) * 100 + 0.5);
+    }
+
+    if(adaptive.have_last){
+        // VWC channels only, the 4th channel is the analog pH probe
+        for(int i = 0; i < 3; i++){
+            int d = abs(sample->raw_analog[i] - adaptive.last_raw[i]);
+            if(d > vwc_delta) vwc_delta = d;
+        }
+        for(int i = 0; i < WIRED_PH_SENSORS; i++){
+            if(pH[i] < 0 || adaptive.last_pH[i] < 0) continue;
+            int d = abs(pH[i] - adaptive.last_pH[i]);
+            if(d > pH_delta) pH_delta = d;
+        }
+
+        int max_period = VWC_FREQ * ADAPTIVE_MAX_SCALE;
+        if(vwc_delta >= ADAPTIVE_VWC_DELTA || pH_delta >= ADAPTIVE_PH_DELTA){
+            adaptive.wired_period /= 2;
+            if(adaptive.wired_period < ADAPTIVE_MIN_FREQ) adaptive.wired_period = ADAPTIVE_MIN_FREQ;
+
+        }else if(2 * vwc_delta < ADAPTIVE_VWC_DELTA && 2 * pH_delta < ADAPTIVE_PH_DELTA){
+            adaptive.wired_period *= 2;
+            if(adaptive.wired_period > max_period) adaptive.wired_period = max_period;
+        }
+        if(adaptive.wired_period < 1) adaptive.wired_period = 1;
+    }
+
+    memcpy(adaptive.last_raw, sample->raw_analog, sizeof(adaptive.last_raw));
+    memcpy(adaptive.last_pH, pH, sizeof(adaptive.last_pH));
+    adaptive.have_last = true;
+    // the first sample is saved too, a cold boot has nothing to compare with otherwise
+    if(!baseline || adaptive.wired_period != period) adaptive.unsaved = true;
+    adaptive_seal();
+
+    if(DEBUG) Serial.printf("[ADAPTIVE] vwc delta %d, pH delta %d, wired period %d ticks\n", vwc_delta, pH_delta, adaptive.wired_period);
+}
+
+#endif
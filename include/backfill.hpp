@@ -0,0 +1,232 @@
+/**
+ * @file backfill.hpp
+ * @brief Replays readings logged to the uSD card while the broker was unreachable.
+ *
+ * Readings logged while offline used to reach the server only when someone asked
+ * for them with `get_time_range`. Instead `log_data()` notes the time span of the
+ * records the broker never got, and the next wakes with a broker connection publish
+ * them from the log files to their original topics with `backfill_run()`. The time
+ * of the reading and `"BACKFILL":true` are added to each message, so the server can
+ * tell them from live readings and drop any it already has.
+ *
+ * ### Budget
+ * A wake replays at most `BACKFILL_BYTES` of messages and stops after `BACKFILL_MS`,
+ * a long outage is sent over many wakes instead of one session that empties the
+ * battery. The records of one wake are replayed together: the tasks of a wake log
+ * concurrently so their records are not in time order in the file, and the cursor
+ * could not resume in between. A wake stops at the first record more than
+ * `BACKFILL_GROUP_S` newer than all it replayed, once the next group of records
+ * would not fit the budget.
+ *
+ * ### Cursor
+ * Progress is kept as the time of the last record published and the number of
+ * records of that second published, so the next wake seeks to it through the time
+ * index of the file, see log_reader.hpp. The cursor only moves past a record once
+ * the client accepted it. It lives in RTC memory and is saved to NVS when a backlog
+ * starts and after every wake that replays. After a cold boot the span is extended
+ * to the epoch last saved by `epoch_clock_save()`, which covers the records logged
+ * since the cursor was saved.
+ *
+ * Records published live inside the span, eg. on a wake the broker came back, are
+ * replayed as well.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef BACKFILL_HPP
+#define BACKFILL_HPP
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <PubSubClient.h>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <epoch_clock.hpp>
+#include <log_reader.hpp>
+#include <rtc_state.hpp>
+
+/** Records logged less than this many seconds after the newest one replayed belong to the same wake. */
+#define BACKFILL_GROUP_S 30
+
+extern Preferences gator_prefs;
+extern PubSubClient mqtt_client;
+
+/**
+ * @brief Span of logged records not yet published, as saved to NVS.
+ */
+struct backfill_cursor{
+    /** time of the next record to replay, 0 if there is no backlog */
+    uint32_t next;
+    /** records logged at `next` already replayed */
+    uint32_t skip;
+    /** time of the last record logged while offline */
+    uint32_t end;
+};
+
+/**
+ * @brief Backlog kept in RTC memory.
+ */
+struct rtc_backfill{
+    struct backfill_cursor cursor;
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct rtc_backfill rtc_backfill;
+
+bool backfill_loaded = false;   //!< `rtc_backfill` checked this boot
+
+/**
+ * @brief Update the checksum after changing the cursor.
+ */
+void backfill_seal(){
+    rtc_backfill.checksum = rtc_checksum(&rtc_backfill, offsetof(struct rtc_backfill, checksum));
+}
+
+/**
+ * @brief Save the cursor to NVS for the next cold boot.
+ */
+void backfill_save(){
+    if(gator_prefs.putBytes("backfill", &rtc_backfill.cursor, sizeof(rtc_backfill.cursor)) != sizeof(rtc_backfill.cursor)){
+        Serial.println("[ERROR] could not save the backfill cursor");
+    }
+}
+
+/**
+ * @brief Start of a wake, the cursor is checked again on first use.
+ */
+void backfill_begin(){
+    backfill_loaded = false;
+}
+
+/**
+ * @brief Check the RTC memory copy of the cursor, reload it from NVS after a cold boot.
+ */
+void backfill_load(){
+    if(backfill_loaded) return;
+    backfill_loaded = true;
+
+    if(rtc_backfill.checksum == rtc_checksum(&rtc_backfill, offsetof(struct rtc_backfill, checksum))) return;
+
+    memset(&rtc_backfill, 0, sizeof(rtc_backfill));
+    if(gator_prefs.getBytesLength("backfill") == sizeof(rtc_backfill.cursor)){
+        gator_prefs.getBytes("backfill", &rtc_backfill.cursor, sizeof(rtc_backfill.cursor));
+        // records logged after the cursor was saved are older than the last saved epoch
+        uint32_t saved = epoch_clock_load().epoch;
+        if(rtc_backfill.cursor.next != 0 && saved > rtc_backfill.cursor.end) rtc_backfill.cursor.end = saved;
+    }
+    backfill_seal();
+}
+
+/**
+ * @brief Note a record logged to the uSD card but not published.
+ *
+ * @param[in] epoch Time of the record.
+ */
+void backfill_note(uint32_t epoch){
+    if(BACKFILL_BYTES == 0) return;
+    backfill_load();
+
+    struct backfill_cursor& c = rtc_backfill.cursor;
+    if(c.next == 0 || epoch < c.next){
+        // a new backlog, or the clock was set back
+        if(c.next == 0) c.end = epoch;
+        c.next = epoch;
+        c.skip = 0;
+        backfill_seal();
+        backfill_save();
+    }else if(epoch > c.end){
+        c.end = epoch;
+        backfill_seal();
+    }
+}
+
+/**
+ * @brief Publishes the rows read back from the log files, see `log_read_days()`.
+ */
+struct backfill_sink{
+    uint32_t from;          //!< cursor time when the wake started
+    uint32_t skip;          //!< records at `from` replayed by earlier wakes
+    uint32_t seen = 0;      //!< records at `from` skipped so far
+    uint32_t bytes = 0;     //!< message bytes published this wake
+    int published = 0;      //!< records published this wake
+    unsigned long started;  //!< `millis()` when the wake started replaying
+    uint32_t newest = 0;    //!< time of the newest record published this wake
+    uint32_t group = 0;     //!< message bytes of the group being published
+    uint32_t group_most = 0;    //!< message bytes of the largest group published
+
+    void file(const std::string&){}
+
+    bool add(uint32_t time, const std::string& row){
+        if(time == from && seen < skip){
+            seen++;
+            return true;
+        }
+        if(published == 0 || time > newest + BACKFILL_GROUP_S){
+            // a new group, only started if one like the last ones fits the budget
+            if(bytes + group_most > BACKFILL_BYTES || bytes >= BACKFILL_BYTES || millis() - started >= BACKFILL_MS) return false;
+            group = 0;
+        }
+
+        // time;topic;message
+        size_t sep = row.find(';');
+        size_t end = row.find(';', sep + 1);
+        if(end == std::string::npos) return true;
+        std::string topic = row.substr(sep + 1, end - sep - 1);
+        std::string message = row.substr(end + 1);
+        if(message.size() > 1 && message[message.size() - 1] == '}'){
+            message.insert(message.size() - 1, ", \"TIME\":\"" + row.substr(0, sep) + "\", \"BACKFILL\":true");
+        }
+        if(!mqtt_client.connected() || !mqtt_publish(topic.c_str(), message.c_str())) return false;
+        bytes += message.size();
+        published++;
+        if(time > newest) newest = time;
+        group += message.size();
+        if(group > group_most) group_most = group;
+
+        struct backfill_cursor& c = rtc_backfill.cursor;
+        if(time == c.next){
+            c.skip++;
+        }else if(time > c.next){
+            c.next = time;
+            c.skip = 1;
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Publish records of the backlog until the wake's budget is spent.
+ *
+ * Reads the log files, so it must be called after the log session is closed and
+ * before the uSD card is powered down.
+ *
+ * @returns records published
+ */
+int backfill_run(){
+    if(BACKFILL_BYTES == 0) return 0;
+    backfill_load();
+
+    struct backfill_cursor& c = rtc_backfill.cursor;
+    if(c.next == 0) return 0;
+
+    struct backfill_sink sink;
+    sink.from = c.next;
+    sink.skip = c.skip;
+    sink.started = millis();
+    bool done = log_read_days(c.next, c.end, std::vector<std::string>(), sink);
+
+    if(done) memset(&c, 0, sizeof(c));
+    backfill_seal();
+    if(done || sink.published > 0) backfill_save();
+
+    if(DEBUG){
+        if(done) Serial.printf("[BACKFILL] published %d records, %u bytes, backlog cleared\n", sink.published, sink.bytes);
+        else Serial.printf("[BACKFILL] published %d records, %u bytes, resuming at %u\n", sink.published, sink.bytes, c.next);
+    }
+    return sink.published;
+}
+
+#endif
@@ -0,0 +1,211 @@
+/**
+ * @file batch_format.hpp
+ * @brief Envelope carrying all readings of a wake in one MQTT message.
+ *
+ * Every reading used to be its own publish, and so its own packet. With
+ * `MQTT_BATCH` the readings of a wake are collected into one JSON envelope per gator
+ * and published once to `datagator/batch/<MAC>`:
+ *
+ *     {"V":1,"MAC":"24:6F:28:0A:1B:2C","T0":1690000000,"R":[[0,"<topic>","<message>"],[2,"<topic>","<message>"]]}
+ *
+ *  * `V` is `BATCH_VERSION`.
+ *  * `T0` is the epoch of the first reading.
+ *  * `R` holds one array per reading: seconds after `T0`, the topic it used to be
+ *    published to and its message as a JSON string, byte for byte the legacy message.
+ *
+ * `batch_expand()` gives back the topic and message of each reading, so an ingest
+ * script or broker bridge restores the per-topic view, see tools/batch_expand.
+ *
+ * This header has no Arduino dependencies and is shared by the firmware
+ * (log_pipeline.hpp) and the host expander.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef BATCH_FORMAT_HPP
+#define BATCH_FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/** Envelope format version, `"V"`. */
+#define BATCH_VERSION 1
+/** Topic prefix of envelopes, followed by the MAC of the gator. */
+#define BATCH_TOPIC "datagator/batch/"
+
+/**
+ * @brief Builds an envelope in a caller-owned buffer, nothing is allocated.
+ */
+class BatchWriter {
+    public:
+        int count = 0;      //!< readings added since `begin()`
+
+        BatchWriter(char* buf, size_t cap): buf(buf), cap(cap){}
+
+        /**
+         * @brief Start an envelope for readings from \p t0 on.
+         *
+         * @returns `false` if the buffer is too small for the header
+         */
+        bool begin(const char* mac, uint32_t t0){
+            count = 0;
+            this->t0 = t0;
+            int n = snprintf(buf, cap, "{\"V\":%d,\"MAC\":\"%s\",\"T0\":%lu,\"R\":[", BATCH_VERSION, mac, (unsigned long)t0);
+            len = n > 0 && (size_t)n + 2 < cap ? n : 0;
+            return len > 0;
+        }
+
+        /**
+         * @brief Add one reading.
+         *
+         * @returns `false` if it does not fit, the envelope is left as it was
+         */
+        bool add(uint32_t epoch, const char* topic, const char* message){
+            if(len == 0) return false;
+            size_t at = len;
+            int n = snprintf(buf + len, cap - len, "%s[%ld,", count > 0 ? "," : "", (long)(int32_t)(epoch - t0));
+            bool ok = n > 0 && len + n < cap;
+            if(ok) len += n;
+            ok = ok && put_string(topic) && put(',') && put_string(message) && put(']');
+            // room for closing the envelope
+            if(!ok || len + 2 >= cap){
+                len = at;
+                buf[len] = '\0';
+                return false;
+            }
+            count++;
+            return true;
+        }
+
+        /**
+         * @brief Close the envelope.
+         *
+         * @returns the NUL terminated envelope
+         */
+        const char* finish(){
+            if(len == 0) return "";
+            buf[len++] = ']';
+            buf[len++] = '}';
+            buf[len] = '\0';
+            return buf;
+        }
+
+        /**
+         * @brief Length of the envelope, after `finish()`.
+         */
+        size_t size(){ return len; }
+
+    private:
+        char* buf;
+        size_t cap;
+        size_t len = 0;
+        uint32_t t0 = 0;
+
+        bool put(char c){
+            if(len + 1 >= cap) return false;
+            buf[len++] = c;
+            return true;
+        }
+
+        bool put_string(const char* s){
+            if(!put('"')) return false;
+            for(; *s != '\0'; s++){
+                unsigned char c = *s;
+                if(c == '"' || c == '\\'){
+                    if(!put('\\') || !put(c)) return false;
+                }else if(c < 0x20){
+                    if(len + 7 >= cap) return false;
+                    len += snprintf(buf + len, cap - len, "\\u%04x", c);
+                }else if(!put(c)){
+                    return false;
+                }
+            }
+            return put('"');
+        }
+};
+
+/**
+ * @brief One reading of an envelope.
+ */
+struct batch_reading{
+    uint32_t epoch;         //!< `T0` plus the offset of the reading
+    std::string topic;
+    std::string message;
+};
+
+/**
+ * @brief Read a JSON string starting at the quote at \p i of \p s.
+ *
+ * @returns `false` if \p s has no string at \p i
+ */
+inline bool batch_read_string(const std::string& s, size_t& i, std::string& out){
+    out.clear();
+    if(i >= s.size() || s[i] != '"') return false;
+    for(i++; i < s.size(); i++){
+        char c = s[i];
+        if(c == '"'){
+            i++;
+            return true;
+        }
+        if(c != '\\'){
+            out += c;
+            continue;
+        }
+        if(++i >= s.size()) return false;
+        switch(s[i]){
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u':{
+                if(i + 4 >= s.size()) return false;
+                unsigned long u = strtoul(s.substr(i + 1, 4).c_str(), NULL, 16);
+                out += u < 0x80 ? (char)u : '?';
+                i += 4;
+                break;
+            }
+            default: out += s[i];
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Split an envelope into its readings.
+ *
+ * @param[in] envelope The payload published to `datagator/batch/<MAC>`.
+ * @param[out] readings Receives the readings, in the order they were logged.
+ *
+ * @returns `false` if \p envelope is not an envelope of a known version, readings before the damage are kept
+ */
+inline bool batch_expand(const std::string& envelope, std::vector<struct batch_reading>& readings){
+    int version = 0;
+    unsigned long t0 = 0;
+    if(sscanf(envelope.c_str(), "{\"V\":%d,", &version) != 1 || version != BATCH_VERSION) return false;
+    size_t at = envelope.find(",\"T0\":");
+    if(at == std::string::npos || sscanf(envelope.c_str() + at, ",\"T0\":%lu", &t0) != 1) return false;
+    size_t i = envelope.find("\"R\":[", at);
+    if(i == std::string::npos) return false;
+
+    for(i += 5; i < envelope.size() && envelope[i] == '['; ){
+        struct batch_reading r;
+        char* end;
+        long offset = strtol(envelope.c_str() + i + 1, &end, 10);
+        i = end - envelope.c_str();
+        if(i >= envelope.size() || envelope[i++] != ',' || !batch_read_string(envelope, i, r.topic)) return false;
+        if(i >= envelope.size() || envelope[i++] != ',' || !batch_read_string(envelope, i, r.message)) return false;
+        if(i >= envelope.size() || envelope[i++] != ']') return false;
+        r.epoch = (uint32_t)(t0 + offset);
+        readings.push_back(r);
+        if(i < envelope.size() && envelope[i] == ',') i++;
+    }
+    return envelope.compare(i, 2, "]}") == 0;
+}
+
+#endif
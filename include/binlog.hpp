@@ -0,0 +1,278 @@
+/**
+ * @file binlog.hpp
+ * @brief Writes and reads the binary uSD card log files, see binlog_format.hpp.
+ *
+ * Enabled with `SD_LOG_BINARY`. Records are collected in a block in RAM and the
+ * block is handed to the wake's log session, see log_session.hpp, when it is full
+ * or the session is closed before sleep.
+ *
+ * The dictionary of the day's file is kept in RTC memory as hashes of its topics
+ * and templates, so a wake only has to write entries for messages it has not seen
+ * before. If the RTC copy does not match the file (cold boot, card swapped) it is
+ * rebuilt from the file once.
+ *
+ * Blocks are added to the file's time index every `LOG_INDEX_EVERY` records and
+ * always when they add dictionary entries, so a reader seeking into the file can
+ * load the dictionary first. Files are read back by log_reader.hpp.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef BINLOG_HPP
+#define BINLOG_HPP
+
+#include <Arduino.h>
+#include <SD.h>
+#include <cstddef>
+#include <string>
+#include <binlog_format.hpp>
+#include <log_session.hpp>
+#include <rtc_state.hpp>
+
+extern LogSession log_session;
+
+/** Most dictionary entries per file, later messages are stored as text. */
+#define BINLOG_DICT_LEN 64
+
+/**
+ * @brief Dictionary of the file being written, kept in RTC memory.
+ */
+struct rtc_binlog{
+    /** file the dictionary belongs to */
+    char filename[LOG_FILENAME_LEN];
+    /** size of the file after the last wake wrote to it */
+    uint32_t file_size;
+    /** entries in `hash` */
+    int count;
+    /** FNV-1a hash of `<topic>\0<template>` of each entry, by id */
+    uint32_t hash[BINLOG_DICT_LEN];
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct rtc_binlog rtc_binlog;
+
+bool binlog_ready = false;       //!< dictionary checked against the file this session
+uint8_t binlog_block[BINLOG_BLOCK_SLOTS * BINLOG_SLOT_LEN];   //!< slots of the block being built
+int binlog_slots = 0;            //!< slots used in `binlog_block`
+int binlog_records = 0;          //!< records in `binlog_block`
+uint8_t binlog_flags = 0;        //!< flags of the block being built
+uint32_t binlog_first_epoch = 0; //!< epoch of the first record in the block
+uint32_t binlog_last_epoch = 0;  //!< epoch of the last record in the block
+char binlog_text[BINLOG_TEXT_LEN];   //!< template or text of the record being logged
+int32_t binlog_values[BINLOG_MAX_VALUES];
+
+/**
+ * @brief Update the checksum after changing the dictionary.
+ */
+void binlog_seal(){
+    rtc_binlog.checksum = rtc_checksum(&rtc_binlog, offsetof(struct rtc_binlog, checksum));
+}
+
+/**
+ * @brief Header written to new binary log files.
+ */
+struct binlog_file_header binlog_header(){
+    struct binlog_file_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "DGBL", 4);
+    h.version = BINLOG_VERSION;
+    h.slot_len = BINLOG_SLOT_LEN;
+    return h;
+}
+
+/**
+ * @brief Hash of a dictionary entry.
+ */
+uint32_t binlog_hash(const char* topic, const char* tmpl){
+    uint32_t hash = rtc_checksum(topic, strlen(topic) + 1);
+    for(const char* p = tmpl; *p != '\0'; p++){
+        hash ^= (uint8_t)*p;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Start a new file, called when the log session is started.
+ */
+void binlog_begin(){
+    binlog_ready = false;
+    binlog_slots = 0;
+    binlog_records = 0;
+    binlog_flags = 0;
+}
+
+/**
+ * @brief Rebuild the dictionary from the hashes of the entries in \p filename.
+ */
+void binlog_load_dictionary(const char* filename){
+    memset(&rtc_binlog, 0, sizeof(rtc_binlog));
+    strncpy(rtc_binlog.filename, filename, LOG_FILENAME_LEN - 1);
+
+    File f = SD.open(filename, FILE_READ);
+    if(f){
+        BinlogReader<File>* reader = new BinlogReader<File>(f);
+        struct binlog_entry* e = new struct binlog_entry;
+        if(reader->begin()){
+            while(reader->next_block(UINT32_MAX, 0)){
+                while(reader->next_record(*e)){
+                    if(e->kind != BINLOG_TOPIC || e->id >= BINLOG_DICT_LEN) continue;
+                    rtc_binlog.hash[e->id] = binlog_hash(e->topic, e->text);
+                    if(e->id >= rtc_binlog.count) rtc_binlog.count = e->id + 1;
+                }
+            }
+        }
+        rtc_binlog.file_size = f.size();
+        if(DEBUG) Serial.printf("[BINLOG] loaded %d dictionary entries from \'%s\'\n", rtc_binlog.count, filename);
+        delete e;
+        delete reader;
+        f.close();
+    }
+    binlog_seal();
+}
+
+/**
+ * @brief Open the file and make sure the dictionary matches it, once per session.
+ */
+bool binlog_prepare(){
+    if(binlog_ready) return true;
+
+    bool valid = rtc_binlog.checksum == rtc_checksum(&rtc_binlog, offsetof(struct rtc_binlog, checksum)) &&
+        strcmp(rtc_binlog.filename, log_session.get_filename()) == 0;
+
+    if(!log_session.open()) return false;
+
+    if(log_session.is_new()){
+        memset(&rtc_binlog, 0, sizeof(rtc_binlog));
+        strncpy(rtc_binlog.filename, log_session.get_filename(), LOG_FILENAME_LEN - 1);
+        binlog_seal();
+    }else if(!valid || rtc_binlog.file_size != log_session.size()){
+        // the file was written by someone else, read its dictionary back
+        log_session.close();
+        binlog_load_dictionary(log_session.get_filename());
+        if(!log_session.open()) return false;
+    }
+    binlog_ready = true;
+    return true;
+}
+
+/**
+ * @brief Hand the block being built to the log session.
+ */
+void binlog_flush_block(){
+    if(binlog_slots == 0) return;
+
+    struct binlog_block_header h;
+    h.magic = BINLOG_BLOCK_MAGIC;
+    h.slots = binlog_slots;
+    h.flags = binlog_flags;
+    h.first_epoch = binlog_first_epoch;
+    h.last_epoch = binlog_last_epoch;
+    h.crc = binlog_crc32(binlog_block, binlog_slots * BINLOG_SLOT_LEN);
+    log_session.index(binlog_first_epoch, binlog_records, binlog_flags & BINLOG_BLOCK_TOPICS);
+    log_session.write(&h, sizeof(h));
+    log_session.write(binlog_block, binlog_slots * BINLOG_SLOT_LEN);
+
+    binlog_slots = 0;
+    binlog_records = 0;
+    binlog_flags = 0;
+}
+
+/**
+ * @brief Reserve the slots of one record in the block being built.
+ *
+ * @returns the first slot, zeroed
+ */
+uint8_t* binlog_reserve(size_t body_len, uint32_t epoch, uint8_t kind, uint8_t sensor, uint8_t id){
+    int slots = (BINLOG_RECORD_HEAD + body_len + BINLOG_SLOT_LEN - 1) / BINLOG_SLOT_LEN;
+    if(binlog_slots + slots > BINLOG_BLOCK_SLOTS) binlog_flush_block();
+
+    if(binlog_slots == 0) binlog_first_epoch = epoch;
+    binlog_last_epoch = epoch;
+
+    uint8_t* slot = binlog_block + binlog_slots * BINLOG_SLOT_LEN;
+    memset(slot, 0, slots * BINLOG_SLOT_LEN);
+    binlog_slots += slots;
+    binlog_records++;
+
+    struct binlog_record r;
+    r.epoch = epoch;
+    r.kind = kind;
+    r.sensor = sensor;
+    r.id = id;
+    r.more = slots - 1;
+    memcpy(slot, &r, BINLOG_RECORD_HEAD);
+    return slot;
+}
+
+/**
+ * @brief Add a record with the text `<topic>\0<text>\0`.
+ */
+void binlog_add_text(uint32_t epoch, uint8_t kind, uint8_t sensor, uint8_t id, const char* topic, const char* text){
+    size_t topic_len = strlen(topic) + 1;
+    size_t text_len = strlen(text) + 1;
+    if(topic_len + text_len > BINLOG_TEXT_LEN){
+        Serial.printf("[ERROR] binary log record for \'%s\' too long, truncated\n", topic);
+        if(topic_len > BINLOG_TEXT_LEN / 2) topic_len = BINLOG_TEXT_LEN / 2;
+        if(text_len > BINLOG_TEXT_LEN - topic_len) text_len = BINLOG_TEXT_LEN - topic_len;
+    }
+
+    uint8_t* body = binlog_reserve(topic_len + text_len, epoch, kind, sensor, id) + BINLOG_RECORD_HEAD;
+    memcpy(body, topic, topic_len - 1);
+    memcpy(body + topic_len, text, text_len - 1);
+    if(kind == BINLOG_TOPIC) binlog_flags |= BINLOG_BLOCK_TOPICS;
+}
+
+/**
+ * @brief Log one message to the binary log file of the session.
+ *
+ * @param[in] epoch Time of the record.
+ * @param[in] topic The MQTT topic.
+ * @param[in] message The message, likely a JSON object.
+ */
+void binlog_log(uint32_t epoch, const char* topic, const char* message){
+    if(!binlog_prepare()) return;
+
+    uint8_t sensor = binlog_sensor(topic);
+    int n = binlog_encode(message, binlog_text, binlog_values);
+    if(n < 0){
+        binlog_add_text(epoch, BINLOG_TEXT, sensor, 0, topic, message);
+        return;
+    }
+
+    // find the dictionary entry, add it if new
+    uint32_t hash = binlog_hash(topic, binlog_text);
+    int id = 0;
+    while(id < rtc_binlog.count && rtc_binlog.hash[id] != hash) id++;
+    if(id == rtc_binlog.count){
+        if(id == BINLOG_DICT_LEN){
+            binlog_add_text(epoch, BINLOG_TEXT, sensor, 0, topic, message);
+            return;
+        }
+        binlog_add_text(epoch, BINLOG_TOPIC, sensor, id, topic, binlog_text);
+        rtc_binlog.hash[rtc_binlog.count++] = hash;
+        binlog_seal();
+    }
+
+    // pack the values into the text buffer, the template is no longer needed
+    uint8_t* packed = (uint8_t*)binlog_text;
+    size_t len = 0;
+    for(int i = 0; i < n; i++) len += binlog_put_varint(binlog_values[i], packed + len);
+
+    uint8_t* body = binlog_reserve(len, epoch, BINLOG_READING, sensor, id) + BINLOG_RECORD_HEAD;
+    memcpy(body, packed, len);
+}
+
+/**
+ * @brief Write the last block, must be called before the log session is closed.
+ */
+void binlog_close(){
+    if(!binlog_ready) return;
+    binlog_flush_block();
+    rtc_binlog.file_size = log_session.size();
+    binlog_seal();
+    binlog_ready = false;
+}
+
+#endif
@@ -0,0 +1,440 @@
+/**
+ * @file binlog_format.hpp
+ * @brief Compact binary format of the uSD card log files.
+ *
+ * A CSV log row repeats the full MQTT topic and the JSON keys of the message for
+ * every reading. The binary format keeps both once per file in a dictionary and
+ * stores each reading as a fixed size record of its epoch and numeric values.
+ *
+ * ### Layout
+ * All integers are little endian.
+ *
+ *  1. file header, `binlog_file_header`
+ *  2. blocks, each a `binlog_block_header` followed by `slots` records of `BINLOG_SLOT_LEN`
+ *     bytes. The CRC in the header covers the slots, a block which fails the check is
+ *     skipped and the reader resynchronizes on the next block magic.
+ *
+ * A record is one `binlog_record` slot, followed by `more` continuation slots:
+ *
+ *  * `BINLOG_TOPIC` adds dictionary entry `id`, the text `<topic>\0<template>\0` starts
+ *    at `body` and continues in the following slots.
+ *  * `BINLOG_READING` holds the values of dictionary entry `id` from `body` on, each
+ *    a zigzag varint (LEB128) so small values take a single byte. Unused bytes are 0.
+ *  * `BINLOG_TEXT` holds `<topic>\0<message>\0` for messages which do not fit a template.
+ *
+ * A template is the message with every number replaced by `BINLOG_PLACEHOLDER` and
+ * the digit count after the decimal point, the value is stored as an integer scaled
+ * by that many decimals. Expanding the template gives back the exact message text.
+ *
+ * This header has no Arduino dependencies and is shared by the firmware (binlog.hpp)
+ * and the host decoder (tools/binlog2csv).
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef BINLOG_FORMAT_HPP
+#define BINLOG_FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+/** File format version written to the file header. */
+#define BINLOG_VERSION 1
+/** Bytes per record slot. */
+#define BINLOG_SLOT_LEN 16
+/** Bytes of the first slot of a record before `body`. */
+#define BINLOG_RECORD_HEAD 8
+/** Most values in one reading, further numbers stay in the template as text. */
+#define BINLOG_MAX_VALUES 64
+/** Most slots in one block, a record never spans two blocks. */
+#define BINLOG_BLOCK_SLOTS 128
+/** Longest template or text record. */
+#define BINLOG_TEXT_LEN (BINLOG_BLOCK_SLOTS * BINLOG_SLOT_LEN - BINLOG_RECORD_HEAD)
+/** Marks a number in a template, followed by the number of decimals as `'0' + n`. */
+#define BINLOG_PLACEHOLDER '\x01'
+/** First two bytes of every block. */
+#define BINLOG_BLOCK_MAGIC 0xB10C
+/** Block flag, the block adds dictionary entries and can not be skipped. */
+#define BINLOG_BLOCK_TOPICS 0x01
+
+/**
+ * @brief Record kinds.
+ */
+enum binlog_kind{
+    BINLOG_TOPIC = 1,   //!< dictionary entry
+    BINLOG_READING = 2, //!< values for a dictionary entry
+    BINLOG_TEXT = 3     //!< topic and message as text
+};
+
+/** Sensor type of a record, `BINLOG_SENSORS[type - 1]` is the topic prefix, 0 if unknown. */
+static const char* const BINLOG_SENSORS[] = {
+    "meter_teros10", "atlas_ezo_ph", "atlas_gravity_ph", "generic_pH", "kkm_k6p", "minew_s1", "datagator"
+};
+/** Number of entries in `BINLOG_SENSORS`. */
+#define BINLOG_NUM_SENSORS (sizeof(BINLOG_SENSORS) / sizeof(BINLOG_SENSORS[0]))
+
+#pragma pack(push, 1)
+/**
+ * @brief Start of every binary log file.
+ */
+struct binlog_file_header{
+    char magic[4];          //!< "DGBL"
+    uint8_t version;        //!< `BINLOG_VERSION`
+    uint8_t slot_len;       //!< `BINLOG_SLOT_LEN`
+    uint8_t reserved[10];
+};
+
+/**
+ * @brief Start of every block.
+ */
+struct binlog_block_header{
+    uint16_t magic;         //!< `BINLOG_BLOCK_MAGIC`
+    uint8_t slots;          //!< slots following the header
+    uint8_t flags;          //!< `BINLOG_BLOCK_TOPICS`
+    uint32_t first_epoch;   //!< epoch of the first record
+    uint32_t last_epoch;    //!< epoch of the last record
+    uint32_t crc;           //!< `binlog_crc32()` of the slots
+};
+
+/**
+ * @brief First slot of a record.
+ */
+struct binlog_record{
+    uint32_t epoch;         //!< seconds since 1970
+    uint8_t kind;           //!< `binlog_kind`
+    uint8_t sensor;         //!< index into `BINLOG_SENSORS` plus one, 0 if unknown
+    uint8_t id;             //!< dictionary entry
+    uint8_t more;           //!< continuation slots following this one
+    uint8_t body[BINLOG_SLOT_LEN - BINLOG_RECORD_HEAD];
+};
+#pragma pack(pop)
+
+/**
+ * @brief CRC-32 (IEEE 802.3) of \p len bytes, continuing from \p crc.
+ */
+inline uint32_t binlog_crc32(const void* data, size_t len, uint32_t crc = 0){
+    const uint8_t* bytes = (const uint8_t*)data;
+    crc = ~crc;
+    for(size_t i = 0; i < len; i++){
+        crc ^= bytes[i];
+        for(int b = 0; b < 8; b++) crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Append \p value to \p out as a zigzag varint.
+ *
+ * @returns the number of bytes written, at most 5
+ */
+inline size_t binlog_put_varint(int32_t value, uint8_t* out){
+    uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    size_t n = 0;
+    do{
+        out[n++] = (v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+        v >>= 7;
+    }while(v != 0);
+    return n;
+}
+
+/**
+ * @brief Read a zigzag varint from \p in, at most \p len bytes.
+ *
+ * @returns the number of bytes read, 0 if \p in ends inside the value
+ */
+inline size_t binlog_get_varint(const uint8_t* in, size_t len, int32_t* value){
+    uint32_t v = 0;
+    for(size_t n = 0; n < len && n < 5; n++){
+        v |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+        if(!(in[n] & 0x80)){
+            *value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Sensor type of a topic, see `BINLOG_SENSORS`.
+ */
+inline uint8_t binlog_sensor(const char* topic){
+    for(size_t i = 0; i < BINLOG_NUM_SENSORS; i++){
+        size_t n = strlen(BINLOG_SENSORS[i]);
+        if(strncmp(topic, BINLOG_SENSORS[i], n) == 0 && topic[n] == '/') return i + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Split a message into a template and its numeric values.
+ *
+ * Numbers outside of JSON strings with at most 9 digits are replaced by a
+ * placeholder, any other number is kept as text.
+ *
+ * @param[in] msg The message.
+ * @param[out] tmpl Receives the NUL terminated template, `BINLOG_TEXT_LEN` bytes.
+ * @param[out] values Receives the values, `BINLOG_MAX_VALUES` entries.
+ *
+ * @returns the number of values, -1 if the message can not be stored as a template
+ */
+inline int binlog_encode(const char* msg, char* tmpl, int32_t* values){
+    size_t t = 0;
+    int n = 0;
+    bool in_string = false;
+
+    for(const char* p = msg; *p != '\0';){
+        if(*p == BINLOG_PLACEHOLDER || t + 3 >= BINLOG_TEXT_LEN) return -1;
+
+        bool starts_number = !in_string && ((*p >= '0' && *p <= '9') || (p[0] == '-' && p[1] >= '0' && p[1] <= '9'));
+        if(starts_number && n < BINLOG_MAX_VALUES){
+            const char* q = p;
+            bool negative = *q == '-';
+            if(negative) q++;
+
+            int64_t mantissa = 0;
+            int digits = 0, decimals = 0;
+            bool leading_zero = q[0] == '0' && q[1] >= '0' && q[1] <= '9';
+            for(; *q >= '0' && *q <= '9'; q++, digits++) if(digits < 10) mantissa = mantissa * 10 + (*q - '0');
+            if(*q == '.' && q[1] >= '0' && q[1] <= '9'){
+                for(q++; *q >= '0' && *q <= '9'; q++, digits++, decimals++) if(digits < 10) mantissa = mantissa * 10 + (*q - '0');
+            }
+
+            bool exact = digits <= 9 && !leading_zero && *q != 'e' && *q != 'E' && *q != '.';
+            if(exact){
+                // keep the sign of -0.000 in the template
+                if(negative && mantissa == 0) tmpl[t++] = '-';
+                tmpl[t++] = BINLOG_PLACEHOLDER;
+                tmpl[t++] = '0' + decimals;
+                values[n++] = (int32_t)(negative ? -mantissa : mantissa);
+                p = q;
+                continue;
+            }
+            // copy the whole number as text
+            while(p < q && t + 1 < BINLOG_TEXT_LEN) tmpl[t++] = *p++;
+            continue;
+        }
+
+        if(*p == '"') in_string = !in_string;
+        else if(*p == '\\' && in_string && p[1] != '\0') tmpl[t++] = *p++;
+        tmpl[t++] = *p++;
+    }
+    tmpl[t] = '\0';
+    return n;
+}
+
+/**
+ * @brief Rebuild a message from its template and values, see `binlog_encode()`.
+ *
+ * @param[in] tmpl The template.
+ * @param[in] values The values, `n` entries.
+ * @param[in] n Number of values.
+ * @param[out] out The message is appended here.
+ *
+ * @returns `false` if the template has more placeholders than \p n
+ */
+inline bool binlog_expand(const char* tmpl, const int32_t* values, int n, std::string& out){
+    static const uint32_t scale[10] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+    int v = 0;
+
+    for(const char* p = tmpl; *p != '\0'; p++){
+        if(*p != BINLOG_PLACEHOLDER){
+            out += *p;
+            continue;
+        }
+        if(v >= n || p[1] < '0' || p[1] > '9') return false;
+        int decimals = *++p - '0';
+        int64_t value = values[v++];
+        if(value < 0){
+            out += '-';
+            value = -value;
+        }
+
+        char digits[24];
+        if(decimals == 0) snprintf(digits, sizeof(digits), "%lu", (unsigned long)value);
+        else snprintf(digits, sizeof(digits), "%lu.%0*lu", (unsigned long)(value / scale[decimals]), decimals, (unsigned long)(value % scale[decimals]));
+        out += digits;
+    }
+    return true;
+}
+
+/**
+ * @brief Format an epoch like the CSV logs, `<month>-<day>-<year>T<hr>:<min>:<sec>+0`.
+ */
+inline std::string binlog_time_string(uint32_t epoch){
+    time_t t = epoch;
+    struct tm tm = *gmtime(&t);
+    char buf[80];
+    snprintf(buf, sizeof(buf), "%d-%d-%dT%d:%d:%d+0", tm.tm_mon + 1, tm.tm_mday, tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+    return buf;
+}
+
+/**
+ * @brief A decoded record, see `BinlogReader::next_record()`.
+ */
+struct binlog_entry{
+    uint32_t epoch;
+    uint8_t kind;                       //!< `binlog_kind`
+    uint8_t sensor;                     //!< see `BINLOG_SENSORS`
+    uint8_t id;                         //!< dictionary entry
+    int n;                              //!< values in a reading
+    int32_t values[BINLOG_MAX_VALUES];
+    const char* topic;                  //!< topic of a dictionary entry or text record
+    const char* text;                   //!< template of a dictionary entry or message of a text record
+};
+
+/**
+ * @brief Reads the blocks and records of a binary log file.
+ *
+ * `Source` provides `size_t read(uint8_t*, size_t)`, `bool seek(uint32_t)` and
+ * `size_t position()`, eg. `fs::File` on the device or a `FILE*` wrapper on a host.
+ * Dictionary entries are collected while reading so readings can be turned
+ * back into rows with `row()`.
+ */
+template<class Source>
+class BinlogReader {
+    public:
+        std::vector<std::string> topics;    //!< dictionary topics by id
+        std::vector<std::string> templates; //!< dictionary templates by id
+        uint32_t bad_blocks = 0;            //!< blocks skipped because of a bad CRC
+
+        BinlogReader(Source& src): src(src){}
+
+        /**
+         * @brief Check the file header.
+         */
+        bool begin(){
+            struct binlog_file_header h;
+            return src.read((uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+                memcmp(h.magic, "DGBL", 4) == 0 && h.version == BINLOG_VERSION && h.slot_len == BINLOG_SLOT_LEN;
+        }
+
+        /**
+         * @brief Load the next valid block which may hold records from \p from to \p to.
+         *
+         * Blocks outside the range are skipped without being read unless they add
+         * dictionary entries. A block starting after \p stop ends the search, for
+         * readers that know the file is in time order.
+         *
+         * @returns `false` at the end of the file
+         */
+        bool next_block(uint32_t from = 0, uint32_t to = UINT32_MAX, uint32_t stop = UINT32_MAX){
+            slot = count = 0;
+            struct binlog_block_header h;
+            while(src.read((uint8_t*)&h, sizeof(h)) == sizeof(h)){
+                size_t start = src.position() - sizeof(h);
+                size_t len = (size_t)h.slots * BINLOG_SLOT_LEN;
+
+                if(h.magic != BINLOG_BLOCK_MAGIC || h.slots == 0 || h.slots > BINLOG_BLOCK_SLOTS){
+                    // torn write, look for the next block one byte further on
+                    src.seek(start + 1);
+                    continue;
+                }
+                if(h.first_epoch > stop) return false;
+                bool in_range = h.last_epoch >= from && h.first_epoch <= to;
+                if(!in_range && !(h.flags & BINLOG_BLOCK_TOPICS)){
+                    src.seek(start + sizeof(h) + len);
+                    continue;
+                }
+                if(src.read(block, len) != len) return false;
+                if(binlog_crc32(block, len) != h.crc){
+                    bad_blocks++;
+                    src.seek(start + 1);
+                    continue;
+                }
+                count = h.slots;
+                return true;
+            }
+            return false;
+        }
+
+        /**
+         * @brief Decode the next record of the current block.
+         *
+         * @returns `false` once the block is exhausted
+         */
+        bool next_record(struct binlog_entry& e){
+            while(slot < count){
+                struct binlog_record r;
+                memcpy(&r, block + slot * BINLOG_SLOT_LEN, sizeof(r));
+                int first = slot;
+                slot += 1 + r.more;
+                if(slot > count) return false;
+
+                e.epoch = r.epoch;
+                e.kind = r.kind;
+                e.sensor = r.sensor;
+                e.id = r.id;
+                e.n = 0;
+                e.topic = e.text = NULL;
+
+                const uint8_t* body = block + first * BINLOG_SLOT_LEN + BINLOG_RECORD_HEAD;
+                size_t body_len = (1 + r.more) * BINLOG_SLOT_LEN - BINLOG_RECORD_HEAD;
+                if(e.kind == BINLOG_READING){
+                    // the padding decodes as zeros past the last value
+                    size_t pos = 0, used;
+                    while(e.n < BINLOG_MAX_VALUES && (used = binlog_get_varint(body + pos, body_len - pos, &e.values[e.n])) > 0){
+                        pos += used;
+                        e.n++;
+                    }
+                    return true;
+                }
+                if(e.kind == BINLOG_TOPIC || e.kind == BINLOG_TEXT){
+                    // the text is NUL padded, a missing terminator means a bad record
+                    if(body[body_len - 1] != '\0') continue;
+                    e.topic = (const char*)body;
+                    e.text = e.topic + strlen(e.topic) + 1;
+                    if(e.text >= (const char*)body + body_len) continue;
+
+                    if(e.kind == BINLOG_TOPIC){
+                        if(topics.size() <= r.id){
+                            topics.resize(r.id + 1);
+                            templates.resize(r.id + 1);
+                        }
+                        topics[r.id] = e.topic;
+                        templates[r.id] = e.text;
+                    }
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * @brief The topic of a reading or text record, NULL if its dictionary entry is missing.
+         */
+        const char* topic(const struct binlog_entry& e){
+            if(e.kind == BINLOG_TEXT) return e.topic;
+            if(e.kind != BINLOG_READING || e.id >= topics.size() || topics[e.id].empty()) return NULL;
+            return topics[e.id].c_str();
+        }
+
+        /**
+         * @brief Format a reading or text record as a CSV row `time;topic;message`.
+         *
+         * @returns `false` for dictionary entries and readings which can not be decoded
+         */
+        bool row(const struct binlog_entry& e, std::string& out){
+            const char* t = topic(e);
+            if(t == NULL) return false;
+
+            out = binlog_time_string(e.epoch) + ";" + t + ";";
+            if(e.kind == BINLOG_TEXT){
+                out += e.text;
+                return true;
+            }
+            return binlog_expand(templates[e.id].c_str(), e.values, e.n, out);
+        }
+
+    private:
+        Source& src;
+        uint8_t block[BINLOG_BLOCK_SLOTS * BINLOG_SLOT_LEN];
+        int slot = 0;
+        int count = 0;
+};
+
+#endif
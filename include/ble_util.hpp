@@ -26,6 +26,23 @@
 #include <KKM_K6P.hpp> 
 #include <logger.hpp>
 
+/**
+ * @brief Log the reading parsed from a BLE packet, with the MAC of the gator added.
+ *
+ * The message is formatted into a buffer on the stack, only one too long for it
+ * is built on the heap.
+ */
+void log_mail(MQTTMail* mail){
+    const char* mac = gator_mac();
+    char msg[LOG_MESSAGE_LEN];
+    int n = snprintf(msg, sizeof(msg), "{%s, \"GATOR_MAC\": \"%s\"}", mail->getMessage().c_str(), mac);
+    if(n >= 0 && (size_t)n < sizeof(msg)){
+        log_data(mail->getTopic().c_str(), msg);
+    }else{
+        log_data(mail->getTopic(), "{" + mail->getMessage() + ", \"GATOR_MAC\": \"" + mac + "\"}");
+    }
+}
+
 /**
  * @brief Callbacks for BLE packets
  *
@@ -55,16 +72,8 @@ class ScanCallbacks: public NimBLEAdvertisedDeviceCallbacks {
             MQTTMail* mail_ptr = k6p.parseAdvertisedData(dev);
             if(USB_DEBUG) Serial.println("\t-> sent BLE mail to publisher");
 
-            MQTTMailer instance = MQTTMailer::getInstance();
-
-            if(WiFi.status() == WL_CONNECTED && !mqtt_client.connected()){
-                if(USB_DEBUG) Serial.println("\t-> not connected");
-                instance.reconnect(mqtt_client);
-            }
-
-            std::string msg = "{" + mail_ptr->getMessage() + ", \"GATOR_MAC\": \"" + WiFi.macAddress().c_str() + "\"}";
-            //instance.mailMessage(&mqtt_client, mail_ptr->getTopic(), msg);
-            log_data(mail_ptr->getTopic(), msg);
+            // queued for the logging task, the scan never waits for MQTT or the uSD card
+            log_mail(mail_ptr);
             delete(mail_ptr);
             mail_ptr = NULL;
         
@@ -76,16 +85,7 @@ class ScanCallbacks: public NimBLEAdvertisedDeviceCallbacks {
 			MQTTMail* mail_ptr = s1_interpreter.parseAdvertisedData(dev); // print the advertised data after interpretation
 			if(mail_ptr != NULL){
 				if(USB_DEBUG) Serial.println("\t-> sent BLE mail to publisher");
-				MQTTMailer instance = MQTTMailer::getInstance();
-
-				if(WiFi.status() == WL_CONNECTED && !mqtt_client.connected()){
-					if(USB_DEBUG) Serial.println("\t-> not connected");
-					instance.reconnect(mqtt_client);
-				}
-
-				std::string msg = "{" + mail_ptr->getMessage() + ", \"GATOR_MAC\": \"" + WiFi.macAddress().c_str() + "\"}";
-				//instance.mailMessage(&mqtt_client, mail_ptr->getTopic(), msg);
-                log_data(mail_ptr->getTopic(), msg);
+                log_mail(mail_ptr);
                 delete(mail_ptr);
 				mail_ptr = NULL;
 			}
@@ -27,3 +27,41 @@
 #define HT_FREQ 5
 /** Ticks/minutes between device telemetry reports */
 #define TLM_FREQ 5
+/** Wired sensor samples buffered with the radio off before uploading them in one session, 1 uploads every sample */
+#define UPLOAD_FREQ 1
+/** Shortest wired sensor period in ticks while readings change quickly */
+#define ADAPTIVE_MIN_FREQ 1
+/** Longest wired sensor period while readings are flat, as a multiple of VWC_FREQ */
+#define ADAPTIVE_MAX_SCALE 4
+/** Change in ADC counts of a VWC probe between samples which shortens the wired period */
+#define ADAPTIVE_VWC_DELTA 200
+/** Change in pH, in hundredths, between samples which shortens the wired period */
+#define ADAPTIVE_PH_DELTA 20
+/** Battery percentage below which all task periods are doubled */
+#define BATT_LOW_PERCENT 30
+/** Battery percentage below which all task periods are quadrupled */
+#define BATT_CRITICAL_PERCENT 15
+/** Log to the uSD card in the compact binary format instead of CSV, see binlog_format.hpp */
+#define SD_LOG_BINARY 0
+/** Compress the CSV log files of past days, see log_archive.hpp */
+#define SD_LOG_COMPRESS 0
+/** Bytes of readings logged while offline replayed to the broker per wake, 0 turns the backfill off */
+#define BACKFILL_BYTES 16384
+/** Longest time in milliseconds a wake spends replaying readings logged while offline */
+#define BACKFILL_MS 5000
+/** Most megabytes of log files of past days kept on the uSD card, the oldest are removed first, 0 for no limit, at most 4095 */
+#define SD_RETENTION_MB 1024
+/** Most days of log files kept on the uSD card, 0 for no limit */
+#define SD_RETENTION_DAYS 0
+/** Readings of the running tasks queued for the logging task, a power of two, see log_pipeline.hpp */
+#define LOG_QUEUE_DEPTH 16
+/** Longest time in milliseconds a task waits for a free slot of the log queue before the reading is dropped */
+#define LOG_QUEUE_WAIT_MS 20
+/** Publish the readings of a wake in one envelope to datagator/batch/<MAC> instead of one message each, see batch_format.hpp */
+#define MQTT_BATCH 0
+/** Longest time in milliseconds a wake spends reconnecting to an unreachable MQTT broker before logging locally, see mqtt_connect.hpp */
+#define MQTT_RECONNECT_MS 10000
+/** QoS 1 publishes of readings waiting for their acknowledgement at once, at most 4, 0 publishes at QoS 0, see mqtt_qos1.hpp. Not yet tested against a real broker */
+#define MQTT_INFLIGHT 0
+/** Publish readings as MessagePack to msgpack/<topic> instead of JSON, see msgpack_format.hpp */
+#define MQTT_MSGPACK 0
\ No newline at end of file
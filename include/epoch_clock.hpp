@@ -0,0 +1,256 @@
+/**
+ * @file epoch_clock.hpp
+ * @brief Wall clock kept across deep sleep, used to timestamp every log record.
+ *
+ * The clock is an estimate of the epoch (microseconds since 1970) at the moment
+ * `esp_timer_get_time()` read zero this boot. It is set from NTP whenever WiFi is
+ * up. Before each deep sleep the current epoch and the programmed sleep time are
+ * kept in RTC memory, and the next wake adds the sleep time to get its own epoch.
+ *
+ * A wake before the timer, eg. a reset by the carrier board's watchdog which keeps
+ * RTC memory, takes the time slept from the RTC timer instead, which keeps counting
+ * through the reset.
+ *
+ * The RTC slow clock that times deep sleep can be off by a few percent. Between two
+ * NTP syncs at least `EPOCH_DRIFT_WINDOW_S` apart, the time the device actually slept
+ * is compared with the time the RTC counted. The difference is saved as `drift_ppm`
+ * and applied to every later sleep, so offline sites keep accurate time.
+ *
+ * After a cold boot RTC memory is lost. The clock then restarts from the epoch last
+ * saved to NVS by `epoch_clock_save()` plus one tick for every tick the reset count
+ * advanced since. Wakes with nothing due commit the reset count but don't save the
+ * epoch, so a device reset by the watchdog every tick keeps its time as well. The
+ * scheduler saves the epoch when it restarts the reset count, see `Scheduler()`.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef EPOCH_CLOCK_HPP
+#define EPOCH_CLOCK_HPP
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_timer.h>
+#include <esp_sleep.h>
+#include <esp32/rtc.h>
+#include <cstddef>
+#include <TimeStamp.hpp>
+#include <rtc_state.hpp>
+
+extern Preferences gator_prefs;
+
+/** Seconds assumed to have passed when the length of the last sleep is unknown, one scheduler tick. */
+#define EPOCH_UNKNOWN_SLEEP_S 65
+/** Minimum time slept between two NTP syncs before the RTC drift is measured. */
+#define EPOCH_DRIFT_WINDOW_S 3600
+/** Largest RTC drift accepted, anything above is treated as a bad measurement. */
+#define EPOCH_MAX_DRIFT_PPM 100000
+
+/**
+ * @brief Clock state kept in RTC memory across deep sleep.
+ */
+struct rtc_epoch_clock{
+    /** epoch in microseconds when the device went to sleep */
+    int64_t sleep_epoch_us;
+    /** sleep time programmed before going to sleep, 0 if the device did not sleep */
+    uint64_t sleep_us;
+    /** `esp_rtc_get_time_us()` when the device went to sleep */
+    uint64_t sleep_rtc_us;
+    /** measured error of the RTC slow clock, positive if the device sleeps longer than programmed */
+    int32_t drift_ppm;
+    /** the epoch derives from NTP, see `epoch_known` */
+    bool known;
+    /** NTP epoch in microseconds when the drift measurement window opened, 0 if none is open */
+    int64_t window_epoch_us;
+    /** time slept since the window opened, as counted by the RTC */
+    uint64_t window_sleep_us;
+    /** time spent awake since the window opened */
+    int64_t window_awake_us;
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct rtc_epoch_clock rtc_epoch_clock;
+
+/**
+ * @brief Clock saved to NVS as a single blob under the key "clock".
+ */
+struct epoch_saved{
+    /** epoch in seconds */
+    uint32_t epoch;
+    /** reset count when it was saved, negative if unknown */
+    int tick;
+};
+
+int64_t epoch_boot_us = 0;  //!< epoch in microseconds when this boot started
+bool epoch_known = false;   //!< `epoch_boot_us` was derived from NTP, now or before a sleep or cold boot
+
+/**
+ * @brief Update the checksum after changing the RTC memory copy of the clock.
+ */
+void epoch_clock_seal(){
+    rtc_epoch_clock.checksum = rtc_checksum(&rtc_epoch_clock, offsetof(struct rtc_epoch_clock, checksum));
+}
+
+/**
+ * @brief Load the epoch saved by firmware which cached a timestamp string and a tick offset.
+ *
+ * The old keys are removed after they are read.
+ *
+ * @returns the epoch in seconds, 0 if it could not be recovered
+ */
+uint32_t epoch_migrate_legacy_keys(){
+    uint32_t epoch = 0;
+    std::string ts = gator_prefs.getString("timestamp", "").c_str();
+    int offset = gator_prefs.getInt("log_offset", 0);
+
+    // the default timestamp "00-00-00T00:00:00+0" carries no date
+    if(ts.find('T') != std::string::npos && ts.find("00-00-00T") != 0){
+        time_t t = TimeStamp(ts).get_epoch();
+        if(t > 0) epoch = (uint32_t)t + offset * EPOCH_UNKNOWN_SLEEP_S;
+    }
+    gator_prefs.remove("timestamp");
+    gator_prefs.remove("log_offset");
+    return epoch;
+}
+
+/**
+ * @brief Load the clock saved to NVS, or the timestamp saved by older firmware.
+ *
+ * @returns the saved clock, `epoch` is 0 if none was saved
+ */
+struct epoch_saved epoch_clock_load(){
+    struct epoch_saved saved = {0, -1};
+    if(gator_prefs.getBytesLength("clock") == sizeof(saved)){
+        gator_prefs.getBytes("clock", &saved, sizeof(saved));
+    }else if(gator_prefs.isKey("timestamp")){
+        saved.epoch = epoch_migrate_legacy_keys();
+    }
+    return saved;
+}
+
+/**
+ * @brief Work out the epoch of this boot, must be called once per boot after NVS is opened.
+ *
+ * On a timer wake the programmed sleep, corrected for drift, is added to the epoch
+ * saved before sleeping. Any other wake adds the time the RTC timer counted since,
+ * or one tick if the timer was restarted. After a cold boot the epoch saved to NVS
+ * is used.
+ *
+ * @param[in] tick The reset count of this boot, the planner must be loaded first.
+ */
+void epoch_clock_init(int tick){
+    bool valid = rtc_epoch_clock.checksum == rtc_checksum(&rtc_epoch_clock, offsetof(struct rtc_epoch_clock, checksum));
+
+    if(valid && rtc_epoch_clock.sleep_us != 0){
+        int64_t slept_us = EPOCH_UNKNOWN_SLEEP_S * 1000000LL;
+        uint64_t boot_rtc_us = esp_rtc_get_time_us() - esp_timer_get_time();
+        if(esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER){
+            slept_us = rtc_epoch_clock.sleep_us + (int64_t)rtc_epoch_clock.sleep_us * rtc_epoch_clock.drift_ppm / 1000000LL;
+        }else if(boot_rtc_us > rtc_epoch_clock.sleep_rtc_us){
+            // woken early, the RTC timer counted the time slept
+            uint64_t rtc_slept_us = boot_rtc_us - rtc_epoch_clock.sleep_rtc_us;
+            slept_us = rtc_slept_us + (int64_t)rtc_slept_us * rtc_epoch_clock.drift_ppm / 1000000LL;
+            // `epoch_clock_sleep()` counted the programmed sleep towards the drift window
+            rtc_epoch_clock.window_sleep_us += rtc_slept_us - rtc_epoch_clock.sleep_us;
+        }else{
+            // sleep time unknown, can't measure drift over it
+            rtc_epoch_clock.window_epoch_us = 0;
+        }
+        epoch_boot_us = rtc_epoch_clock.sleep_epoch_us + slept_us;
+        epoch_known = rtc_epoch_clock.known;
+
+    }else{
+        struct epoch_saved saved = epoch_clock_load();
+        // the reset count is committed on every wake, the epoch only by wakes which logged
+        int64_t ticks = saved.tick >= 0 && tick > saved.tick ? tick - saved.tick : 1;
+
+        memset(&rtc_epoch_clock, 0, sizeof(rtc_epoch_clock));
+        epoch_known = saved.epoch != 0;
+        epoch_boot_us = epoch_known ? (saved.epoch + ticks * EPOCH_UNKNOWN_SLEEP_S) * 1000000LL : 0;
+        rtc_epoch_clock.known = epoch_known;
+    }
+    epoch_clock_seal();
+
+    if(DEBUG) Serial.printf("[EPOCH] boot epoch %lld s%s, drift %d ppm\n", (long long)(epoch_boot_us / 1000000LL),
+            epoch_known ? "" : " (unknown)", rtc_epoch_clock.drift_ppm);
+}
+
+/**
+ * @brief Current epoch in microseconds.
+ */
+int64_t epoch_now_us(){
+    return epoch_boot_us + esp_timer_get_time();
+}
+
+/**
+ * @brief Current epoch in seconds, counted from the first boot if the clock was never set.
+ */
+time_t epoch_now(){
+    return (time_t)(epoch_now_us() / 1000000LL);
+}
+
+/**
+ * @brief Set the clock from NTP and, if the last sync was long enough ago, measure the RTC drift.
+ *
+ * @param[in] ntp_epoch_s Epoch in seconds returned by the NTP server.
+ */
+void epoch_clock_sync(uint32_t ntp_epoch_s){
+    int64_t ntp_us = (int64_t)ntp_epoch_s * 1000000LL;
+    int64_t uptime_us = esp_timer_get_time();
+
+    if(DEBUG && epoch_known) Serial.printf("[EPOCH] clock off by %lld ms at NTP sync\n", (long long)((epoch_now_us() - ntp_us) / 1000));
+
+    struct rtc_epoch_clock* c = &rtc_epoch_clock;
+    if(c->window_epoch_us != 0 && c->window_sleep_us >= EPOCH_DRIFT_WINDOW_S * 1000000ULL){
+        int64_t slept_us = ntp_us - c->window_epoch_us - (c->window_awake_us + uptime_us);
+        int64_t drift = (slept_us - (int64_t)c->window_sleep_us) * 1000000LL / (int64_t)c->window_sleep_us;
+
+        if(drift > -EPOCH_MAX_DRIFT_PPM && drift < EPOCH_MAX_DRIFT_PPM){
+            c->drift_ppm = (int32_t)drift;
+            if(DEBUG) Serial.printf("[EPOCH] RTC drift %d ppm\n", c->drift_ppm);
+        }
+        c->window_epoch_us = 0;
+    }
+    if(c->window_epoch_us == 0){
+        c->window_epoch_us = ntp_us;
+        c->window_sleep_us = 0;
+        c->window_awake_us = -uptime_us;
+    }
+
+    epoch_boot_us = ntp_us - uptime_us;
+    epoch_known = true;
+    c->known = true;
+    epoch_clock_seal();
+}
+
+/**
+ * @brief Save the clock to RTC memory before deep sleep.
+ *
+ * @param[in] sleep_us The sleep time programmed into the deep sleep timer.
+ */
+void epoch_clock_sleep(uint64_t sleep_us){
+    rtc_epoch_clock.sleep_epoch_us = epoch_now_us();
+    rtc_epoch_clock.sleep_us = sleep_us;
+    rtc_epoch_clock.sleep_rtc_us = esp_rtc_get_time_us();
+    if(rtc_epoch_clock.window_epoch_us != 0){
+        rtc_epoch_clock.window_sleep_us += sleep_us;
+        rtc_epoch_clock.window_awake_us += esp_timer_get_time();
+    }
+    epoch_clock_seal();
+}
+
+/**
+ * @brief Save the current epoch to NVS for the next cold boot, if the clock was ever set.
+ *
+ * @param[in] tick The current reset count.
+ */
+void epoch_clock_save(int tick){
+    if(!epoch_known) return;
+    struct epoch_saved saved = {(uint32_t)epoch_now(), tick};
+    if(gator_prefs.putBytes("clock", &saved, sizeof(saved)) != sizeof(saved)){
+        if(DEBUG) Serial.println("[ERROR] failed to save the epoch to NVS");
+    }
+}
+
+#endif
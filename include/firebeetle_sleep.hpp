@@ -47,11 +47,14 @@ void deep_sleep(uint16_t time_to_sleep){
 /**
  * @brief Hibernate for \p time_to_sleep seconds
  *
+ * RTC slow memory stays powered so `RTC_NOINIT_ATTR` variables (scheduler and
+ * timestamp state, see rtc_state.hpp) survive until the next wake.
+ *
  * @param[in] time_to_sleep The number of seconds to put the device to sleep for
  */
 void hibernate(uint16_t time_to_sleep) {
     esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH,   ESP_PD_OPTION_OFF);
-    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_SLOW_MEM, ESP_PD_OPTION_OFF);
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_SLOW_MEM, ESP_PD_OPTION_ON);
     esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_FAST_MEM, ESP_PD_OPTION_OFF);
     esp_sleep_pd_config(ESP_PD_DOMAIN_XTAL,         ESP_PD_OPTION_OFF);
     
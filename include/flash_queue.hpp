@@ -0,0 +1,405 @@
+/**
+ * @file flash_queue.hpp
+ * @brief Store-and-forward queue in internal flash for devices without a uSD card.
+ *
+ * When neither the uSD card nor the MQTT broker is available `log_data()` used to
+ * drop the reading. Instead it is appended to a queue in the `fqueue` data
+ * partition of max_ota.csv and published once the broker is reachable again,
+ * `FLASH_QUEUE_DRAIN_MAX` records per wake.
+ *
+ * ### Layout
+ * The partition is a ring of 4 KB segments, one flash sector each. A segment starts
+ * with a `flash_queue_segment` header holding an increasing sequence number and
+ * records are only ever appended after it:
+ *
+ *  * `flash_queue_record` header, `len` bytes `<topic>\0<message>`, padded to 4 bytes.
+ *  * `sent` is cleared to 0x00 in place once the record is published, flash bits can
+ *    be cleared without an erase.
+ *
+ * A full segment moves the head to the next sector in the ring, so every sector is
+ * erased equally often. If that sector still holds queued records the queue is full
+ * and its oldest segment is dropped.
+ *
+ * ### Crash safety
+ * Head and tail are kept in RTC memory and rebuilt from flash after a cold boot: the
+ * segment with the highest sequence number is the head, the oldest record with
+ * `sent` set is the tail. A record whose check does not match, eg. cut off by a reset,
+ * ends its segment and the next record goes to a new one.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef FLASH_QUEUE_HPP
+#define FLASH_QUEUE_HPP
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <TimeStamp.hpp>
+#include <esp_partition.h>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <rtc_state.hpp>
+#include <mqtt_stream.hpp>
+
+extern PubSubClient mqtt_client;
+
+/** Label of the queue partition in max_ota.csv. */
+#define FLASH_QUEUE_LABEL "fqueue"
+/** Bytes per segment, one erasable flash sector. */
+#define FLASH_QUEUE_SECTOR_LEN 4096
+/** Longest `<topic>\0<message>` queued, longer messages are dropped. */
+#define FLASH_QUEUE_RECORD_LEN 512
+/** Queued records published per wake. */
+#define FLASH_QUEUE_DRAIN_MAX 32
+/** `flash_queue_segment::magic`, "DGFQ" */
+#define FLASH_QUEUE_MAGIC 0x51464744UL
+
+/**
+ * @brief First bytes of every segment.
+ */
+struct flash_queue_segment{
+    uint32_t magic;     //!< `FLASH_QUEUE_MAGIC`
+    uint32_t seq;       //!< one more than the segment written before
+    uint32_t check;     //!< `rtc_checksum()` of `magic` and `seq`
+    uint32_t reserved;
+};
+
+/**
+ * @brief Header of a queued record, followed by `len` bytes.
+ */
+struct flash_queue_record{
+    uint32_t check;     //!< `rtc_checksum()` of the record from `epoch` on with `sent` 0xFF
+    uint32_t epoch;     //!< time the reading was logged
+    uint16_t len;       //!< bytes of `<topic>\0<message>`
+    uint8_t sent;       //!< 0xFF queued, 0x00 published
+    uint8_t reserved;
+};
+
+/**
+ * @brief Head and tail of the queue, kept in RTC memory.
+ */
+struct rtc_flash_queue{
+    /** sequence number of the head segment, 0 if no segment was written yet */
+    uint32_t seq;
+    /** segment records are appended to */
+    uint16_t head;
+    /** segment of the oldest queued record */
+    uint16_t tail;
+    /** offset in `head` of the next record */
+    uint32_t head_off;
+    /** offset in `tail` of the oldest queued record */
+    uint32_t tail_off;
+    /** records waiting to be published */
+    uint32_t pending;
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct rtc_flash_queue rtc_flash_queue;
+
+const esp_partition_t* flash_queue_partition = NULL;   //!< NULL until mounted, or if the partition table has none
+bool flash_queue_mounted = false;                      //!< partition looked up and head/tail checked this wake
+uint8_t flash_queue_buffer[sizeof(struct flash_queue_record) + FLASH_QUEUE_RECORD_LEN];  //!< record being written or read
+
+/** @brief Segments in the partition. */
+uint16_t flash_queue_segments(){ return flash_queue_partition->size / FLASH_QUEUE_SECTOR_LEN; }
+
+/** @brief Bytes a record with \p len bytes of text takes up. */
+uint32_t flash_queue_record_size(uint16_t len){ return (sizeof(struct flash_queue_record) + len + 3) & ~3UL; }
+
+/**
+ * @brief Update the checksum after changing the head or tail.
+ */
+void flash_queue_seal(){
+    rtc_flash_queue.checksum = rtc_checksum(&rtc_flash_queue, offsetof(struct rtc_flash_queue, checksum));
+}
+
+/**
+ * @brief Read the record at \p offset of \p segment into `flash_queue_buffer`.
+ *
+ * @returns its size, 0 if there is no intact record
+ */
+uint32_t flash_queue_read(uint16_t segment, uint32_t offset){
+    struct flash_queue_record r;
+    size_t at = (size_t)segment * FLASH_QUEUE_SECTOR_LEN + offset;
+    if(offset + sizeof(r) > FLASH_QUEUE_SECTOR_LEN || esp_partition_read(flash_queue_partition, at, &r, sizeof(r)) != ESP_OK) return 0;
+    if(r.len == 0 || r.len > FLASH_QUEUE_RECORD_LEN || offset + flash_queue_record_size(r.len) > FLASH_QUEUE_SECTOR_LEN) return 0;
+    if(esp_partition_read(flash_queue_partition, at + sizeof(r), flash_queue_buffer + sizeof(r), r.len) != ESP_OK) return 0;
+
+    uint8_t sent = r.sent;
+    r.sent = 0xFF;
+    memcpy(flash_queue_buffer, &r, sizeof(r));
+    if(rtc_checksum(flash_queue_buffer + 4, sizeof(r) - 4 + r.len) != r.check) return 0;
+    ((struct flash_queue_record*)flash_queue_buffer)->sent = sent;
+    return flash_queue_record_size(r.len);
+}
+
+/**
+ * @brief Check that \p segment is erased from \p offset to its end.
+ */
+bool flash_queue_blank(uint16_t segment, uint32_t offset){
+    uint32_t chunk[16];
+    for(; offset < FLASH_QUEUE_SECTOR_LEN; offset += sizeof(chunk)){
+        size_t n = FLASH_QUEUE_SECTOR_LEN - offset < sizeof(chunk) ? FLASH_QUEUE_SECTOR_LEN - offset : sizeof(chunk);
+        esp_partition_read(flash_queue_partition, (size_t)segment * FLASH_QUEUE_SECTOR_LEN + offset, chunk, n);
+        for(size_t i = 0; i < n / 4; i++) if(chunk[i] != 0xFFFFFFFFUL) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Sequence number of \p segment, 0 if it has no valid header.
+ */
+uint32_t flash_queue_segment_seq(uint16_t segment){
+    struct flash_queue_segment h;
+    if(esp_partition_read(flash_queue_partition, (size_t)segment * FLASH_QUEUE_SECTOR_LEN, &h, sizeof(h)) != ESP_OK) return 0;
+    if(h.magic != FLASH_QUEUE_MAGIC || h.check != rtc_checksum(&h, offsetof(struct flash_queue_segment, check))) return 0;
+    return h.seq;
+}
+
+/**
+ * @brief Rebuild head and tail from the partition after a cold boot.
+ */
+void flash_queue_scan(){
+    uint16_t n = flash_queue_segments();
+    memset(&rtc_flash_queue, 0, sizeof(rtc_flash_queue));
+
+    // the ring runs from the oldest segment to the newest
+    uint16_t oldest = 0;
+    uint32_t oldest_seq = 0;
+    for(uint16_t s = 0; s < n; s++){
+        uint32_t seq = flash_queue_segment_seq(s);
+        if(seq == 0) continue;
+        if(oldest_seq == 0 || seq < oldest_seq){
+            oldest = s;
+            oldest_seq = seq;
+        }
+        if(seq > rtc_flash_queue.seq){
+            rtc_flash_queue.seq = seq;
+            rtc_flash_queue.head = s;
+        }
+    }
+    if(rtc_flash_queue.seq == 0){
+        // nothing written yet, the first record opens segment 0
+        rtc_flash_queue.head = rtc_flash_queue.tail = n - 1;
+        rtc_flash_queue.head_off = rtc_flash_queue.tail_off = FLASH_QUEUE_SECTOR_LEN;
+        return;
+    }
+
+    bool found_tail = false;
+    rtc_flash_queue.head_off = FLASH_QUEUE_SECTOR_LEN;
+    for(uint16_t s = oldest, i = 0; i < n; s = (s + 1) % n, i++){
+        if(flash_queue_segment_seq(s) != oldest_seq + i) break;
+
+        uint32_t off = sizeof(struct flash_queue_segment);
+        uint32_t size;
+        while((size = flash_queue_read(s, off)) > 0){
+            if(((struct flash_queue_record*)flash_queue_buffer)->sent == 0xFF){
+                if(!found_tail){
+                    rtc_flash_queue.tail = s;
+                    rtc_flash_queue.tail_off = off;
+                    found_tail = true;
+                }
+                rtc_flash_queue.pending++;
+            }
+            off += size;
+        }
+        if(s == rtc_flash_queue.head){
+            // a torn record seals the segment, the next record starts a new one
+            rtc_flash_queue.head_off = flash_queue_blank(s, off) ? off : FLASH_QUEUE_SECTOR_LEN;
+            break;
+        }
+    }
+    if(!found_tail){
+        rtc_flash_queue.tail = rtc_flash_queue.head;
+        rtc_flash_queue.tail_off = rtc_flash_queue.head_off;
+    }
+    if(DEBUG) Serial.printf("[FLASH QUEUE] %u records queued\n", rtc_flash_queue.pending);
+}
+
+/**
+ * @brief Start of a wake, the queue is mounted again on first use.
+ */
+void flash_queue_begin(){
+    flash_queue_mounted = false;
+}
+
+/**
+ * @brief Find the partition and load head and tail, once per wake.
+ *
+ * @returns false if the partition table has no queue partition
+ */
+bool flash_queue_mount(){
+    if(flash_queue_mounted) return flash_queue_partition != NULL;
+    flash_queue_mounted = true;
+
+    flash_queue_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)0x40, FLASH_QUEUE_LABEL);
+    if(flash_queue_partition == NULL || flash_queue_partition->size < 2 * FLASH_QUEUE_SECTOR_LEN){
+        Serial.println("[ERROR] no flash queue partition, readings without uSD card or broker are lost");
+        flash_queue_partition = NULL;
+        return false;
+    }
+
+    bool valid = rtc_flash_queue.checksum == rtc_checksum(&rtc_flash_queue, offsetof(struct rtc_flash_queue, checksum));
+    if(!valid){
+        flash_queue_scan();
+        flash_queue_seal();
+    }
+    return true;
+}
+
+/** @brief Records waiting to be published. */
+uint32_t flash_queue_pending(){
+    return flash_queue_mount() ? rtc_flash_queue.pending : 0;
+}
+
+/**
+ * @brief Move the head to the next segment of the ring, dropping its records if the queue is full.
+ */
+bool flash_queue_open_segment(){
+    uint16_t n = flash_queue_segments();
+    uint16_t next = (rtc_flash_queue.head + 1) % n;
+
+    if(rtc_flash_queue.pending > 0 && rtc_flash_queue.tail == next){
+        uint32_t dropped = 0;
+        uint32_t size;
+        for(uint32_t off = rtc_flash_queue.tail_off; (size = flash_queue_read(next, off)) > 0; off += size){
+            if(((struct flash_queue_record*)flash_queue_buffer)->sent == 0xFF) dropped++;
+        }
+        Serial.printf("[ERROR] flash queue full, dropped %u oldest records\n", dropped);
+        rtc_flash_queue.pending -= dropped < rtc_flash_queue.pending ? dropped : rtc_flash_queue.pending;
+        rtc_flash_queue.tail = (next + 1) % n;
+        rtc_flash_queue.tail_off = sizeof(struct flash_queue_segment);
+    }
+
+    struct flash_queue_segment h;
+    h.magic = FLASH_QUEUE_MAGIC;
+    h.seq = rtc_flash_queue.seq + 1;
+    h.check = rtc_checksum(&h, offsetof(struct flash_queue_segment, check));
+    h.reserved = 0xFFFFFFFFUL;
+    if(esp_partition_erase_range(flash_queue_partition, (size_t)next * FLASH_QUEUE_SECTOR_LEN, FLASH_QUEUE_SECTOR_LEN) != ESP_OK ||
+            esp_partition_write(flash_queue_partition, (size_t)next * FLASH_QUEUE_SECTOR_LEN, &h, sizeof(h)) != ESP_OK){
+        Serial.println("[ERROR] could not open a flash queue segment");
+        return false;
+    }
+
+    rtc_flash_queue.seq = h.seq;
+    rtc_flash_queue.head = next;
+    rtc_flash_queue.head_off = sizeof(struct flash_queue_segment);
+    if(rtc_flash_queue.pending == 0){
+        rtc_flash_queue.tail = next;
+        rtc_flash_queue.tail_off = rtc_flash_queue.head_off;
+    }
+    return true;
+}
+
+/**
+ * @brief Queue a reading to be published later.
+ *
+ * @param[in] epoch Time of the reading.
+ * @param[in] topic The MQTT topic.
+ * @param[in] message The message, likely a JSON object.
+ *
+ * @returns false if the reading could not be queued
+ */
+bool flash_queue_push(uint32_t epoch, const char* topic, const char* message){
+    if(!flash_queue_mount()) return false;
+
+    size_t topic_len = strlen(topic);
+    size_t message_len = strlen(message);
+    size_t len = topic_len + 1 + message_len;
+    if(len > FLASH_QUEUE_RECORD_LEN){
+        Serial.printf("[ERROR] \'%s\' too long for the flash queue\n", topic);
+        return false;
+    }
+
+    uint32_t size = flash_queue_record_size(len);
+    if(rtc_flash_queue.seq == 0 || rtc_flash_queue.head_off + size > FLASH_QUEUE_SECTOR_LEN){
+        if(!flash_queue_open_segment()){
+            flash_queue_seal();
+            return false;
+        }
+    }
+
+    struct flash_queue_record r;
+    r.epoch = epoch;
+    r.len = len;
+    r.sent = 0xFF;
+    r.reserved = 0xFF;
+    memset(flash_queue_buffer, 0xFF, size);
+    memcpy(flash_queue_buffer, &r, sizeof(r));
+    memcpy(flash_queue_buffer + sizeof(r), topic, topic_len + 1);
+    memcpy(flash_queue_buffer + sizeof(r) + topic_len + 1, message, message_len);
+    r.check = rtc_checksum(flash_queue_buffer + 4, sizeof(r) - 4 + len);
+    memcpy(flash_queue_buffer, &r.check, sizeof(r.check));
+
+    size_t at = (size_t)rtc_flash_queue.head * FLASH_QUEUE_SECTOR_LEN + rtc_flash_queue.head_off;
+    bool ok = esp_partition_write(flash_queue_partition, at, flash_queue_buffer, size) == ESP_OK;
+    if(ok){
+        rtc_flash_queue.head_off += size;
+        rtc_flash_queue.pending++;
+    }else{
+        Serial.println("[ERROR] could not write to the flash queue");
+        rtc_flash_queue.head_off = FLASH_QUEUE_SECTOR_LEN;
+    }
+    flash_queue_seal();
+    return ok;
+}
+
+/**
+ * @brief Publish up to \p max queued records, oldest first.
+ *
+ * The time of the reading is added to the message as `"TIME"`, the same time
+ * stamp format as the uSD card log files.
+ *
+ * @returns records published
+ */
+int flash_queue_drain(int max){
+    if(!flash_queue_mount() || rtc_flash_queue.pending == 0) return 0;
+
+    uint16_t n = flash_queue_segments();
+    int published = 0;
+    while(rtc_flash_queue.pending > 0 && published < max && mqtt_client.connected()){
+        bool at_head = rtc_flash_queue.tail == rtc_flash_queue.head;
+        if(at_head && rtc_flash_queue.tail_off >= rtc_flash_queue.head_off){
+            rtc_flash_queue.pending = 0;
+            break;
+        }
+
+        uint32_t size = flash_queue_read(rtc_flash_queue.tail, rtc_flash_queue.tail_off);
+        if(size == 0){
+            if(at_head){
+                rtc_flash_queue.pending = 0;
+                break;
+            }
+            rtc_flash_queue.tail = (rtc_flash_queue.tail + 1) % n;
+            rtc_flash_queue.tail_off = sizeof(struct flash_queue_segment);
+            continue;
+        }
+
+        struct flash_queue_record* r = (struct flash_queue_record*)flash_queue_buffer;
+        if(r->sent == 0xFF){
+            const char* topic = (const char*)flash_queue_buffer + sizeof(*r);
+            size_t topic_len = strlen(topic);
+            std::string message(topic + topic_len + 1, r->len - topic_len - 1);
+            if(message.size() > 1 && message[message.size() - 1] == '}'){
+                message.insert(message.size() - 1, ", \"TIME\":\"" + TimeStamp((time_t)r->epoch).to_string() + "\"");
+            }
+            if(!mqtt_publish(topic, message.c_str())) break;
+
+            uint8_t sent = 0x00;
+            size_t at = (size_t)rtc_flash_queue.tail * FLASH_QUEUE_SECTOR_LEN + rtc_flash_queue.tail_off + offsetof(struct flash_queue_record, sent);
+            esp_partition_write(flash_queue_partition, at, &sent, 1);
+            rtc_flash_queue.pending--;
+            published++;
+        }
+        rtc_flash_queue.tail_off += size;
+    }
+    flash_queue_seal();
+
+    if(DEBUG && published > 0) Serial.printf("[FLASH QUEUE] published %d records, %u left\n", published, rtc_flash_queue.pending);
+    return published;
+}
+
+#endif
@@ -0,0 +1,143 @@
+/**
+ * @file log_archive.hpp
+ * @brief Compresses the CSV log files of past days on the uSD card, see lz_format.hpp.
+ *
+ * Enabled with `SD_LOG_COMPRESS`. Once a day is over its file is no longer written,
+ * so the first wake of the next day compresses it: "/2023-07/log_7-22-2023.csv" becomes
+ * "/2023-07/log_7-22-2023.lz", about a quarter of the size, and takes less time to read
+ * back for `get_time_range` and the backfill.
+ *
+ * A chunk is started at every entry of the file's time index, so the index of the
+ * compressed file "/2023-07/log_7-22-2023.lz.idx" points at chunks and readers still seek,
+ * see log_reader.hpp. The CSV file and its index are removed once the compressed
+ * copy is complete. A copy cut off by a reset is written again the next wake.
+ *
+ * Binary log files are already compact and are left as they are.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef LOG_ARCHIVE_HPP
+#define LOG_ARCHIVE_HPP
+
+#include <Arduino.h>
+#include <SD.h>
+#include <TimeStamp.hpp>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <epoch_clock.hpp>
+#include <log_reader.hpp>
+#include <lz_format.hpp>
+#include <rtc_state.hpp>
+
+extern bool log_binary;
+extern bool log_compress;
+
+/**
+ * @brief Last day checked, kept in RTC memory so a file is looked for once a day.
+ */
+struct rtc_log_archive{
+    /** epoch of midnight of the last day compressed or found without a CSV file */
+    uint32_t day;
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct rtc_log_archive rtc_log_archive;
+
+/**
+ * @brief Compress the CSV log file of the day starting at \p day.
+ *
+ * @returns false if the file could not be compressed, it is left as it was
+ */
+bool log_archive_day(uint32_t day){
+    std::string csv = log_day_path(day) + ".csv";
+    std::string lz = log_archive_filename(day);
+    File in = SD.open(csv.c_str(), FILE_READ);
+    if(!in) return true;
+
+    std::vector<struct log_index_entry> index;
+    log_index_load(csv, index);
+    File out = SD.open(lz.c_str(), FILE_WRITE);
+    if(!out){
+        Serial.printf("[ERROR] could not create \'%s\'\n", lz.c_str());
+        in.close();
+        return false;
+    }
+
+    LzEncoder* encoder = new LzEncoder;
+    uint8_t* raw = new uint8_t[LZ_CHUNK_LEN];
+    uint8_t* chunk = new uint8_t[LZ_CHUNK_MAX];
+    std::vector<struct log_index_entry> lz_index;
+
+    struct lz_file_header h = lz_header();
+    bool ok = out.write((const uint8_t*)&h, sizeof(h)) == sizeof(h);
+    uint32_t packed = sizeof(h);
+    uint32_t size = in.size();
+    uint32_t pos = 0;
+    size_t next = 0;
+    while(ok && pos < size){
+        // chunks start at the newline before each indexed row, see log_read_archive()
+        uint32_t end = size - pos < LZ_CHUNK_LEN ? size : pos + LZ_CHUNK_LEN;
+        while(next < index.size() && index[next].offset - 1 <= pos){
+            if(index[next].offset - 1 == pos) lz_index.push_back({index[next].epoch, packed});
+            next++;
+        }
+        if(next < index.size() && index[next].offset - 1 < end) end = index[next].offset - 1;
+
+        size_t n = in.read(raw, end - pos);
+        size_t len = encoder->chunk(raw, n, chunk);
+        ok = n == end - pos && out.write(chunk, len) == len;
+        packed += len;
+        pos = end;
+    }
+    out.close();
+    in.close();
+    delete[] chunk;
+    delete[] raw;
+    delete encoder;
+
+    // the index is written whole, the file may be left from an earlier attempt
+    std::string lz_idx = log_index_filename(lz);
+    SD.remove(lz_idx.c_str());
+    if(ok && !lz_index.empty()){
+        size_t n = lz_index.size() * sizeof(struct log_index_entry);
+        File idx = SD.open(lz_idx.c_str(), FILE_WRITE);
+        ok = idx && idx.write((const uint8_t*)lz_index.data(), n) == n;
+        idx.close();
+    }
+
+    if(!ok){
+        Serial.printf("[ERROR] could not compress \'%s\'\n", csv.c_str());
+        SD.remove(lz_idx.c_str());
+        SD.remove(lz.c_str());
+        return false;
+    }
+    SD.remove(log_index_filename(csv).c_str());
+    SD.remove(csv.c_str());
+    if(DEBUG) Serial.printf("[ARCHIVE] compressed \'%s\' from %u to %u bytes\n", csv.c_str(), size, packed);
+    return true;
+}
+
+/**
+ * @brief Compress the log file of the day before, once a day.
+ *
+ * Must be called after the log session is closed and before the uSD card is
+ * powered down.
+ */
+void log_archive_closed(){
+    if(!log_compress || log_binary || !epoch_known) return;
+
+    uint32_t now = epoch_now();
+    uint32_t yesterday = now - now % 86400 - 86400;
+    bool valid = rtc_log_archive.checksum == rtc_checksum(&rtc_log_archive, offsetof(struct rtc_log_archive, checksum));
+    if(valid && rtc_log_archive.day == yesterday) return;
+
+    // a file which can not be compressed stays CSV, it is not tried again
+    log_archive_day(yesterday);
+    rtc_log_archive.day = yesterday;
+    rtc_log_archive.checksum = rtc_checksum(&rtc_log_archive, offsetof(struct rtc_log_archive, checksum));
+}
+
+#endif
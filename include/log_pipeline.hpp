@@ -0,0 +1,519 @@
+/**
+ * @file log_pipeline.hpp
+ * @brief Destinations of logged readings and the queue feeding them from concurrent tasks.
+ *
+ * `log_data()` used to publish, write the uSD card and queue to flash itself, on
+ * whichever task logged the reading, including the BLE scan callback. A reading
+ * now passes through a list of sinks, in order:
+ *
+ *  1. `MqttSink` publishes it while WiFi is up, or with `MQTT_BATCH` `MqttBatchSink`
+ *     collects it into the wake's envelope, see batch_format.hpp.
+ *  2. `SdSink` appends it to the wake's log file, see log_session.hpp, and notes it
+ *     for the backfill if it was not published, see backfill.hpp.
+ *  3. `FlashSink` queues it in flash if it was neither published nor stored, see flash_queue.hpp.
+ *  4. `SerialSink` echoes it for debugging.
+ *
+ * Sinks are handed records in batches and each decides how to handle its part of
+ * a batch, eg. MQTT checks the connection once per batch and stops publishing after
+ * the first failure so the rest fall through to the uSD card or flash. Sinks which
+ * hold records for longer write them out in `LogSink::flush()`, once all readings
+ * of the wake are logged. More sinks are added with `log_sink_add()`.
+ *
+ * ### Queue
+ * While the scheduler runs tasks `log_data()` copies each reading to a bounded
+ * lock-free queue and returns, a FreeRTOS task drains it through the sinks, see
+ * `log_pipeline_start()`. The BLE callback and the wired sensor task never wait for
+ * the network or the uSD card. A reading arriving while the queue is full waits up
+ * to `LOG_QUEUE_WAIT_MS` for the logging task to free a slot, then it is dropped and
+ * counted in `log_queue_overflows`. Readings that do not fit a slot are delivered by
+ * the caller as before.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef LOG_PIPELINE_HPP
+#define LOG_PIPELINE_HPP
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include <atomic>
+#include <cstring>
+#include <epoch_clock.hpp>
+#include <flash_queue.hpp>
+#include <backfill.hpp>
+#include <batch_format.hpp>
+#include <mqtt_connect.hpp>
+#include <mqtt_stream.hpp>
+#include <mqtt_qos1.hpp>
+#include <msgpack_format.hpp>
+
+/** Size of the buffers readings are formatted into before `log_data()`, topic. */
+#define LOG_TOPIC_LEN 96
+/** Size of the buffers readings are formatted into before `log_data()`, message. */
+#define LOG_MESSAGE_LEN 384
+/** Most sinks registered with `log_sink_add()`. */
+#define LOG_SINKS_MAX 8
+/** Stack size in bytes of the task draining the queue. */
+#define LOG_TASK_STACK_SIZE 8192
+/** Core the queue is drained on, the one running the WiFi stack. */
+#define LOG_TASK_CORE 0
+/** Size of the envelope of `MqttBatchSink`, a full envelope is published and another started. */
+#define MQTT_BATCH_LEN 4096
+
+static_assert((LOG_QUEUE_DEPTH & (LOG_QUEUE_DEPTH - 1)) == 0, "LOG_QUEUE_DEPTH must be a power of two");
+
+extern PubSubClient mqtt_client;
+extern bool logging_available;
+void log_record(uint32_t epoch, const char* topic, const char* message);
+void log_lock();
+void log_unlock();
+const char* gator_mac();
+
+bool mqtt_batch = MQTT_BATCH;   //!< readings of a wake are published in one envelope, see batch_format.hpp
+bool mqtt_msgpack = MQTT_MSGPACK;   //!< readings are published as MessagePack, see msgpack_format.hpp
+
+/**
+ * @brief What the sinks before have done with a record.
+ */
+struct log_delivery{
+    bool published;     //!< accepted by the MQTT client
+    bool stored;        //!< written to the uSD card or the flash queue
+};
+
+/**
+ * @brief A destination of logged readings.
+ *
+ * Called with the logging lock held, see `log_lock()`, one batch at a time.
+ */
+class LogSink {
+    public:
+        virtual ~LogSink(){}
+
+        /**
+         * @brief Called before the records of a batch.
+         */
+        virtual void begin(){}
+
+        /**
+         * @brief Deliver one record.
+         *
+         * @param[in] epoch Time of the reading.
+         * @param[in] topic The MQTT topic, NUL terminated.
+         * @param[in] message The message, NUL terminated.
+         * @param[inout] d What earlier sinks did with the record, updated by this one.
+         */
+        virtual void write(uint32_t epoch, const char* topic, const char* message, struct log_delivery& d) = 0;
+
+        /**
+         * @brief Called after the records of a batch.
+         */
+        virtual void end(){}
+
+        /**
+         * @brief Write out records held back, once all readings of the wake are logged.
+         */
+        virtual void flush(){}
+};
+
+/**
+ * @brief Publishes records while WiFi is connected.
+ *
+ * Reconnects to the broker once per batch within the wake's budget, see
+ * mqtt_connect.hpp. Once a publish fails the rest of the batch is left to the
+ * sinks after it rather than waiting on the client again. With `MQTT_INFLIGHT`
+ * readings are published at QoS 1, see mqtt_qos1.hpp, with `MQTT_MSGPACK` as
+ * MessagePack, see msgpack_format.hpp.
+ */
+class MqttSink: public LogSink {
+    public:
+        void begin(){
+            failed = false;
+            mqtt_reconnect();
+        }
+
+        void write(uint32_t, const char* topic, const char* message, struct log_delivery& d){
+            if(mqtt_batch || WiFi.status() != WL_CONNECTED) return;
+            if(DEBUG) Serial.println("\t-> logging to MQTT");
+            if(failed || !mqtt_client.connected()) return;
+
+            // messages which are not JSON are published as they are
+            size_t packed_len = mqtt_msgpack ? MsgpackEncoder(packed, sizeof(packed)).encode(message) : 0;
+            if(packed_len > 0 && snprintf(packed_topic, sizeof(packed_topic), MSGPACK_TOPIC "%s", topic) < (int)sizeof(packed_topic)){
+                if(mqtt_inflight > 0) d.published = mqtt_qos1_publish(packed_topic, packed, packed_len);
+                else d.published = mqtt_publish(packed_topic, packed, packed_len);
+            }else if(mqtt_inflight > 0){
+                d.published = mqtt_qos1_publish(topic, message);
+            }else{
+                d.published = mqtt_publish(topic, message);
+            }
+            if(!d.published) Serial.printf("\tfailed to send %s | %s\n", topic, message);
+            failed = !d.published;
+        }
+
+        void flush(){
+            // wait for the acknowledgements still outstanding, the rest are sent again next wake
+            if(mqtt_inflight == 0 || mqtt_qos1_stalled || !mqtt_client.connected()) return;
+            mqtt_qos1_resend();
+            mqtt_qos1_poll(0, MQTT_ACK_TIMEOUT_MS);
+        }
+
+    private:
+        bool failed = false;    //!< a publish of this batch failed
+        char packed_topic[LOG_TOPIC_LEN + sizeof(MSGPACK_TOPIC)];  //!< topic with `MQTT_MSGPACK`
+        uint8_t packed[LOG_MESSAGE_LEN];    //!< message with `MQTT_MSGPACK`
+};
+
+/**
+ * @brief Collects the records of a wake into one envelope published by `flush()`.
+ *
+ * A record counts as published once it is in the envelope. If the envelope can not
+ * be published its records are handed back: they are already on the uSD card and
+ * noted for the backfill, without a card they are queued in flash.
+ */
+class MqttBatchSink: public LogSink {
+    public:
+        MqttBatchSink(): writer(envelope, sizeof(envelope)){}
+
+        void write(uint32_t epoch, const char* topic, const char* message, struct log_delivery& d){
+            if(!mqtt_batch || WiFi.status() != WL_CONNECTED) return;
+            if(writer.count == 0) start(epoch);
+            if(!writer.add(epoch, topic, message)){
+                // full, publish it and start another
+                publish();
+                start(epoch);
+                if(!writer.add(epoch, topic, message)){
+                    // longer than an envelope, published on its own
+                    if(DEBUG) Serial.println("\t-> logging to MQTT");
+                    d.published = mqtt_client.connected() && mqtt_publish(topic, message);
+                    return;
+                }
+            }
+            if(DEBUG) Serial.println("\t-> batching for MQTT");
+            if(epoch < first) first = epoch;
+            if(epoch > last) last = epoch;
+            d.published = true;
+        }
+
+        void flush(){
+            publish();
+        }
+
+    private:
+        char envelope[MQTT_BATCH_LEN];
+        BatchWriter writer;
+        uint32_t first = 0;     //!< oldest record in the envelope
+        uint32_t last = 0;      //!< newest record in the envelope
+
+        void start(uint32_t epoch){
+            writer.begin(gator_mac(), epoch);
+            first = last = epoch;
+        }
+
+        void publish(){
+            if(writer.count == 0) return;
+            const char* payload = writer.finish();
+            char topic[LOG_TOPIC_LEN];
+            snprintf(topic, sizeof(topic), BATCH_TOPIC "%s", gator_mac());
+
+            bool ok = mqtt_reconnect() && mqtt_publish(topic, payload);
+            if(DEBUG) Serial.printf("[BATCH] %s %d readings, %u bytes\n", ok ? "published" : "failed to publish", writer.count, (unsigned)writer.size());
+            writer.count = 0;
+            if(ok) return;
+
+            if(logging_available){
+                if(epoch_known){
+                    backfill_note(first);
+                    backfill_note(last);
+                }
+                return;
+            }
+            std::vector<struct batch_reading> readings;
+            batch_expand(payload, readings);
+            for(size_t i = 0; i < readings.size(); i++){
+                flash_queue_push(readings[i].epoch, readings[i].topic.c_str(), readings[i].message.c_str());
+            }
+        }
+};
+
+/**
+ * @brief Appends records to the wake's log file on the uSD card.
+ *
+ * The log session already writes whole sectors, see log_session.hpp. Records the
+ * broker did not get are noted for the backfill once per batch, as the span from
+ * the oldest to the newest of them.
+ */
+class SdSink: public LogSink {
+    public:
+        void begin(){
+            first = last = 0;
+        }
+
+        void write(uint32_t epoch, const char* topic, const char* message, struct log_delivery& d){
+            if(!logging_available){
+                if(d.published) Serial.println("[ERROR] no SD card connected when logging");
+                return;
+            }
+            if(DEBUG) Serial.println("\t-> logging to SD card");
+            log_record(epoch, topic, message);
+            d.stored = true;
+
+            if(!d.published && epoch_known){
+                if(first == 0 || epoch < first) first = epoch;
+                if(epoch > last) last = epoch;
+            }
+        }
+
+        void end(){
+            if(first == 0) return;
+            backfill_note(first);
+            backfill_note(last);
+        }
+
+    private:
+        uint32_t first = 0;     //!< oldest record of the batch not published, 0 if none
+        uint32_t last = 0;      //!< newest record of the batch not published
+};
+
+/**
+ * @brief Queues records in flash which were neither published nor stored.
+ *
+ * Published once the broker is back, see `flash_queue_drain()`. A record the queue
+ * can not take is dropped, the queue reports why.
+ */
+class FlashSink: public LogSink {
+    public:
+        void write(uint32_t epoch, const char* topic, const char* message, struct log_delivery& d){
+            if(d.published || d.stored) return;
+            if(DEBUG) Serial.println("\t-> queueing in flash");
+            d.stored = flash_queue_push(epoch, topic, message);
+        }
+};
+
+/**
+ * @brief Echoes records to the serial port in debug builds.
+ */
+class SerialSink: public LogSink {
+    public:
+        void write(uint32_t epoch, const char* topic, const char* message, struct log_delivery&){
+            if(DEBUG) Serial.printf("[DEBUG] logging %ld | \'%s\' | \'%s\'\n", (long)epoch, topic, message);
+        }
+};
+
+MqttSink mqtt_sink;         //!< publishes to the broker
+MqttBatchSink mqtt_batch_sink;  //!< publishes the wake's envelope with `MQTT_BATCH`
+SdSink sd_sink;             //!< logs to the uSD card
+FlashSink flash_sink;       //!< queues in flash without either
+SerialSink serial_sink;     //!< debug output
+
+LogSink* log_sinks[LOG_SINKS_MAX] = {&mqtt_sink, &mqtt_batch_sink, &sd_sink, &flash_sink, &serial_sink};
+int log_sink_count = 5;     //!< entries of `log_sinks` in use
+
+/**
+ * @brief Add a sink after the ones already registered.
+ *
+ * Must be called before tasks are started.
+ *
+ * @returns `false` if `LOG_SINKS_MAX` sinks are already registered
+ */
+bool log_sink_add(LogSink* sink){
+    if(log_sink_count >= LOG_SINKS_MAX) return false;
+    log_sinks[log_sink_count++] = sink;
+    return true;
+}
+
+/**
+ * @brief Start a batch on every sink, the logging lock must be held.
+ */
+void log_sinks_begin(){
+    for(int i = 0; i < log_sink_count; i++) log_sinks[i]->begin();
+}
+
+/**
+ * @brief Pass one record through every sink, within a batch.
+ */
+void log_sinks_write(uint32_t epoch, const char* topic, const char* message){
+    struct log_delivery d = {false, false};
+    for(int i = 0; i < log_sink_count; i++) log_sinks[i]->write(epoch, topic, message, d);
+}
+
+/**
+ * @brief End a batch on every sink.
+ */
+void log_sinks_end(){
+    for(int i = 0; i < log_sink_count; i++) log_sinks[i]->end();
+}
+
+/**
+ * @brief Write out the records every sink held back, once all readings of the wake are logged.
+ *
+ * Called from `loop()` after the scheduler, while nothing else logs.
+ */
+void log_sinks_flush(){
+    log_lock();
+    for(int i = 0; i < log_sink_count; i++) log_sinks[i]->flush();
+    log_unlock();
+}
+
+/**
+ * @brief A slot of the queue.
+ *
+ * `seq` is the position the slot is written at next, and that plus one once it was
+ * written, so writers on both cores claim slots without a lock.
+ */
+struct log_queue_slot{
+    std::atomic<uint32_t> seq;
+    uint32_t epoch;
+    char topic[LOG_TOPIC_LEN];
+    char message[LOG_MESSAGE_LEN];
+};
+
+struct log_queue_slot log_queue[LOG_QUEUE_DEPTH];
+std::atomic<uint32_t> log_queue_head(0);    //!< position of the next record written
+std::atomic<uint32_t> log_queue_tail(0);    //!< position of the next record read, only moved by the reader
+std::atomic<bool> log_pipeline_running(false);  //!< `log_data()` queues records
+std::atomic<bool> log_pipeline_stopping(false); //!< the drain task exits after the next batch
+std::atomic<uint32_t> log_queue_records(0);     //!< records queued since boot
+std::atomic<uint32_t> log_queue_overflows(0);   //!< records dropped as the queue stayed full
+
+SemaphoreHandle_t log_pending = NULL;   //!< given for every record queued, wakes the drain task
+SemaphoreHandle_t log_freed = NULL;     //!< given for every slot the drain task frees, wakes a waiting writer
+SemaphoreHandle_t log_stopped = NULL;   //!< given by the drain task when it exits
+
+/**
+ * @brief Copy a record to the queue, or drop it if the queue stays full for `LOG_QUEUE_WAIT_MS`.
+ *
+ * @returns `false` if the pipeline is not running or the record is longer than a
+ *          slot, the caller must deliver it
+ */
+bool log_queue_push(uint32_t epoch, const char* topic, const char* message){
+    if(!log_pipeline_running) return false;
+    size_t topic_len = strlen(topic);
+    size_t message_len = strlen(message);
+    if(topic_len >= LOG_TOPIC_LEN || message_len >= LOG_MESSAGE_LEN) return false;
+
+    unsigned long waited = millis();
+    uint32_t pos = log_queue_head.load(std::memory_order_relaxed);
+    for(;;){
+        struct log_queue_slot& s = log_queue[pos & (LOG_QUEUE_DEPTH - 1)];
+        int32_t diff = (int32_t)(s.seq.load(std::memory_order_acquire) - pos);
+        if(diff == 0){
+            if(log_queue_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                s.epoch = epoch;
+                memcpy(s.topic, topic, topic_len + 1);
+                memcpy(s.message, message, message_len + 1);
+                s.seq.store(pos + 1, std::memory_order_release);
+                log_queue_records++;
+                xSemaphoreGive(log_pending);
+                return true;
+            }
+        }else if(diff < 0){
+            // the slot still holds a record a lap behind, wait for the drain task to free one
+            unsigned long spent = millis() - waited;
+            if(spent >= LOG_QUEUE_WAIT_MS || xSemaphoreTake(log_freed, pdMS_TO_TICKS(LOG_QUEUE_WAIT_MS - spent)) != pdTRUE){
+                log_queue_overflows++;
+                return true;
+            }
+            pos = log_queue_head.load(std::memory_order_relaxed);
+        }else{
+            pos = log_queue_head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Check if the oldest slot holds a record.
+ */
+bool log_queue_ready(){
+    uint32_t pos = log_queue_tail.load(std::memory_order_relaxed);
+    return log_queue[pos & (LOG_QUEUE_DEPTH - 1)].seq.load(std::memory_order_acquire) == pos + 1;
+}
+
+/**
+ * @brief Deliver every queued record as one batch.
+ *
+ * Only one task may read the queue at a time.
+ *
+ * @returns records delivered
+ */
+int log_queue_drain(){
+    if(!log_queue_ready()) return 0;
+
+    int n = 0;
+    log_lock();
+    log_sinks_begin();
+    while(log_queue_ready()){
+        // records are read in place, writers do not reuse the slot until it is released
+        uint32_t pos = log_queue_tail.load(std::memory_order_relaxed);
+        struct log_queue_slot& s = log_queue[pos & (LOG_QUEUE_DEPTH - 1)];
+        log_sinks_write(s.epoch, s.topic, s.message);
+        log_queue_tail.store(pos + 1, std::memory_order_relaxed);
+        s.seq.store(pos + LOG_QUEUE_DEPTH, std::memory_order_release);
+        xSemaphoreGive(log_freed);
+        n++;
+    }
+    log_sinks_end();
+    log_unlock();
+    return n;
+}
+
+/**
+ * @brief FreeRTOS task body draining the queue until `log_pipeline_stop()`.
+ */
+void log_pipeline_task(void*){
+    while(!log_pipeline_stopping && xSemaphoreTake(log_pending, portMAX_DELAY) == pdTRUE){
+        log_queue_drain();
+    }
+    xSemaphoreGive(log_stopped);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Queue readings logged from now on and start the task draining them.
+ *
+ * Called before the scheduler starts its first task, the queue must be empty.
+ *
+ * @returns `false` if the task could not be started, readings are delivered by whoever logs them
+ */
+bool log_pipeline_start(){
+    if(log_pending == NULL) log_pending = xSemaphoreCreateCounting(LOG_QUEUE_DEPTH + 1, 0);
+    if(log_stopped == NULL) log_stopped = xSemaphoreCreateBinary();
+    if(log_freed == NULL) log_freed = xSemaphoreCreateCounting(LOG_QUEUE_DEPTH, 0);
+    if(log_pending == NULL || log_stopped == NULL || log_freed == NULL) return false;
+
+    while(xSemaphoreTake(log_pending, 0) == pdTRUE);
+    while(xSemaphoreTake(log_freed, 0) == pdTRUE);
+    for(uint32_t i = 0; i < LOG_QUEUE_DEPTH; i++) log_queue[i].seq.store(i, std::memory_order_relaxed);
+    log_queue_head = 0;
+    log_queue_tail = 0;
+    log_pipeline_stopping = false;
+    log_pipeline_running = true;
+
+    if(xTaskCreatePinnedToCore(log_pipeline_task, "log", LOG_TASK_STACK_SIZE, NULL, 1, NULL, LOG_TASK_CORE) != pdPASS){
+        Serial.println("[ERROR] failed to start the logging task");
+        log_pipeline_running = false;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop the drain task and deliver whatever it left in the queue.
+ *
+ * Called once the tasks logging through the queue are finished, readings logged
+ * after it are delivered by the caller.
+ */
+void log_pipeline_stop(){
+    if(!log_pipeline_running) return;
+
+    log_pipeline_stopping = true;
+    xSemaphoreGive(log_pending);
+    xSemaphoreTake(log_stopped, portMAX_DELAY);
+    log_pipeline_running = false;
+
+    int n = log_queue_drain();
+    if(DEBUG) Serial.printf("[LOG] %u records queued, %d left at stop, %u dropped as the queue was full\n",
+            (unsigned)log_queue_records, n, (unsigned)log_queue_overflows);
+}
+
+#endif
@@ -0,0 +1,404 @@
+/**
+ * @file log_reader.hpp
+ * @brief Reads logged rows back off the uSD card for `get_time_range`.
+ *
+ * The daily files covered by the range are read, CSV or binary (binlog.hpp),
+ * and matching rows are published in pages to `datagator/data/time_range/<MAC>`,
+ * the same message as the SDReader library. The same readers feed the backfill
+ * of records logged while offline, see backfill.hpp.
+ *
+ * Reading a file starts at the last entry of its time index (log_session.hpp)
+ * before the range, found by binary search, so at most `LOG_INDEX_EVERY` rows are
+ * read before the first match. Records are written in time order, reading stops
+ * at the first one more than `LOG_ORDER_SLACK_S` past the range. A file without
+ * an index is read from the start.
+ *
+ * The CSV files of past days may have been compressed, see log_archive.hpp. They are
+ * read through the decoder of lz_format.hpp, seeking to chunks the same way.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef LOG_READER_HPP
+#define LOG_READER_HPP
+
+#include <Arduino.h>
+#include <SD.h>
+#include <PubSubClient.h>
+#include <WiFi.h>
+#include <TimeStamp.hpp>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <binlog_format.hpp>
+#include <log_session.hpp>
+#include <lz_format.hpp>
+#include <mqtt_stream.hpp>
+
+extern PubSubClient mqtt_client;
+extern bool log_binary;
+
+/** Records may be this many seconds older than one logged before them, eg. after a clock correction. */
+#define LOG_ORDER_SLACK_S 600
+
+/**
+ * @brief Reads a CSV log file one row at a time, a sector per read.
+ *
+ * `Source` provides `size_t read(uint8_t*, size_t)`, a `File` or an `LzReader`.
+ */
+template<class Source>
+class LogRowReader {
+    public:
+        LogRowReader(Source& f): f(f){}
+
+        /**
+         * @brief Read the next row, without the newline.
+         *
+         * @returns `false` at the end of the file
+         */
+        bool next(std::string& row){
+            row.clear();
+            while(true){
+                if(pos == len){
+                    len = f.read((uint8_t*)buffer, sizeof(buffer));
+                    pos = 0;
+                    if(len == 0) return !row.empty();
+                }
+                const char* nl = (const char*)memchr(buffer + pos, '\n', len - pos);
+                size_t end = nl != NULL ? nl - buffer : len;
+                row.append(buffer + pos, end - pos);
+                pos = end;
+                if(nl != NULL){
+                    pos++;
+                    return true;
+                }
+            }
+        }
+
+    private:
+        Source& f;
+        char buffer[LOG_SECTOR_LEN];
+        size_t pos = 0;
+        size_t len = 0;
+};
+
+/**
+ * @brief Load the time index of \p filename, empty if it has none.
+ */
+void log_index_load(const std::string& filename, std::vector<struct log_index_entry>& index){
+    index.clear();
+    File f = SD.open(log_index_filename(filename).c_str(), FILE_READ);
+    if(!f) return;
+    index.resize(f.size() / sizeof(struct log_index_entry));
+    size_t n = f.read((uint8_t*)index.data(), index.size() * sizeof(struct log_index_entry));
+    index.resize(n / sizeof(struct log_index_entry));
+    f.close();
+}
+
+/**
+ * @brief Offset of the last indexed record before \p epoch, 0 if there is none.
+ */
+uint32_t log_index_seek(const std::vector<struct log_index_entry>& index, uint32_t epoch){
+    auto first = std::lower_bound(index.begin(), index.end(), epoch,
+        [](const struct log_index_entry& e, uint32_t epoch){ return e.epoch < epoch; });
+    if(first == index.begin()) return 0;
+    return (first - 1)->offset & ~LOG_INDEX_DICTIONARY;
+}
+
+/**
+ * @brief Write the message of one page of rows to \p out.
+ *
+ * `Out` provides `put(char)` and `write(const char*, size_t)`.
+ */
+template<class Out>
+void log_write_page(Out& out, const std::string& head, const std::vector<std::string>& rows){
+    out.write(head.data(), head.size());
+    for(size_t i = 0; i < rows.size(); i++){
+        if(i > 0) out.put(',');
+        out.put('"');
+        for(char c: rows[i]){
+            if(c == '"' || c == '\\') out.put('\\');
+            out.put(c);
+        }
+        out.put('"');
+    }
+    out.write("]}", 2);
+}
+
+/**
+ * @brief Counts the bytes of a page, the length is sent before the message.
+ */
+struct log_page_length{
+    size_t n = 0;
+    void put(char){ n++; }
+    void write(const char*, size_t len){ n += len; }
+};
+
+/**
+ * @brief Collects a page to be compressed.
+ */
+struct log_page_string{
+    std::string s;
+    void put(char c){ s += c; }
+    void write(const char* data, size_t len){ s.append(data, len); }
+};
+
+/**
+ * @brief Publish one page of rows, as a compressed stream of lz_format.hpp if \p compress is set.
+ *
+ * An uncompressed page is streamed from the rows, see mqtt_stream.hpp, it is never
+ * held as one message. The compressed length is only known once the whole page is
+ * compressed, so a compressed page is built first and streamed from the result.
+ */
+void log_publish_page(const std::string& topic, const std::string& filename, uint32_t epoch, uint32_t terminus, const std::vector<std::string>& rows, bool compress){
+    std::string head = "{\"file_name\":\"" + filename + "\", \"epoch\":" + std::to_string(epoch) +
+        ", \"terminus\":" + std::to_string(terminus) + ", \"data\":[";
+    if(compress){
+        struct log_page_string msg;
+        log_write_page(msg, head, rows);
+        std::string packed;
+        lz_compress(msg.s, packed);
+        mqtt_publish(topic.c_str(), (const uint8_t*)packed.data(), packed.size());
+        return;
+    }
+
+    struct log_page_length length;
+    log_write_page(length, head, rows);
+    MqttStream stream;
+    if(!stream.begin(topic.c_str(), length.n)) return;
+    log_write_page(stream, head, rows);
+    stream.end();
+}
+
+/**
+ * @brief Check a topic against the `get_time_range` filter, an empty filter matches all.
+ */
+bool log_topic_match(const char* topic, size_t len, const std::vector<std::string>& topic_filter){
+    bool match = topic_filter.empty();
+    for(const std::string& filter: topic_filter) match = match || (filter.size() <= len && strncmp(topic, filter.c_str(), filter.size()) == 0);
+    return match;
+}
+
+/**
+ * @brief Collects rows into pages and publishes them.
+ */
+struct log_range_pages{
+    std::string topic;              //!< response topic
+    std::string filename;           //!< file the rows are read from
+    uint32_t epoch;
+    uint32_t terminus;
+    int page_size;
+    bool compress;                  //!< publish compressed pages
+    std::vector<std::string> page;  //!< rows not yet published
+
+    void file(const std::string& name){
+        flush();
+        filename = name;
+    }
+
+    bool add(uint32_t, const std::string& row){
+        page.push_back(row);
+        if((int)page.size() == page_size) flush();
+        return true;
+    }
+
+    void flush(){
+        if(!page.empty()) log_publish_page(topic, filename, epoch, terminus, page, compress);
+        page.clear();
+    }
+};
+
+/**
+ * @brief Hand the matching rows to \p sink, the first row read is dropped.
+ *
+ * `sink.add(time, row)` returns false to stop reading.
+ *
+ * @returns false if the sink stopped the read
+ */
+template<class Reader, class Sink>
+bool log_read_rows(Reader* reader, uint32_t epoch, uint32_t terminus, uint32_t stop, const std::vector<std::string>& topic_filter, Sink& sink){
+    std::string row;
+    bool more = true;
+    reader->next(row);
+    while(more && reader->next(row)){
+        uint32_t t;
+        size_t sep = row.find(';');
+        if(sep == std::string::npos || !log_parse_time(row.c_str(), t)) continue;
+        if(t > stop) break;
+        if(t < epoch || t > terminus) continue;
+
+        size_t end = row.find(';', sep + 1);
+        if(end == std::string::npos) end = row.size();
+        if(log_topic_match(row.c_str() + sep + 1, end - sep - 1, topic_filter)) more = sink.add(t, row);
+    }
+    return more;
+}
+
+/**
+ * @brief Hand the matching rows of one CSV file to \p sink, from \p offset on.
+ *
+ * @returns false if the sink stopped the read
+ */
+template<class Sink>
+bool log_read_csv(File& f, uint32_t offset, uint32_t epoch, uint32_t terminus, uint32_t stop, const std::vector<std::string>& topic_filter, Sink& sink){
+    // start one byte early and drop the partial row, at the index offset that is
+    // the newline ending the row before, at the start of the file the header
+    if(offset > 0 && !f.seek(offset - 1)) f.seek(0);
+
+    LogRowReader<File>* reader = new LogRowReader<File>(f);
+    bool more = log_read_rows(reader, epoch, terminus, stop, topic_filter, sink);
+    delete reader;
+    return more;
+}
+
+/**
+ * @brief Hand the matching rows of one compressed CSV file to \p sink, from the chunk at \p offset on.
+ *
+ * Chunks of indexed rows start with the newline ending the row before, the first
+ * chunk with the CSV header, so the first row read is dropped as for CSV files.
+ *
+ * @returns false if the sink stopped the read
+ */
+template<class Sink>
+bool log_read_archive(File& f, uint32_t offset, uint32_t epoch, uint32_t terminus, uint32_t stop, const std::vector<std::string>& topic_filter, Sink& sink){
+    LzReader<File>* lz = new LzReader<File>(f);
+    bool more = true;
+    if(lz->begin()){
+        if(offset > 0) f.seek(offset);
+        LogRowReader<LzReader<File> >* reader = new LogRowReader<LzReader<File> >(*lz);
+        more = log_read_rows(reader, epoch, terminus, stop, topic_filter, sink);
+        delete reader;
+    }
+    delete lz;
+    return more;
+}
+
+/**
+ * @brief Hand the matching rows of one binary file to \p sink, from \p offset on.
+ *
+ * @returns false if the sink stopped the read
+ */
+template<class Sink>
+bool log_read_binary(File& f, const std::vector<struct log_index_entry>& index, uint32_t offset, uint32_t epoch, uint32_t terminus, uint32_t stop, const std::vector<std::string>& topic_filter, Sink& sink){
+    BinlogReader<File>* reader = new BinlogReader<File>(f);
+    struct binlog_entry* e = new struct binlog_entry;
+    std::string row;
+    bool more = true;
+    if(reader->begin()){
+        // dictionary entries written before the offset are needed to expand the rows
+        for(const struct log_index_entry& entry: index){
+            uint32_t at = entry.offset & ~LOG_INDEX_DICTIONARY;
+            if(!(entry.offset & LOG_INDEX_DICTIONARY) || at >= offset || !f.seek(at)) continue;
+            if(reader->next_block(UINT32_MAX, 0)) while(reader->next_record(*e));
+        }
+        if(offset > 0) f.seek(offset);
+
+        while(more && reader->next_block(epoch, terminus, stop)){
+            while(more && reader->next_record(*e)){
+                if(e->epoch < epoch || e->epoch > terminus) continue;
+                const char* topic = reader->topic(*e);
+                if(topic == NULL || !log_topic_match(topic, strlen(topic), topic_filter) || !reader->row(*e, row)) continue;
+                more = sink.add(e->epoch, row);
+            }
+        }
+    }
+    delete e;
+    delete reader;
+    return more;
+}
+
+/**
+ * @brief Path of the log files of the day holding \p epoch without extension, eg "/2023-07/log_7-22-2023"
+ *
+ * Files are kept in one directory per month, see log_retention.hpp.
+ */
+std::string log_day_path(uint32_t epoch){
+    time_t t = epoch;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char path[80];
+    snprintf(path, sizeof(path), "/%04d-%02d/log_%d-%d-%d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mon + 1, tm.tm_mday, tm.tm_year + 1900);
+    return path;
+}
+
+/**
+ * @brief Path of the log file of the day holding \p epoch, eg "/2023-07/log_7-22-2023.csv"
+ */
+std::string log_day_filename(uint32_t epoch){
+    return log_day_path(epoch) + (log_binary ? ".bin" : ".csv");
+}
+
+/**
+ * @brief Path of the compressed CSV log file of the day holding \p epoch, eg "/2023-07/log_7-22-2023.lz"
+ */
+std::string log_archive_filename(uint32_t epoch){
+    return log_day_path(epoch) + ".lz";
+}
+
+/**
+ * @brief Hand every logged row with `epoch <= time <= terminus` whose topic starts with one of `topic_filter` to \p sink.
+ *
+ * Reads the daily files covered by the range in order, each from the last entry
+ * of its time index before \p epoch. `sink.file(filename)` is called before a
+ * file is read and `sink.add(time, row)` for each row, returning false to stop.
+ *
+ * @returns false if the sink stopped the read
+ */
+template<class Sink>
+bool log_read_days(uint32_t epoch, uint32_t terminus, const std::vector<std::string>& topic_filter, Sink& sink){
+    uint32_t stop = terminus < UINT32_MAX - LOG_ORDER_SLACK_S ? terminus + LOG_ORDER_SLACK_S : UINT32_MAX;
+
+    bool more = true;
+    std::vector<struct log_index_entry> index;
+    for(uint32_t day = epoch - epoch % 86400; more && day <= terminus; day += 86400){
+        std::string filename = log_day_filename(day);
+        File f = SD.open(filename.c_str(), FILE_READ);
+        bool archived = false;
+        if(!f && !log_binary){
+            filename = log_archive_filename(day);
+            f = SD.open(filename.c_str(), FILE_READ);
+            archived = true;
+        }
+        if(!f) continue;
+
+        log_index_load(filename, index);
+        uint32_t offset = log_index_seek(index, epoch);
+        if(DEBUG) Serial.printf("[LOG] reading \'%s\' from byte %u of %u\n", filename.c_str(), offset, (unsigned)f.size());
+
+        sink.file(filename);
+        if(log_binary){
+            more = log_read_binary(f, index, offset, epoch, terminus, stop, topic_filter, sink);
+        }else if(archived){
+            more = log_read_archive(f, offset, epoch, terminus, stop, topic_filter, sink);
+        }else{
+            more = log_read_csv(f, offset, epoch, terminus, stop, topic_filter, sink);
+        }
+        f.close();
+
+        if(day > UINT32_MAX - 86400) break;
+    }
+    return more;
+}
+
+/**
+ * @brief Publish every logged row with `epoch <= time <= terminus` whose topic starts with one of `topic_filter`.
+ *
+ * Reads the daily files covered by the range and publishes matching rows in pages
+ * of \p page_size to `datagator/data/time_range/<MAC>`. With \p compress each page
+ * is compressed, see lz_format.hpp, and goes to `datagator/data/time_range_lz/<MAC>`.
+ */
+void log_read_range(uint32_t epoch, uint32_t terminus, const std::vector<std::string>& topic_filter, int page_size, bool compress = false){
+    if(page_size <= 0 || epoch > terminus) return;
+
+    struct log_range_pages pages;
+    pages.topic = std::string(compress ? "datagator/data/time_range_lz/" : "datagator/data/time_range/") + WiFi.macAddress().c_str();
+    pages.compress = compress;
+    pages.epoch = epoch;
+    pages.terminus = terminus;
+    pages.page_size = page_size;
+    log_read_days(epoch, terminus, topic_filter, pages);
+    pages.flush();
+}
+
+#endif
@@ -0,0 +1,362 @@
+/**
+ * @file log_retention.hpp
+ * @brief Keeps the log files on the uSD card within a size and age budget.
+ *
+ * One log file was added to the root directory of the card every day and none
+ * was ever removed. FAT looks a name up by reading its directory from the start,
+ * so every `open()` and `exists()` got slower as the card filled. Files are kept in
+ * one directory per month instead, eg. "/2023-07/log_7-22-2023.csv", and the files
+ * of past days are removed once they take more than `SD_RETENTION_MB` or are more
+ * than `SD_RETENTION_DAYS` old.
+ *
+ * ### Manifest
+ * The bytes of each past day, log files and time indexes together, are kept in
+ * "/log_manifest.dat" so the budget is checked without listing the card:
+ *
+ *  1. `log_manifest_header`
+ *  2. `count` `log_manifest_entry`, oldest day first
+ *
+ * The first wake of a day adds the days before it, after log_archive.hpp compressed
+ * them. The day being written is not counted. A missing or damaged manifest, eg. on
+ * a card written by older firmware, is rebuilt by listing the card, which also moves
+ * log files from the root directory into the directory of their month.
+ *
+ * ### Eviction
+ * Days are removed oldest first, skipping days with readings the backfill has not
+ * published yet (backfill.hpp). Those are kept past the age limit, but removed
+ * oldest first if the size budget can not be met otherwise, so the card never fills.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef LOG_RETENTION_HPP
+#define LOG_RETENTION_HPP
+
+#include <Arduino.h>
+#include <SD.h>
+#include <TimeStamp.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <backfill.hpp>
+#include <binlog_format.hpp>
+#include <epoch_clock.hpp>
+#include <log_reader.hpp>
+#include <rtc_state.hpp>
+
+extern uint32_t log_retention_bytes;
+extern uint32_t log_retention_days;
+
+/** Path of the manifest. */
+#define LOG_MANIFEST_PATH "/log_manifest.dat"
+/** Manifest format version written to its header. */
+#define LOG_MANIFEST_VERSION 1
+/** Most days missing from the manifest looked up one by one, a longer gap lists the card instead. */
+#define LOG_RETENTION_SCAN_DAYS 31
+
+/**
+ * @brief First bytes of the manifest.
+ */
+struct log_manifest_header{
+    char magic[4];          //!< "DGLM"
+    uint16_t version;       //!< `LOG_MANIFEST_VERSION`
+    uint16_t reserved;
+    uint32_t through;       //!< midnight of the first day not yet counted
+    uint32_t count;         //!< entries after the header
+    uint32_t crc;           //!< `binlog_crc32()` of the entries
+};
+
+/**
+ * @brief Log files of one day.
+ */
+struct log_manifest_entry{
+    uint32_t day;           //!< epoch of midnight
+    uint32_t bytes;         //!< size of the day's log and index files
+};
+
+/**
+ * @brief Last day checked, kept in RTC memory so the manifest is read once a day.
+ */
+struct rtc_log_retention{
+    /** epoch of midnight of the last day the budget was enforced */
+    uint32_t day;
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct rtc_log_retention rtc_log_retention;
+
+/** Extensions of the files of one day, CSV, compressed and binary log files and their time indexes. */
+const char* const log_day_extensions[] = {".csv", ".csv.idx", ".lz", ".lz.idx", ".bin", ".bin.idx"};
+
+/**
+ * @brief Directory of the log files of the day holding \p epoch, eg "/2023-07"
+ */
+std::string log_month_dir(uint32_t epoch){
+    std::string path = log_day_path(epoch);
+    return path.substr(0, path.rfind('/'));
+}
+
+/**
+ * @brief Name of a file without its directory, older cores return the whole path.
+ */
+const char* log_base_name(const char* name){
+    const char* slash = strrchr(name, '/');
+    return slash == NULL ? name : slash + 1;
+}
+
+/**
+ * @brief Find the day of a log or index file from its name, eg. "log_7-22-2023.csv.idx".
+ *
+ * @returns false if \p name is not a file of a day
+ */
+bool log_name_day(const char* name, uint32_t& day){
+    int m, d, y, n = 0;
+    if(sscanf(name, "log_%d-%d-%d%n", &m, &d, &y, &n) != 3 || name[n] != '.') return false;
+    if(m < 1 || m > 12 || d < 1 || d > 31 || y < 1970) return false;
+    day = TimeStamp(d, m, y, 0, 0, 0, 0).get_epoch();
+    return true;
+}
+
+/**
+ * @brief Check if \p name is a month directory, eg. "2023-07".
+ */
+bool log_is_month_dir(const char* name){
+    int y, m, n = 0;
+    return sscanf(name, "%4d-%2d%n", &y, &m, &n) == 2 && n == 7 && name[n] == '\0';
+}
+
+/**
+ * @brief Bytes of the log files of the day starting at \p day.
+ */
+uint32_t log_day_bytes(uint32_t day){
+    std::string path = log_day_path(day);
+    uint32_t bytes = 0;
+    for(const char* ext: log_day_extensions){
+        File f = SD.open((path + ext).c_str(), FILE_READ);
+        if(!f) continue;
+        bytes += f.size();
+        f.close();
+    }
+    return bytes;
+}
+
+/**
+ * @brief Count \p bytes to \p day, keeping the entries in order.
+ */
+void log_manifest_add(std::vector<struct log_manifest_entry>& entries, uint32_t day, uint32_t bytes){
+    size_t i = entries.size();
+    while(i > 0 && entries[i - 1].day > day) i--;
+    if(i > 0 && entries[i - 1].day == day){
+        entries[i - 1].bytes += bytes;
+    }else{
+        entries.insert(entries.begin() + i, {day, bytes});
+    }
+}
+
+/**
+ * @brief Read the manifest.
+ *
+ * @param[out] entries The days counted.
+ * @param[out] through Midnight of the first day not yet counted.
+ *
+ * @returns false if there is no manifest or it is damaged
+ */
+bool log_manifest_load(std::vector<struct log_manifest_entry>& entries, uint32_t& through){
+    entries.clear();
+    File f = SD.open(LOG_MANIFEST_PATH, FILE_READ);
+    if(!f) return false;
+
+    struct log_manifest_header h;
+    bool ok = f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) && memcmp(h.magic, "DGLM", 4) == 0 &&
+        h.version == LOG_MANIFEST_VERSION && f.size() == sizeof(h) + (size_t)h.count * sizeof(struct log_manifest_entry);
+    if(ok){
+        size_t n = h.count * sizeof(struct log_manifest_entry);
+        entries.resize(h.count);
+        ok = f.read((uint8_t*)entries.data(), n) == n && binlog_crc32(entries.data(), n) == h.crc;
+        through = h.through;
+    }
+    f.close();
+    if(!ok) entries.clear();
+    return ok;
+}
+
+/**
+ * @brief Write the manifest, whole.
+ */
+void log_manifest_save(const std::vector<struct log_manifest_entry>& entries, uint32_t through){
+    size_t n = entries.size() * sizeof(struct log_manifest_entry);
+    struct log_manifest_header h;
+    memcpy(h.magic, "DGLM", 4);
+    h.version = LOG_MANIFEST_VERSION;
+    h.reserved = 0;
+    h.through = through;
+    h.count = entries.size();
+    h.crc = binlog_crc32(entries.data(), n);
+
+    File f = SD.open(LOG_MANIFEST_PATH, FILE_WRITE);
+    bool ok = f && f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+        (n == 0 || f.write((const uint8_t*)entries.data(), n) == n);
+    f.close();
+    // a damaged manifest is rebuilt the next day
+    if(!ok) Serial.println("[ERROR] could not write the log manifest");
+}
+
+/**
+ * @brief Rebuild the manifest by listing the card.
+ *
+ * Log files in the root directory, written by older firmware, are moved into the
+ * directory of their month first.
+ *
+ * @param[in] today Midnight of the day being written, it is not counted.
+ * @param[out] entries The days found.
+ */
+void log_manifest_rebuild(uint32_t today, std::vector<struct log_manifest_entry>& entries){
+    entries.clear();
+    std::vector<std::string> dirs;
+    std::vector<std::string> legacy;
+    uint32_t day;
+
+    File root = SD.open("/");
+    if(!root) return;
+    for(File f = root.openNextFile(); f; f = root.openNextFile()){
+        const char* name = log_base_name(f.name());
+        if(f.isDirectory()){
+            if(log_is_month_dir(name)) dirs.push_back(std::string("/") + name);
+        }else if(log_name_day(name, day)){
+            legacy.push_back(name);
+        }
+        f.close();
+    }
+    root.close();
+
+    for(const std::string& name: legacy){
+        log_name_day(name.c_str(), day);
+        std::string dir = log_month_dir(day);
+        SD.mkdir(dir.c_str());
+        if(!SD.rename(("/" + name).c_str(), (dir + "/" + name).c_str())){
+            Serial.printf("[ERROR] could not move \'/%s\' to \'%s\'\n", name.c_str(), dir.c_str());
+        }
+        if(std::find(dirs.begin(), dirs.end(), dir) == dirs.end()) dirs.push_back(dir);
+    }
+
+    for(const std::string& dir: dirs){
+        File d = SD.open(dir.c_str());
+        if(!d) continue;
+        for(File f = d.openNextFile(); f; f = d.openNextFile()){
+            if(!f.isDirectory() && log_name_day(log_base_name(f.name()), day) && day < today) log_manifest_add(entries, day, f.size());
+            f.close();
+        }
+        d.close();
+    }
+    if(DEBUG) Serial.printf("[RETENTION] rebuilt the manifest, %u days, moved %u files\n", (unsigned)entries.size(), (unsigned)legacy.size());
+}
+
+/**
+ * @brief Check if the day starting at \p day holds readings the backfill has not published yet.
+ */
+bool log_day_pending(uint32_t day){
+    if(BACKFILL_BYTES == 0) return false;
+    backfill_load();
+    const struct backfill_cursor& c = rtc_backfill.cursor;
+    return c.next != 0 && c.next < day + 86400;
+}
+
+/**
+ * @brief Remove the files of the entry at \p i and the entry, and the month's directory once empty.
+ */
+void log_day_remove(std::vector<struct log_manifest_entry>& entries, size_t i){
+    uint32_t day = entries[i].day;
+    std::string path = log_day_path(day);
+    for(const char* ext: log_day_extensions) SD.remove((path + ext).c_str());
+    entries.erase(entries.begin() + i);
+    if(DEBUG) Serial.printf("[RETENTION] removed \'%s\'\n", path.c_str());
+
+    std::string dir = log_month_dir(day);
+    for(const struct log_manifest_entry& e: entries){
+        if(log_month_dir(e.day) == dir) return;
+    }
+    if(dir != log_month_dir(epoch_now())) SD.rmdir(dir.c_str());
+}
+
+/**
+ * @brief Remove days, oldest first, until the manifest is within the budget.
+ *
+ * @param[in] today Midnight of the day being written.
+ * @param[inout] entries The days counted.
+ *
+ * @returns bytes removed
+ */
+uint32_t log_retention_enforce(uint32_t today, std::vector<struct log_manifest_entry>& entries){
+    uint64_t total = 0;
+    for(const struct log_manifest_entry& e: entries) total += e.bytes;
+    uint32_t keep_from = log_retention_days != 0 && today > log_retention_days * 86400UL ? today - log_retention_days * 86400UL : 0;
+
+    // published days first, then the others if the size budget is still exceeded
+    uint32_t removed = 0;
+    for(int pass = 0; pass < 2; pass++){
+        size_t i = 0;
+        while(i < entries.size()){
+            bool over_size = log_retention_bytes != 0 && total > log_retention_bytes;
+            bool too_old = entries[i].day < keep_from;
+            if(!over_size && !too_old) break;
+
+            bool pending = log_day_pending(entries[i].day);
+            if((pass == 0 && pending) || (pass == 1 && !over_size)){
+                i++;
+                continue;
+            }
+            if(pending) Serial.printf("[ERROR] log files over budget, removing unpublished readings of %u\n", entries[i].day);
+            total -= entries[i].bytes;
+            removed += entries[i].bytes;
+            log_day_remove(entries, i);
+        }
+    }
+    return removed;
+}
+
+/**
+ * @brief Count the days before today and enforce the budget, once a day.
+ *
+ * Must be called after the log session is closed and after `log_archive_closed()`,
+ * before the uSD card is powered down.
+ */
+void log_retention_closed(){
+    if(!epoch_known) return;
+
+    uint32_t now = epoch_now();
+    uint32_t today = now - now % 86400;
+    bool valid = rtc_log_retention.checksum == rtc_checksum(&rtc_log_retention, offsetof(struct rtc_log_retention, checksum));
+    if(valid && rtc_log_retention.day == today) return;
+
+    std::vector<struct log_manifest_entry> entries;
+    uint32_t through = 0;
+    bool changed = false;
+    if(!log_manifest_load(entries, through) || through > today || today - through > LOG_RETENTION_SCAN_DAYS * 86400UL){
+        log_manifest_rebuild(today, entries);
+        changed = true;
+    }else{
+        for(uint32_t day = through; day < today; day += 86400){
+            uint32_t bytes = log_day_bytes(day);
+            if(bytes > 0) log_manifest_add(entries, day, bytes);
+            changed = true;
+        }
+    }
+
+    uint32_t removed = log_retention_enforce(today, entries);
+    if(changed || removed > 0) log_manifest_save(entries, today);
+
+    rtc_log_retention.day = today;
+    rtc_log_retention.checksum = rtc_checksum(&rtc_log_retention, offsetof(struct rtc_log_retention, checksum));
+
+    if(DEBUG){
+        uint64_t total = 0;
+        for(const struct log_manifest_entry& e: entries) total += e.bytes;
+        Serial.printf("[RETENTION] %u days, %llu bytes, removed %u bytes\n", (unsigned)entries.size(), (unsigned long long)total, removed);
+    }
+}
+
+#endif
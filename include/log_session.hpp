@@ -0,0 +1,309 @@
+/**
+ * @file log_session.hpp
+ * @brief Buffered writer for the day's log file on the uSD card.
+ *
+ * Opening a file on the uSD card walks the FAT and every small write costs a
+ * read-modify-write of a whole 512 byte sector. Instead of opening the log file
+ * for each record, one `LogSession` per wake opens the file on the first record,
+ * writes the header if the file is new, and collects records in a fixed RAM
+ * buffer. Only whole sectors are written while the session is open, the rest is
+ * written by `close()` right before the card is powered down for sleep.
+ *
+ * Records still in the buffer are lost if the wake ends without `close()`,
+ * eg. a brown out or a watchdog reset.
+ *
+ * Every `LOG_INDEX_EVERY` records the session notes the epoch and byte offset of
+ * the next record. The entries are appended to a sidecar file `<filename>.idx`
+ * when the session is closed, so `get_time_range` can seek close to the first
+ * row it needs instead of reading the whole file, see log_reader.hpp.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef LOG_SESSION_HPP
+#define LOG_SESSION_HPP
+
+#include <Arduino.h>
+#include <SD.h>
+#include <TimeStamp.hpp>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <rtc_state.hpp>
+
+/** uSD card sector size, the unit of every write to the card. */
+#define LOG_SECTOR_LEN 512
+/** Records buffered before full sectors are written, a multiple of `LOG_SECTOR_LEN`. */
+#define LOG_SESSION_BUFFER_LEN (4 * LOG_SECTOR_LEN)
+/** Longest log file path, eg "/2023-12/log_12-31-2023.csv" */
+#define LOG_FILENAME_LEN 32
+/** Longest file header written to a new log file. */
+#define LOG_HEADER_LEN 32
+/** Header of the CSV log files. */
+#define LOG_CSV_HEADER "TIME;MQTT TOPIC;MQTT MESSAGE\n"
+/** Records between two entries of the time index, the most rows read before the first match. */
+#define LOG_INDEX_EVERY 32
+/** Index entries buffered before they are appended to the `.idx` file. */
+#define LOG_INDEX_PENDING 8
+/** Set in `log_index_entry::offset` when the entry is a block of dictionary entries. */
+#define LOG_INDEX_DICTIONARY 0x80000000UL
+
+/**
+ * @brief One entry of the time index, as stored in the `.idx` file.
+ */
+struct log_index_entry{
+    /** epoch of the record at `offset` */
+    uint32_t epoch;
+    /** byte offset of the record in the log file, may be or'ed with `LOG_INDEX_DICTIONARY` */
+    uint32_t offset;
+};
+
+/**
+ * @brief Indexing progress of the file being written, kept in RTC memory.
+ */
+struct rtc_log_index{
+    /** file the count belongs to */
+    char filename[LOG_FILENAME_LEN];
+    /** records written since the last index entry */
+    int since;
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct rtc_log_index rtc_log_index;
+
+/**
+ * @brief Epoch of a log row starting with a `TimeStamp` string, eg "7-25-2023T2:18:44+0;..."
+ *
+ * @return false if \p row does not start with a time.
+ */
+bool log_parse_time(const char* row, uint32_t& epoch){
+    int month, day, year, hour, minutes, seconds;
+    if(sscanf(row, "%d-%d-%dT%d:%d:%d", &month, &day, &year, &hour, &minutes, &seconds) != 6) return false;
+    epoch = TimeStamp(day, month, year, hour, minutes, seconds, 0).get_epoch();
+    return true;
+}
+
+/**
+ * @brief Path of the time index of \p filename, eg "/2023-07/log_7-22-2023.csv.idx"
+ */
+std::string log_index_filename(const std::string& filename){
+    return filename + ".idx";
+}
+
+/**
+ * @brief Appends records to one log file, at most one open per wake.
+ *
+ * `log()` writes CSV rows `time;topic;message`, `write()` any other format.
+ */
+class LogSession {
+    public:
+        /**
+         * @brief Start a session on \p filename, nothing is read or written until the first record.
+         *
+         * Anything left over from a session which was never closed is dropped.
+         *
+         * @param[in] filename Path of the log file, eg "/2023-07/log_7-22-2023.csv"
+         * @param[in] header Written first if the file is new, at most `LOG_HEADER_LEN` bytes.
+         * @param[in] header_len Length of \p header.
+         */
+        void begin(const std::string& filename, const void* header = LOG_CSV_HEADER, size_t header_len = strlen(LOG_CSV_HEADER)){
+            strncpy(this->filename, filename.c_str(), LOG_FILENAME_LEN - 1);
+            this->filename[LOG_FILENAME_LEN - 1] = '\0';
+            this->header_len = header_len < LOG_HEADER_LEN ? header_len : LOG_HEADER_LEN;
+            memcpy(this->header, header, this->header_len);
+            file = File();
+            opened = false;
+            created = false;
+            file_size = 0;
+            len = 0;
+            since = LOG_INDEX_EVERY;
+            pending = 0;
+        }
+
+        /** @brief Path of the file the session writes to. */
+        const char* get_filename(){ return filename; }
+
+        /**
+         * @brief Open the file, if not already open this session.
+         *
+         * @return false if the log file could not be opened.
+         */
+        bool open(){
+            return opened || open_file();
+        }
+
+        /** @brief The file was empty when opened. */
+        bool is_new(){ return created; }
+
+        /** @brief Size of the file once everything buffered is written. */
+        size_t size(){ return file_size + len; }
+
+        /**
+         * @brief Buffer \p n bytes.
+         *
+         * @return false if the log file could not be opened.
+         */
+        bool write(const void* data, size_t n){
+            if(!open()) return false;
+            append((const char*)data, n);
+            return true;
+        }
+
+        /**
+         * @brief Buffer one record.
+         *
+         * @param[in] epoch Time of the record if known, parsed from \p time for the index otherwise.
+         *
+         * @return false if the log file could not be opened.
+         */
+        bool log(const char* time, const char* topic, const char* message, uint32_t epoch = 0){
+            if(!open()) return false;
+
+            if(since >= LOG_INDEX_EVERY && (epoch != 0 || log_parse_time(time, epoch))) add_index(epoch, 0);
+            since++;
+
+            append(time, strlen(time));
+            append(";", 1);
+            append(topic, strlen(topic));
+            append(";", 1);
+            append(message, strlen(message));
+            append("\n", 1);
+            return true;
+        }
+
+        /** @brief Buffer one record, see `log(const char*, const char*, const char*, uint32_t)`. */
+        bool log(const std::string& time, const std::string& topic, const std::string& message, uint32_t epoch = 0){
+            return log(time.c_str(), topic.c_str(), message.c_str(), epoch);
+        }
+
+        /**
+         * @brief Count \p records about to be written with `write()`, adding an index entry if one is due.
+         *
+         * @param[in] epoch Time of the first of the records.
+         * @param[in] records Records in the write.
+         * @param[in] dictionary The write holds dictionary entries, always indexed.
+         */
+        void index(uint32_t epoch, int records, bool dictionary = false){
+            if(!open()) return;
+            if(since >= LOG_INDEX_EVERY || dictionary) add_index(epoch, dictionary ? LOG_INDEX_DICTIONARY : 0);
+            since += records;
+        }
+
+        /**
+         * @brief Write out everything buffered and close the file, then append the new index entries.
+         */
+        void close(){
+            if(!opened) return;
+            if(len > 0) write_out(len);
+            file.close();
+            opened = false;
+
+            strncpy(rtc_log_index.filename, filename, LOG_FILENAME_LEN);
+            rtc_log_index.since = since;
+            rtc_log_index.checksum = rtc_checksum(&rtc_log_index, offsetof(struct rtc_log_index, checksum));
+
+            // written after the records, so an entry does not point past the end of the file
+            if(pending > 0) write_index();
+        }
+
+    private:
+        char filename[LOG_FILENAME_LEN] = "/log.csv";
+        char header[LOG_HEADER_LEN];
+        size_t header_len = 0;
+        File file;
+        bool opened = false;
+        bool created = false;                   //!< the file was empty when opened
+        size_t file_size = 0;                   //!< bytes in the file, including those written this session
+        char buffer[LOG_SESSION_BUFFER_LEN];
+        size_t len = 0;                         //!< bytes waiting in `buffer`
+        int since = LOG_INDEX_EVERY;            //!< records since the last index entry
+        struct log_index_entry entries[LOG_INDEX_PENDING];  //!< index entries not yet written
+        int pending = 0;                        //!< entries in `entries`
+
+        /**
+         * @brief Open the file for appending and queue the header if it is new.
+         */
+        bool open_file(){
+            // the first file of a month also creates its directory
+            file = SD.open(filename, FILE_APPEND, true);
+            if(!file){
+                Serial.printf("[ERROR] could not open \'%s\'\n", filename);
+                return false;
+            }
+            opened = true;
+            file_size = file.size();
+
+            created = file_size == 0;
+            if(created){
+                append(header, header_len);
+                SD.remove(log_index_filename(filename).c_str());   // left behind by a deleted log file
+            }
+
+            // carry on counting where the last wake stopped, index the first record otherwise
+            bool valid = rtc_log_index.checksum == rtc_checksum(&rtc_log_index, offsetof(struct rtc_log_index, checksum)) &&
+                strcmp(rtc_log_index.filename, filename) == 0;
+            since = valid && !created ? rtc_log_index.since : LOG_INDEX_EVERY;
+            return true;
+        }
+
+        /**
+         * @brief Note that the next record starts at the current end of the file.
+         */
+        void add_index(uint32_t epoch, uint32_t flags){
+            if(pending == LOG_INDEX_PENDING) write_index();
+            entries[pending].epoch = epoch;
+            entries[pending].offset = size() | flags;
+            pending++;
+            since = 0;
+        }
+
+        /**
+         * @brief Append the buffered index entries to the `.idx` file.
+         */
+        void write_index(){
+            size_t n = pending * sizeof(struct log_index_entry);
+            File idx = SD.open(log_index_filename(filename).c_str(), FILE_APPEND);
+            if(!idx || idx.write((const uint8_t*)entries, n) != n){
+                Serial.printf("[ERROR] could not write the time index of '%s'\n", filename);
+            }
+            idx.close();
+            pending = 0;
+        }
+
+        void append(const char* data, size_t n){
+            while(n > 0){
+                size_t copy = n < LOG_SESSION_BUFFER_LEN - len ? n : LOG_SESSION_BUFFER_LEN - len;
+                memcpy(buffer + len, data, copy);
+                len += copy;
+                data += copy;
+                n -= copy;
+
+                if(len == LOG_SESSION_BUFFER_LEN) write_sectors();
+            }
+        }
+
+        /**
+         * @brief Write the buffered bytes up to the last sector boundary of the file.
+         */
+        void write_sectors(){
+            size_t head = LOG_SECTOR_LEN - file_size % LOG_SECTOR_LEN;
+            if(len < head) return;
+            write_out(head + (len - head) / LOG_SECTOR_LEN * LOG_SECTOR_LEN);
+        }
+
+        /**
+         * @brief Write the first \p n buffered bytes and keep the rest.
+         */
+        void write_out(size_t n){
+            if(file.write((const uint8_t*)buffer, n) != n){
+                Serial.printf("[ERROR] short write to \'%s\'\n", filename);
+            }
+            file_size += n;
+            memmove(buffer, buffer + n, len - n);
+            len -= n;
+        }
+};
+
+#endif
@@ -4,7 +4,7 @@
  * Defines the high-level wrapper for logging data on the Data Gator (DG). Currently
  * this consists of a single function `log_data` which takes the data strings to be
  * logged and logs them to all available logging destinations such as MQTT and the 
- * SD card. 
+ * SD card, see the sinks of log_pipeline.hpp.
  *
  * Data destinations are controlled by whether their 'is available' flag is set
  * to `true`. This flag is first set in the user configuration files but can be 
@@ -16,7 +16,49 @@
 #ifndef LOGGER_HPP
 #define LOGGER_HPP
 
-extern int reset_count;
+#include <log_pipeline.hpp>
+
+SemaphoreHandle_t log_mutex = NULL; //!< serializes logging from tasks running on both cores
+
+/**
+ * @brief Create the lock used by `log_lock()`, must be called before tasks are started.
+ */
+void log_lock_init(){
+    if(log_mutex == NULL) log_mutex = xSemaphoreCreateRecursiveMutex();
+}
+
+/**
+ * @brief Take the logging lock.
+ *
+ * Held while logging and while using the MQTT client, neither the client nor the
+ * SD logger may be used by two tasks at once.
+ */
+void log_lock(){
+    if(log_mutex != NULL) xSemaphoreTakeRecursive(log_mutex, portMAX_DELAY);
+}
+
+/**
+ * @brief Release the logging lock.
+ */
+void log_unlock(){
+    if(log_mutex != NULL) xSemaphoreGiveRecursive(log_mutex);
+}
+
+/**
+ * @brief MAC address of the gator, eg. "24:6F:28:0A:1B:2C", formatted once per boot.
+ *
+ * Readings carry it in their topic and message, unlike `WiFi.macAddress()` it does
+ * not allocate.
+ */
+const char* gator_mac(){
+    static char mac[18] = "";
+    if(mac[0] == '\0'){
+        uint8_t m[6];
+        WiFi.macAddress(m);
+        snprintf(mac, sizeof(mac), "%02X:%02X:%02X:%02X:%02X:%02X", m[0], m[1], m[2], m[3], m[4], m[5]);
+    }
+    return mac;
+}
 
 /**
  * Helper function that handles all data logging to MQTT and 
@@ -24,84 +66,37 @@ extern int reset_count;
  *
  * IF (there is a WiFi connection) -> log to MQTT broker
  *
- * IF (there is a SD card) -> log to SD card
+ * IF (there is a SD card) -> log to SD card, replayed later if the broker missed it, see backfill.hpp
+ *
+ * IF (neither the SD card nor the broker) -> queue in flash, see flash_queue.hpp
+ *
+ * Safe to call from tasks running concurrently. While the scheduler runs tasks
+ * the reading is copied to the log queue and delivered by the logging task, or
+ * dropped if the queue stays full, otherwise by the caller, see log_pipeline.hpp.
  *
- * @param[in] topic     The MQTT topic to log
- * @param[in] message   The message to log, likely JSON object
+ * Neither string is kept, readings built in a caller-owned buffer are logged
+ * without touching the heap.
+ *
+ * @param[in] topic     The MQTT topic to log, NUL terminated
+ * @param[in] message   The message to log, likely JSON object, NUL terminated
  */
-void log_data(std::string topic, std::string message){
-
-
-    bool wifi_connected = WiFi.status() == WL_CONNECTED;
-    
-    if(wifi_connected){
-        // log to MQTT 
-        MQTTMailer instance = MQTTMailer::getInstance();
-        instance.mailMessage(&mqtt_client, topic, message);
-        Serial.println("\t-> logging to MQTT");
-    }
-
-    // logging available set when initializing SDLogger in 
-    //  setup
-    if(logging_available){
-        Serial.println("\t-> logging to SD card");
-
-        std::string time;
-
-        if(absolute_timestamp_available){
-            // use absolute time from NTP
-            time = tsp->get_timestamp();
-            log_to_sd_file(logger, time, topic, message);
-            logged_relative_data = false;
-
-        }else{
-            // use relative timestamp and offset
-            // calculate the offset to use
-            int log_offset = cache_retrieve_log_offset();
-            Serial.printf("[DEBUG] log offset:%i, reset_count:%i, tsp offset:%i\n", log_offset, reset_count, tsp->get_offset());
-
-            int new_offset;
-            // prevent reset_count wrap from breaking
-            // relative time keeping
-            if(log_offset > reset_count){
-                // offset has exceeded MAX_COUNT and wrapped 
-                // so make the new offset the old offset + net distance 
-                // between log_offset and reset_count
-                new_offset = tsp->get_offset() + (MAX_COUNT - log_offset) + reset_count;
-
-            }else{
-                // new offset is cached offset + distance between 
-                // current reset count and previous marker
-                new_offset = tsp->get_offset() + (reset_count - log_offset);
-
-            }
-
-            // parse the date and time from previous time stamp
-            //
-            std::string date = std::to_string(tsp->get_month()) + "-" + 
-                std::to_string(tsp->get_day()) + "-" + 
-                std::to_string(tsp->get_year());
-
-            std::string clock_time = std::to_string(tsp->get_hours()) + ":" + 
-                std::to_string(tsp->get_minutes()) + ":" + 
-                std::to_string(tsp->get_seconds());
-
-            std::string offset = std::to_string(new_offset);
-
-            time = tsb->get_date_time(date, clock_time, offset);
-            // save the timestamp with updated offset
-            time_stamp_to_cache = time;
-
-            log_to_sd_file(logger, time, topic, message);
-
-            logged_relative_data = true;
-        }
-
-        Serial.printf("[DEBUG] logging \'%s\' | \'%s\' | \'%s\'\n", time.c_str(), topic.c_str(), message.c_str());
+void log_data(const char* topic, const char* message){
+    // every record gets the current epoch, see epoch_clock.hpp
+    uint32_t now = epoch_now();
+    if(log_queue_push(now, topic, message)) return;
+
+    log_lock();
+    log_sinks_begin();
+    log_sinks_write(now, topic, message);
+    log_sinks_end();
+    log_unlock();
+}
 
-    }else{
-        Serial.println("[ERROR] no SD card connected when logging");
-    }
+/**
+ * @brief Log \p message to \p topic, see `log_data(const char*, const char*)`.
+ */
+void log_data(const std::string& topic, const std::string& message){
+    log_data(topic.c_str(), message.c_str());
 }
 
 #endif
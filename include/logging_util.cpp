@@ -15,57 +15,92 @@
  *  ### Key Functionality
  *  Key functionality includes functions for:
  *
- *  1. caching and retreiving data from NVS 
- *      * timestamps 
- *      * log offsets (calculated from # of resets)
- *  2. constructing file names for logging 
- *  3. logging to SD card file
+ *  1. constructing file names for logging 
+ *  2. logging to SD card file
+ *
+ *  Records are timestamped with the epoch clock kept across sleep, see
+ *  epoch_clock.hpp. They are buffered by the wake's log session and written when
+ *  it is closed before sleep, see log_session.hpp. The time string of a record is
+ *  kept in the wake's `LogContext` and only formatted again once the second
+ *  changes. Files are CSV, or the compact binary format of binlog.hpp with
+ *  `SD_LOG_BINARY`. CSV files of past days are compressed with `SD_LOG_COMPRESS`,
+ *  see log_archive.hpp.
  *
  * @author Garrett Wells
  * @file logging_util.cpp
  */
+#include <cstddef>
 #include <Preferences.h>
 #include <NTPClient.h>
 #include <TimeStamp.hpp>    // functions for formatting time stamps
 #include <SDLogger.hpp>     
 #include <SDReader.hpp>
+#include <epoch_clock.hpp>
+#include <log_session.hpp>
+#include <binlog.hpp>
+#include <flash_queue.hpp>
+#include <backfill.hpp>
+#include <log_archive.hpp>
+#include <log_retention.hpp>
 
 // interface to NVM access
 extern Preferences gator_prefs; //!< Reference to non-volatile-storage on ESP32
+
 bool logging_available = false; //!< is some logging interface available?
 /**< Flag showing that some logging interface is available. May be uSD card or MQTT. */
-bool absolute_timestamp_available = false; //!< is an exact/accurate timestamp available?
-/**< Flag set during initialization, indicates that WiFi connection to NTP for update was obtained. */
-bool logged_relative_data = false; //!< relatively accurate timestamp used, last exact timestamp + # of minutes/resets elapsed         
-/**< Flag set to indicate that no network connection was available for NTP update to get precise timestamp. */
-
-std::string time_stamp_to_cache = ""; //!< the formatted timestamp to write to non-volatile memory for next reset
-/**< 
- * The timestamp, last exact timestamp + offset to write to non-volatile storage. 
- * This timestamp will be retrieved on next reset and replaced if network connection to NTP available. If NTP not
- * available, then the offset is incremented.
- * */
+bool log_binary = SD_LOG_BINARY; //!< log files use the binary format, see binlog.hpp
+bool log_compress = SD_LOG_COMPRESS; //!< CSV files of past days are compressed, see log_archive.hpp
+uint32_t log_retention_bytes = SD_RETENTION_MB * 1048576UL; //!< most bytes of log files kept, see log_retention.hpp
+uint32_t log_retention_days = SD_RETENTION_DAYS; //!< most days of log files kept, see log_retention.hpp
 
 // SDLogger 
-SDLogger* logger = NULL;        //!< reads and writes to files
+SDLogger* logger = NULL;        //!< initializes the uSD card
+LogSession log_session;         //!< writes this wake's records to the log file
+
+/**
+ * @brief Logging state of one wake, reset by `init_data_logger()`.
+ *
+ * Readings of a wake are logged within a few seconds of each other, so most
+ * records reuse the time string of the one before.
+ */
+struct LogContext{
+    uint32_t epoch = 0;     //!< second `time` was formatted for
+    char time[80] = "";     //!< `TimeStamp` string of `epoch`, empty until the first record
+
+    /**
+     * @brief Format the time of a record logged at \p now, if not already done for that second.
+     */
+    void stamp(uint32_t now){
+        if(time[0] != '\0' && now == epoch) return;
+        time_t t = now;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        snprintf(time, sizeof(time), "%d-%d-%dT%d:%d:%d+0", tm.tm_mon + 1, tm.tm_mday, tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        epoch = now;
+    }
+};
+
+LogContext log_context;         //!< time of this wake's records
 // TimeStamp
 TimeStampBuilder* tsb = NULL;   //!< builds timestamp strings
-TimeStampParser* tsp = NULL;    //!< parses timestamp strings
 
 // uSD Utilities
 //bool is_sd_attached(void);                      // check if there is an sd card connected
 
-// TimeStamp Utilities
-std::string cache_retrieve_timestamp();         // return the last timestamp as a string
-void cache_timestamp(std::string timestamp);    // save the current timestamp to NVM
-                                                //
 // Logging Utilities
 bool init_data_logger();                        // perform all initialization that MUST happen before logging
-std::string get_log_filename(TimeStampParser*);                 // build the log filename from timestamp
+void close_data_logger();                       // write out everything logged this wake
+std::string get_log_filename(time_t epoch);     // build the log filename from the epoch
 void log_to_sd_file(std::string filename, 
         std::string time, 
         std::string topic, 
         std::string message); // log an mqtt message to the sd card
+void log_to_sd_file(std::string time,
+        std::string topic,
+        std::string message); // log an mqtt message to the current log file
+void log_record(uint32_t epoch,
+        const char* topic,
+        const char* message); // log an mqtt message at epoch in the wake's format
 
 /**
  * @brief Initialize logging interfaces.
@@ -79,168 +114,89 @@ void log_to_sd_file(std::string filename,
  */
 bool init_data_logger(){
     Serial.println("[DEBUG] initializing new SDLogger");
-    // initialize SDLogger
-    logger = new SDLogger();
+    // initialize SDLogger, once per boot
+    if(logger == NULL) logger = new SDLogger();
 
     // check if the uSD card is connected
     if(!logger->initialize_sd_card()){
         return false;
     }     
 
-    // retrieve latest timestamp
-    std::string ts = cache_retrieve_timestamp();
     std::string fn = "";
-    Serial.printf("[DEBUG] retrieved cached timestamp -> \'%s\'\n", ts.c_str());
-    if(ts != "" && !absolute_timestamp_available){
-        // 1. there was a cached timestamp
-        // 2. no absolute timestamp from NTP available
-        // therefore,
-        //  use cached timestamp
-        tsp = new TimeStampParser(ts);
-        // generate log filename
-        fn = get_log_filename(tsp);
-
-    }else if(absolute_timestamp_available){
-        // use absolute timestamp to initialize
-        tsp = new TimeStampParser(tsb->get_date_time());
-        Serial.printf("[DEBUG] using absolute timestamp -> \'%s\'\n", tsp->get_timestamp().c_str());
-        fn = get_log_filename(tsp);
+    if(epoch_known){
+        // one file per day
+        fn = get_log_filename(epoch_now());
 
     }else{
-        // 1. no cached timestamp
-        // 2. no absolute timestamp
-        // therefore,
-        //  set to default log file name
+        // the clock was never set, time counts from the first boot
+        //  so use the default log file name
         fn = "/log";
-        // set timestamp to default value
-        tsp = new TimeStampParser("00-00-00T00:00:00+0");
-        Serial.printf("[DEBUG] using default timestamp -> \'%s\'\n", tsp->get_timestamp().c_str());
+        Serial.println("[DEBUG] epoch unknown, using default log file");
     }
 
     // ready to rock!
-    logger->set_filename(fn + ".csv");
+    log_context = LogContext();
+    if(log_binary){
+        struct binlog_file_header header = binlog_header();
+        log_session.begin(fn + ".bin", &header, sizeof(header));
+        binlog_begin();
+    }else{
+        logger->set_filename(fn + ".csv");
+        log_session.begin(fn + ".csv");
+    }
 
     return true;
 }
 
 /**
- * Generate a file name based on the current time stamp. Should only be 
- *  called if TimeStampBuilder has been updated.
- *
- *  @param[in] tsp TimeStampParser which defines parser for reading the current time stamp from a string.
- *
- *  @returns a constructed filename `log_<month>-<day>-<year>`
- */
-std::string get_log_filename(TimeStampParser* tsp){
-    if(tsp == NULL) return "";
-
-    std::string filename = "/log_" + std::to_string(tsp->get_month()) + 
-        "-" + std::to_string(tsp->get_day()) + 
-        "-" + std::to_string(tsp->get_year());
-
-    return filename;
-}
-
-/**
- * Cache/update the last known absolute timestamp from the NTPClient
- *  to non-volatile memory
- *
- *  @param[in] timestamp A timestamp string following the syntax of TimeStampBuilder
- */
-void cache_timestamp(std::string timestamp){
-    // cache string 
-    gator_prefs.putString("timestamp", timestamp.c_str());
-}
-
-/**
- * Save the reset count.
+ * @brief Write out the records logged this wake and close the log file.
  *
- * @param[in] log_offset The offset in ticks.
+ * Must be called before the uSD card is powered down.
  */
-void cache_log_offset(int log_offset){
-    gator_prefs.putInt("log_offset", log_offset);
+void close_data_logger(){
+    if(log_binary) binlog_close();
+    log_session.close();
 }
 
 /**
- * Retrieve time stamp from non-volatile memory
- *  so that it can be used for log file access.
+ * Generate a file name for the day of \p epoch.
  *
- *  @return The string value stored in non-volatile memory,
- *                              should be expected to be of format produced by 
- *                              TimeStampBuilder
+ *  @param[in] epoch Seconds since 1970.
  *
+ *  @returns a constructed filename `/<year>-<month>/log_<month>-<day>-<year>`, see `log_day_path()`
  */
-std::string cache_retrieve_timestamp(){
-    if(!gator_prefs.isKey("timestamp")){
-        // return empty string, because it doesn't
-        //  exist 
-        Serial.println("[WARNING] key \'timestamp\' doesn't exist");
-        gator_prefs.putString("timestamp",  "00-00-00T00:00:00+0");
-        return "";
-    }
-
-    return gator_prefs.getString("timestamp", "").c_str();
+std::string get_log_filename(time_t epoch){
+    return log_day_path(epoch);
 }
 
-/**
- * Retrieves the reset count.
- *
- * @return Number of resets/times the device as booted.
- */
-int cache_retrieve_log_offset(void){
-    if(!gator_prefs.isKey("log_offset")){
-        Serial.println("[WARNING] key \'log_offset\' doesn't exist");
-        gator_prefs.putInt("log_offset", 0);
-        return 0;
-    }
-
-    return gator_prefs.getInt("log_offset", 0);
-}
-
-
 /**
  * Write an MQTT message to a file on the SD card. Requires a time stamp and filename.
  *
+ * The current log session is closed and a new one started if \p filename is
+ * a different file.
+ *
  * @param [in] filename The string file name to log the topic and message to.
  * @param [in] time string time, formatted according to TimeStampBuilder.
  * @param [in] topic The topic, according to MQTT format.
  * @param [in] message The message which contains data. Often JSON object.
  */
 void log_to_sd_file(std::string filename, std::string time, std::string topic, std::string message){
-    std::string log_fn = filename;
-    if(DEBUG){
-        Serial.printf("[SDLogger] logging to \'%s\n\'", log_fn);
-    }
-
-    logger = new SDLogger(log_fn);
-    
-    // Write headers if file doesn't already exist
-    if(!logger->exists(filename)){
-
-        std::vector<std::string> header_fields;
-        header_fields.push_back("TIME");
-        header_fields.push_back("MQTT TOPIC");
-        header_fields.push_back("MQTT MESSAGE");
-
-        logger->write_header(header_fields);
-
+    if(filename != log_session.get_filename()){
+        if(DEBUG){
+            Serial.printf("[SDLogger] logging to \'%s\'\n", filename.c_str());
+        }
+        log_session.close();
+        log_session.begin(filename);
     }
 
-    // generate timestamp
-    std::string ts = tsb->get_date_time();
-
-    // log as absolute, trust user to have 
-    //  generated the timestamp they wanted
-    logger->log_absolute_mqtt(time, topic, message);
-
-    //logger->close_card();
+    log_to_sd_file(time, topic, message);
 }
 
 /**
- * Write an MQTT message to a file on the SD card. Requires a time stamp and filename.
+ * Write an MQTT message to the log file picked by `init_data_logger()`.
  *
- * @param[in] l The SDLogger instance with all filename and separator
- *                  information pre-set
+ * The record is buffered by the log session and written to the card in whole
+ * sectors or when the session is closed before sleep.
  *
  * @param[in] time The time hr:min:sec+offset that will be written to the 
  *                  log file
@@ -250,24 +206,29 @@ void log_to_sd_file(std::string filename, std::string time, std::string topic, s
  * @param[in] message  The mqtt message containing the data we want to save
  *
  */
-void log_to_sd_file(SDLogger* l, std::string time, std::string topic, std::string message){
-    /*
-    if(DEBUG){
-        Serial.printf("[SDLogger] logging to \'%s\n\'", log_fn);
-    }
-    */
-
-    if(!l->exists()){
-        std::vector<std::string> header_fields;
-        header_fields.push_back("TIME");
-        header_fields.push_back("MQTT TOPIC");
-        header_fields.push_back("MQTT MESSAGE");
-
-        l->write_header(header_fields);
-
-    }
-
+void log_to_sd_file(std::string time, std::string topic, std::string message){
     // log as absolute, trust user to have 
     //  generated the timestamp they wanted
-    l->log_absolute_mqtt(time, topic, message);
+    log_session.log(time, topic, message);
+}
+
+/**
+ * Append a record taken at \p epoch to the log file picked by `init_data_logger()`.
+ *
+ * CSV records share the time string of the wake's `LogContext`, binary records
+ * only store the epoch, see binlog.hpp. Nothing is allocated.
+ *
+ * @param[in] epoch Time of the record.
+ *
+ * @param[in] topic  The mqtt topic the data should have been logged to
+ *
+ * @param[in] message  The mqtt message containing the data we want to save
+ */
+void log_record(uint32_t epoch, const char* topic, const char* message){
+    if(log_binary){
+        binlog_log(epoch, topic, message);
+        return;
+    }
+    log_context.stamp(epoch);
+    log_session.log(log_context.time, topic, message, epoch);
 }
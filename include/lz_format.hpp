@@ -0,0 +1,319 @@
+/**
+ * @file lz_format.hpp
+ * @brief LZ77 compression of CSV log files and bulk uploads.
+ *
+ * CSV log rows repeat the same topics, JSON keys and MAC addresses over and over.
+ * This is a small window LZSS coder in the spirit of heatshrink: the encoder needs
+ * about 10 KB of RAM while it runs, the decoder one chunk, and both only look back
+ * `1 << LZ_WINDOW_BITS` bytes.
+ *
+ * ### Layout
+ * All integers are little endian.
+ *
+ *  1. file header, `lz_file_header`
+ *  2. chunks, each a `lz_chunk_header` followed by `packed_len` bytes. A chunk holds
+ *     at most `LZ_CHUNK_LEN` bytes of input and never refers to an earlier chunk,
+ *     so a reader can start at any chunk. The CRC covers the decoded bytes.
+ *
+ * The bits of a chunk are read most significant first:
+ *
+ *  * `1` and 8 bits: one literal byte.
+ *  * `0`, `LZ_WINDOW_BITS` bits of distance - 1 and `LZ_LENGTH_BITS` bits of
+ *    length - `LZ_MIN_MATCH`: copy bytes already decoded.
+ *
+ * Chunks that do not get smaller are stored as they are with `LZ_CHUNK_STORED`.
+ *
+ * This header has no Arduino dependencies and is shared by the firmware
+ * (log_archive.hpp, log_reader.hpp) and the host decoder (tools/lzcat).
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef LZ_FORMAT_HPP
+#define LZ_FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <binlog_format.hpp>
+
+/** File format version written to the file header. */
+#define LZ_VERSION 1
+/** Bits of a match distance, the window is `1 << LZ_WINDOW_BITS` bytes. */
+#define LZ_WINDOW_BITS 11
+/** Bits of a match length. */
+#define LZ_LENGTH_BITS 5
+/** Shortest match, shorter repeats are cheaper as literals. */
+#define LZ_MIN_MATCH 3
+/** Longest match. */
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + (1 << LZ_LENGTH_BITS) - 1)
+/** Most input bytes in one chunk. */
+#define LZ_CHUNK_LEN 4096
+/** Largest chunk body, every byte a literal. */
+#define LZ_PACKED_LEN (LZ_CHUNK_LEN + LZ_CHUNK_LEN / 8 + 1)
+/** Bits of the match finder's hash of three bytes. */
+#define LZ_HASH_BITS 10
+/** Most earlier positions compared when looking for a match. */
+#define LZ_MAX_CHAIN 32
+/** First two bytes of every chunk. */
+#define LZ_CHUNK_MAGIC 0xC71A
+/** Chunk flag, the body is the input as it is. */
+#define LZ_CHUNK_STORED 0x01
+
+/**
+ * @brief First bytes of a compressed file.
+ */
+struct lz_file_header{
+    char magic[4];          //!< "DGLZ"
+    uint8_t version;        //!< `LZ_VERSION`
+    uint8_t window_bits;    //!< `LZ_WINDOW_BITS`
+    uint8_t length_bits;    //!< `LZ_LENGTH_BITS`
+    uint8_t reserved;
+};
+
+/**
+ * @brief Header of each chunk.
+ */
+struct lz_chunk_header{
+    uint16_t magic;         //!< `LZ_CHUNK_MAGIC`
+    uint16_t flags;         //!< `LZ_CHUNK_STORED`
+    uint16_t raw_len;       //!< bytes decoded from the chunk
+    uint16_t packed_len;    //!< bytes of the body
+    uint32_t crc;           //!< `binlog_crc32()` of the decoded bytes
+};
+
+/** Largest chunk, header and body. */
+#define LZ_CHUNK_MAX (sizeof(struct lz_chunk_header) + LZ_PACKED_LEN)
+
+/**
+ * @brief Header written to new compressed files.
+ */
+inline struct lz_file_header lz_header(){
+    struct lz_file_header h;
+    memcpy(h.magic, "DGLZ", 4);
+    h.version = LZ_VERSION;
+    h.window_bits = LZ_WINDOW_BITS;
+    h.length_bits = LZ_LENGTH_BITS;
+    h.reserved = 0;
+    return h;
+}
+
+/**
+ * @brief Compresses chunks, reusable for any number of them.
+ *
+ * Matches are found through hash chains of the positions of the chunk, at most
+ * `LZ_MAX_CHAIN` deep. Allocate it on the heap, it is about 10 KB.
+ */
+class LzEncoder {
+    public:
+        /**
+         * @brief Compress \p n bytes into one chunk.
+         *
+         * @param[in] in The input, at most `LZ_CHUNK_LEN` bytes.
+         * @param[in] n Length of \p in.
+         * @param[out] out Receives the chunk header and body, `LZ_CHUNK_MAX` bytes.
+         *
+         * @returns bytes written to \p out
+         */
+        size_t chunk(const uint8_t* in, size_t n, uint8_t* out){
+            if(n > LZ_CHUNK_LEN) n = LZ_CHUNK_LEN;
+            struct lz_chunk_header h;
+            h.magic = LZ_CHUNK_MAGIC;
+            h.flags = 0;
+            h.raw_len = n;
+            h.crc = binlog_crc32(in, n);
+
+            uint8_t* body = out + sizeof(h);
+            size_t len = encode(in, n, body);
+            if(len >= n){
+                memcpy(body, in, n);
+                len = n;
+                h.flags = LZ_CHUNK_STORED;
+            }
+            h.packed_len = len;
+            memcpy(out, &h, sizeof(h));
+            return sizeof(h) + len;
+        }
+
+    private:
+        uint16_t head[1 << LZ_HASH_BITS];   //!< last position of each hash
+        uint16_t prev[LZ_CHUNK_LEN];        //!< position before with the same hash
+        uint8_t* bits_out;
+        size_t bits_len;                    //!< whole bytes written
+        uint32_t bits;                      //!< bits not yet written
+        int bits_count;
+
+        static uint32_t hash(const uint8_t* p){
+            uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+            return (uint32_t)(v * 2654435761UL) >> (32 - LZ_HASH_BITS);
+        }
+
+        void insert(const uint8_t* in, size_t pos, size_t n){
+            if(pos + LZ_MIN_MATCH > n) return;
+            uint32_t h = hash(in + pos);
+            prev[pos] = head[h];
+            head[h] = pos;
+        }
+
+        void put(uint32_t value, int count){
+            bits = (bits << count) | (value & ((1UL << count) - 1));
+            bits_count += count;
+            while(bits_count >= 8){
+                bits_count -= 8;
+                bits_out[bits_len++] = bits >> bits_count;
+            }
+        }
+
+        size_t encode(const uint8_t* in, size_t n, uint8_t* out){
+            memset(head, 0xFF, sizeof(head));
+            bits_out = out;
+            bits_len = 0;
+            bits = 0;
+            bits_count = 0;
+
+            size_t pos = 0;
+            while(pos < n){
+                // longest match in the window
+                size_t best = 0, distance = 0;
+                if(pos + LZ_MIN_MATCH <= n){
+                    size_t most = n - pos < LZ_MAX_MATCH ? n - pos : LZ_MAX_MATCH;
+                    uint16_t p = head[hash(in + pos)];
+                    for(int chain = 0; p != 0xFFFF && chain < LZ_MAX_CHAIN && pos - p <= (1U << LZ_WINDOW_BITS); chain++){
+                        size_t len = 0;
+                        while(len < most && in[p + len] == in[pos + len]) len++;
+                        if(len > best){
+                            best = len;
+                            distance = pos - p;
+                            if(len == most) break;
+                        }
+                        p = prev[p];
+                    }
+                }
+
+                if(best >= LZ_MIN_MATCH){
+                    put(0, 1);
+                    put(distance - 1, LZ_WINDOW_BITS);
+                    put(best - LZ_MIN_MATCH, LZ_LENGTH_BITS);
+                    for(size_t i = 0; i < best; i++) insert(in, pos + i, n);
+                    pos += best;
+                }else{
+                    put(1, 1);
+                    put(in[pos], 8);
+                    insert(in, pos, n);
+                    pos++;
+                }
+                if(bits_len >= n) return bits_len;   // no gain, stored instead
+            }
+            if(bits_count > 0) put(0, 8 - bits_count);
+            return bits_len;
+        }
+};
+
+/**
+ * @brief Decode the body of one chunk.
+ *
+ * @returns `false` if the body is damaged
+ */
+inline bool lz_decode(const struct lz_chunk_header& h, const uint8_t* body, uint8_t* out){
+    if(h.raw_len > LZ_CHUNK_LEN || h.packed_len > LZ_PACKED_LEN) return false;
+    if(h.flags & LZ_CHUNK_STORED){
+        if(h.packed_len != h.raw_len) return false;
+        memcpy(out, body, h.raw_len);
+    }else{
+        size_t bit = 0, end = (size_t)h.packed_len * 8, len = 0;
+        auto get = [&](int count) -> uint32_t {
+            uint32_t v = 0;
+            for(int i = 0; i < count; i++, bit++) v = (v << 1) | ((body[bit / 8] >> (7 - bit % 8)) & 1);
+            return v;
+        };
+        while(len < h.raw_len){
+            if(bit + 9 > end) return false;
+            if(get(1)){
+                out[len++] = get(8);
+                continue;
+            }
+            if(bit + LZ_WINDOW_BITS + LZ_LENGTH_BITS > end) return false;
+            size_t distance = get(LZ_WINDOW_BITS) + 1;
+            size_t count = get(LZ_LENGTH_BITS) + LZ_MIN_MATCH;
+            if(distance > len || len + count > h.raw_len) return false;
+            for(size_t i = 0; i < count; i++, len++) out[len] = out[len - distance];
+        }
+    }
+    return binlog_crc32(out, h.raw_len) == h.crc;
+}
+
+/**
+ * @brief Compress \p in into a complete stream, file header and chunks.
+ */
+inline void lz_compress(const std::string& in, std::string& out){
+    LzEncoder* encoder = new LzEncoder;
+    uint8_t* chunk = new uint8_t[LZ_CHUNK_MAX];
+    struct lz_file_header h = lz_header();
+    out.assign((const char*)&h, sizeof(h));
+    for(size_t pos = 0; pos < in.size(); pos += LZ_CHUNK_LEN){
+        size_t n = in.size() - pos < LZ_CHUNK_LEN ? in.size() - pos : LZ_CHUNK_LEN;
+        out.append((const char*)chunk, encoder->chunk((const uint8_t*)in.data() + pos, n, chunk));
+    }
+    delete[] chunk;
+    delete encoder;
+}
+
+/**
+ * @brief Reads the decoded bytes of a compressed stream.
+ *
+ * `Source` provides `size_t read(uint8_t*, size_t)`, eg. `fs::File` on the device
+ * or a `FILE*` wrapper on a host. A chunk is decoded whole, allocate the reader
+ * on the heap. Reading stops at a damaged chunk.
+ */
+template<class Source>
+class LzReader {
+    public:
+        uint32_t bad_chunks = 0;    //!< chunks which failed to decode
+
+        LzReader(Source& src): src(src){}
+
+        /**
+         * @brief Check the file header.
+         */
+        bool begin(){
+            struct lz_file_header h;
+            return src.read((uint8_t*)&h, sizeof(h)) == sizeof(h) && memcmp(h.magic, "DGLZ", 4) == 0 &&
+                h.version == LZ_VERSION && h.window_bits == LZ_WINDOW_BITS && h.length_bits == LZ_LENGTH_BITS;
+        }
+
+        /**
+         * @brief Read up to \p n decoded bytes, from the next chunk of the source on.
+         *
+         * @returns bytes read, 0 at the end of the stream
+         */
+        size_t read(uint8_t* buf, size_t n){
+            if(pos == len && !next_chunk()) return 0;
+            size_t copy = n < len - pos ? n : len - pos;
+            memcpy(buf, raw + pos, copy);
+            pos += copy;
+            return copy;
+        }
+
+    private:
+        Source& src;
+        uint8_t packed[LZ_PACKED_LEN];
+        uint8_t raw[LZ_CHUNK_LEN];
+        size_t pos = 0;
+        size_t len = 0;
+
+        bool next_chunk(){
+            pos = len = 0;
+            struct lz_chunk_header h;
+            if(src.read((uint8_t*)&h, sizeof(h)) != sizeof(h)) return false;
+            if(h.magic != LZ_CHUNK_MAGIC || h.packed_len > LZ_PACKED_LEN ||
+                src.read(packed, h.packed_len) != h.packed_len || !lz_decode(h, packed, raw)){
+                bad_chunks++;
+                return false;
+            }
+            len = h.raw_len;
+            return len > 0 || next_chunk();
+        }
+};
+
+#endif
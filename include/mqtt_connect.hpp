@@ -0,0 +1,150 @@
+/**
+ * @file mqtt_connect.hpp
+ * @brief Connects to the MQTT broker within a time budget per wake.
+ *
+ * Reconnecting used to loop until the broker answered, 5 seconds apart and as the
+ * fixed client ID "aggregator", which kept a battery powered gator awake until the
+ * watchdog reset it whenever the broker was down. Now every attempt connects the
+ * client as its own `dg_<MAC>` and `mqtt_reconnect()` never waits:
+ *
+ *  * after a failed attempt the next one is not made before a backoff of
+ *    `MQTT_BACKOFF_MS`, doubled after every failure up to `MQTT_BACKOFF_MAX_MS`, and
+ *    randomly shortened by up to half so gators that lost the broker together do
+ *    not all come back at once,
+ *  * once `MQTT_RECONNECT_MS` have passed since the first failure of the wake no
+ *    more attempts are made, the rest of the wake logs to the uSD card or flash and
+ *    readings are published later, see backfill.hpp and flash_queue.hpp,
+ *  * the TCP connect and the wait for the CONNACK time out with what is left of
+ *    the budget, not after the client's default 15 seconds.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef MQTT_CONNECT_HPP
+#define MQTT_CONNECT_HPP
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include <esp_system.h>
+
+extern WiFiClient wifi_client;
+extern PubSubClient mqtt_client;
+
+/** Backoff after the first failed attempt, in milliseconds. */
+#define MQTT_BACKOFF_MS 500
+/** Longest backoff between attempts, in milliseconds. */
+#define MQTT_BACKOFF_MAX_MS 8000
+/** Topic of the commands for all gators, see mqtt_util.hpp. */
+#define MQTT_CMD_TOPIC "datagator/cmd/#"
+
+/**
+ * @brief Reconnect attempts of this wake, reset by `mqtt_backoff_reset()`.
+ */
+struct mqtt_backoff{
+    int failures;               //!< failed attempts since the last connection
+    unsigned long first_ms;     //!< `millis()` when the first of them started
+    unsigned long next_ms;      //!< `millis()` before which no attempt is made
+    bool given_up;              //!< budget spent, no attempts until the next wake
+    int connections;            //!< successful connects this wake
+};
+
+struct mqtt_backoff mqtt_backoff = {0, 0, 0, false, 0};
+
+/**
+ * @brief Client ID of the gator, eg. "dg_24:6F:28:0A:1B:2C".
+ *
+ * The broker keeps the session and subscriptions of each ID, a shared ID would
+ * disconnect the other gators using it.
+ */
+const char* mqtt_client_id(){
+    static char id[24] = "";
+    if(id[0] == '\0'){
+        uint8_t m[6];
+        WiFi.macAddress(m);
+        snprintf(id, sizeof(id), "dg_%02X:%02X:%02X:%02X:%02X:%02X", m[0], m[1], m[2], m[3], m[4], m[5]);
+    }
+    return id;
+}
+
+/**
+ * @brief Start counting attempts and time for a new wake.
+ */
+void mqtt_backoff_reset(){
+    memset(&mqtt_backoff, 0, sizeof(mqtt_backoff));
+}
+
+/**
+ * @brief Stop reconnecting for the rest of the wake.
+ *
+ * @param spent milliseconds since the first failed attempt
+ */
+void mqtt_give_up(unsigned long spent){
+    Serial.printf("[ERROR] broker unreachable for %lu ms, logging locally until the next wake\n", spent);
+    mqtt_backoff.given_up = true;
+}
+
+/**
+ * @brief Connect to the broker once as a persistent client and subscribe to the commands.
+ *
+ * @returns `true` if connected
+ */
+bool mqtt_connect(){
+    if(!mqtt_client.connect(mqtt_client_id(), NULL, NULL, NULL, 0, false, NULL, false)){
+        if(DEBUG) Serial.printf("[WARNING] error with MQTT connection, rc = %d\n", mqtt_client.state());
+        return false;
+    }
+    if(DEBUG) Serial.printf("Subscribing to %s\n", MQTT_CMD_TOPIC);
+    mqtt_client.subscribe(MQTT_CMD_TOPIC, 1);
+    return true;
+}
+
+/**
+ * @brief Make sure the client is connected, without waiting.
+ *
+ * Makes an attempt only if WiFi is up, the backoff after the last failure is over
+ * and the wake's budget is not spent.
+ *
+ * @returns `true` if the client is connected
+ */
+bool mqtt_reconnect(){
+    if(mqtt_client.connected()) return true;
+    if(WiFi.status() != WL_CONNECTED || mqtt_backoff.given_up) return false;
+
+    unsigned long started = millis();
+    if(mqtt_backoff.failures > 0 && (long)(started - mqtt_backoff.next_ms) < 0) return false;
+
+    // the timeouts are whole seconds, an attempt with less left would overrun the budget
+    unsigned long left = MQTT_RECONNECT_MS;
+    if(mqtt_backoff.failures > 0) left = started - mqtt_backoff.first_ms < left ? left - (started - mqtt_backoff.first_ms) : 0;
+    if(left < 1000){
+        mqtt_give_up(started - mqtt_backoff.first_ms);
+        return false;
+    }
+    wifi_client.setTimeout(left / 1000);
+    mqtt_client.setSocketTimeout(left / 1000);
+
+    if(mqtt_connect()){
+        if(DEBUG) Serial.println("connected to MQTT client!");
+        mqtt_backoff.failures = 0;
+        mqtt_backoff.connections++;
+        return true;
+    }
+
+    unsigned long now = millis();
+    if(mqtt_backoff.failures++ == 0) mqtt_backoff.first_ms = started;
+    if(now - mqtt_backoff.first_ms >= MQTT_RECONNECT_MS){
+        mqtt_give_up(now - mqtt_backoff.first_ms);
+        return false;
+    }
+
+    unsigned long backoff = MQTT_BACKOFF_MAX_MS;
+    if(mqtt_backoff.failures <= 5) backoff = (unsigned long)MQTT_BACKOFF_MS << (mqtt_backoff.failures - 1);
+    if(backoff > MQTT_BACKOFF_MAX_MS) backoff = MQTT_BACKOFF_MAX_MS;
+    backoff -= esp_random() % (backoff / 2 + 1);
+    mqtt_backoff.next_ms = now + backoff;
+    if(DEBUG) Serial.printf("[DEBUG] next MQTT attempt in %lu ms\n", backoff);
+    return false;
+}
+
+#endif
@@ -0,0 +1,338 @@
+/**
+ * @file mqtt_qos1.hpp
+ * @brief Publishes readings at QoS 1 with several acknowledgements outstanding.
+ *
+ * PubSubClient only publishes at QoS 0, a reading the TCP stack accepted counted as
+ * delivered even if the connection dropped before the broker got it. With
+ * `MQTT_INFLIGHT` the MQTT sink writes the PUBLISH packets of readings with QoS 1
+ * itself, on the connection of the client, and keeps each one until the PUBACK
+ * for its packet ID arrives:
+ *
+ *  * up to `mqtt_inflight` packets are unacknowledged at once, a publish only waits
+ *    for the broker when the window is full, at most `MQTT_ACK_TIMEOUT_MS`,
+ *  * the window is kept in RTC memory, packets still unacknowledged at the end of
+ *    a wake are sent again with the DUP flag and the same packet IDs after the next
+ *    connect, as MQTT 3.1.1 asks of a client with a persistent session,
+ *  * once a wait times out no more readings are published at QoS 1 this wake, they
+ *    go to the uSD card or the flash queue and are published later.
+ *
+ * PubSubClient reads the connection through `MqttAckFilter`, which takes the PUBACKs
+ * out of the stream and hands every other packet, eg. commands and PINGRESP, on to
+ * the client. `mqtt_qos1_poll()` waits for acknowledgements by running
+ * `PubSubClient::loop()`, so commands which arrive meanwhile are handled there.
+ *
+ * Readings longer than `MQTT_INFLIGHT_LEN`, eg. telemetry, are published at QoS 0,
+ * so are the ones published by the backfill, the flash queue and commands.
+ *
+ * Off by default, `MQTT_INFLIGHT` is 0, until it has been tested against a real
+ * broker. Packets are only delivered again if the broker kept the session of the
+ * client, the CONNACK's session present flag is not checked.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef MQTT_QOS1_HPP
+#define MQTT_QOS1_HPP
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include <cstddef>
+#include <cstring>
+#include <rtc_state.hpp>
+#include <mqtt_connect.hpp>
+#include <mqtt_stream.hpp>
+
+extern PubSubClient mqtt_client;
+
+/** Most unacknowledged packets kept, the upper limit of `MQTT_INFLIGHT`, each takes `MQTT_INFLIGHT_LEN` bytes of RTC memory. */
+#define MQTT_INFLIGHT_MAX 4
+/** Bytes of `<topic>\0<message>` kept per unacknowledged packet, enough for the sensor readings. */
+#define MQTT_INFLIGHT_LEN 256
+/** Bytes of the packets other than PUBACK read ahead by `MqttAckFilter`. */
+#define MQTT_ACK_FILTER_LEN 16
+/** Longest wait in milliseconds for an acknowledgement, or the rest of a packet. */
+#define MQTT_ACK_TIMEOUT_MS 2000
+
+/**
+ * @brief A packet waiting for its PUBACK.
+ */
+struct mqtt_inflight_slot{
+    uint16_t id;        //!< packet ID, 0 if the slot is free
+    uint16_t len;       //!< bytes of `<topic>\0<message>` in `data`
+    char data[MQTT_INFLIGHT_LEN];
+};
+
+/**
+ * @brief Unacknowledged packets, kept in RTC memory.
+ */
+struct rtc_mqtt_inflight{
+    /** packet ID of the next publish */
+    uint16_t next_id;
+    /** slots in use */
+    uint16_t used;
+    struct mqtt_inflight_slot slots[MQTT_INFLIGHT_MAX];
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct rtc_mqtt_inflight rtc_mqtt_inflight;
+
+uint8_t mqtt_inflight = MQTT_INFLIGHT;  //!< packets unacknowledged at once, 0 publishes at QoS 0
+bool mqtt_qos1_stalled = false;         //!< an acknowledgement timed out this wake
+int mqtt_qos1_resent_on = 0;            //!< `mqtt_backoff.connections` the window was last sent again on
+uint8_t mqtt_qos1_packet[MQTT_INFLIGHT_LEN + 8];    //!< packet being written
+
+/**
+ * @brief Update the checksum after changing the window.
+ */
+void mqtt_qos1_seal(){
+    rtc_mqtt_inflight.checksum = rtc_checksum(&rtc_mqtt_inflight, offsetof(struct rtc_mqtt_inflight, checksum));
+}
+
+/** @brief Packets waiting for their acknowledgement. */
+uint16_t mqtt_qos1_pending(){ return rtc_mqtt_inflight.used; }
+
+/**
+ * @brief Check the window kept in RTC memory, once per wake before connecting.
+ */
+void mqtt_qos1_begin(){
+    mqtt_qos1_stalled = false;
+    mqtt_qos1_resent_on = 0;
+    if(rtc_mqtt_inflight.checksum == rtc_checksum(&rtc_mqtt_inflight, offsetof(struct rtc_mqtt_inflight, checksum))){
+        if(DEBUG && rtc_mqtt_inflight.used > 0) Serial.printf("[MQTT] %u packets unacknowledged\n", rtc_mqtt_inflight.used);
+        return;
+    }
+    memset(&rtc_mqtt_inflight, 0, sizeof(rtc_mqtt_inflight));
+    rtc_mqtt_inflight.next_id = 1;
+    mqtt_qos1_seal();
+}
+
+/**
+ * @brief Free the slot of packet \p id.
+ */
+void mqtt_qos1_ack(uint16_t id){
+    for(int i = 0; i < MQTT_INFLIGHT_MAX; i++){
+        struct mqtt_inflight_slot& s = rtc_mqtt_inflight.slots[i];
+        if(s.id != id || id == 0) continue;
+        s.id = 0;
+        rtc_mqtt_inflight.used--;
+        mqtt_qos1_seal();
+        return;
+    }
+}
+
+/**
+ * @brief Connection of the MQTT client which takes out the PUBACKs of QoS 1 publishes.
+ *
+ * PubSubClient only knows QoS 0 and drops any PUBACK it reads. The client reads the
+ * connection through this instead, which follows the packets in the stream: PUBACKs
+ * are passed to `mqtt_qos1_ack()`, the bytes of every other packet are read ahead,
+ * at most `MQTT_ACK_FILTER_LEN` at a time, and handed on unchanged.
+ */
+class MqttAckFilter: public Client {
+    public:
+        MqttAckFilter(Client& client): client(&client){}
+
+        int connect(IPAddress ip, uint16_t port){
+            reset();
+            return client->connect(ip, port);
+        }
+        int connect(const char* host, uint16_t port){
+            reset();
+            return client->connect(host, port);
+        }
+        size_t write(uint8_t b){ return client->write(b); }
+        size_t write(const uint8_t* buf, size_t size){ return client->write(buf, size); }
+
+        int available(){
+            pump();
+            return held;
+        }
+        int read(){
+            pump();
+            if(held == 0) return -1;
+            uint8_t b = ahead[first];
+            first = (first + 1) % MQTT_ACK_FILTER_LEN;
+            held--;
+            return b;
+        }
+        int read(uint8_t* buf, size_t size){
+            size_t n = 0;
+            for(int b; n < size && (b = read()) >= 0; n++) buf[n] = b;
+            return n > 0 ? (int)n : -1;
+        }
+        int peek(){
+            pump();
+            return held > 0 ? ahead[first] : -1;
+        }
+        void flush(){ client->flush(); }
+        void stop(){
+            reset();
+            client->stop();
+        }
+        uint8_t connected(){ return held > 0 || client->connected(); }
+        operator bool(){ return connected(); }
+
+    private:
+        Client* client;
+        uint8_t ahead[MQTT_ACK_FILTER_LEN];     //!< bytes read ahead for the client
+        int first = 0;          //!< index of the oldest byte in `ahead`
+        int held = 0;           //!< bytes in `ahead`
+        int stage = 0;          //!< next byte of a packet: 0 type, 1 remaining length, 2 payload
+        bool ack = false;       //!< the packet is a PUBACK
+        uint32_t remaining = 0; //!< bytes left of the packet, once its length is read
+        int shift = 0;          //!< of the next remaining length byte
+        uint16_t id = 0;        //!< packet ID of a PUBACK
+
+        void reset(){
+            held = first = stage = shift = 0;
+            remaining = 0;
+        }
+
+        /** @brief Read ahead until `ahead` is full or the connection has nothing more. */
+        void pump(){
+            while(held < MQTT_ACK_FILTER_LEN && client->available() > 0){
+                int b = client->read();
+                if(b < 0) return;
+                if(stage == 0){
+                    ack = (b & 0xF0) == 0x40;
+                    remaining = 0;
+                    shift = 0;
+                    id = 0;
+                    stage = 1;
+                }else if(stage == 1){
+                    remaining |= (uint32_t)(b & 0x7F) << shift;
+                    shift += 7;
+                    if(!(b & 0x80)) stage = remaining > 0 ? 2 : 0;
+                }else{
+                    if(ack) id = (id << 8) | b;
+                    if(--remaining == 0){
+                        stage = 0;
+                        if(ack) mqtt_qos1_ack(id);
+                    }
+                }
+                if(!ack){
+                    ahead[(first + held) % MQTT_ACK_FILTER_LEN] = b;
+                    held++;
+                }
+            }
+        }
+};
+
+extern MqttAckFilter mqtt_ack_filter;
+
+/**
+ * @brief Write the PUBLISH packet of \p s, with the DUP flag if \p dup.
+ *
+ * @returns `true` if the connection took all of it
+ */
+bool mqtt_qos1_send(const struct mqtt_inflight_slot& s, bool dup){
+    size_t tlen = strlen(s.data);
+    size_t mlen = s.len - tlen - 1;
+    size_t remaining = 2 + tlen + 2 + mlen;
+
+    uint8_t* p = mqtt_qos1_packet;
+    *p++ = 0x32 | (dup ? 0x08 : 0x00);     // PUBLISH, QoS 1
+    do{
+        uint8_t b = remaining % 128;
+        remaining /= 128;
+        *p++ = remaining > 0 ? b | 0x80 : b;
+    }while(remaining > 0);
+    *p++ = tlen >> 8;
+    *p++ = tlen & 0xFF;
+    memcpy(p, s.data, tlen);
+    p += tlen;
+    *p++ = s.id >> 8;
+    *p++ = s.id & 0xFF;
+    memcpy(p, s.data + tlen + 1, mlen);
+    p += mlen;
+
+    size_t n = p - mqtt_qos1_packet;
+    return mqtt_ack_filter.write(mqtt_qos1_packet, n) == n;
+}
+
+/**
+ * @brief Run the client until at most \p most packets are unacknowledged or \p wait_ms passed.
+ *
+ * Acknowledgements are taken out of the stream by `MqttAckFilter`, other packets are
+ * handled by `PubSubClient::loop()` as usual.
+ *
+ * @returns packets still unacknowledged
+ */
+uint16_t mqtt_qos1_poll(uint16_t most, unsigned long wait_ms){
+    unsigned long start = millis();
+    while(rtc_mqtt_inflight.used > most && mqtt_client.connected() && millis() - start < wait_ms){
+        if(mqtt_ack_filter.available() > 0) mqtt_client.loop();
+        else delay(1);
+    }
+    return rtc_mqtt_inflight.used;
+}
+
+/**
+ * @brief Send the packets unacknowledged before again, once per connection.
+ */
+void mqtt_qos1_resend(){
+    if(mqtt_qos1_resent_on == mqtt_backoff.connections || !mqtt_client.connected()) return;
+    mqtt_qos1_resent_on = mqtt_backoff.connections;
+    for(int i = 0; i < MQTT_INFLIGHT_MAX; i++){
+        const struct mqtt_inflight_slot& s = rtc_mqtt_inflight.slots[i];
+        if(s.id == 0) continue;
+        if(DEBUG) Serial.printf("[MQTT] resending packet %u\n", s.id);
+        if(!mqtt_qos1_send(s, true)) return;
+    }
+}
+
+/**
+ * @brief Publish a reading at QoS 1.
+ *
+ * @param[in] topic The MQTT topic, NUL terminated.
+ * @param[in] message The message, may hold NUL bytes, eg. with `MQTT_MSGPACK`.
+ * @param[in] mlen Bytes of \p message.
+ *
+ * @returns `true` if the packet was sent and is kept until acknowledged
+ */
+bool mqtt_qos1_publish(const char* topic, const uint8_t* message, size_t mlen){
+    if(!mqtt_client.connected()) return false;
+    size_t tlen = strlen(topic);
+    if(tlen + 1 + mlen > MQTT_INFLIGHT_LEN) return mqtt_publish(topic, message, mlen);
+    if(mqtt_qos1_stalled) return false;
+
+    mqtt_qos1_resend();
+    uint16_t window = mqtt_inflight < MQTT_INFLIGHT_MAX ? mqtt_inflight : MQTT_INFLIGHT_MAX;
+    if(mqtt_qos1_poll(window - 1, MQTT_ACK_TIMEOUT_MS) >= window){
+        Serial.printf("[ERROR] no MQTT acknowledgement in %d ms, logging locally\n", MQTT_ACK_TIMEOUT_MS);
+        mqtt_qos1_stalled = true;
+        return false;
+    }
+
+    struct mqtt_inflight_slot* s = rtc_mqtt_inflight.slots;
+    while(s->id != 0) s++;
+    uint16_t id = rtc_mqtt_inflight.next_id;
+    for(bool used = true; used; ){
+        if(id == 0) id = 1;
+        used = false;
+        for(int i = 0; i < MQTT_INFLIGHT_MAX; i++) used = used || rtc_mqtt_inflight.slots[i].id == id;
+        if(used) id++;
+    }
+    s->id = id;
+    s->len = tlen + 1 + mlen;
+    memcpy(s->data, topic, tlen + 1);
+    memcpy(s->data + tlen + 1, message, mlen);
+    rtc_mqtt_inflight.next_id = id + 1;
+    rtc_mqtt_inflight.used++;
+    mqtt_qos1_seal();
+
+    if(mqtt_qos1_send(*s, false)) return true;
+    mqtt_qos1_ack(id);
+    return false;
+}
+
+/**
+ * @brief Publish a NUL terminated message at QoS 1, see above.
+ */
+bool mqtt_qos1_publish(const char* topic, const char* message){
+    return mqtt_qos1_publish(topic, (const uint8_t*)message, strlen(message));
+}
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * @file mqtt_stream.hpp
+ * @brief Publishes messages larger than the MQTT client's buffer as a stream.
+ *
+ * PubSubClient builds a whole message in its buffer before sending it, so the buffer
+ * used to be set to 30 KB for the largest `get_time_range` page, taken from the heap
+ * for good. It is now `MQTT_BUFFER_LEN` bytes. Messages which do not fit are written
+ * with `beginPublish()`, `write()` and `endPublish()`, which send the payload to the
+ * socket as it is handed over, `MQTT_STREAM_CHUNK` bytes at a time. Only the length
+ * has to be known before the first byte.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef MQTT_STREAM_HPP
+#define MQTT_STREAM_HPP
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <cstring>
+
+extern PubSubClient mqtt_client;
+
+/** Size of the buffer of the MQTT client, fits the readings of `log_data()` and commands. */
+#define MQTT_BUFFER_LEN 512
+/** Bytes of a streamed payload collected before they are written to the socket. */
+#define MQTT_STREAM_CHUNK 256
+
+/**
+ * @brief Writes the payload of one message to the broker as it is produced.
+ */
+class MqttStream {
+    public:
+        /**
+         * @brief Start a message of exactly \p len payload bytes to \p topic.
+         *
+         * @returns `false` if the client is not connected
+         */
+        bool begin(const char* topic, size_t len){
+            n = 0;
+            ok = mqtt_client.beginPublish(topic, len, false);
+            return ok;
+        }
+
+        void put(char c){
+            if(n == sizeof(chunk)) flush();
+            chunk[n++] = c;
+        }
+
+        void write(const char* data, size_t len){
+            if(n + len > sizeof(chunk)) flush();
+            if(len >= sizeof(chunk)){
+                // large pieces go out as they are
+                if(ok && mqtt_client.write((const uint8_t*)data, len) != len) ok = false;
+                return;
+            }
+            memcpy(chunk + n, data, len);
+            n += len;
+        }
+
+        /**
+         * @brief Finish the message.
+         *
+         * @returns `true` if every byte was sent, the broker got exactly the length given to `begin()`
+         */
+        bool end(){
+            flush();
+            return mqtt_client.endPublish() == 1 && ok;
+        }
+
+    private:
+        uint8_t chunk[MQTT_STREAM_CHUNK];
+        size_t n = 0;
+        bool ok = false;
+
+        void flush(){
+            if(ok && n > 0 && mqtt_client.write(chunk, n) != n) ok = false;
+            n = 0;
+        }
+};
+
+/**
+ * @brief Publish \p payload, streamed if it does not fit the client's buffer.
+ *
+ * @returns `true` if the client sent the message
+ */
+bool mqtt_publish(const char* topic, const uint8_t* payload, size_t len){
+    if(MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + len <= mqtt_client.getBufferSize()) return mqtt_client.publish(topic, payload, len);
+    MqttStream stream;
+    if(!stream.begin(topic, len)) return false;
+    stream.write((const char*)payload, len);
+    return stream.end();
+}
+
+/**
+ * @brief Publish the NUL terminated \p payload, see above.
+ */
+bool mqtt_publish(const char* topic, const char* payload){
+    return mqtt_publish(topic, (const uint8_t*)payload, strlen(payload));
+}
+
+#endif
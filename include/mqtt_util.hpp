@@ -16,7 +16,7 @@
  */
 #include <ArduinoJson.h>
 #include <string>
-#include "SDReader.hpp"
+#include <log_reader.hpp>
 
 /**
  * @brief Process a command execute it.
@@ -55,6 +55,9 @@ void process_command(string command, string message){
             time_range = doc["time_range"].as<string>();
         }
 
+        // optional, 1 publishes compressed pages
+        bool compress = doc.containsKey("compress") && (int)doc["compress"] != 0;
+
         if(!doc.containsKey("topic_filter")){
             if(USB_DEBUG) Serial.println("[ERROR] MQTT command \'get_time_range\' missing key \'topic_filter\' so using default \"\"");
             topic_filter_ja.add("");
@@ -103,12 +106,7 @@ void process_command(string command, string message){
         }
         */
         // read data from files and upload via MQTT
-        SDReader sdr;
-        sdr.read_entry_range_from_files(
-                *ep, 
-                *term, 
-                topic_filter_v,
-                page_size);
+        log_read_range(ep->get_epoch(), term->get_epoch(), topic_filter_v, page_size, compress);
 
     }else{
 
@@ -145,7 +143,7 @@ void process_command(string command, string message){
  */
 void callback(char* topic, byte* message, unsigned int length){
     std::string msg_str;
-    for(int i = 0; i < length; i++){
+    for(unsigned int i = 0; i < length; i++){
         msg_str += (char)message[i];
     }
 
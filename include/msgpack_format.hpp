@@ -0,0 +1,413 @@
+/**
+ * @file msgpack_format.hpp
+ * @brief MessagePack encoding of reading messages, `MQTT_MSGPACK`.
+ *
+ * Readings are formatted as JSON text with long keys and six decimals per float, eg.
+ * `{"MAC": "24:6F:28:0A:1B:2C", "DEPTH": "shallow", "VWC_RAW":0.512345, "VWC":12.345678}`.
+ * With `MQTT_MSGPACK` the MQTT sink sends the same document as MessagePack
+ * (https://msgpack.org) to `msgpack/<topic>` instead, the prefix marks the content
+ * type. The uSD card, the flash queue and the backfill keep the JSON text.
+ *
+ *  * Objects, arrays, strings, `true`, `false` and `null` map to their MessagePack types.
+ *  * Numbers without fraction or exponent are integers in the fewest bytes, others
+ *    are 32 bit floats, about seven significant digits, more than the sensors resolve.
+ *  * Strings which are MAC addresses, `XX:XX:XX:XX:XX:XX`, are ext type
+ *    `MSGPACK_EXT_MAC` (upper case hex) or `MSGPACK_EXT_MAC_LOWER` holding the 6 bytes.
+ *
+ * `msgpack_to_json()` turns a message back into equivalent, compact JSON, see
+ * tools/msgpack2json.
+ *
+ * This header has no Arduino dependencies and is shared by the firmware
+ * (log_pipeline.hpp) and the host decoder.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef MSGPACK_FORMAT_HPP
+#define MSGPACK_FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+/** Topic prefix of MessagePack messages, followed by the topic of the JSON message. */
+#define MSGPACK_TOPIC "msgpack/"
+/** Ext type of a MAC address printed with upper case hex digits. */
+#define MSGPACK_EXT_MAC 1
+/** Ext type of a MAC address printed with lower case hex digits. */
+#define MSGPACK_EXT_MAC_LOWER 2
+/** Deepest nesting of objects and arrays encoded. */
+#define MSGPACK_DEPTH 4
+
+/**
+ * @brief Encodes a JSON message into a caller-owned buffer, nothing is allocated.
+ */
+class MsgpackEncoder {
+    public:
+        MsgpackEncoder(uint8_t* buf, size_t cap): buf(buf), cap(cap){}
+
+        /**
+         * @brief Encode \p json.
+         *
+         * @returns bytes written, 0 if \p json is not JSON or does not fit
+         */
+        size_t encode(const char* json){
+            len = 0;
+            p = json;
+            if(!value(0)) return 0;
+            skip_space();
+            return *p == '\0' ? len : 0;
+        }
+
+    private:
+        uint8_t* buf;
+        size_t cap;
+        size_t len = 0;
+        const char* p = NULL;   //!< next character of the JSON text
+
+        void skip_space(){
+            while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+        }
+
+        bool put(uint8_t b){
+            if(len >= cap) return false;
+            buf[len++] = b;
+            return true;
+        }
+
+        bool put_be(uint64_t v, int bytes){
+            for(int i = bytes - 1; i >= 0; i--){
+                if(!put((uint8_t)(v >> (8 * i)))) return false;
+            }
+            return true;
+        }
+
+        bool value(int depth){
+            skip_space();
+            switch(*p){
+                case '{': return container(depth, '}');
+                case '[': return container(depth, ']');
+                case '"': return string();
+                case 't': return literal("true", 0xc3);
+                case 'f': return literal("false", 0xc2);
+                case 'n': return literal("null", 0xc0);
+                default: return number();
+            }
+        }
+
+        bool literal(const char* word, uint8_t b){
+            size_t n = strlen(word);
+            if(strncmp(p, word, n) != 0) return false;
+            p += n;
+            return put(b);
+        }
+
+        /** @brief A map or array, its size is filled in once the members are counted. */
+        bool container(int depth, char close){
+            if(depth >= MSGPACK_DEPTH) return false;
+            bool map = close == '}';
+            size_t at = len;
+            if(!put(0)) return false;
+            p++;
+
+            uint32_t count = 0;
+            skip_space();
+            if(*p == close){
+                p++;
+            }else{
+                for(;;){
+                    if(map){
+                        skip_space();
+                        if(*p != '"' || !string()) return false;
+                        skip_space();
+                        if(*p != ':') return false;
+                        p++;
+                    }
+                    if(!value(depth + 1)) return false;
+                    count++;
+                    skip_space();
+                    if(*p == ','){
+                        p++;
+                        continue;
+                    }
+                    if(*p != close) return false;
+                    p++;
+                    break;
+                }
+            }
+
+            if(count < 16){
+                buf[at] = (map ? 0x80 : 0x90) | count;
+                return true;
+            }
+            // map 16 or array 16, two more bytes of header
+            if(count > 0xFFFF || len + 2 > cap) return false;
+            memmove(buf + at + 3, buf + at + 1, len - at - 1);
+            len += 2;
+            buf[at] = map ? 0xde : 0xdc;
+            buf[at + 1] = count >> 8;
+            buf[at + 2] = count & 0xFF;
+            return true;
+        }
+
+        static int hex(char c){
+            if(c >= '0' && c <= '9') return c - '0';
+            if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        /** @brief \p s is `XX:XX:XX:XX:XX:XX`, written as ext if so. */
+        bool mac(const char* s){
+            bool upper = false, lower = false;
+            for(int i = 0; i < 17; i++){
+                if(i % 3 == 2){
+                    if(s[i] != ':') return false;
+                    continue;
+                }
+                if(hex(s[i]) < 0) return false;
+                upper = upper || (s[i] >= 'A' && s[i] <= 'F');
+                lower = lower || (s[i] >= 'a' && s[i] <= 'f');
+            }
+            if(upper && lower) return false;
+
+            if(!put(0xc7) || !put(6) || !put(lower ? MSGPACK_EXT_MAC_LOWER : MSGPACK_EXT_MAC)) return false;
+            for(int i = 0; i < 17; i += 3){
+                if(!put(hex(s[i]) << 4 | hex(s[i + 1]))) return false;
+            }
+            return true;
+        }
+
+        bool string(){
+            const char* start = ++p;
+            size_t n = 0;
+            bool escaped = false;
+            for(; *p != '"'; p++, n++){
+                if(*p == '\0') return false;
+                if(*p != '\\') continue;
+                escaped = true;
+                p++;
+                if(*p == 'u'){
+                    for(int i = 1; i <= 4; i++) if(hex(p[i]) < 0) return false;
+                    p += 4;
+                }else if(*p == '\0'){
+                    return false;
+                }
+            }
+            const char* end = p++;
+            if(n == 17 && !escaped && mac(start)) return true;
+
+            if(n < 32){
+                if(!put(0xa0 | n)) return false;
+            }else if(n < 256){
+                if(!put(0xd9) || !put(n)) return false;
+            }else if(n <= 0xFFFF){
+                if(!put(0xda) || !put_be(n, 2)) return false;
+            }else{
+                return false;
+            }
+            for(const char* s = start; s < end; s++){
+                char c = *s;
+                if(c == '\\'){
+                    c = *++s;
+                    switch(c){
+                        case 'n': c = '\n'; break;
+                        case 't': c = '\t'; break;
+                        case 'r': c = '\r'; break;
+                        case 'b': c = '\b'; break;
+                        case 'f': c = '\f'; break;
+                        case 'u':{
+                            int u = hex(s[1]) << 12 | hex(s[2]) << 8 | hex(s[3]) << 4 | hex(s[4]);
+                            c = u < 0x80 ? (char)u : '?';
+                            s += 4;
+                            break;
+                        }
+                        default: break;
+                    }
+                }
+                if(!put(c)) return false;
+            }
+            return true;
+        }
+
+        bool put_int(long long v){
+            if(v >= 0 && v < 128) return put(v);
+            if(v < 0 && v >= -32) return put(0xe0 | (v + 32));
+            if(v >= 0){
+                if(v < 256) return put(0xcc) && put(v);
+                if(v < 65536) return put(0xcd) && put_be(v, 2);
+                if(v < 4294967296LL) return put(0xce) && put_be(v, 4);
+                return put(0xcf) && put_be(v, 8);
+            }
+            if(v >= -128) return put(0xd0) && put(v);
+            if(v >= -32768) return put(0xd1) && put_be(v, 2);
+            if(v >= -2147483648LL) return put(0xd2) && put_be(v, 4);
+            return put(0xd3) && put_be(v, 8);
+        }
+
+        bool number(){
+            const char* s = p;
+            bool integer = true;
+            for(const char* q = s; (*q >= '0' && *q <= '9') || *q == '-' || *q == '+' || *q == '.' || *q == 'e' || *q == 'E'; q++){
+                if(*q == '.' || *q == 'e' || *q == 'E') integer = false;
+            }
+            char* end;
+            if(integer){
+                long long v = strtoll(s, &end, 10);
+                if(end == s) return false;
+                p = end;
+                return put_int(v);
+            }
+            float f = (float)strtod(s, &end);
+            if(end == s) return false;
+            p = end;
+            uint32_t u;
+            memcpy(&u, &f, sizeof(u));
+            return put(0xca) && put_be(u, 4);
+        }
+};
+
+/**
+ * @brief Read the big endian unsigned integer of \p n bytes at \p i of \p in.
+ */
+inline uint64_t msgpack_read_be(const uint8_t* in, size_t& i, int n){
+    uint64_t v = 0;
+    for(int k = 0; k < n; k++) v = v << 8 | in[i++];
+    return v;
+}
+
+/**
+ * @brief Decode one MessagePack value at \p i of \p in as compact JSON appended to \p out.
+ *
+ * @returns `false` if \p in is cut off or has a type messages do not use
+ */
+inline bool msgpack_value_json(const uint8_t* in, size_t len, size_t& i, std::string& out, int depth = 0){
+    if(i >= len || depth > MSGPACK_DEPTH) return false;
+    uint8_t t = in[i++];
+    char num[32];
+
+    size_t need = 0;
+    switch(t){
+        case 0xcc: case 0xd0: case 0xd9: need = 1; break;
+        case 0xcd: case 0xd1: case 0xda: case 0xdc: case 0xde: need = 2; break;
+        case 0xce: case 0xd2: case 0xca: need = 4; break;
+        case 0xcf: case 0xd3: case 0xcb: need = 8; break;
+        case 0xc7: need = 2; break;
+    }
+    if(i + need > len) return false;
+
+    uint32_t count = 0;     // members of a map or array
+    bool map = false;
+    size_t slen = 0;        // bytes of a string
+    if(t <= 0x7f){
+        out += std::to_string((int)t);
+        return true;
+    }else if(t >= 0xe0){
+        out += std::to_string((int)(int8_t)t);
+        return true;
+    }else if((t & 0xf0) == 0x80 || t == 0xde){
+        map = true;
+        count = t == 0xde ? msgpack_read_be(in, i, 2) : t & 0x0f;
+    }else if((t & 0xf0) == 0x90 || t == 0xdc){
+        count = t == 0xdc ? msgpack_read_be(in, i, 2) : t & 0x0f;
+    }else if((t & 0xe0) == 0xa0 || t == 0xd9 || t == 0xda){
+        slen = t == 0xd9 ? msgpack_read_be(in, i, 1) : t == 0xda ? msgpack_read_be(in, i, 2) : t & 0x1f;
+        if(i + slen > len) return false;
+        out += '"';
+        for(size_t k = 0; k < slen; k++){
+            char c = in[i + k];
+            if(c == '"' || c == '\\'){
+                out += '\\';
+                out += c;
+            }else if((unsigned char)c < 0x20){
+                snprintf(num, sizeof(num), "\\u%04x", c);
+                out += num;
+            }else{
+                out += c;
+            }
+        }
+        out += '"';
+        i += slen;
+        return true;
+    }else{
+        switch(t){
+            case 0xc0: out += "null"; return true;
+            case 0xc2: out += "false"; return true;
+            case 0xc3: out += "true"; return true;
+            case 0xcc: case 0xcd: case 0xce: case 0xcf:
+                snprintf(num, sizeof(num), "%llu", (unsigned long long)msgpack_read_be(in, i, need));
+                out += num;
+                return true;
+            case 0xd0: out += std::to_string((long long)(int8_t)msgpack_read_be(in, i, 1)); return true;
+            case 0xd1: out += std::to_string((long long)(int16_t)msgpack_read_be(in, i, 2)); return true;
+            case 0xd2: out += std::to_string((long long)(int32_t)msgpack_read_be(in, i, 4)); return true;
+            case 0xd3: out += std::to_string((long long)msgpack_read_be(in, i, 8)); return true;
+            case 0xca:{
+                uint32_t u = msgpack_read_be(in, i, 4);
+                float f;
+                memcpy(&f, &u, sizeof(f));
+                // fewest digits giving back the same float, still a float when encoded again
+                for(int digits = 6; digits <= 9; digits++){
+                    snprintf(num, sizeof(num), "%.*g", digits, f);
+                    if(strtof(num, NULL) == f) break;
+                }
+                if(strpbrk(num, ".en") == NULL) strcat(num, ".0");
+                out += num;
+                return true;
+            }
+            case 0xcb:{
+                uint64_t u = msgpack_read_be(in, i, 8);
+                double d;
+                memcpy(&d, &u, sizeof(d));
+                snprintf(num, sizeof(num), "%.17g", d);
+                if(strpbrk(num, ".en") == NULL) strcat(num, ".0");
+                out += num;
+                return true;
+            }
+            case 0xc7:{
+                uint8_t n = in[i++];
+                uint8_t type = in[i++];
+                if(n != 6 || i + 6 > len || (type != MSGPACK_EXT_MAC && type != MSGPACK_EXT_MAC_LOWER)) return false;
+                snprintf(num, sizeof(num), type == MSGPACK_EXT_MAC ? "\"%02X:%02X:%02X:%02X:%02X:%02X\"" : "\"%02x:%02x:%02x:%02x:%02x:%02x\"",
+                        in[i], in[i + 1], in[i + 2], in[i + 3], in[i + 4], in[i + 5]);
+                out += num;
+                i += 6;
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    out += map ? '{' : '[';
+    for(uint32_t k = 0; k < count; k++){
+        if(k > 0) out += ',';
+        if(map){
+            if(!msgpack_value_json(in, len, i, out, depth + 1)) return false;
+            out += ':';
+        }
+        if(!msgpack_value_json(in, len, i, out, depth + 1)) return false;
+    }
+    out += map ? '}' : ']';
+    return true;
+}
+
+/**
+ * @brief Turn a message published to `msgpack/<topic>` back into JSON.
+ *
+ * @param[in] in The payload.
+ * @param[in] len Bytes of \p in.
+ * @param[out] out Receives the JSON text.
+ *
+ * @returns `false` if \p in is not one whole MessagePack value
+ */
+inline bool msgpack_to_json(const uint8_t* in, size_t len, std::string& out){
+    out.clear();
+    size_t i = 0;
+    return msgpack_value_json(in, len, i, out) && i == len;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ * @file rtc_state.hpp
+ * @brief Helpers for keeping state in RTC memory between wakes.
+ *
+ * Variables marked `RTC_NOINIT_ATTR` are placed in RTC slow memory which stays powered
+ * while the device hibernates. Keeping state there lets a wake skip reading it back
+ * from NVS (flash). Unlike `RTC_DATA_ATTR` the bootloader leaves them alone on every
+ * reset, so they also survive a reset by the external watchdog or a panic. Their
+ * contents are trusted when the checksum saved with them matches, after a cold
+ * power-on RTC memory holds random bytes and state is loaded from NVS instead.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef RTC_STATE_HPP
+#define RTC_STATE_HPP
+
+#include <Arduino.h>
+
+/**
+ * @brief Compute the checksum (32 bit FNV-1a) used to validate data kept in RTC memory.
+ *
+ * The build time is hashed first, state left behind by other firmware, eg. before
+ * an OTA update, doesn't match.
+ *
+ * @param[in] data The data to checksum.
+ * @param[in] len Number of bytes in \p data.
+ *
+ * @returns the checksum of \p data
+ */
+uint32_t rtc_checksum(const void* data, size_t len){
+    const uint8_t* bytes = (const uint8_t*)data;
+    static const char build[] = __DATE__ " " __TIME__;
+    uint32_t hash = 2166136261UL;
+    for(size_t i = 0; i < sizeof(build) - 1; i++){
+        hash ^= (uint8_t)build[i];
+        hash *= 16777619UL;
+    }
+    for(size_t i = 0; i < len; i++){
+        hash ^= bytes[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+#endif
@@ -16,6 +16,7 @@
 
 //#include <setup_util.hpp>
 #include <NimBLEDevice.h>
+#include <esp32/rtc.h>
 #include <Adafruit_MAX1704X.h>
 #include <OWMAdafruit_ADS1015.h>
 #include <ble_util.hpp>
@@ -23,6 +24,11 @@
 #include <Teros10.hpp>
 #include <Atlas_EZO-pH.hpp>
 #include <Atlas_Gravity_pH.hpp>
+#include <rtc_state.hpp>
+#include <wired_buffer.hpp>
+#include <wake_profile.hpp>
+#include <adaptive_rate.hpp>
+#include <mqtt_stream.hpp>
 
 extern bool maxlipo_attached;
 extern Adafruit_MAX17048 maxlipo;
@@ -30,58 +36,276 @@ extern Adafruit_ADS1115 ads;
 
 int reset_count = -1; // times reset by WDT, one tick roughly equivalent to one minute
 
+/** Seconds slept per tick, slightly longer than the watchdog timer period. */
+#define TICK_SECONDS 65
+/** Longest sleep in ticks, keeps the deep sleep timer within `hibernate()`'s range. */
+#define MAX_SLEEP_TICKS 60
+
+void ReadWired();
+void ReadHT();
+void OTAUpdate();
+void SendTLM();
+
+/**
+ * @brief Entry in the task registry.
+ *
+ * A task runs when the current reset count minus the reset count of its last run
+ * (`t0`, physics-esque notation for the starting point of our calculation) is at
+ * least its period, `period` adjusted by `task_period()`.
+ *
+ * To add a sensor task, write the handler and append an entry to `tasks`. Append
+ * new entries at the end of the table so the `t0` values saved by older firmware
+ * keep matching their tasks.
+ */
+struct task{
+    /** short name used in debug output */
+    const char* name;
+    /** ticks between executions, from the config header */
+    int period;
+    /** reset count of the last execution */
+    int t0;
+    /** function which performs the task */
+    void (*handler)();
+    /** estimated run time in milliseconds */
+    int est_cost_ms;
+    /** needs WiFi/MQTT/BLE, tasks which don't are run with the radio off */
+    bool needs_radio;
+    /** core to run on concurrently with the other due tasks, `TASK_SEQUENTIAL` to run in `loop()` */
+    int core;
+};
+
+/** `task.core` of tasks which run one after the other in `loop()` */
+#define TASK_SEQUENTIAL -1
+/** Stack size in bytes of the FreeRTOS task a concurrent task runs in. */
+#define TASK_STACK_SIZE 8192
+
+/**
+ * @brief Registry of all scheduled tasks.
+ *
+ * Tasks pinned to a core are started first and run at the same time, the
+ * scheduler waits for all of them before running the sequential tasks in table
+ * order. `ReadWired()` spends most of its time waiting for the sensors to warm up
+ * and `ReadHT()` waiting for the BLE scan so they overlap well.
+ */
+struct task tasks[] = {
+    {"vwc", VWC_FREQ, -1, ReadWired, 10500, false, 0},
+    {"ht",  HT_FREQ,  -1, ReadHT,    10000, true,  1},
+    {"ota", OTA_FREQ, -1, OTAUpdate, 5000,  true,  TASK_SEQUENTIAL},
+    {"tlm", TLM_FREQ, -1, SendTLM,   200,   true,  TASK_SEQUENTIAL},
+};
+
+/** Number of entries in the task registry. */
+#define NUM_TASKS (sizeof(tasks) / sizeof(tasks[0]))
+
+/**
+ * @brief Period of a task after adapting it to the readings and battery, see adaptive_rate.hpp.
+ *
+ * @param[in] t The task.
+ *
+ * @returns ticks between executions
+ */
+int task_period(const struct task* t){
+    return adaptive_period(t->period, t->handler == ReadWired);
+}
+
+/** Version of the planner blob stored in NVS. */
+#define PLANNER_VERSION 1
+
+/**
+ * @brief Scheduler state saved to NVS as a single blob under the key "planner".
+ *
+ * Only the reset count and the `t0` of each task change between wakes so only
+ * they are saved. Storing them in one blob costs one flash write per wake instead
+ * of one per value.
+ */
+struct planner_state{
+    uint16_t version;
+    uint16_t num_tasks;
+    int reset_count;
+    int t0[NUM_TASKS];
+};
+
+/**
+ * @brief Copy of the planner kept in RTC memory so warm wakes don't read NVS.
+ */
+struct rtc_planner{
+    struct planner_state state;
+    /** ticks the device was put to sleep for by `SchedulerSleep()` */
+    int sleep_ticks;
+    /** RTC time the sleep planned by `SchedulerSleep()` ends, see `esp_rtc_get_time_us()` */
+    uint64_t wake_rtc_us;
+    /** `rtc_checksum()` of the members above, anything else means RTC memory was lost */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct rtc_planner rtc_planner;
+
+bool planner_from_rtc = false;  //!< the planner of this boot was loaded from RTC memory, not NVS
+bool planner_resumed = false;   //!< woken before the planned sleep ended, `SchedulerSleep()` sleeps the rest of it
+
+/**
+ * @brief Set the reset count and the `t0` of every task to \p tick.
+ *
+ * @param[in] tick The reset count to start counting from.
+ */
+void planner_reset(int tick){
+    reset_count = tick;
+    for(size_t i = 0; i < NUM_TASKS; i++) tasks[i].t0 = tick;
+}
+
+/**
+ * @brief Save the reset count and task registry state to RTC memory only.
+ *
+ * Used by wakes which run no task, eg. watchdog resets, if RTC memory held the
+ * planner. A later cold boot carries on from the copy last saved to NVS, the tasks
+ * then run up to that many ticks late.
+ *
+ * @param[in] reset_count The reset count to save.
+ */
+void planner_commit_rtc(int reset_count){
+    struct planner_state* state = &rtc_planner.state;
+    state->version = PLANNER_VERSION;
+    state->num_tasks = NUM_TASKS;
+    state->reset_count = reset_count;
+    for(size_t i = 0; i < NUM_TASKS; i++) state->t0[i] = tasks[i].t0;
+    rtc_planner.sleep_ticks = 1;
+    rtc_planner.checksum = rtc_checksum(&rtc_planner, offsetof(struct rtc_planner, checksum));
+}
+
+/**
+ * @brief Save the reset count and task registry state to RTC memory and to NVS with one write.
+ *
+ * NVS holds the copy used after a cold boot.
+ *
+ * @param[in] reset_count The reset count to save.
+ */
+void SchedulerCommit(int reset_count){
+    planner_commit_rtc(reset_count);
+
+    struct planner_state* state = &rtc_planner.state;
+    if(gator_prefs.putBytes("planner", state, sizeof(*state)) != sizeof(*state)){
+        if(DEBUG) Serial.println("[ERROR] failed to save planner to NVS");
+    }
+}
+
+/**
+ * @brief Check if the RTC memory copy of the planner can be used.
+ *
+ * @returns `true` if the checksum matches, `false` after a cold power-on
+ */
+bool planner_rtc_valid(){
+    return rtc_planner.checksum == rtc_checksum(&rtc_planner, offsetof(struct rtc_planner, checksum));
+}
+
+/**
+ * @brief Number of ticks elapsed since the planner was saved.
+ *
+ * A timer wake means the whole sleep planned by `SchedulerSleep()` elapsed. A
+ * watchdog reset which kept RTC memory before the planned sleep ended counts no
+ * tick, the rest of the sleep follows, see `planner_resumed`. Any other wake or
+ * reset (power-on) is counted as one tick like before.
+ *
+ * @returns ticks to add to the saved reset count
+ */
+int planner_ticks_slept(){
+    planner_resumed = false;
+    if(!planner_rtc_valid() || rtc_planner.sleep_ticks <= 0) return 1;
+    if(esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER) return rtc_planner.sleep_ticks;
+
+    uint64_t now_us = esp_rtc_get_time_us();
+    if(now_us >= rtc_planner.wake_rtc_us) return 1;  // reset while awake
+    // less than a second left is slept through
+    if(now_us + 1000000ULL >= rtc_planner.wake_rtc_us) return rtc_planner.sleep_ticks;
+    planner_resumed = true;
+    return 0;
+}
+
+/**
+ * @brief Load the planner saved by firmware which used one NVS key per value.
+ *
+ * The old keys are removed after they are read.
+ */
+void planner_migrate_legacy_keys(){
+    const char* legacy_keys[] = {"analog_t0", "ht_t0", "ota_t0", "tlm_t0"};
+
+    reset_count = gator_prefs.getInt("reset_count");
+    gator_prefs.remove("reset_count");
+
+    // legacy keys are in the same order as the first entries of the registry
+    for(size_t i = 0; i < NUM_TASKS; i++){
+        tasks[i].t0 = reset_count;
+        if(i < sizeof(legacy_keys) / sizeof(legacy_keys[0]) && gator_prefs.isKey(legacy_keys[i])){
+            tasks[i].t0 = gator_prefs.getInt(legacy_keys[i]);
+            gator_prefs.remove(legacy_keys[i]);
+        }
+    }
+}
+
 /**
- * @brief Data structure for task scheduling stored in NVS. 
+ * @brief Load the planner from RTC memory, or from the NVS blob after a cold boot.
  *
- * Counters for when the last time the task was executed, the last reset counter value 
- * when reading was taken. Members are named by task name and the `_t0` denotes physics-esque
- * mathematical notation, ie this is the starting point of our calculation.
+ * Tasks missing from the NVS blob, ie appended to the registry since it was saved,
+ * start counting from the saved reset count.
  *
- * Tasks are similarly named functions which are run when the current reset count value minus 
- * the previous reset count recorded in `<task_name>_t0` equals the time between task executions
- * specified in the config header.
+ * @returns `true` if a valid planner was found, `false` otherwise
  */
-struct planner{
-    /** time since analog reading */
-	int analog_t0 = -1;	 
-    /** time since temperature and humidity sensor reading */
-	int ht_t0 = -1;		
-    /** time since over the air update check was made */
-	int ota_t0 = -1;	
-    /** time since the last telemetry message was sent */
-	int tlm_t0 = -1;	
-}planner;
+bool planner_load(){
+    struct planner_state state;
+    const size_t header_size = sizeof(state) - sizeof(state.t0);
+    size_t saved_tasks = NUM_TASKS;
+
+    planner_from_rtc = planner_rtc_valid();
+    if(planner_from_rtc){
+        state = rtc_planner.state;
+
+    }else{
+        size_t len = gator_prefs.getBytesLength("planner");
+        if(len < header_size || len > sizeof(state)) return false;
+
+        gator_prefs.getBytes("planner", &state, len);
+        saved_tasks = (len - header_size) / sizeof(int);
+        if(saved_tasks > state.num_tasks) saved_tasks = state.num_tasks;
+    }
+
+    if(state.version != PLANNER_VERSION) return false;
+
+    reset_count = state.reset_count;
+    for(size_t i = 0; i < NUM_TASKS; i++){
+        tasks[i].t0 = i < saved_tasks ? state.t0[i] : reset_count;
+    }
+    return true;
+}
 
 /**
- * @brief Open NVS, check if it is initialized with data, if not, initialize it.
+ * @brief Open NVS and load the planner, if it is not initialized, initialize it.
+ *
+ * On a wake from deep sleep or a watchdog reset the planner comes from RTC memory
+ * and NVS is not read.
+ * The incremented reset count is not saved here, it is saved along with the
+ * task state by `SchedulerCommit()` before the due tasks run.
  */
 void init_nvs(){
 
 	// NVS Setup
 	gator_prefs.begin("GatorState", RW_MODE);
 
-	if(gator_prefs.isKey("reset_count")){ // if key exists
-		reset_count = gator_prefs.getInt("reset_count");
+	if(planner_load()){
+		reset_count += planner_ticks_slept();
+
+	}else if(gator_prefs.isKey("reset_count")){ // saved by older firmware
+		planner_migrate_legacy_keys();
 		reset_count++;
-		if(DEBUG) Serial.printf("Reset Count = %d\n", reset_count);
-		gator_prefs.putInt("reset_count", reset_count);
-
-		planner.analog_t0 = gator_prefs.getInt("analog_t0");
-		planner.ht_t0 = gator_prefs.getInt("ht_t0");
-		planner.ota_t0 = gator_prefs.getInt("ota_t0");
-		planner.tlm_t0 = gator_prefs.getInt("tlm_t0");
-
-	}else{ // create the keys
-		reset_count = planner.analog_t0 = planner.ht_t0 = planner.ota_t0 = 1;
-		if(DEBUG) Serial.printf("Reset Count = %d\n", reset_count);
-		gator_prefs.putInt("reset_count", reset_count);	
-		gator_prefs.putInt("analog_t0", planner.analog_t0);
-		gator_prefs.putInt("ht_t0", planner.ht_t0);
-		gator_prefs.putInt("ota_t0", planner.ota_t0);
-		gator_prefs.putInt("tlm_t0", planner.tlm_t0);
+
+	}else{ // first boot
+		planner_reset(1);
 
 	}
 
+	if(DEBUG) Serial.printf("Reset Count = %d\n", reset_count);
+
+	wired_buffer_init();
+	adaptive_init();
+	epoch_clock_init(reset_count);
 }
 
 /**
@@ -92,16 +316,36 @@ void init_nvs(){
  * @returns `true` if a task is scheduled to run this reboot cycle, `false` otherwise
  */
 bool task_is_scheduled(int reset_count){
-    bool run_vwc = reset_count - planner.analog_t0 >= VWC_FREQ;
-    bool run_ht = reset_count - planner.ht_t0 >= HT_FREQ;
-    bool run_ota_update = reset_count - planner.ota_t0 >= OTA_FREQ;
-    bool run_tlm = reset_count - planner.tlm_t0 >= TLM_FREQ;
+    for(size_t i = 0; i < NUM_TASKS; i++){
+        if(reset_count - tasks[i].t0 >= task_period(&tasks[i])){
+            // start WIFI
+            return true;
+        }
+    }
+    return false;
+}
 
-    if( run_vwc || run_ht || run_ota_update || run_tlm){
-        // start WIFI
-        return true;
-    }else return false;
+/**
+ * @brief Check if WiFi, MQTT and BLE need to be started this wake, NVS must be initialized first!
+ *
+ * The radio is needed if a task which uses it is due. Tasks which don't need it, ie 
+ * `ReadWired()`, only bring it up when the buffered samples are due for upload: every
+ * `UPLOAD_FREQ` samples or when the buffer is nearly full.
+ *
+ * @param[in] reset_count The number of resets recorded.
+ *
+ * @returns `true` if the radio should be started, `false` otherwise
+ */
+bool radio_is_needed(int reset_count){
+    int upload_at = UPLOAD_FREQ < WIRED_BUFFER_LEN ? UPLOAD_FREQ : WIRED_BUFFER_LEN;
 
+    for(size_t i = 0; i < NUM_TASKS; i++){
+        if(reset_count - tasks[i].t0 < task_period(&tasks[i])) continue;
+
+        // the sample taken this wake completes the batch
+        if(tasks[i].needs_radio || wired_buffer.count + wired_buffer.logged + 1 >= upload_at) return true;
+    }
+    return false;
 }
 
 /**
@@ -118,142 +362,208 @@ void ReadHT(){
 
 	int scanTime = 10; // in seconds
 
-	BLEScanResults res = scanner->start(scanTime, false);
+	scanner->start(scanTime, false);
 	scanner->clearResults();
 }
 
+/**
+ * @brief Build the MQTT messages for the readings in a wired sample.
+ *
+ * @param[in] sample The sample.
+ * @param[in] age_s Seconds since the sample was taken, added to the message as `AGE_S` if not negative.
+ * @param[in] emit Called with the topic and message of each reading, returns `false` to stop.
+ *
+ * Messages are formatted into buffers on the stack, nothing is allocated.
+ *
+ * @returns `false` if \p emit failed, `true` otherwise
+ */
+bool build_wired_messages(const struct wired_sample* sample, long age_s, bool (*emit)(const char*, const char*)){
+    const char* pH_depths[WIRED_PH_SENSORS] = {"normal", "shallow", "middle", "deep"};
+    const char* vwc_depths[3] = {"shallow", "middle", "deep"};
+
+    const char* mac = gator_mac();
+    char age[40] = "";
+    if(age_s >= 0) snprintf(age, sizeof(age), ", \"AGE_S\": %ld", age_s);
+
+    char topic[LOG_TOPIC_LEN];
+    char msg[LOG_MESSAGE_LEN];
+
+    // pH mqtt messages
+    for(int i = 0; i < WIRED_PH_SENSORS; i++){
+        if(sample->pH[i][0] == '\0') continue;
+
+        snprintf(topic, sizeof(topic), "atlas_ezo_ph/pH/%s/%s", pH_depths[i], mac);
+        snprintf(msg, sizeof(msg), "{\"MAC\": \"%s\", \"PH\":%s%s}", mac, sample->pH[i], age);
+        if(!emit(topic, msg)) return false;
+    }
+
+	// build VWC mqtt message, fields as `Teros10::toJSON()`
+	Teros10 vwc_converter;
+	std::string brand = vwc_converter.getSensorType();
+
+	for(int i = 0; i < 3; i++){
+        double voltage = sample->raw_analog[i] * 0.0001875;
+        snprintf(topic, sizeof(topic), "%s/%d_%s/%s", brand.c_str(), i, vwc_depths[i], mac);
+        snprintf(msg, sizeof(msg), "{\"MAC\": \"%s\", \"DEPTH\": \"%s\", \"VWC_RAW\":%f, \"VWC\":%f%s}",
+                mac, vwc_depths[i], voltage, vwc_converter.getVWC(VWCSensor::MINERAL_SOIL, voltage), age);
+        if(!emit(topic, msg)) return false;
+	}
+    return true;
+}
+
+/**
+ * @brief Log a reading to all available destinations, see `log_data()`.
+ */
+bool emit_log_data(const char* topic, const char* msg){
+    log_data(topic, msg);
+    return true;
+}
+
+/**
+ * @brief Publish a buffered reading to MQTT only, it was logged to uSD when it was taken.
+ */
+bool emit_mqtt(const char* topic, const char* msg){
+    bool success = mqtt_publish(topic, msg);
+    if(DEBUG) Serial.printf("\t-> %s \'%s\' | \'%s\'\n", success ? "sent" : "failed to send", topic, msg);
+    return success;
+}
+
+/** Time the wired sensors need after power-up before they can be read, in milliseconds. */
+#define SENSOR_WARMUP_MS 10000
+
+bool sensor_powered = false;            //!< PWR_EN raised by `sensor_power_on()`
+unsigned long sensor_power_on_ms = 0;   //!< `millis()` when the sensors were powered
+
+/**
+ * @brief Turn on power to the wired sensors and start the warm-up clock.
+ *
+ * Called from `setup()` when a wired read is due so the sensors warm up while
+ * WiFi and the uSD card are set up. Does nothing if they are already on.
+ */
+void sensor_power_on(){
+    if(sensor_powered) return;
+    digitalWrite(PWR_EN, HIGH);
+    sensor_power_on_ms = millis();
+    sensor_powered = true;
+}
+
+/**
+ * @brief Turn off power to the wired sensors.
+ */
+void sensor_power_off(){
+    digitalWrite(PWR_EN, LOW);
+    sensor_powered = false;
+}
+
+/**
+ * @brief Wait for whatever is left of the sensor warm-up, powering the sensors first if needed.
+ */
+void sensor_warmup_wait(){
+    sensor_power_on();
+    unsigned long elapsed = millis() - sensor_power_on_ms;
+    if(DEBUG) Serial.printf("\tsensors powered %lu ms ago\n", elapsed);
+    if(elapsed < SENSOR_WARMUP_MS) delay(SENSOR_WARMUP_MS - elapsed);
+}
+
+/**
+ * @brief Check if the task with \p handler is due, NVS must be initialized first!
+ *
+ * @param[in] handler The handler of the task in the registry.
+ * @param[in] reset_count The number of resets recorded.
+ *
+ * @returns `true` if the task is due, `false` otherwise or if it is not in the registry
+ */
+bool task_is_due(void (*handler)(), int reset_count){
+    for(size_t i = 0; i < NUM_TASKS; i++){
+        if(tasks[i].handler == handler) return reset_count - tasks[i].t0 >= task_period(&tasks[i]);
+    }
+    return false;
+}
+
 /**
  * @brief      Reads all wired sensors attached to the aggregator
+ *
+ * Readings are logged right away. If the radio is off they are also buffered 
+ * for upload by `UploadWiredBuffer()`, unless the backfill or the flash queue
+ * publishes them.
  */
 void ReadWired(){
 
 	if(DEBUG) Serial.println("[VWC/WIRED SENSORS] queueing data");
 
-    // turn on power to sensors
-	digitalWrite(PWR_EN, HIGH);
-	delay(10000);
+    // turn on power to sensors, usually done in setup()
+	sensor_warmup_wait();
 
     // initialize sensor readers
-	VWCSensor* vwc_converter = new Teros10();
-	pHSensor* pH_converter = new AtlasGravitypH();
-    AtlasEZOpH* ezopH_converter = new AtlasEZOpH();
+    AtlasEZOpH ezopH_converter;
+    const int pH_addresses[WIRED_PH_SENSORS] = {EZO_I2C_ADDR, EZO_I2C_SHALLOW_ADDR, EZO_I2C_MIDDLE_ADDR, EZO_I2C_DEEP_ADDR};
 
-	MQTTMailer instance = MQTTMailer::getInstance();
-    // get the MAC address
-	std::string mac_str(WiFi.macAddress().c_str());
-
-    
-	int raw_analog[4];
-	double voltage[4];
+    struct wired_sample sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.epoch = (uint32_t)epoch_now();
 
     // read voltage at analog ports
     // SHALLOW
-	raw_analog[0] = ads.readADC_SingleEnded(1);
-	voltage[0] = raw_analog[0] * 0.0001875;
+	sample.raw_analog[0] = ads.readADC_SingleEnded(1);
     // MIDDLE
-	raw_analog[1] = ads.readADC_SingleEnded(2);
-	voltage[1] = raw_analog[1] * 0.0001875;
+	sample.raw_analog[1] = ads.readADC_SingleEnded(2);
     // DEEP
-	raw_analog[2] = ads.readADC_SingleEnded(3);
-	voltage[2] = raw_analog[2] * 0.0001875;
+	sample.raw_analog[2] = ads.readADC_SingleEnded(3);
     // ANALOG/pH
-	raw_analog[3] = ads.readADC_SingleEnded(0);
-	voltage[3] = raw_analog[3] * 0.0001875;
-
-    // read I2C sensors
-    char pH_normal[32];
-    char pH_shallow[32];
-    char pH_middle[32];
-    char pH_deep[32];
-    // NORMAL
-    if(ezopH_converter->sensor_at_address(EZO_I2C_ADDR)){
-        strcpy(pH_normal, ezopH_converter->getpH_str(EZO_I2C_ADDR));
-        ezopH_converter->clear_pH_str();
-        // build pH mqtt message
-        std::string topic = ezopH_converter->getSensorType() + "/pH/normal/" + mac_str;
-        //std::string msg = "{\"MAC\": \"" + mac_str + "\"," + pH_converter->toJSON(voltage[3]) + "}";
-        std::string msg = "{\"MAC\": \"" + mac_str + "\", \"PH\":" + pH_normal + "}";
-        //instance.mailMessage(&mqtt_client, topic, msg);
-        log_data(topic, msg);
-    
-    }else if(DEBUG){
-        Serial.println("\tno pH at addr 99");
-    }
-    // SHALLOW
-    if(ezopH_converter->sensor_at_address(EZO_I2C_SHALLOW_ADDR)){
-        strcpy(pH_shallow, ezopH_converter->getpH_str(EZO_I2C_SHALLOW_ADDR));
-        ezopH_converter->clear_pH_str();
-        // build pH mqtt message
-        std::string topic = ezopH_converter->getSensorType() + "/pH/shallow/" + mac_str;
-        //std::string msg = "{\"MAC\": \"" + mac_str + "\"," + pH_converter->toJSON(voltage[3]) + "}";
-        std::string msg = "{\"MAC\": \"" + mac_str + "\", \"PH\":" + pH_shallow + "}";
-        //instance.mailMessage(&mqtt_client, topic, msg);
-        log_data(topic, msg);
-    
-    }else if(DEBUG){
-        Serial.println("\tno pH at addr shallow");
-    }
-    // MIDDLE
-    if(ezopH_converter->sensor_at_address(EZO_I2C_MIDDLE_ADDR)){
-        strcpy(pH_middle, ezopH_converter->getpH_str(EZO_I2C_MIDDLE_ADDR));
-        ezopH_converter->clear_pH_str();
-        std::string topic = ezopH_converter->getSensorType() + "/pH/middle/" + mac_str;
-        //std::string msg = "{\"MAC\": \"" + mac_str + "\"," + pH_converter->toJSON(voltage[3]) + "}";
-        std::string msg = "{\"MAC\": \"" + mac_str + "\", \"PH\":" + pH_middle + "}";
-        //instance.mailMessage(&mqtt_client, topic, msg);
-        log_data(topic, msg);
-    
-    }else if(DEBUG){
-        Serial.println("\tno pH at addr middle");
+	sample.raw_analog[3] = ads.readADC_SingleEnded(0);
+
+    // read I2C sensors, NORMAL/SHALLOW/MIDDLE/DEEP
+    for(int i = 0; i < WIRED_PH_SENSORS; i++){
+        if(ezopH_converter.sensor_at_address(pH_addresses[i])){
+            strncpy(sample.pH[i], ezopH_converter.getpH_str(pH_addresses[i]), WIRED_PH_LEN - 1);
+            ezopH_converter.clear_pH_str();
+        }else if(DEBUG){
+            Serial.printf("\tno pH at addr %d\n", pH_addresses[i]);
+        }
     }
-    // DEEP
-    if(ezopH_converter->sensor_at_address(EZO_I2C_DEEP_ADDR)){
-        strcpy(pH_deep, ezopH_converter->getpH_str(EZO_I2C_DEEP_ADDR));
-        ezopH_converter->clear_pH_str();
-        std::string topic = ezopH_converter->getSensorType() + "/pH/deep/" + mac_str;
-        //std::string msg = "{\"MAC\": \"" + mac_str + "\"," + pH_converter->toJSON(voltage[3]) + "}";
-        std::string msg = "{\"MAC\": \"" + mac_str + "\", \"PH\":" + pH_deep + "}";
-        //instance.mailMessage(&mqtt_client, topic, msg);
-        log_data(topic, msg);
-    
-    }else if(DEBUG){
-        Serial.println("\tno pH at addr deep");
-    }
-
-    free(pH_converter);
 	
     // turn off power to sensors
-	digitalWrite(PWR_EN, LOW);
+	sensor_power_off();
 
-	// build VWC mqtt message
-	std::string brand = vwc_converter->getSensorType();
+    // queued for the logging task, the BLE scan may be logging from the other core
+    build_wired_messages(&sample, -1, emit_log_data);
 
-	if(WiFi.status() == WL_CONNECTED && !mqtt_client.connected()){
-		if(DEBUG) Serial.println("\t-> not connected");
-		instance.reconnect(mqtt_client);
-	}
+    adaptive_update_wired(&sample);
 
-	for(int i = 0; i < 3; i++){
+    // radio off, keep for the next upload unless the readings are replayed from the
+    // uSD card by the backfill or wait in the flash queue
+    if(WiFi.status() != WL_CONNECTED){
+        bool replayed = logging_available ? epoch_known && BACKFILL_BYTES > 0 : flash_queue_mount();
+        if(replayed) wired_buffer_skip();
+        else wired_buffer_push(&sample);
+    }
+}
 
-		std::string depth = "";
-		switch(i){
-			case 0:
-				depth = "shallow";
-				break;
-			case 1:
-				depth = "middle";
-				break;
-			case 2:
-				depth = "deep";
-				break;
-		}
-		
-		std::string topic = brand + "/" + std::to_string(i) + std::string("_") + depth + std::string("/") + mac_str;
-		std::string msg = "{\"MAC\": \"" + mac_str + "\", \"DEPTH\": \"" + depth + "\", " + vwc_converter->toJSON(voltage[i]) + "}";
-		//instance.mailMessage(&mqtt_client, topic, msg);
-        log_data(topic, msg);
-	}
-	free(vwc_converter);
+/**
+ * @brief Upload the wired samples buffered while the radio was off.
+ *
+ * Samples are removed from the buffer once all of their messages were published.
+ */
+void UploadWiredBuffer(){
+    if(WiFi.status() != WL_CONNECTED || !mqtt_client.connected()) return;
+    // the readings of the samples not buffered are published by the backfill or the flash queue
+    if(wired_buffer.logged > 0){
+        wired_buffer.logged = 0;
+        wired_buffer_seal();
+    }
+    if(wired_buffer.count == 0) return;
+
+    if(DEBUG) Serial.printf("[UPLOAD] %d buffered wired samples\n", wired_buffer.count);
+
+    int uploaded = 0;
+    for(; uploaded < wired_buffer.count; uploaded++){
+        const struct wired_sample* sample = &wired_buffer.samples[uploaded];
+        long age_s = (long)((uint32_t)epoch_now() - sample->epoch);
+
+        if(!build_wired_messages(sample, age_s, emit_mqtt)) break;
+        mqtt_client.loop();
+    }
+    wired_buffer_drop(uploaded);
 }
 
 /**
@@ -284,13 +594,6 @@ void SendTLM(){
 
     digitalWrite(PWR_EN, HIGH);
 
-	MQTTMailer instance = MQTTMailer::getInstance();
-
-	if(WiFi.status() == WL_CONNECTED && !mqtt_client.connected()){
-		if(USB_DEBUG) Serial.println("\t-> not connected");
-		instance.reconnect(mqtt_client);
-	}
-
 	std::string fw_version = "V" + std::to_string(VERSION_MAJOR) + "." + std::to_string(VERSION_MINOR) + "." + std::to_string(VERSION_PATCH);
 	std::string topic = "datagator/tlm/" + std::string(WiFi.macAddress().c_str());
 	std::string msg = "{ \"MAC\": \"" + std::string(WiFi.macAddress().c_str()) + 
@@ -299,72 +602,201 @@ void SendTLM(){
                         ", \"BSSID\": \"" + WiFi.BSSIDstr().c_str() + "\"";
 
     if(maxlipo_attached){
+        float percent = maxlipo.cellPercent();
         msg = msg + ", \"BATT_VOLTAGE\": " + std::to_string(maxlipo.cellVoltage()) +
-                    ", \"BATT_PERCENTAGE\": " + std::to_string(maxlipo.cellPercent()) + "}";
+                    ", \"BATT_PERCENTAGE\": " + std::to_string(percent);
+        adaptive_update_battery(percent);
     }else{
         msg = msg + ", \"BATT_VOLTAGE\": -1" +
-                    ", \"BATT_PERCENTAGE\": -1}";
+                    ", \"BATT_PERCENTAGE\": -1";
     }
+
+    // phase times of the last wakes
+    const char* task_names[NUM_TASKS];
+    for(size_t i = 0; i < NUM_TASKS; i++) task_names[i] = tasks[i].name;
+    msg = msg + ", " + profile_to_json(task_names, NUM_TASKS) + "}";
     
     digitalWrite(PWR_EN, LOW);
-	//instance.mailMessage(&mqtt_client, topic, msg);
+    // reconnects to the broker if needed, see `MqttSink`
     log_data(topic, msg);
 }
 
 
 /**
- * @brief      Perform a state transition based on the number of reset counts
+ * @brief Check if a task is due and can run this wake.
+ *
+ * @param[in] t The task.
+ * @param[in] reset_count The current reset count.
+ * @param[in] radio_tasks_can_log `false` if there is neither WiFi nor a uSD card to log to.
+ *
+ * @returns `true` if the task should run now, tasks which can't are left due and retried next wake
+ */
+bool task_can_run(const struct task* t, int reset_count, bool radio_tasks_can_log){
+    if(reset_count - t->t0 < task_period(t)) return false;
+    return !t->needs_radio || radio_tasks_can_log;
+}
+
+SemaphoreHandle_t task_done = NULL; //!< given once by each concurrent task when it finishes
+
+/**
+ * @brief FreeRTOS task body of a concurrent task, runs its handler then signals `task_done`.
+ *
+ * @param[in] arg The `struct task` to run.
+ */
+void task_runner(void* arg){
+    struct task* t = (struct task*)arg;
+    profile_begin(PHASE_TASKS + (t - tasks));
+    t->handler();
+    profile_end(PHASE_TASKS + (t - tasks));
+    xSemaphoreGive(task_done);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Start a task as a FreeRTOS task pinned to its core.
+ *
+ * @param[in] t The task, `t->core` must not be `TASK_SEQUENTIAL`.
+ *
+ * @returns `true` if the task was started and will give `task_done`, `false` otherwise
+ */
+bool task_start(struct task* t){
+    if(task_done == NULL) task_done = xSemaphoreCreateCounting(NUM_TASKS, 0);
+    if(task_done == NULL) return false;
+
+    return xTaskCreatePinnedToCore(task_runner, t->name, TASK_STACK_SIZE, t, 1, NULL, t->core) == pdPASS;
+}
+
+/**
+ * @brief Service the MQTT client between tasks, the logging task may be publishing.
+ */
+void mqtt_client_loop(){
+	log_lock();
+	mqtt_client.loop();
+	log_unlock();
+}
+
+/**
+ * @brief      Save the planner to NVS, then run every task in the registry which is due
+ *
+ * The due tasks are marked as run and the planner committed before any of them
+ * starts, so a handler which hangs until the watchdog resets the device, or which
+ * reboots it, is not run again on every following wake.
+ *
+ * Tasks pinned to a core run concurrently and are joined before the sequential
+ * tasks run, see `tasks`. While any task runs the readings are queued for the
+ * logging task, see log_pipeline.hpp. Periods changed by the tasks are saved to NVS next to
+ * the planner afterwards, see adaptive_rate.hpp.
  *
  * @param[in]  reset_count The number of resets that have been performed in this epoch
  */
 void Scheduler(int reset_count){
 
     // bounds checking -> error msgs
-	if(reset_count < 0 || reset_count > MAX_COUNT || planner.analog_t0 > reset_count){
+	if(reset_count < 0 || reset_count > MAX_COUNT || tasks[0].t0 > reset_count){
 		if(DEBUG) Serial.println("[ERROR] over ran max reset count without reseting count, check if variable is being reset or if tasks are not completing");
-		//Serial.printf("\tPlanner { read analog [%d], read ht [%d], published MQTT [%d] }\n", planner.readAnalog, planner.readHT, planner.publishedMQTT);
-		reset_count = planner.analog_t0 = planner.ht_t0 = planner.ota_t0 = planner.tlm_t0 = 1;
-		gator_prefs.putInt("reset_count", reset_count);	
-		gator_prefs.putInt("analog_t0", planner.analog_t0);
-		gator_prefs.putInt("ht_t0", planner.ht_t0);
-		gator_prefs.putInt("ota_t0", planner.ota_t0);
-		gator_prefs.putInt("tlm_t0", planner.tlm_t0);
+		planner_reset(1);
+		reset_count = 1;
+		// a cold boot counts the ticks since the epoch was saved from the reset count
+		epoch_clock_save(reset_count);
 	}
 
-    bool run_vwc = reset_count - planner.analog_t0 >= VWC_FREQ;
-    bool run_ht = reset_count - planner.ht_t0 >= HT_FREQ;
-    bool run_ota_update = reset_count - planner.ota_t0 >= OTA_FREQ;
-    bool run_tlm = reset_count - planner.tlm_t0 >= TLM_FREQ;
+	// tasks using the radio have nowhere to log to without WiFi or a uSD card
+	bool radio_tasks_can_log = logging_available || WiFi.status() == WL_CONNECTED;
 
-	if(run_vwc){
-		ReadWired();
-		planner.analog_t0 = reset_count;
-		gator_prefs.putInt("analog_t0", planner.analog_t0);
-        mqtt_client.loop();
+	bool due[NUM_TASKS];
+	for(size_t i = 0; i < NUM_TASKS; i++){
+		due[i] = task_can_run(&tasks[i], reset_count, radio_tasks_can_log);
+		if(due[i]) tasks[i].t0 = reset_count;
 	}
+	SchedulerCommit(reset_count);
 
-	if(run_ht){
-		ReadHT();
-		planner.ht_t0 = reset_count;
-		gator_prefs.putInt("ht_t0", planner.ht_t0);
-		// Publish happens in callback function
-        mqtt_client.loop();
+	// readings of every task are queued for the logging task until the last one finishes
+	bool queued = false;
+	for(size_t i = 0; i < NUM_TASKS && !queued; i++){
+		if(due[i]) queued = log_pipeline_start();
 	}
 
-	if(run_ota_update){
-		planner.ota_t0 = reset_count;
-		gator_prefs.putInt("ota_t0", planner.ota_t0);
-		OTAUpdate();
-        mqtt_client.loop();
+	// start the concurrent tasks, then wait for all of them
+	int started = 0;
+	for(size_t i = 0; i < NUM_TASKS; i++){
+		struct task* t = &tasks[i];
+		if(t->core == TASK_SEQUENTIAL || !due[i]) continue;
+
+		if(task_start(t)){
+			started++;
+		}else{
+			if(DEBUG) Serial.printf("[ERROR] failed to start task %s, running it in loop()\n", t->name);
+			t->handler();
+		}
 	}
+	for(int i = 0; i < started; i++) xSemaphoreTake(task_done, portMAX_DELAY);
+	if(started > 0) mqtt_client_loop();
 
-	if(run_tlm){
-		SendTLM();
-		planner.tlm_t0 = reset_count;
-		gator_prefs.putInt("tlm_t0", planner.tlm_t0);
-        mqtt_client.loop();
+	for(size_t i = 0; i < NUM_TASKS; i++){
+		struct task* t = &tasks[i];
+		if(t->core != TASK_SEQUENTIAL || !due[i]) continue;
+
+		profile_begin(PHASE_TASKS + i);
+		t->handler();
+		profile_end(PHASE_TASKS + i);
+		mqtt_client_loop();
 	}
+	if(queued) log_pipeline_stop();
+
+	UploadWiredBuffer();
+	adaptive_save();
+}
+
+/**
+ * @brief Number of ticks until the earliest task in the registry is due.
+ *
+ * @param[in] reset_count The current reset count.
+ *
+ * @returns ticks until the next task deadline, at least one and at most `MAX_SLEEP_TICKS`
+ */
+int SchedulerTicksUntilNextTask(int reset_count){
+    int ticks = MAX_SLEEP_TICKS;
+    for(size_t i = 0; i < NUM_TASKS; i++){
+        int due = tasks[i].t0 + task_period(&tasks[i]) - reset_count;
+        if(due < ticks) ticks = due;
+    }
+    return ticks < 1 ? 1 : ticks;
+}
+
+/**
+ * @brief Hibernate until the next task is due.
+ *
+ * The planned number of ticks is kept in RTC memory so the next wake can advance
+ * the reset count by all of them. The watchdog is patted first so it doesn't
+ * reset the device while it is awake; if it wakes the device before the timer,
+ * `setup()` goes straight back to sleep for the rest of the planned sleep, timed
+ * with the RTC timer, and the ticks are counted once it ends.
+ *
+ * The planner must be committed with `SchedulerCommit()` or `planner_commit_rtc()` first.
+ *
+ * @param[in] reset_count The current reset count.
+ */
+void SchedulerSleep(int reset_count){
+    int ticks = SchedulerTicksUntilNextTask(reset_count);
+    uint64_t now_us = esp_rtc_get_time_us();
+    uint32_t seconds = ticks * TICK_SECONDS;
+    if(planner_resumed){
+        // the ticks are counted by the timer wake ending the planned sleep
+        seconds = (rtc_planner.wake_rtc_us - now_us + 999999ULL) / 1000000ULL;
+        if(DEBUG) Serial.printf("[DEBUG] sleeping the last %u s of %d ticks\n", (unsigned)seconds, ticks);
+    }else{
+        if(DEBUG) Serial.printf("[DEBUG] next task due in %d ticks\n", ticks);
+        rtc_planner.wake_rtc_us = now_us + (uint64_t)seconds * 1000000ULL;
+    }
+
+    rtc_planner.sleep_ticks = ticks;
+    rtc_planner.checksum = rtc_checksum(&rtc_planner, offsetof(struct rtc_planner, checksum));
+
+    epoch_clock_sleep((uint64_t)seconds * 1000000ULL);
 
+    PatWDT();
+    profile_sleep();
+    hibernate(seconds);
 }
 
 /**
@@ -373,10 +805,8 @@ void Scheduler(int reset_count){
  * @param[in] reset_count The number of reset counts to have elapsed.
  */
 void SchedulerClearAll(int reset_count){
-    gator_prefs.putInt("ota_t0", reset_count);
-    gator_prefs.putInt("tlm_t0", reset_count);
-    gator_prefs.putInt("analog_t0", reset_count);
-    gator_prefs.putInt("ht_t0", reset_count);
+    for(size_t i = 0; i < NUM_TASKS; i++) tasks[i].t0 = reset_count;
+    SchedulerCommit(reset_count);
 }
 
 #endif
@@ -12,6 +12,9 @@
 #define RW_MODE false //!< define read/write access mode for SD card files
 
 #include <scheduler.hpp>
+#include <mqtt_connect.hpp>
+#include <mqtt_stream.hpp>
+#include <mqtt_qos1.hpp>
 
 #include <OWMAdafruit_ADS1015.h>
 #include <Adafruit_MAX1704X.h>
@@ -100,7 +103,8 @@ void setup_mqtt_connection(){
         double perc = ESP.getFreeHeap();
         Serial.println(perc);
     }
-    mqtt_client.setBufferSize(30000);
+    // larger messages are streamed, see mqtt_stream.hpp
+    mqtt_client.setBufferSize(MQTT_BUFFER_LEN);
     mqtt_client.setKeepAlive(120);
     mqtt_client.setServer(MQTT_BROKER_ADDR, MQTT_PORT);
     mqtt_client.setCallback(callback);
@@ -110,28 +114,13 @@ void setup_mqtt_connection(){
         Serial.println(perc);
     }
 
-    // connect to MQTT
-    string mqtt_client_id = string("dg_") + WiFi.macAddress().c_str();
-    // connect as persistent/durable client
-    bool mqtt_client_connected = mqtt_client.connect(mqtt_client_id.c_str(), NULL, NULL, NULL, 0, false, NULL, false);
-
-    if(mqtt_client_connected){
-        std::string unique_topic = "datagator/cmd/#";
-        Serial.print("Subscribing to ");
-        Serial.println(unique_topic.c_str());
-        mqtt_client.subscribe(unique_topic.c_str(), 1);
-        /*
-           if(USB_DEBUG){
-           Serial.print("[DEBUG] bytes free after connecting & subscribing =  ");
-           double perc = ESP.getFreeHeap();
-           Serial.println(perc);
-           }
-           */
-        if(USB_DEBUG) Serial.println("connected to MQTT client!");
-    }else{
-        if(USB_DEBUG) Serial.println("[WARNING] error with MQTT connection");
-        delay(2000);
-    }
+    // connect to MQTT as persistent/durable client, retried by the sinks within
+    //  the wake's budget, see mqtt_connect.hpp
+    profile_begin(PHASE_MQTT);
+    mqtt_backoff_reset();
+    mqtt_qos1_begin();
+    mqtt_reconnect();
+    profile_end(PHASE_MQTT);
 
 }
 
@@ -157,6 +146,7 @@ void setup_ble(){
  */
 void setup_wifi_connection(){
 
+    profile_begin(PHASE_WIFI);
     WiFi.begin(NETWORK, PSSWD);
     //wifi_client.setInsecure();
 
@@ -178,6 +168,7 @@ void setup_wifi_connection(){
             // collect data, but store locally
         }    
     }
+    profile_end(PHASE_WIFI);
 
     // can start time client w/o wifi
     //  but can't update
@@ -199,7 +190,7 @@ void setup_wifi_connection(){
  */
 void setup_wireless_connections(){
 
-    if (task_is_scheduled(reset_count)){
+    if (radio_is_needed(reset_count)){
 	    setup_wifi_connection(); 
         setup_mqtt_connection();
         setup_ble();
@@ -218,13 +209,23 @@ void setup_logging(){
     //          turning off power to card while initialized 
     //          seems to terminate the connection
     digitalWrite(SD_PWR_EN, HIGH);
+    // log_to_sd_file() uses it without WiFi too
+    if(tsb == NULL) tsb = new TimeStampBuilder(&timeClient);
     if(WiFi.status() == WL_CONNECTED){
         // update with NTP
-        timeClient.update();
-        absolute_timestamp_available = true;
+        profile_begin(PHASE_NTP);
+        if(timeClient.forceUpdate()) epoch_clock_sync(timeClient.getEpochTime());
+        profile_end(PHASE_NTP);
     }
 
+    profile_begin(PHASE_SD);
     logging_available = init_data_logger();
+    profile_end(PHASE_SD);
+    // readings are queued in flash if neither the SD card nor the broker is reachable,
+    // mounted before the tasks which check it from both cores start
+    flash_queue_begin();
+    if(!logging_available) flash_queue_mount();
+    backfill_begin();
 
 }
 
@@ -30,6 +30,22 @@ using namespace std;
 #define OTA_SERVER "192.168.50.10" //!< Over-The-Air update server address
 extern const bool USB_DEBUG;        
 extern PubSubClient mqtt_client;    //!< MQTT client object for logging
+void log_lock();                    //!< see logger.hpp
+void log_unlock();
+void log_pipeline_stop();           //!< see log_pipeline.hpp
+
+/**
+ * @brief Publish an update status message.
+ *
+ * The logging task may be publishing readings of the same wake, the client is only
+ * used with the logging lock held.
+ */
+void mail_update_status(const std::string& topic, const std::string& msg){
+    MQTTMailer instance = MQTTMailer::getInstance();
+    log_lock();
+    instance.mailMessage(&mqtt_client, topic, msg);
+    log_unlock();
+}
 
 /**
  * @brief Check if server has different firmware version.
@@ -68,14 +84,13 @@ string new_firmware_version_available() {
         int version_minor = stoi(fw_filename.substr(fw_filename.length()-7, 1));
         int version_patch = stoi(fw_filename.substr(fw_filename.length()-5, 1));
 
-        MQTTMailer instance = MQTTMailer::getInstance();
         std::string topic = "datagator/ota_status/" + std::string(WiFi.macAddress().c_str());
         std::string msg = "{\"STATUS_MSG\": \"version\", \"SERVER_FW_VERSION\": \"" + fw_version + 
                 "\", \"DEVICE_FW_VERSION\": \"v" + to_string(VERSION_MAJOR) + 
                 "." + to_string(VERSION_MINOR) + 
                 "." + to_string(VERSION_PATCH) + 
                 "\"}";
-        instance.mailMessage(&mqtt_client, topic, msg);
+        mail_update_status(topic, msg);
     
 
         if(USB_DEBUG) Serial.printf("\tv_maj: %d, v_min: %d, v_patch: %d\n", version_major, version_minor, version_patch);
@@ -120,10 +135,11 @@ void update_progress(int cur, int total){
  */
 void update_started(){
 	if(USB_DEBUG) Serial.println("CALLBACK: HTTP update process started");
-    MQTTMailer instance = MQTTMailer::getInstance();
+    // the device reboots into the new firmware, deliver the readings still queued
+    log_pipeline_stop();
     std::string topic = "datagator/ota_status/" + std::string(WiFi.macAddress().c_str());
     std::string msg = "{\"STATUS_MSG\": \"started\"}";
-    instance.mailMessage(&mqtt_client, topic, msg);
+    mail_update_status(topic, msg);
 
 }
 
@@ -135,10 +151,9 @@ void update_started(){
  */
 void update_finished(){
 	if(USB_DEBUG) Serial.println("update finished");
-    MQTTMailer instance = MQTTMailer::getInstance();
     std::string topic = "datagator/ota_status/" + std::string(WiFi.macAddress().c_str());
     std::string msg = "{\"STATUS_MSG\": \"finished\"}";
-    instance.mailMessage(&mqtt_client, topic, msg);
+    mail_update_status(topic, msg);
 
 }
 
@@ -152,10 +167,9 @@ void update_finished(){
  */
 void update_error(int err) {
     if(USB_DEBUG) Serial.printf("CALLBACK:  HTTP update fatal error code %d\n", err);
-	MQTTMailer instance = MQTTMailer::getInstance();
     std::string topic = "datagator/ota/" + std::string(WiFi.macAddress().c_str());
     std::string msg = "{\"STATUS_MSG\": \"error\"}";
-    instance.mailMessage(&mqtt_client, topic, msg);
+    mail_update_status(topic, msg);
 }
 
 /**
@@ -194,7 +208,7 @@ void attempt_update() {
             string fw_url = string("http://") + string(OTA_SERVER) + string("/") + file_name;
             if(USB_DEBUG) Serial.println(fw_url.c_str());
 
-            t_httpUpdate_return ret = httpUpdate.update(client, fw_url.c_str());
+            httpUpdate.update(client, fw_url.c_str());
         }
 	}
 }
@@ -0,0 +1,203 @@
+/**
+ * @file wake_profile.hpp
+ * @brief Per-phase timing of each wake, kept in RTC memory and reported in telemetry.
+ *
+ * Each phase of a wake (WiFi association, MQTT connect, SD init, each scheduler
+ * task, ...) is timed with `esp_timer_get_time()` between `profile_begin()` and
+ * `profile_end()`. The times of the last `PROFILE_HISTORY_LEN` wakes which ran
+ * tasks are kept in an RTC memory ring and `SendTLM()` publishes the min/avg/max
+ * of each phase so slow sites and regressions show up in the telemetry.
+ *
+ * The record of a wake is saved by `profile_save()` before the planner's sleep is
+ * programmed; `profile_sleep()` adds the time from there until deep sleep is
+ * entered. Only the register writes of `esp_deep_sleep_start()` are not counted.
+ *
+ * The history does not survive a cold boot.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef WAKE_PROFILE_HPP
+#define WAKE_PROFILE_HPP
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <cstddef>
+#include <string>
+#include <rtc_state.hpp>
+
+/** Number of wakes kept in the history. */
+#define PROFILE_HISTORY_LEN 8
+/** Maximum number of scheduler tasks which can be timed, see `PHASE_TASKS`. */
+#define PROFILE_MAX_TASKS 8
+
+/**
+ * @brief Phases of a wake.
+ *
+ * Scheduler task `i` of the registry is timed as phase `PHASE_TASKS + i`.
+ */
+enum profile_phase{
+    PHASE_GPIO,     //!< `setup_gpio()`
+    PHASE_I2C,      //!< `setup_i2c_sensors()`
+    PHASE_NVS,      //!< `init_nvs()`
+    PHASE_WIFI,     //!< WiFi association
+    PHASE_MQTT,     //!< MQTT connect and subscribe
+    PHASE_NTP,      //!< NTP update
+    PHASE_SD,       //!< uSD card init
+    PHASE_AWAKE,    //!< boot until sleep is entered
+    PHASE_SLEEP,    //!< `profile_save()` until sleep is entered
+    PHASE_TASKS     //!< first scheduler task
+};
+
+/** Total number of phases, including the scheduler tasks. */
+#define PROFILE_PHASES (PHASE_TASKS + PROFILE_MAX_TASKS)
+
+/** Names of the phases before `PHASE_TASKS`, as reported in telemetry. */
+const char* profile_phase_names[PHASE_TASKS] = {"gpio", "i2c", "nvs", "wifi", "mqtt", "ntp", "sd", "awake", "sleep"};
+
+/**
+ * @brief Phase times of one wake.
+ */
+struct wake_profile{
+    /** bit `i` set if phase `i` ran */
+    uint32_t ran;
+    /** time spent in each phase in microseconds */
+    uint32_t phase_us[PROFILE_PHASES];
+};
+
+/**
+ * @brief History of the last wakes, kept in RTC memory.
+ */
+struct rtc_profile{
+    /** number of wakes in the history */
+    int count;
+    /** index the next wake is saved at */
+    int next;
+    struct wake_profile wakes[PROFILE_HISTORY_LEN];
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct rtc_profile rtc_profile;
+
+struct wake_profile profile_current;            //!< phase times of this wake
+int64_t profile_start_us[PROFILE_PHASES];       //!< `esp_timer_get_time()` when each phase began
+int64_t profile_saved_us = 0;                   //!< `esp_timer_get_time()` when this wake was saved, 0 if not yet
+
+/**
+ * @brief Start profiling a wake and check the history left in RTC memory by the last one.
+ *
+ * The history is cleared if RTC memory was lost. Must be called once per boot,
+ * before any phase is timed.
+ */
+void profile_init(){
+    memset(&profile_current, 0, sizeof(profile_current));
+    profile_saved_us = 0;
+
+    bool valid = rtc_profile.count >= 0 && rtc_profile.count <= PROFILE_HISTORY_LEN &&
+        rtc_profile.next >= 0 && rtc_profile.next < PROFILE_HISTORY_LEN &&
+        rtc_profile.checksum == rtc_checksum(&rtc_profile, offsetof(struct rtc_profile, checksum));
+
+    if(!valid){
+        memset(&rtc_profile, 0, sizeof(rtc_profile));
+        rtc_profile.checksum = rtc_checksum(&rtc_profile, offsetof(struct rtc_profile, checksum));
+    }
+}
+
+/**
+ * @brief Start timing a phase.
+ *
+ * @param[in] phase The phase, `PHASE_TASKS + i` for scheduler task `i`.
+ */
+void profile_begin(int phase){
+    if(phase < 0 || phase >= PROFILE_PHASES) return;
+    profile_start_us[phase] = esp_timer_get_time();
+}
+
+/**
+ * @brief Stop timing a phase started with `profile_begin()`.
+ *
+ * Phases which run more than once in a wake add up.
+ *
+ * @param[in] phase The phase.
+ */
+void profile_end(int phase){
+    if(phase < 0 || phase >= PROFILE_PHASES) return;
+    profile_current.phase_us[phase] += (uint32_t)(esp_timer_get_time() - profile_start_us[phase]);
+    profile_current.ran |= 1UL << phase;
+}
+
+/**
+ * @brief Record the time until now as `PHASE_AWAKE` and add this wake to the history.
+ */
+void profile_save(){
+    profile_saved_us = esp_timer_get_time();
+    profile_current.phase_us[PHASE_AWAKE] = (uint32_t)profile_saved_us;
+    profile_current.ran |= 1UL << PHASE_AWAKE;
+
+    rtc_profile.wakes[rtc_profile.next] = profile_current;
+    rtc_profile.next = (rtc_profile.next + 1) % PROFILE_HISTORY_LEN;
+    if(rtc_profile.count < PROFILE_HISTORY_LEN) rtc_profile.count++;
+    rtc_profile.checksum = rtc_checksum(&rtc_profile, offsetof(struct rtc_profile, checksum));
+}
+
+/**
+ * @brief Add the time since `profile_save()` to the wake's record, right before sleeping.
+ *
+ * Sets `PHASE_SLEEP` and extends `PHASE_AWAKE` to now. Does nothing on wakes which
+ * were not saved, eg. when no task was due.
+ */
+void profile_sleep(){
+    if(profile_saved_us == 0) return;
+    int64_t now = esp_timer_get_time();
+
+    struct wake_profile* w = &rtc_profile.wakes[(rtc_profile.next + PROFILE_HISTORY_LEN - 1) % PROFILE_HISTORY_LEN];
+    w->phase_us[PHASE_SLEEP] = (uint32_t)(now - profile_saved_us);
+    w->phase_us[PHASE_AWAKE] = (uint32_t)now;
+    w->ran |= 1UL << PHASE_SLEEP;
+    rtc_profile.checksum = rtc_checksum(&rtc_profile, offsetof(struct rtc_profile, checksum));
+    profile_saved_us = 0;
+}
+
+/**
+ * @brief Build the telemetry JSON field with the min/avg/max of each phase in the history.
+ *
+ * Phases which did not run in any of the saved wakes are left out.
+ *
+ * @param[in] task_names Names of the scheduler tasks, in registry order.
+ * @param[in] num_tasks Number of entries in \p task_names.
+ *
+ * @returns `"PROFILE_MS": {"<phase>": [min, avg, max], ...}`, times in milliseconds
+ */
+std::string profile_to_json(const char* const* task_names, size_t num_tasks){
+    std::string json = "\"PROFILE_MS\": {";
+    bool first = true;
+
+    for(int phase = 0; phase < PHASE_TASKS + (int)num_tasks && phase < PROFILE_PHASES; phase++){
+        uint32_t min_us = UINT32_MAX, max_us = 0;
+        uint64_t sum_us = 0;
+        int n = 0;
+
+        for(int i = 0; i < rtc_profile.count; i++){
+            const struct wake_profile* w = &rtc_profile.wakes[i];
+            if(!(w->ran & (1UL << phase))) continue;
+
+            uint32_t us = w->phase_us[phase];
+            if(us < min_us) min_us = us;
+            if(us > max_us) max_us = us;
+            sum_us += us;
+            n++;
+        }
+        if(n == 0) continue;
+
+        const char* name = phase < PHASE_TASKS ? profile_phase_names[phase] : task_names[phase - PHASE_TASKS];
+        json += std::string(first ? "" : ", ") + "\"" + name + "\": [" +
+                std::to_string(min_us / 1000) + ", " +
+                std::to_string(sum_us / n / 1000) + ", " +
+                std::to_string(max_us / 1000) + "]";
+        first = false;
+    }
+    return json + "}";
+}
+
+#endif
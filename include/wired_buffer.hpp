@@ -0,0 +1,128 @@
+/**
+ * @file wired_buffer.hpp
+ * @brief Buffer for wired sensor samples taken while the radio is off.
+ *
+ * Bringing up WiFi and MQTT is the most expensive part of a wake. When `UPLOAD_FREQ`
+ * is greater than one, wired sensor samples are kept in RTC memory instead of being 
+ * published right away and the radio is only turned on every `UPLOAD_FREQ` samples
+ * to upload the whole batch in one session, see `radio_is_needed()`.
+ *
+ * Samples are stored as raw readings, the MQTT messages are built when they are
+ * uploaded. The buffer does not survive a cold boot; samples are logged to the uSD
+ * card, if available, when they are taken.
+ *
+ * Samples whose readings are replayed from the uSD card, see backfill.hpp, or wait
+ * in the flash queue, see flash_queue.hpp, are published from there and only
+ * counted in `logged`, so the radio still comes up every `UPLOAD_FREQ` samples.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef WIRED_BUFFER_HPP
+#define WIRED_BUFFER_HPP
+
+#include <Arduino.h>
+#include <cstddef>
+#include <rtc_state.hpp>
+
+/** Maximum number of samples held in RTC memory, the oldest sample is dropped when full. */
+#define WIRED_BUFFER_LEN 24
+/** Size of one EZO pH reading string, eg "14.000" */
+#define WIRED_PH_LEN 8
+/** Number of EZO pH sensor addresses read, normal/shallow/middle/deep */
+#define WIRED_PH_SENSORS 4
+
+/**
+ * @brief Raw readings of all wired sensors from one `ReadWired()`.
+ */
+struct wired_sample{
+    /** `epoch_now()` when the sample was taken */
+    uint32_t epoch;
+    /** ADS1115 counts, shallow/middle/deep VWC and analog pH */
+    int16_t raw_analog[4];
+    /** EZO pH readings, empty string if no sensor at the address */
+    char pH[WIRED_PH_SENSORS][WIRED_PH_LEN];
+};
+
+/**
+ * @brief Samples waiting for upload, kept in RTC memory.
+ */
+struct wired_buffer{
+    int count;
+    /** samples taken since the last upload which are published from elsewhere */
+    int logged;
+    struct wired_sample samples[WIRED_BUFFER_LEN];
+    /** `rtc_checksum()` of the members above */
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR struct wired_buffer wired_buffer;
+
+/**
+ * @brief Update the checksum after changing the buffer.
+ */
+void wired_buffer_seal(){
+    wired_buffer.checksum = rtc_checksum(&wired_buffer, offsetof(struct wired_buffer, checksum));
+}
+
+/**
+ * @brief Empty the buffer.
+ */
+void wired_buffer_clear(){
+    wired_buffer.count = 0;
+    wired_buffer.logged = 0;
+    wired_buffer_seal();
+}
+
+/**
+ * @brief Check the buffer left in RTC memory by the last wake, empty it if RTC memory was lost.
+ *
+ * Must be called once per boot before the buffer is used.
+ */
+void wired_buffer_init(){
+    bool valid = wired_buffer.count >= 0 && wired_buffer.count <= WIRED_BUFFER_LEN &&
+        wired_buffer.logged >= 0 && wired_buffer.logged <= UPLOAD_FREQ &&
+        wired_buffer.checksum == rtc_checksum(&wired_buffer, offsetof(struct wired_buffer, checksum));
+
+    if(!valid) wired_buffer_clear();
+}
+
+/**
+ * @brief Append a sample, dropping the oldest one if the buffer is full.
+ *
+ * @param[in] sample The sample to append.
+ */
+void wired_buffer_push(const struct wired_sample* sample){
+    if(wired_buffer.count == WIRED_BUFFER_LEN){
+        if(DEBUG) Serial.println("[WARNING] wired sample buffer full, dropping oldest sample");
+        memmove(&wired_buffer.samples[0], &wired_buffer.samples[1], sizeof(struct wired_sample) * (WIRED_BUFFER_LEN - 1));
+        wired_buffer.count--;
+    }
+    wired_buffer.samples[wired_buffer.count++] = *sample;
+    wired_buffer_seal();
+}
+
+/**
+ * @brief Count a sample which is not buffered, its readings are published from elsewhere.
+ */
+void wired_buffer_skip(){
+    if(wired_buffer.logged < UPLOAD_FREQ) wired_buffer.logged++;
+    wired_buffer_seal();
+}
+
+/**
+ * @brief Remove the first \p n samples, ie the ones which were uploaded.
+ *
+ * @param[in] n Number of samples to remove.
+ */
+void wired_buffer_drop(int n){
+    if(n >= wired_buffer.count){
+        wired_buffer_clear();
+        return;
+    }
+    memmove(&wired_buffer.samples[0], &wired_buffer.samples[n], sizeof(struct wired_sample) * (wired_buffer.count - n));
+    wired_buffer.count -= n;
+    wired_buffer_seal();
+}
+
+#endif
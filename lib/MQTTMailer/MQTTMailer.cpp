@@ -8,7 +8,7 @@
  *
  * @return     String message for publishing, should be properly formatted as a JSON object
  */
-std::string MQTTMail::getMessage(){
+const std::string& MQTTMail::getMessage(){
 	return this->message;
 }
 
@@ -17,7 +17,7 @@ std::string MQTTMail::getMessage(){
  *
  * @return     String topic to publish to.
  */
-std::string MQTTMail::getTopic(){
+const std::string& MQTTMail::getTopic(){
     return this->topic;
 }
 
@@ -27,45 +27,39 @@ std::string MQTTMail::getTopic(){
  *
  * @param[in]  topic    The topic/destination for the message
  * @param[in]  message  The message in string form
+ *
+ * @return     `true` if the client accepted the message
  */
-void MQTTMailer::mailMessage(
+bool MQTTMailer::mailMessage(
         PubSubClient* mqtt_client, 
-        std::string topic, 
-        std::string message,
+        const std::string& topic, 
+        const std::string& message,
         bool serial_debug){
-    bool success = mqtt_client->publish(topic.c_str(), message.c_str());
-    if(!success){
-       Serial.printf("\tfailed to send %s | %s", topic.c_str(), message.c_str());
-    }
-    if(USB_DEBUG && serial_debug) Serial.printf("\t-> sent \'%s\' | \'%s\'\n", topic.c_str(), message.c_str());
+    return mailMessage(mqtt_client, topic.c_str(), message.c_str(), serial_debug);
 }
 
 /**
- * @brief      Attempt to reconnect to MQTT broker every 5 seconds until successful
+ * @brief      Publish an MQTT message without copying it.
  *
- * @param[in]  mqtt_client  The mqtt client
+ * The message must fit the client's buffer, longer ones are streamed by
+ * `mqtt_publish()` of the firmware's mqtt_stream.hpp.
+ *
+ * @param[in]  topic    The topic/destination for the message, NUL terminated
+ * @param[in]  message  The message, NUL terminated
+ *
+ * @return     `true` if the client accepted the message
  */
-void MQTTMailer::reconnect(PubSubClient mqtt_client){
-
-    while(!mqtt_client.connected()){
-        if(USB_DEBUG) Serial.println("Attempting MQTT connection...");
-        if(/*mqtt_client.connect("aggregator", "vineyard", "R0b0tslab")*/mqtt_client.connect("aggregator")){
-            if(USB_DEBUG)Serial.println("connected");
-            // TODO: subscribe to topics here
-            //mqtt_client.subscribe("topic");
-        }else{
-            if(USB_DEBUG){
-                if(USB_DEBUG){
-                    Serial.print("\tconnection failed. rc = ");
-                    Serial.println(mqtt_client.state());
-                }
-            }
-            delay(5000);
-        }
+bool MQTTMailer::mailMessage(
+        PubSubClient* mqtt_client, 
+        const char* topic, 
+        const char* message,
+        bool serial_debug){
+    bool success = mqtt_client->publish(topic, message);
+    if(!success){
+       Serial.printf("\tfailed to send %s | %s\n", topic, message);
     }
-
-    if(USB_DEBUG) Serial.println("MQTT Connection successful...");
-
+    if(USB_DEBUG && serial_debug) Serial.printf("\t-> sent \'%s\' | \'%s\'\n", topic, message);
+    return success;
 }
 
 /**
@@ -42,8 +42,8 @@ public:
 		this->message = message;
 	}
 	
-	std::string getMessage(); // output MQTT compatible representation of data
-	std::string getTopic();	 // get the topic string connected to this message
+	const std::string& getMessage(); // output MQTT compatible representation of data
+	const std::string& getTopic();	 // get the topic string connected to this message
                              //
     std::string to_string(){ return getTopic() + getMessage(); }
 
@@ -64,13 +64,17 @@ public:
 		return instance;
 	}
 
-	void mailMessage(
+	bool mailMessage(
             PubSubClient* mqtt_client, 
-            std::string topic, 
-            std::string message,
+            const std::string& topic, 
+            const std::string& message,
+            bool serial_debug=true);
+	bool mailMessage(
+            PubSubClient* mqtt_client, 
+            const char* topic, 
+            const char* message,
             bool serial_debug=true);
 
-	void reconnect(PubSubClient mqtt_client);
 	std::string buildMessage(std::string* elements, int num_elements);
 
 private:
@@ -62,7 +62,8 @@ extern int reset_count; //!< number of resets retrieved for NVS
 const bool USB_DEBUG = DEBUG; //!< USB serial debugging enabled
 
 WiFiClient wifi_client; //!< WiFi stack object
-PubSubClient mqtt_client(wifi_client); //!< MQTT client object
+MqttAckFilter mqtt_ack_filter(wifi_client); //!< takes the QoS 1 acknowledgements out of the MQTT stream
+PubSubClient mqtt_client(mqtt_ack_filter); //!< MQTT client object
 /** NVS memory access interface. */
 Preferences gator_prefs; //!< NVS memory object
 
@@ -73,29 +74,51 @@ Preferences gator_prefs; //!< NVS memory object
  * can be found below:
  *
  *  1. initializes gpio pins,
- *  2. initializes i2c sensors,
- *  3. starts serial debug interface and waits 1 sec (defaults to 115200 baud),
- *  4. initializes the non-volatile memory system (specific to ESP32, adapt for other uC), 
- *  5. initializes wireless connections,
- *  6. initializes logging systems and configures flags based on what logging interfaces are available.
+ *  2. starts serial debug interface (defaults to 115200 baud),
+ *  3. initializes the non-volatile memory system (specific to ESP32, adapt for other uC), 
+ *  4. goes back to sleep if no task is due, eg. after a watchdog reset, without reaching `loop()`,
+ *  5. waits 1 sec and initializes i2c sensors,
+ *  6. initializes wireless connections,
+ *  7. initializes logging systems and configures flags based on what logging interfaces are available.
  *
  */
 void setup(){
 
+    // time each phase of the wake, see wake_profile.hpp
+    profile_init();
+
     // initialize pins for output/input and set default state
+    profile_begin(PHASE_GPIO);
     setup_gpio();
-    // initialize adc and fuel gauge and other i2c bus sensors
-    setup_i2c_sensors();
+    profile_end(PHASE_GPIO);
     // start serial by default for printing firmware version
 	Serial.begin(115200);
-	delay(1000);
 	// start non-volatile storage system (NVS)
+	profile_begin(PHASE_NVS);
 	init_nvs();
+	profile_end(PHASE_NVS);
+    // if woken before a task is due (eg. by the watchdog timer), count the ticks and sleep
+    if(!task_is_scheduled(reset_count)){
+        // NVS only needs the tick if RTC memory was lost, it would be lost again
+        if(planner_from_rtc) planner_commit_rtc(reset_count);
+        else SchedulerCommit(reset_count);
+        SchedulerSleep(reset_count);
+        return;
+    }
+	delay(1000);
+    // initialize adc and fuel gauge and other i2c bus sensors
+    profile_begin(PHASE_I2C);
+    setup_i2c_sensors();
+    profile_end(PHASE_I2C);
+    // warm up the wired sensors while connecting
+    if(task_is_due(ReadWired, reset_count)) sensor_power_on();
     Serial.printf("FIRMWARE VERSION v%i.%i.%i\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
     // connect to WiFi, BLE, etc
     setup_wireless_connections();
     // detect logging options (MQTT, SD card, etc)
     setup_logging();
+    // tasks run concurrently by the scheduler log through log_data()
+    log_lock_init();
 
 }
 
@@ -107,49 +130,48 @@ void setup(){
  *  
  *  1. reads sensors, 
  *  2. logs data, 
- *  3. and finishes by putting the system into hibernation to conserve energy.
+ *  3. and finishes by putting the system into hibernation until the next task is due to conserve energy.
  *
  */
 void loop(){
-    // if no logging or wifi, sleep
-    if(!logging_available && WiFi.status() != WL_CONNECTED){
+    if(WiFi.status() == WL_CONNECTED){mqtt_client.loop();}
 
-        hibernate(65);
+    if(logging_available) Serial.println("[DEBUG] SD card detected");
 
-    }else{
-        if(WiFi.status() == WL_CONNECTED){mqtt_client.loop();}
+    // allow scheduler to run tasks
+    Scheduler(reset_count);
 
-        if(logging_available) Serial.println("[DEBUG] SD card detected");
+    // write out readings the sinks held back, eg. the MQTT batch envelope
+    log_sinks_flush();
 
-        // allow scheduler to run tasks
-        Scheduler(reset_count);
+    // publish readings queued in flash while the broker was unreachable
+    if(mqtt_client.connected()) flash_queue_drain(FLASH_QUEUE_DRAIN_MAX);
 
-        digitalWrite(SD_PWR_EN, LOW);
+    // write out the records buffered this wake before cutting uSD power
+    if(logging_available) close_data_logger();
 
-        if(logged_relative_data){
-            // save the current reset count
-            //  but don't overwrite the cached timestamp
-            cache_log_offset(reset_count);
-            cache_timestamp(time_stamp_to_cache);
+    // publish readings logged to the uSD card while the broker was unreachable
+    if(logging_available && mqtt_client.connected()) backfill_run();
 
-        }else if(logging_available && absolute_timestamp_available){
-            // save the new timestamp to NVS
-            cache_timestamp(tsb->get_date_time());
-            // reset the log_offset
-            cache_log_offset(reset_count);
+    // compress the log file of the day before, once a day
+    if(logging_available) log_archive_closed();
 
-        }else{
-            Serial.println("[DEBUG] no timestamp cached because nothing logged");
-        }
+    // remove the oldest log files once over the budget, once a day
+    if(logging_available) log_retention_closed();
+    digitalWrite(SD_PWR_EN, LOW);
+    sensor_power_off();
 
-        // go to sleep until next WDT reset
-        //  or wake from sleep
-        if(DEBUG) Serial.println("Sleeping...");
+    // save the epoch to NVS for the next cold boot
+    epoch_clock_save(reset_count);
 
-        //deep_sleep(120);
-        if(WiFi.status() == WL_CONNECTED){mqtt_client.loop();}
-        hibernate(65); // has same effect as watchdog
-    }
+    // go to sleep until next WDT reset
+    //  or wake from sleep
+    if(DEBUG) Serial.println("Sleeping...");
+
+    //deep_sleep(120);
+    if(WiFi.status() == WL_CONNECTED){mqtt_client.loop();}
+    profile_save();
+    SchedulerSleep(reset_count); // sleep until the next task is due
 
 }
 
@@ -0,0 +1,20 @@
+/**
+ * @file Adafruit_MAX1704X.h
+ * @brief Host-native stand-in for the MAX17048 battery fuel gauge.
+ */
+#ifndef NATIVE_ADAFRUIT_MAX1704X_H
+#define NATIVE_ADAFRUIT_MAX1704X_H
+
+#include <Arduino.h>
+
+/** @brief Fuel gauge reporting native_sim::battery_voltage and native_sim::battery_percent. */
+class Adafruit_MAX17048 {
+    public:
+        bool begin(){ return native_sim::fuel_gauge_present; }
+        float cellVoltage(){ return native_sim::battery_voltage; }
+        float cellPercent(){ return native_sim::battery_percent; }
+        void wake(){}
+        void quickStart(){}
+};
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * @file Arduino.h
+ * @brief Host-native stand-in for the ESP32 Arduino core.
+ *
+ * Provides the subset of the Arduino API used by the Data Gator firmware:
+ * timing, GPIO, `String`, `Serial`, `ESP` and the few FreeRTOS/ESP-IDF
+ * helpers reached through `Arduino.h` on the real core. Timing functions run
+ * against the simulated clock in native_sim.h.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "native_sim.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x01
+#define OUTPUT       0x03
+#define INPUT_PULLUP 0x05
+
+/** RTC slow memory placement; on the host every global already survives a simulated sleep. */
+#define RTC_DATA_ATTR
+/** RTC slow memory the bootloader doesn't initialize, scrambled by `native_sim::boot()` on a power-on. */
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_noinit")))
+
+inline uint16_t word(uint8_t h, uint8_t l){ return (uint16_t)((h << 8) | l); }
+
+// ---------------------------------------------------------------------
+// timing
+// ---------------------------------------------------------------------
+inline unsigned long millis(){ return (unsigned long)(native_sim::uptime_us() / 1000ULL); }
+inline unsigned long micros(){ return (unsigned long)native_sim::uptime_us(); }
+inline void delay(uint32_t ms){ native_sim::advance_us((uint64_t)ms * 1000ULL); }
+inline void delayMicroseconds(uint32_t us){ native_sim::advance_us(us); }
+
+// FreeRTOS, pulled in by the real Arduino core
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+// ---------------------------------------------------------------------
+// gpio
+// ---------------------------------------------------------------------
+inline void pinMode(uint8_t, uint8_t){}
+inline void digitalWrite(uint8_t pin, uint8_t val){
+    native_sim::AllocPause p;
+    native_sim::pins[pin] = val;
+}
+inline int digitalRead(uint8_t pin){
+    auto it = native_sim::pins.find(pin);
+    return it == native_sim::pins.end() ? LOW : it->second;
+}
+inline uint16_t analogRead(uint8_t){ return 2048; }
+
+// ---------------------------------------------------------------------
+// String
+// ---------------------------------------------------------------------
+/**
+ * @brief Minimal Arduino `String` backed by `std::string`.
+ */
+class String {
+    public:
+        String(){}
+        String(const char* s): s(s ? s : ""){}
+        String(const std::string& s): s(s){}
+        String(char c): s(1, c){}
+        String(int v): s(std::to_string(v)){}
+        String(unsigned int v): s(std::to_string(v)){}
+        String(long v): s(std::to_string(v)){}
+        String(unsigned long v): s(std::to_string(v)){}
+        String(double v, unsigned int decimals = 2){
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+            s = buf;
+        }
+
+        const char* c_str() const { return s.c_str(); }
+        unsigned int length() const { return s.length(); }
+        long toInt() const { return strtol(s.c_str(), NULL, 10); }
+
+        String& operator+=(const String& r){ s += r.s; return *this; }
+        friend String operator+(const String& l, const String& r){ return String(l.s + r.s); }
+        friend String operator+(const String& l, const char* r){ return String(l.s + r); }
+        friend String operator+(const char* l, const String& r){ return String(l + r.s); }
+        bool operator==(const String& r) const { return s == r.s; }
+        bool operator==(const char* r) const { return s == r; }
+        bool operator!=(const String& r) const { return s != r.s; }
+
+    private:
+        std::string s;
+};
+
+// ---------------------------------------------------------------------
+// Print / Serial
+// ---------------------------------------------------------------------
+class Print;
+
+/** @brief Objects which know how to print themselves, e.g. `IPAddress`. */
+class Printable {
+    public:
+        virtual ~Printable(){}
+        virtual size_t printTo(Print& p) const = 0;
+};
+
+/**
+ * @brief Formatting front end shared by `Serial` and the fake network clients.
+ */
+class Print {
+    public:
+        virtual ~Print(){}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* buf, size_t size){
+            size_t n = 0;
+            while(size--) n += write(*buf++);
+            return n;
+        }
+        size_t write(const char* str){ return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+
+        size_t print(const char* s){ return write(s); }
+        size_t print(const String& s){ return write(s.c_str()); }
+        size_t print(char c){ return write((uint8_t)c); }
+        size_t print(int v){ return printf("%d", v); }
+        size_t print(unsigned int v){ return printf("%u", v); }
+        size_t print(long v){ return printf("%ld", v); }
+        size_t print(unsigned long v){ return printf("%lu", v); }
+        size_t print(double v, int digits = 2){ return printf("%.*f", digits, v); }
+        size_t print(const Printable& p){ return p.printTo(*this); }
+
+        size_t println(){ return write("\r\n"); }
+        template<typename T> size_t println(const T& v){ size_t n = print(v); return n + println(); }
+        size_t println(double v, int digits){ size_t n = print(v, digits); return n + println(); }
+
+        size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))){
+            char buf[256];
+            va_list args;
+            va_start(args, format);
+            int len = vsnprintf(buf, sizeof(buf), format, args);
+            va_end(args);
+            if(len < 0) return 0;
+            size_t n = (size_t)len < sizeof(buf) ? (size_t)len : sizeof(buf) - 1;
+            return write((const uint8_t*)buf, n);
+        }
+};
+
+/**
+ * @brief UART0 stand-in, output is dropped unless native_sim::serial_echo is set.
+ */
+class HardwareSerial: public Print {
+    public:
+        void begin(unsigned long){}
+        void end(){}
+        void flush(){ fflush(stdout); }
+        using Print::write;
+        size_t write(uint8_t c) override {
+            if(native_sim::serial_echo) fputc(c, stdout);
+            return 1;
+        }
+        size_t write(const uint8_t* buf, size_t size) override {
+            if(native_sim::serial_echo) fwrite(buf, 1, size, stdout);
+            return size;
+        }
+};
+
+extern HardwareSerial Serial;
+
+// ---------------------------------------------------------------------
+// ESP
+// ---------------------------------------------------------------------
+/** @brief Chip information, heap figures are nominal on the host. */
+class EspClass {
+    public:
+        uint32_t getFreeHeap(){ return 180000; }
+        uint32_t getHeapSize(){ return 320000; }
+        void restart(){}
+};
+
+extern EspClass ESP;
+
+#endif
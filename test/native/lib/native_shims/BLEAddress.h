@@ -0,0 +1,12 @@
+/**
+ * @file BLEAddress.h
+ * @brief Host-native stand-in for the Bluedroid address header, aliased to NimBLE.
+ */
+#ifndef NATIVE_BLEADDRESS_H
+#define NATIVE_BLEADDRESS_H
+
+#include <NimBLEAddress.h>
+
+typedef NimBLEAddress BLEAddress;
+
+#endif
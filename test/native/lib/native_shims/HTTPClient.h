@@ -0,0 +1,25 @@
+/**
+ * @file HTTPClient.h
+ * @brief Host-native stand-in for the ESP32 HTTP client; no OTA server is reachable.
+ */
+#ifndef NATIVE_HTTPCLIENT_H
+#define NATIVE_HTTPCLIENT_H
+
+#include <WiFi.h>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+/** @brief HTTP client whose requests always fail to connect. */
+class HTTPClient {
+    public:
+        bool begin(const char* url){ return true; }
+        void end(){}
+        int GET(){
+            native_sim::advance_us(WiFi.status() == WL_CONNECTED ? 50000 : 0);
+            return HTTPC_ERROR_CONNECTION_REFUSED;
+        }
+        String getString(){ return String(); }
+        static String errorToString(int error){ return String("connection refused"); }
+};
+
+#endif
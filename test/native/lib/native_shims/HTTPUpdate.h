@@ -0,0 +1,28 @@
+/**
+ * @file HTTPUpdate.h
+ * @brief Host-native stand-in for the ESP32 HTTP firmware updater.
+ */
+#ifndef NATIVE_HTTPUPDATE_H
+#define NATIVE_HTTPUPDATE_H
+
+#include <HTTPClient.h>
+
+typedef enum {
+    HTTP_UPDATE_FAILED,
+    HTTP_UPDATE_NO_UPDATES,
+    HTTP_UPDATE_OK
+} t_httpUpdate_return;
+
+/** @brief Updater which never finds an image to install. */
+class HTTPUpdate {
+    public:
+        void onStart(void (*cb)()){}
+        void onEnd(void (*cb)()){}
+        void onProgress(void (*cb)(int, int)){}
+        void onError(void (*cb)(int)){}
+        t_httpUpdate_return update(WiFiClient& client, const char* url){ return HTTP_UPDATE_FAILED; }
+};
+
+extern HTTPUpdate httpUpdate;
+
+#endif
@@ -0,0 +1,8 @@
+/**
+ * @file HttpsOTAUpdate.h
+ * @brief Host-native stand-in for the ESP32 HTTPS OTA header, nothing from it is used.
+ */
+#ifndef NATIVE_HTTPSOTAUPDATE_H
+#define NATIVE_HTTPSOTAUPDATE_H
+
+#endif
@@ -0,0 +1,21 @@
+/**
+ * @file NimBLEAddress.h
+ * @brief Host-native stand-in for the NimBLE device address.
+ */
+#ifndef NATIVE_NIMBLEADDRESS_H
+#define NATIVE_NIMBLEADDRESS_H
+
+#include <string>
+
+/** @brief BLE MAC address kept in its printable form. */
+class NimBLEAddress {
+    public:
+        NimBLEAddress(){}
+        NimBLEAddress(const std::string& address): address(address){}
+        std::string toString() const { return address; }
+        bool equals(const NimBLEAddress& other) const { return address == other.address; }
+    private:
+        std::string address = "00:00:00:00:00:00";
+};
+
+#endif
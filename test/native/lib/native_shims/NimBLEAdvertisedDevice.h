@@ -0,0 +1,50 @@
+/**
+ * @file NimBLEAdvertisedDevice.h
+ * @brief Host-native stand-in for a device reported by a NimBLE scan.
+ *
+ * Built from a native_sim::Advert so tests can replay captured sensor
+ * advertisements through the firmware's scan callbacks.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_NIMBLEADVERTISEDDEVICE_H
+#define NATIVE_NIMBLEADVERTISEDDEVICE_H
+
+#include <Arduino.h>
+#include <NimBLEAddress.h>
+#include <NimBLEUUID.h>
+
+/** @brief One received advertisement. */
+class NimBLEAdvertisedDevice {
+    public:
+        NimBLEAdvertisedDevice(const native_sim::Advert& advert): advert(advert){}
+
+        NimBLEAddress getAddress(){ return NimBLEAddress(advert.address); }
+
+        bool haveName(){ return !advert.name.empty(); }
+        std::string getName(){ return advert.name; }
+
+        bool haveServiceUUID(){ return !advert.service_uuid.empty(); }
+        NimBLEUUID getServiceUUID(){ return NimBLEUUID(advert.service_uuid); }
+
+        bool haveServiceData(){ return !advert.service_data.empty(); }
+        std::string getServiceData(){ return advert.service_data; }
+
+        bool haveManufacturerData(){ return false; }
+        std::string getManufacturerData(){ return ""; }
+
+        int getRSSI(){ return -70; }
+
+    private:
+        const native_sim::Advert& advert;
+};
+
+/** @brief Scan result callbacks implemented by the firmware. */
+class NimBLEAdvertisedDeviceCallbacks {
+    public:
+        virtual ~NimBLEAdvertisedDeviceCallbacks(){}
+        virtual void onResult(NimBLEAdvertisedDevice* advertisedDevice) = 0;
+};
+
+#endif
@@ -0,0 +1,70 @@
+/**
+ * @file NimBLEDevice.h
+ * @brief Host-native stand-in for the NimBLE-Arduino stack.
+ *
+ * A scan delivers every advertisement in native_sim::adverts to the
+ * registered callbacks and then advances the simulated clock by the scan
+ * duration, the same wall time the radio spends listening on the device.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_NIMBLEDEVICE_H
+#define NATIVE_NIMBLEDEVICE_H
+
+#include <Arduino.h>
+#include <NimBLEAddress.h>
+#include <NimBLEUUID.h>
+#include <NimBLEAdvertisedDevice.h>
+
+/** @brief Results handle returned by a blocking scan. */
+class NimBLEScanResults {
+    public:
+        int getCount(){ return count; }
+        int count = 0;
+};
+
+typedef NimBLEScanResults BLEScanResults;
+
+/** @brief Active/passive scanner. */
+class NimBLEScan {
+    public:
+        void setAdvertisedDeviceCallbacks(NimBLEAdvertisedDeviceCallbacks* callbacks, bool wantDuplicates = false){
+            this->callbacks = callbacks;
+        }
+        void setActiveScan(bool active){}
+        void setInterval(uint16_t interval){}
+        void setWindow(uint16_t window){}
+        void clearResults(){}
+        void stop(){}
+
+        NimBLEScanResults start(uint32_t duration, bool is_continue = false){
+            NimBLEScanResults results;
+            for(const native_sim::Advert& a: native_sim::adverts){
+                NimBLEAdvertisedDevice dev(a);
+                native_sim::counters.ble_adverts++;
+                results.count++;
+                native_sim::ble_callbacks_running++;
+                if(callbacks) callbacks->onResult(&dev);
+                native_sim::ble_callbacks_running--;
+            }
+            native_sim::advance_us((uint64_t)duration * 1000000ULL);
+            return results;
+        }
+
+    private:
+        NimBLEAdvertisedDeviceCallbacks* callbacks = NULL;
+};
+
+/** @brief Stack singleton. */
+class NimBLEDevice {
+    public:
+        static void init(const std::string& deviceName){ native_sim::advance_us(80000); }
+        static void deinit(bool clearAll = false){}
+        static NimBLEScan* getScan(){
+            static NimBLEScan scan;
+            return &scan;
+        }
+};
+
+#endif
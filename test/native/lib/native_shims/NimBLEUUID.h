@@ -0,0 +1,22 @@
+/**
+ * @file NimBLEUUID.h
+ * @brief Host-native stand-in for the NimBLE UUID type.
+ */
+#ifndef NATIVE_NIMBLEUUID_H
+#define NATIVE_NIMBLEUUID_H
+
+#include <string>
+
+/** @brief 128 bit UUID kept in its printable form. */
+class NimBLEUUID {
+    public:
+        NimBLEUUID(){}
+        NimBLEUUID(const std::string& uuid): uuid(uuid){}
+        NimBLEUUID(const char* uuid): uuid(uuid){}
+        bool equals(const NimBLEUUID& other) const { return uuid == other.uuid; }
+        std::string toString() const { return uuid; }
+    private:
+        std::string uuid;
+};
+
+#endif
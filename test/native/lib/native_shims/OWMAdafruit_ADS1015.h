@@ -0,0 +1,34 @@
+/**
+ * @file OWMAdafruit_ADS1015.h
+ * @brief Host-native stand-in for the ADS1115 analog to digital converter.
+ *
+ * Channel readings come from native_sim::adc_raw.
+ */
+#ifndef NATIVE_OWMADAFRUIT_ADS1015_H
+#define NATIVE_OWMADAFRUIT_ADS1015_H
+
+#include <Arduino.h>
+
+typedef enum {
+    GAIN_TWOTHIRDS,
+    GAIN_ONE,
+    GAIN_TWO,
+    GAIN_FOUR,
+    GAIN_EIGHT,
+    GAIN_SIXTEEN
+} adsGain_t;
+
+/** @brief 16 bit, 4 channel I2C ADC. */
+class Adafruit_ADS1115 {
+    public:
+        Adafruit_ADS1115(uint8_t i2cAddress = 0x48){}
+        void begin(){}
+        void setGain(adsGain_t gain){}
+        uint16_t readADC_SingleEnded(uint8_t channel){
+            // single shot conversion at the default data rate
+            native_sim::advance_us(9000);
+            return channel < 4 ? native_sim::adc_raw[channel] : 0;
+        }
+};
+
+#endif
@@ -0,0 +1,120 @@
+/**
+ * @file Preferences.h
+ * @brief Host-native stand-in for the ESP32 `Preferences` (NVS) library.
+ *
+ * Values live in native_sim::nvs and therefore survive simulated sleeps just
+ * like flash does. Every get/put is counted so that the cost of NVS traffic
+ * per wake can be measured.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_PREFERENCES_H
+#define NATIVE_PREFERENCES_H
+
+#include <Arduino.h>
+#include <vector>
+
+/**
+ * @brief Namespaced key/value store backed by the simulated flash.
+ */
+class Preferences {
+    public:
+        bool begin(const char* name, bool readOnly = false, const char* partition_label = NULL){
+            native_sim::AllocPause p;
+            this->ns = name;
+            this->read_only = readOnly;
+            return true;
+        }
+
+        void end(){}
+
+        bool clear(){
+            native_sim::AllocPause p;
+            native_sim::counters.nvs_writes++;
+            std::string prefix = ns + "/";
+            for(auto it = native_sim::nvs.begin(); it != native_sim::nvs.end();){
+                if(it->first.compare(0, prefix.size(), prefix) == 0) it = native_sim::nvs.erase(it);
+                else ++it;
+            }
+            return true;
+        }
+
+        bool remove(const char* key){
+            native_sim::AllocPause p;
+            native_sim::counters.nvs_writes++;
+            return native_sim::nvs.erase(path(key)) > 0;
+        }
+
+        bool isKey(const char* key){
+            native_sim::AllocPause p;
+            native_sim::counters.nvs_reads++;
+            return native_sim::nvs.count(path(key)) > 0;
+        }
+
+        size_t putInt(const char* key, int32_t value){ return put(key, &value, sizeof(value)); }
+        size_t putUInt(const char* key, uint32_t value){ return put(key, &value, sizeof(value)); }
+        size_t putULong64(const char* key, uint64_t value){ return put(key, &value, sizeof(value)); }
+        size_t putBool(const char* key, bool value){ uint8_t v = value; return put(key, &v, sizeof(v)); }
+        size_t putString(const char* key, const char* value){ return put(key, value, strlen(value) + 1); }
+        size_t putString(const char* key, String value){ return putString(key, value.c_str()); }
+        size_t putBytes(const char* key, const void* value, size_t len){ return put(key, value, len); }
+
+        int32_t getInt(const char* key, int32_t defaultValue = 0){ get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+        uint32_t getUInt(const char* key, uint32_t defaultValue = 0){ get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+        uint64_t getULong64(const char* key, uint64_t defaultValue = 0){ get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+        bool getBool(const char* key, bool defaultValue = false){
+            uint8_t v = defaultValue;
+            get(key, &v, sizeof(v));
+            return v;
+        }
+
+        String getString(const char* key, String defaultValue = String()){
+            std::vector<uint8_t> v;
+            if(!lookup(key, v) || v.empty()) return defaultValue;
+            return String((const char*)v.data());
+        }
+
+        size_t getBytesLength(const char* key){
+            std::vector<uint8_t> v;
+            return lookup(key, v) ? v.size() : 0;
+        }
+
+        size_t getBytes(const char* key, void* buf, size_t maxLen){
+            std::vector<uint8_t> v;
+            if(!lookup(key, v) || v.size() > maxLen) return 0;
+            memcpy(buf, v.data(), v.size());
+            return v.size();
+        }
+
+    private:
+        std::string ns;
+        bool read_only = false;
+
+        std::string path(const char* key){ return ns + "/" + key; }
+
+        size_t put(const char* key, const void* value, size_t len){
+            if(read_only) return 0;
+            native_sim::AllocPause p;
+            native_sim::counters.nvs_writes++;
+            const uint8_t* b = (const uint8_t*)value;
+            native_sim::nvs[path(key)] = std::vector<uint8_t>(b, b + len);
+            return len;
+        }
+
+        bool lookup(const char* key, std::vector<uint8_t>& out){
+            native_sim::AllocPause p;
+            native_sim::counters.nvs_reads++;
+            auto it = native_sim::nvs.find(path(key));
+            if(it == native_sim::nvs.end()) return false;
+            out = it->second;
+            return true;
+        }
+
+        void get(const char* key, void* out, size_t len){
+            std::vector<uint8_t> v;
+            if(lookup(key, v) && v.size() == len) memcpy(out, v.data(), len);
+        }
+};
+
+#endif
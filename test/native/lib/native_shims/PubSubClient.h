@@ -0,0 +1,184 @@
+/**
+ * @file PubSubClient.h
+ * @brief Host-native stand-in for the knolleary PubSubClient MQTT client.
+ *
+ * Mirrors the public API and the buffer size limit of the real client.
+ * Published messages are recorded in native_sim::mqtt_outbox and counted;
+ * `loop()` reads the packets the broker sent on the connection, eg. the messages
+ * queued in native_sim::mqtt_inbox, and like the real client drops PUBACKs.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_PUBSUBCLIENT_H
+#define NATIVE_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <functional>
+
+#define MQTT_MAX_HEADER_SIZE 5
+#define MQTT_SOCKET_TIMEOUT 15
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+/**
+ * @brief MQTT 3.1.1 client, QoS0 publish only.
+ */
+class PubSubClient: public Print {
+    public:
+        PubSubClient(Client& client): client(&client){}
+
+        PubSubClient& setServer(const char* domain, uint16_t port){ return *this; }
+        PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE){ this->callback = callback; return *this; }
+        PubSubClient& setKeepAlive(uint16_t keepAlive){ return *this; }
+        PubSubClient& setSocketTimeout(uint16_t timeout){ socket_timeout = timeout; return *this; }
+
+        bool setBufferSize(uint16_t size){
+            if(size == 0) return false;
+            buffer_size = size;
+            return true;
+        }
+        uint16_t getBufferSize(){ return buffer_size; }
+
+        bool connect(const char* id){ return connect(id, NULL, NULL, NULL, 0, false, NULL, true); }
+        bool connect(const char* id, const char* user, const char* pass){ return connect(id, user, pass, NULL, 0, false, NULL, true); }
+        bool connect(const char* id, const char* user, const char* pass, const char* willTopic,
+                uint8_t willQos, bool willRetain, const char* willMessage, bool cleanSession){
+            // TCP + CONNECT/CONNACK round trip
+            if(!client->connect("broker", 1883)){
+                rc = MQTT_CONNECT_FAILED;
+                return false;
+            }
+            native_sim::advance_us(120000);
+            if(!native_sim::broker_available){
+                native_sim::advance_us(socket_timeout * 1000000ULL);   // no CONNACK
+                client->stop();
+                rc = MQTT_CONNECTION_TIMEOUT;
+                return false;
+            }
+            session_boot = native_sim::boot_count;
+            rc = MQTT_CONNECTED;
+            return true;
+        }
+
+        void disconnect(){
+            session_boot = 0;
+            rc = MQTT_DISCONNECTED;
+            client->stop();
+        }
+
+        bool connected(){
+            bool c = session_boot == native_sim::boot_count && client->connected() && native_sim::broker_available;
+            if(!c && rc == MQTT_CONNECTED) rc = MQTT_CONNECTION_LOST;
+            return c;
+        }
+
+        int state(){ return rc; }
+
+        bool publish(const char* topic, const char* payload){ return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, false); }
+        bool publish(const char* topic, const char* payload, bool retained){ return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, retained); }
+        bool publish(const char* topic, const uint8_t* payload, unsigned int plength){ return publish(topic, payload, plength, false); }
+        bool publish(const char* topic, const uint8_t* payload, unsigned int plength, bool retained){
+            if(!connected() || MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + plength > buffer_size){
+                native_sim::counters.mqtt_failed++;
+                return false;
+            }
+            native_sim::AllocPause p;
+            record(topic, std::string((const char*)payload, plength));
+            return true;
+        }
+
+        /** @brief Start a streamed publish of exactly `plength` payload bytes. */
+        bool beginPublish(const char* topic, unsigned int plength, bool retained){
+            if(!connected()) return false;
+            native_sim::AllocPause p;
+            stream_topic = topic;
+            stream_payload.clear();
+            stream_length = plength;
+            return true;
+        }
+        using Print::write;
+        size_t write(uint8_t c) override { return write(&c, 1); }
+        size_t write(const uint8_t* buf, size_t size) override {
+            if(!connected()) return 0;
+            native_sim::AllocPause p;
+            stream_payload.append((const char*)buf, size);
+            return size;
+        }
+        int endPublish(){
+            if(!connected() || stream_payload.size() != stream_length){
+                native_sim::counters.mqtt_failed++;
+                return 0;
+            }
+            record(stream_topic.c_str(), stream_payload);
+            return 1;
+        }
+
+        bool subscribe(const char* topic){ return subscribe(topic, 0); }
+        bool subscribe(const char* topic, uint8_t qos){ return connected(); }
+        bool unsubscribe(const char* topic){ return connected(); }
+
+        bool loop(){
+            if(!connected()) return false;
+            while(client->available() > 0){
+                int type = client->read();
+                size_t len = 0;
+                for(int shift = 0, b = 0x80; b & 0x80; shift += 7){
+                    if((b = client->read()) < 0) return false;
+                    len |= (size_t)(b & 0x7F) << shift;
+                }
+                std::string body;
+                {
+                    native_sim::AllocPause p;
+                    for(int b; body.size() < len && (b = client->read()) >= 0; ) body += (char)b;
+                }
+                if(body.size() < len) return false;
+
+                if((type & 0xF0) == 0x30 && len >= 2){
+                    size_t tlen = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+                    size_t at = 2 + tlen + ((type & 0x06) ? 2 : 0);
+                    if(at > len || !callback) continue;
+                    std::string topic, payload;
+                    {
+                        native_sim::AllocPause p;
+                        topic = body.substr(2, tlen);
+                        payload = body.substr(at);
+                    }
+                    native_sim::counters.mqtt_received++;
+                    callback((char*)topic.c_str(), (uint8_t*)payload.data(), payload.size());
+                }else if((type & 0xF0) == 0x40){
+                    native_sim::counters.mqtt_acks_dropped++;
+                }
+            }
+            return true;
+        }
+
+    private:
+        Client* client;
+        std::function<void(char*, uint8_t*, unsigned int)> callback;
+        uint16_t buffer_size = 256;
+        uint16_t socket_timeout = MQTT_SOCKET_TIMEOUT;
+        uint32_t session_boot = 0;
+        int rc = MQTT_DISCONNECTED;
+
+        std::string stream_topic;
+        std::string stream_payload;
+        unsigned int stream_length = 0;
+
+        void record(const char* topic, const std::string& payload){
+            native_sim::AllocPause p;
+            native_sim::counters.mqtt_publishes++;
+            native_sim::counters.mqtt_bytes += strlen(topic) + payload.size();
+            native_sim::note_io();
+            native_sim::mqtt_outbox.emplace_back(topic, payload);
+        }
+};
+
+#endif
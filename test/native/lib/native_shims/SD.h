@@ -0,0 +1,218 @@
+/**
+ * @file SD.h
+ * @brief Host-native stand-in for the ESP32 Arduino `SD` filesystem.
+ *
+ * Files are kept in native_sim::sd_files, the same storage the SDLogger and
+ * SDReader shims use, directories in native_sim::sd_dirs. Opening, closing and
+ * looking up a path are each counted as one FAT operation, bytes written or read
+ * through a `File` are counted as written to or read from the card.
+ *
+ * As on the device, a file can only be created in an existing directory unless
+ * `open()` is asked to create the missing ones.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_SD_H
+#define NATIVE_SD_H
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <string>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+/**
+ * @brief Handle to an open file on the simulated uSD card.
+ */
+class File {
+    public:
+        File(){}
+        File(const char* path, size_t position, bool directory = false): file_path(path), pos(position), open(true), directory(directory){}
+
+        explicit operator bool() const { return open && native_sim::sd_present; }
+
+        size_t write(uint8_t c){ return write(&c, 1); }
+        size_t write(const uint8_t* buf, size_t size){
+            if(!*this || directory) return 0;
+            native_sim::AllocPause p;
+            std::string& contents = native_sim::sd_files[file_path];
+            contents.replace(pos, size, (const char*)buf, size);
+            pos += size;
+            native_sim::counters.sd_bytes_written += size;
+            native_sim::note_io();
+            return size;
+        }
+
+        int available(){ return *this && !directory ? (int)(contents().size() - pos) : 0; }
+        int read(){
+            if(available() <= 0) return -1;
+            native_sim::counters.sd_bytes_read++;
+            return (uint8_t)contents()[pos++];
+        }
+        size_t read(uint8_t* buf, size_t size){
+            size_t n = available() < (int)size ? available() : size;
+            if(n > 0) memcpy(buf, contents().data() + pos, n);
+            pos += n;
+            native_sim::counters.sd_bytes_read += n;
+            return n;
+        }
+
+        bool seek(uint32_t position){
+            if(!*this || directory || position > contents().size()) return false;
+            pos = position;
+            return true;
+        }
+        size_t position() const { return pos; }
+        size_t size() const { return *this && !directory ? contents().size() : 0; }
+        /** @brief File name without the directory, as arduino-esp32 2.x. */
+        const char* name() const { return file_path.c_str() + file_path.rfind('/') + 1; }
+        const char* path() const { return file_path.c_str(); }
+        bool isDirectory() const { return *this && directory; }
+
+        /**
+         * @brief Next entry of a directory, in name order.
+         */
+        File openNextFile(const char* mode = FILE_READ){
+            if(!isDirectory()) return File();
+            native_sim::AllocPause p;
+            native_sim::counters.sd_file_ops++;
+            std::string prefix = file_path == "/" ? "/" : file_path + "/";
+            std::string next;
+            bool next_dir = false;
+            auto consider = [&](const std::string& path, bool dir){
+                if(path.size() <= prefix.size() || path.compare(0, prefix.size(), prefix) != 0) return;
+                if(path.find('/', prefix.size()) != std::string::npos || path <= cursor) return;
+                if(next.empty() || path < next){
+                    next = path;
+                    next_dir = dir;
+                }
+            };
+            for(const auto& f: native_sim::sd_files) consider(f.first, false);
+            for(const auto& d: native_sim::sd_dirs) consider(d, true);
+            if(next.empty()) return File();
+            cursor = next;
+            return File(next.c_str(), 0, next_dir);
+        }
+
+        void flush(){}
+        void close(){
+            if(!open) return;
+            native_sim::counters.sd_file_ops++;
+            open = false;
+        }
+
+    private:
+        std::string file_path;
+        size_t pos = 0;
+        bool open = false;
+        bool directory = false;
+        std::string cursor;     //!< last entry returned by `openNextFile()`
+
+        const std::string& contents() const {
+            native_sim::AllocPause p;
+            return native_sim::sd_files[file_path];
+        }
+};
+
+/**
+ * @brief The mounted uSD card.
+ */
+class SDFS {
+    public:
+        bool begin(uint8_t ssPin = 2, SPIClass& spi = SPI){
+            native_sim::counters.sd_file_ops++;
+            return native_sim::sd_present;
+        }
+        void end(){}
+
+        File open(const char* path, const char* mode = FILE_READ, const bool create = false){
+            if(!native_sim::sd_present) return File();
+            native_sim::AllocPause p;
+            native_sim::counters.sd_file_ops++;
+            if(is_dir(path)) return mode[0] == 'r' ? File(path, 0, true) : File();
+            bool exists = native_sim::sd_files.count(path) > 0;
+            if(mode[0] == 'r'){
+                return exists ? File(path, 0) : File();
+            }
+            if(!exists && !is_dir(parent(path))){
+                if(!create) return File();
+                // arduino-esp32 creates the missing directories
+                std::string p(path);
+                for(size_t i = p.find('/', 1); i != std::string::npos; i = p.find('/', i + 1)) native_sim::sd_dirs.insert(p.substr(0, i));
+            }
+            std::string& contents = native_sim::sd_files[path];
+            if(mode[0] == 'w') contents.clear();
+            return File(path, contents.size());
+        }
+        File open(const String& path, const char* mode = FILE_READ, const bool create = false){
+            return open(path.c_str(), mode, create);
+        }
+
+        bool exists(const char* path){
+            native_sim::AllocPause p;
+            native_sim::counters.sd_file_ops++;
+            return native_sim::sd_present && (native_sim::sd_files.count(path) > 0 || is_dir(path));
+        }
+        bool exists(const String& path){ return exists(path.c_str()); }
+
+        bool remove(const char* path){
+            native_sim::AllocPause p;
+            native_sim::counters.sd_file_ops++;
+            return native_sim::sd_present && native_sim::sd_files.erase(path) > 0;
+        }
+        bool remove(const String& path){ return remove(path.c_str()); }
+
+        bool rename(const char* from, const char* to){
+            if(!exists(from) || is_dir(from)) return false;
+            native_sim::AllocPause p;
+            if(!is_dir(parent(to))) return false;
+            native_sim::sd_files[to] = native_sim::sd_files[from];
+            native_sim::sd_files.erase(from);
+            return true;
+        }
+
+        bool mkdir(const char* path){
+            if(!native_sim::sd_present) return false;
+            native_sim::AllocPause p;
+            native_sim::counters.sd_file_ops++;
+            if(is_dir(path)) return true;
+            if(native_sim::sd_files.count(path) > 0 || !is_dir(parent(path))) return false;
+            native_sim::sd_dirs.insert(path);
+            return true;
+        }
+        bool mkdir(const String& path){ return mkdir(path.c_str()); }
+
+        /** @brief Remove an empty directory. */
+        bool rmdir(const char* path){
+            if(!native_sim::sd_present) return false;
+            native_sim::AllocPause p;
+            native_sim::counters.sd_file_ops++;
+            std::string prefix = std::string(path) + "/";
+            for(const auto& f: native_sim::sd_files) if(f.first.compare(0, prefix.size(), prefix) == 0) return false;
+            for(const auto& d: native_sim::sd_dirs) if(d.compare(0, prefix.size(), prefix) == 0) return false;
+            return native_sim::sd_dirs.erase(path) > 0;
+        }
+        bool rmdir(const String& path){ return rmdir(path.c_str()); }
+
+    private:
+        static bool is_dir(const std::string& path){
+            return path.empty() || path == "/" || native_sim::sd_dirs.count(path) > 0;
+        }
+        static std::string parent(const std::string& path){
+            size_t slash = path.rfind('/');
+            return slash == std::string::npos ? "" : path.substr(0, slash);
+        }
+};
+
+} // namespace fs
+
+using fs::File;
+
+extern fs::SDFS SD;
+
+#endif
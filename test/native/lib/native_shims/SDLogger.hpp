@@ -0,0 +1,71 @@
+/**
+ * @file SDLogger.hpp
+ * @brief Host-native stand-in for the Data-Gator SDLogger library.
+ *
+ * Files are kept in native_sim::sd_files. Every append is counted as one FAT
+ * open/close and the bytes written are recorded, which is what dominates the
+ * cost of SD logging on the real card.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_SDLOGGER_HPP
+#define NATIVE_SDLOGGER_HPP
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Appends CSV rows of `time;topic;message` to a file on the uSD card.
+ */
+class SDLogger {
+    public:
+        SDLogger(){}
+        SDLogger(std::string filename): filename(filename){}
+
+        bool initialize_sd_card(){
+            native_sim::counters.sd_file_ops++;
+            return native_sim::sd_present;
+        }
+
+        void set_filename(std::string filename){ this->filename = filename; }
+        std::string get_filename(){ return this->filename; }
+
+        bool exists(){ return exists(this->filename); }
+        bool exists(std::string filename){
+            native_sim::AllocPause p;
+            native_sim::counters.sd_file_ops++;
+            return native_sim::sd_present && native_sim::sd_files.count(filename) > 0;
+        }
+
+        void write_header(std::vector<std::string> header_fields){
+            std::string line;
+            for(size_t i = 0; i < header_fields.size(); i++){
+                if(i > 0) line += separator;
+                line += header_fields[i];
+            }
+            append(line + "\n");
+        }
+
+        void log_absolute_mqtt(std::string time, std::string topic, std::string message){
+            append(time + separator + topic + separator + message + "\n");
+        }
+
+        void close_card(){}
+
+    private:
+        std::string filename = "/log.csv";
+        std::string separator = ";";
+
+        void append(const std::string& line){
+            if(!native_sim::sd_present) return;
+            native_sim::AllocPause p;
+            native_sim::counters.sd_file_ops++;
+            native_sim::counters.sd_bytes_written += line.size();
+            native_sim::note_io();
+            native_sim::sd_files[filename] += line;
+        }
+};
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * @file SDReader.hpp
+ * @brief Host-native stand-in for the Data-Gator SDReader library.
+ *
+ * Scans the daily log files covered by a time range and publishes matching
+ * rows in pages to `datagator/data/time_range/<MAC>`, the same contract as
+ * the SD card reader on the device.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_SDREADER_HPP
+#define NATIVE_SDREADER_HPP
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <TimeStamp.hpp>
+#include <string>
+#include <vector>
+
+extern PubSubClient mqtt_client;
+
+/**
+ * @brief Reads rows back out of the daily CSV log files.
+ */
+class SDReader {
+    public:
+        /**
+         * @brief Publish every logged row with `epoch <= time <= terminus` whose topic starts with one of `topic_filter`.
+         */
+        void read_entry_range_from_files(TimeStamp epoch, TimeStamp terminus, vector<string> topic_filter, int page_size){
+            if(!native_sim::sd_present || page_size <= 0) return;
+
+            string response_topic = string("datagator/data/time_range/") + WiFi.macAddress().c_str();
+
+            for(time_t day = epoch.get_epoch() - epoch.get_epoch() % 86400; day <= terminus.get_epoch(); day += 86400){
+                TimeStamp d(day);
+                string filename = "/log_" + d.get_mdy() + ".csv";
+                native_sim::counters.sd_file_ops++;
+                if(!native_sim::sd_files.count(filename)) continue;
+
+                const string& contents = native_sim::sd_files[filename];
+                vector<string> page;
+                size_t pos = contents.find('\n') + 1;  // skip header
+                while(pos > 0 && pos < contents.size()){
+                    size_t end = contents.find('\n', pos);
+                    string row = contents.substr(pos, end - pos);
+                    pos = end == string::npos ? 0 : end + 1;
+
+                    size_t sep = row.find(';');
+                    if(sep == string::npos) continue;
+                    TimeStamp t(row.substr(0, sep));
+                    if(t < epoch || t > terminus) continue;
+
+                    string topic = row.substr(sep + 1, row.find(';', sep + 1) - sep - 1);
+                    bool match = topic_filter.empty();
+                    for(const string& f: topic_filter) match = match || topic.compare(0, f.size(), f) == 0;
+                    if(!match) continue;
+
+                    page.push_back(row);
+                    if((int)page.size() == page_size){
+                        publish_page(response_topic, filename, epoch, terminus, page);
+                        page.clear();
+                    }
+                }
+                if(!page.empty()) publish_page(response_topic, filename, epoch, terminus, page);
+            }
+        }
+
+    private:
+        void publish_page(const string& topic, const string& filename, TimeStamp& epoch, TimeStamp& terminus, const vector<string>& rows){
+            string msg = "{\"file_name\":\"" + filename + "\", \"epoch\":" + std::to_string(epoch.get_epoch()) +
+                ", \"terminus\":" + std::to_string(terminus.get_epoch()) + ", \"data\":[";
+            for(size_t i = 0; i < rows.size(); i++){
+                if(i > 0) msg += ",";
+                msg += "\"";
+                for(char c: rows[i]){
+                    if(c == '"' || c == '\\') msg += '\\';
+                    msg += c;
+                }
+                msg += "\"";
+            }
+            msg += "]}";
+            mqtt_client.publish(topic.c_str(), msg.c_str());
+        }
+};
+
+#endif
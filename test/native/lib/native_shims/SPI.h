@@ -0,0 +1,19 @@
+/**
+ * @file SPI.h
+ * @brief Host-native stand-in for the SPI bus, only the global object is needed.
+ */
+#ifndef NATIVE_SPI_H
+#define NATIVE_SPI_H
+
+#include <Arduino.h>
+
+/** @brief SPI bus placeholder. */
+class SPIClass {
+    public:
+        void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1){}
+        void end(){}
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,22 @@
+/**
+ * @file Udp.h
+ * @brief Host-native stand-in for the Arduino UDP interface.
+ */
+#ifndef NATIVE_UDP_H
+#define NATIVE_UDP_H
+
+#include <Arduino.h>
+
+/** @brief Datagram socket interface consumed by NTPClient. */
+class UDP: public Print {
+    public:
+        virtual uint8_t begin(uint16_t port) = 0;
+        virtual void stop() = 0;
+        virtual int beginPacket(const char* host, uint16_t port) = 0;
+        virtual int endPacket() = 0;
+        virtual int parsePacket() = 0;
+        virtual int read(unsigned char* buffer, size_t len) = 0;
+        virtual void flush() = 0;
+};
+
+#endif
@@ -0,0 +1,208 @@
+/**
+ * @file WiFi.h
+ * @brief Host-native stand-in for the ESP32 WiFi station and TCP client.
+ *
+ * Association succeeds `native_sim::wifi_assoc_ms` after `WiFi.begin()` when
+ * `native_sim::wifi_available` is set. Connection state is forgotten on every
+ * simulated boot, the same as the radio losing power in deep sleep.
+ *
+ * The TCP client talks to a fake broker which understands the QoS 1 PUBLISH packets
+ * of mqtt_qos1.hpp: they are recorded like PubSubClient publishes and answered
+ * with a PUBACK while `native_sim::mqtt_acks` is set. Messages queued in
+ * `native_sim::mqtt_inbox` are sent on the connection as QoS 0 PUBLISH packets.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_WIFI_H
+#define NATIVE_WIFI_H
+
+#include <Arduino.h>
+
+typedef enum {
+    WL_IDLE_STATUS      = 0,
+    WL_NO_SSID_AVAIL    = 1,
+    WL_SCAN_COMPLETED   = 2,
+    WL_CONNECTED        = 3,
+    WL_CONNECT_FAILED   = 4,
+    WL_CONNECTION_LOST  = 5,
+    WL_DISCONNECTED     = 6
+} wl_status_t;
+
+typedef enum {
+    WIFI_OFF = 0,
+    WIFI_STA = 1
+} wifi_mode_t;
+
+/** @brief IPv4 address, printable through `Serial`. */
+class IPAddress: public Printable {
+    public:
+        IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0): octets{a, b, c, d}{}
+        size_t printTo(Print& p) const override {
+            return p.printf("%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+        }
+    private:
+        uint8_t octets[4];
+};
+
+/** @brief Byte stream interface consumed by PubSubClient. */
+class Client: public Print {
+    public:
+        virtual int connect(IPAddress ip, uint16_t port){ return 0; }
+        virtual int connect(const char* host, uint16_t port) = 0;
+        virtual uint8_t connected() = 0;
+        virtual void stop() = 0;
+        virtual int available(){ return 0; }
+        virtual int read(){ return -1; }
+        virtual int read(uint8_t* buf, size_t size){
+            size_t n = 0;
+            for(int b; n < size && (b = read()) >= 0; n++) buf[n] = b;
+            return n > 0 ? (int)n : -1;
+        }
+        virtual int peek(){ return -1; }
+        virtual void flush(){}
+        virtual operator bool(){ return connected(); }
+};
+
+/**
+ * @brief TCP client connected to the fake broker.
+ */
+class WiFiClient: public Client {
+    public:
+        int connect(IPAddress, uint16_t) override { return connect("broker", 1883); }
+        int connect(const char*, uint16_t) override;
+        uint8_t connected() override;
+        void stop() override { open_boot = 0; }
+        /** @brief Like the ESP32 client, limits connect, read and write, in seconds. The simulated TCP connect never waits. */
+        int setTimeout(uint32_t seconds){ timeout_s = seconds; return 0; }
+        using Print::write;
+        size_t write(uint8_t c) override { return write(&c, 1); }
+        size_t write(const uint8_t* buf, size_t size) override {
+            if(!connected()) return 0;
+            native_sim::AllocPause p;
+            native_sim::note_io();
+            tx.append((const char*)buf, size);
+            broker_receive();
+            return size;
+        }
+        int available() override {
+            if(!connected()) return 0;
+            broker_send();
+            return rx.size() - rx_at;
+        }
+        using Client::read;
+        int read() override { return available() > 0 ? (uint8_t)rx[rx_at++] : -1; }
+        int peek() override { return available() > 0 ? (uint8_t)rx[rx_at] : -1; }
+    private:
+        uint32_t open_boot = 0;
+        uint32_t timeout_s = 3;
+        std::string tx;     //!< bytes written, not yet a whole packet
+        std::string rx;     //!< bytes sent by the broker
+        size_t rx_at = 0;   //!< next byte of `rx` read
+
+        /** @brief Send the messages of `native_sim::mqtt_inbox` as PUBLISH packets. */
+        void broker_send(){
+            if(native_sim::mqtt_inbox.empty()) return;
+            native_sim::AllocPause p;
+            for(const auto& m: native_sim::mqtt_inbox){
+                size_t remaining = 2 + m.first.size() + m.second.size();
+                rx += '\x30';
+                do{
+                    uint8_t b = remaining % 128;
+                    remaining /= 128;
+                    rx += (char)(remaining > 0 ? b | 0x80 : b);
+                }while(remaining > 0);
+                rx += (char)(m.first.size() >> 8);
+                rx += (char)(m.first.size() & 0xFF);
+                rx += m.first + m.second;
+            }
+            native_sim::mqtt_inbox.clear();
+        }
+
+        /** @brief Handle the whole packets written so far. */
+        void broker_receive(){
+            for(;;){
+                size_t len = 0, at = 1;
+                for(int shift = 0; at < tx.size(); shift += 7){
+                    len |= (size_t)(tx[at] & 0x7F) << shift;
+                    if(!(tx[at++] & 0x80)) break;
+                }
+                if(at >= tx.size() || at + len > tx.size()) return;
+
+                uint8_t type = tx[0];
+                if((type & 0xF6) == 0x32 && native_sim::mqtt_acks){
+                    // PUBLISH at QoS 1
+                    size_t tlen = ((uint8_t)tx[at] << 8) | (uint8_t)tx[at + 1];
+                    std::string topic = tx.substr(at + 2, tlen);
+                    std::string id = tx.substr(at + 2 + tlen, 2);
+                    std::string payload = tx.substr(at + 4 + tlen, len - 4 - tlen);
+                    native_sim::counters.mqtt_publishes++;
+                    native_sim::counters.mqtt_bytes += topic.size() + payload.size();
+                    if(type & 0x08) native_sim::counters.mqtt_dups++;
+                    native_sim::mqtt_outbox.emplace_back(topic, payload);
+                    rx += std::string("\x40\x02", 2) + id;
+                }
+                tx.erase(0, at + len);
+            }
+        }
+};
+
+/**
+ * @brief WiFi station interface.
+ */
+class WiFiClass {
+    public:
+        wifi_mode_t mode(wifi_mode_t m){ return current_mode = m; }
+
+        wl_status_t begin(const char* ssid, const char* passphrase = NULL){
+            begin_boot = native_sim::boot_count;
+            begin_us = native_sim::uptime_us();
+            return status();
+        }
+
+        bool disconnect(bool wifioff = false, bool eraseap = false){
+            begin_boot = 0;
+            return true;
+        }
+
+        wl_status_t status(){
+            if(begin_boot != native_sim::boot_count) return WL_IDLE_STATUS;
+            if(!native_sim::wifi_available) return WL_NO_SSID_AVAIL;
+            if(native_sim::uptime_us() - begin_us < (uint64_t)native_sim::wifi_assoc_ms * 1000ULL) return WL_DISCONNECTED;
+            return WL_CONNECTED;
+        }
+
+        String macAddress(){ return String("24:6F:28:0A:1B:2C"); }
+        uint8_t* macAddress(uint8_t* mac){
+            const uint8_t m[6] = {0x24, 0x6F, 0x28, 0x0A, 0x1B, 0x2C};
+            memcpy(mac, m, sizeof(m));
+            return mac;
+        }
+        String BSSIDstr(){ return String("A0:B1:C2:D3:E4:F5"); }
+        int8_t RSSI(){ return status() == WL_CONNECTED ? -61 : 0; }
+        IPAddress localIP(){ return status() == WL_CONNECTED ? IPAddress(192, 168, 50, 42) : IPAddress(); }
+        bool setSleep(bool){ return true; }
+
+    private:
+        wifi_mode_t current_mode = WIFI_OFF;
+        uint32_t begin_boot = 0;
+        uint64_t begin_us = 0;
+};
+
+extern WiFiClass WiFi;
+
+inline int WiFiClient::connect(const char*, uint16_t){
+    if(WiFi.status() != WL_CONNECTED) return 0;
+    open_boot = native_sim::boot_count;
+    native_sim::AllocPause p;
+    tx.clear();
+    rx.clear();
+    rx_at = 0;
+    return 1;
+}
+
+inline uint8_t WiFiClient::connected(){
+    return open_boot == native_sim::boot_count && WiFi.status() == WL_CONNECTED;
+}
+
+#endif
@@ -0,0 +1,16 @@
+/**
+ * @file WiFiClientSecure.h
+ * @brief Host-native stand-in for the ESP32 TLS client, plain TCP on the host.
+ */
+#ifndef NATIVE_WIFICLIENTSECURE_H
+#define NATIVE_WIFICLIENTSECURE_H
+
+#include <WiFi.h>
+
+/** @brief TLS client; behaves like WiFiClient in the simulation. */
+class WiFiClientSecure: public WiFiClient {
+    public:
+        void setInsecure(){}
+};
+
+#endif
@@ -0,0 +1,10 @@
+/**
+ * @file WiFiMulti.h
+ * @brief Host-native stand-in for the ESP32 multi-AP helper.
+ */
+#ifndef NATIVE_WIFIMULTI_H
+#define NATIVE_WIFIMULTI_H
+
+#include <WiFi.h>
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * @file WiFiUdp.h
+ * @brief Host-native stand-in for the ESP32 UDP socket.
+ *
+ * Answers NTP requests from the simulated wall clock when WiFi is connected
+ * and `native_sim::ntp_available` is set, so NTPClient produces real dates.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_WIFIUDP_H
+#define NATIVE_WIFIUDP_H
+
+#include <Udp.h>
+#include <WiFi.h>
+
+/** @brief UDP socket with a built in NTP responder. */
+class WiFiUDP: public UDP {
+    public:
+        uint8_t begin(uint16_t) override { return 1; }
+        void stop() override { pending = false; }
+        int beginPacket(const char*, uint16_t) override { return WiFi.status() == WL_CONNECTED; }
+        using Print::write;
+        size_t write(uint8_t) override { return 1; }
+        size_t write(const uint8_t*, size_t size) override { return size; }
+
+        int endPacket() override {
+            // NTP round trip
+            pending = WiFi.status() == WL_CONNECTED && native_sim::ntp_available;
+            if(pending) native_sim::advance_us(30000);
+            return pending;
+        }
+
+        int parsePacket() override { return pending ? 48 : 0; }
+
+        int read(unsigned char* buffer, size_t len) override {
+            if(!pending || len < 48) return 0;
+            pending = false;
+            memset(buffer, 0, len);
+            buffer[0] = 0x24;   // LI = 0, version 4, mode server
+            buffer[1] = 2;      // stratum
+            uint32_t secs = (uint32_t)(native_sim::wall_us / 1000000ULL + 2208988800ULL);
+            for(int base: {16, 40}){
+                buffer[base] = secs >> 24;
+                buffer[base + 1] = secs >> 16;
+                buffer[base + 2] = secs >> 8;
+                buffer[base + 3] = secs;
+            }
+            return 48;
+        }
+
+        void flush() override { pending = false; }
+
+    private:
+        bool pending = false;
+};
+
+#endif
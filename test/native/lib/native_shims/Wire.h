@@ -0,0 +1,57 @@
+/**
+ * @file Wire.h
+ * @brief Host-native stand-in for the I2C bus.
+ *
+ * Devices present on the bus are listed in native_sim::i2c_devices. A read
+ * request returns an Atlas EZO style response: status code `1` followed by
+ * the configured reading and a null terminator.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_WIRE_H
+#define NATIVE_WIRE_H
+
+#include <Arduino.h>
+
+/** @brief I2C master. */
+class TwoWire: public Print {
+    public:
+        bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0){ return true; }
+
+        void beginTransmission(int address){ this->address = address; }
+        uint8_t endTransmission(bool sendStop = true){
+            native_sim::advance_us(200);
+            return native_sim::i2c_devices.count(address) ? 0 : 2;
+        }
+
+        using Print::write;
+        size_t write(uint8_t) override { return 1; }
+        size_t write(const uint8_t*, size_t size) override { return size; }
+
+        uint8_t requestFrom(int address, int quantity, int sendStop = 1){
+            rx_len = rx_pos = 0;
+            auto it = native_sim::i2c_devices.find(address);
+            if(it == native_sim::i2c_devices.end()) return 0;
+            rx[rx_len++] = 1;
+            for(char c: it->second){
+                if(rx_len >= (int)sizeof(rx) - 1 || rx_len >= quantity - 1) break;
+                rx[rx_len++] = c;
+            }
+            rx[rx_len++] = 0;
+            return rx_len;
+        }
+
+        int available(){ return rx_len - rx_pos; }
+        int read(){ return rx_pos < rx_len ? rx[rx_pos++] : -1; }
+
+    private:
+        int address = 0;
+        uint8_t rx[32];
+        int rx_len = 0;
+        int rx_pos = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,19 @@
+/**
+ * @file rtc.h
+ * @brief Host-native stand-in for the ESP32 RTC timer API.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_ESP32_RTC_H
+#define NATIVE_ESP32_RTC_H
+
+#include <cstdint>
+#include "../native_sim.h"
+
+/** @brief Microseconds counted by the RTC timer since power-on, kept through deep sleep and resets. */
+inline uint64_t esp_rtc_get_time_us(){
+    return native_sim::rtc_time_us();
+}
+
+#endif
@@ -0,0 +1,8 @@
+/**
+ * @file esp_gap_ble_api.h
+ * @brief Host-native stand-in for the ESP-IDF BLE GAP header, nothing from it is used.
+ */
+#ifndef NATIVE_ESP_GAP_BLE_API_H
+#define NATIVE_ESP_GAP_BLE_API_H
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * @file esp_partition.h
+ * @brief Host-native stand-in for the ESP-IDF partition API.
+ *
+ * One data partition, the flash queue of max_ota.csv, backed by
+ * native_sim::flash. Writes behave like NOR flash and can only clear bits,
+ * erases set whole sectors back to 0xFF.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_ESP_PARTITION_H
+#define NATIVE_ESP_PARTITION_H
+
+#include <cstring>
+#include "native_sim.h"
+
+typedef int esp_err_t;
+#ifndef ESP_OK
+#define ESP_OK 0
+#endif
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_SIZE 0x104
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef int esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+inline const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label){
+    static esp_partition_t p = {ESP_PARTITION_TYPE_DATA, 0x40, 0x3E6000, 0, "fqueue", false};
+    p.size = native_sim::flash.size();
+    if(p.size == 0 || type != p.type || (label != NULL && strcmp(label, p.label) != 0)) return NULL;
+    return &p;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t* p, size_t offset, void* dst, size_t size){
+    if(offset + size > p->size) return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, native_sim::flash.data() + offset, size);
+    return ESP_OK;
+}
+
+inline esp_err_t esp_partition_write(const esp_partition_t* p, size_t offset, const void* src, size_t size){
+    if(offset + size > p->size) return ESP_ERR_INVALID_SIZE;
+    for(size_t i = 0; i < size; i++) native_sim::flash[offset + i] &= ((const uint8_t*)src)[i];
+    native_sim::counters.flash_bytes_written += size;
+    native_sim::note_io();
+    return ESP_OK;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t* p, size_t offset, size_t size){
+    if(offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0) return ESP_ERR_INVALID_ARG;
+    if(offset + size > p->size) return ESP_ERR_INVALID_SIZE;
+    memset(native_sim::flash.data() + offset, 0xFF, size);
+    native_sim::counters.flash_erases += size / SPI_FLASH_SEC_SIZE;
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,10 @@
+/**
+ * @file esp_pm.h
+ * @brief Host-native stand-in for the ESP-IDF power management header.
+ */
+#ifndef NATIVE_ESP_PM_H
+#define NATIVE_ESP_PM_H
+
+#include "esp_sleep.h"
+
+#endif
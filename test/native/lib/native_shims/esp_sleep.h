@@ -0,0 +1,66 @@
+/**
+ * @file esp_sleep.h
+ * @brief Host-native stand-in for the ESP-IDF sleep API.
+ *
+ * `esp_deep_sleep_start()` records the requested timer and returns instead of
+ * resetting the chip; the caller's `loop()` then runs to completion and the
+ * test harness starts the next simulated wake.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_ESP_SLEEP_H
+#define NATIVE_ESP_SLEEP_H
+
+#include <cstdint>
+#include "native_sim.h"
+
+typedef int esp_err_t;
+#define ESP_OK 0
+
+typedef enum {
+    ESP_PD_DOMAIN_RTC_PERIPH,
+    ESP_PD_DOMAIN_RTC_SLOW_MEM,
+    ESP_PD_DOMAIN_RTC_FAST_MEM,
+    ESP_PD_DOMAIN_XTAL,
+    ESP_PD_DOMAIN_MAX
+} esp_sleep_pd_domain_t;
+
+typedef enum {
+    ESP_PD_OPTION_OFF,
+    ESP_PD_OPTION_ON,
+    ESP_PD_OPTION_AUTO
+} esp_sleep_pd_option_t;
+
+typedef enum {
+    ESP_SLEEP_WAKEUP_UNDEFINED,
+    ESP_SLEEP_WAKEUP_ALL,
+    ESP_SLEEP_WAKEUP_EXT0,
+    ESP_SLEEP_WAKEUP_EXT1,
+    ESP_SLEEP_WAKEUP_TIMER,
+    ESP_SLEEP_WAKEUP_TOUCHPAD,
+    ESP_SLEEP_WAKEUP_ULP
+} esp_sleep_wakeup_cause_t;
+
+inline esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us){
+    native_sim::sleep_request_us = time_in_us;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t domain, esp_sleep_pd_option_t option){
+    if(domain == ESP_PD_DOMAIN_RTC_SLOW_MEM) native_sim::rtc_slow_mem_on = option != ESP_PD_OPTION_OFF;
+    return ESP_OK;
+}
+
+inline void esp_deep_sleep_start(){ native_sim::slept = true; }
+
+inline esp_err_t esp_light_sleep_start(){
+    native_sim::advance_us(native_sim::sleep_request_us);
+    return ESP_OK;
+}
+
+inline esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(){
+    return (esp_sleep_wakeup_cause_t)native_sim::wake_cause;
+}
+
+#endif
@@ -0,0 +1,40 @@
+/**
+ * @file esp_system.h
+ * @brief Host-native stand-in for the ESP-IDF reset reason and random number APIs.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_ESP_SYSTEM_H
+#define NATIVE_ESP_SYSTEM_H
+
+#include "native_sim.h"
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+    ESP_RST_DEEPSLEEP,
+    ESP_RST_BROWNOUT,
+    ESP_RST_SDIO
+} esp_reset_reason_t;
+
+inline esp_reset_reason_t esp_reset_reason(){
+    return (esp_reset_reason_t)native_sim::reset_reason;
+}
+
+/** @brief Pseudo random numbers from a fixed seed, so bench runs repeat exactly. */
+inline uint32_t esp_random(){
+    static uint32_t x = 2463534242UL;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+#endif
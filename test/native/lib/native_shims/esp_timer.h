@@ -0,0 +1,18 @@
+/**
+ * @file esp_timer.h
+ * @brief Host-native stand-in for the ESP-IDF high resolution timer.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_ESP_TIMER_H
+#define NATIVE_ESP_TIMER_H
+
+#include "native_sim.h"
+
+/** @brief Microseconds since boot, like the real timer. */
+inline int64_t esp_timer_get_time(){
+    return (int64_t)native_sim::uptime_us();
+}
+
+#endif
@@ -0,0 +1,27 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host-native stand-in for the FreeRTOS types used by the firmware.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_FREERTOS_H
+#define NATIVE_FREERTOS_H
+
+#include <cstdint>
+#include "../native_sim.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdFAIL  pdFALSE
+#define pdPASS  pdTRUE
+
+#define portMAX_DELAY      ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(ms))
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file semphr.h
+ * @brief Host-native stand-in for FreeRTOS semaphores and mutexes.
+ *
+ * Taking a semaphore moves the simulated clock forward to the time it was
+ * given, which is how waiting for a task "running on the other core" costs
+ * time, see task.h. Mutexes never block since nothing runs concurrently.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_FREERTOS_SEMPHR_H
+#define NATIVE_FREERTOS_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+struct native_semaphore {
+    UBaseType_t count;
+    UBaseType_t max_count;
+    bool is_mutex;
+    uint64_t given_us;      //!< latest simulated time the semaphore was given
+};
+
+typedef native_semaphore* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t native_semaphore_create(UBaseType_t max_count, UBaseType_t initial, bool is_mutex){
+    native_sim::AllocPause p;
+    native_semaphore* s = new native_semaphore();
+    s->count = initial;
+    s->max_count = max_count;
+    s->is_mutex = is_mutex;
+    s->given_us = 0;
+    return s;
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary(){ return native_semaphore_create(1, 0, false); }
+inline SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial){
+    return native_semaphore_create(max_count, initial, false);
+}
+inline SemaphoreHandle_t xSemaphoreCreateMutex(){ return native_semaphore_create(1, 1, true); }
+inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(){ return native_semaphore_create(1, 1, true); }
+
+inline void vSemaphoreDelete(SemaphoreHandle_t s){
+    native_sim::AllocPause p;
+    delete s;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s){
+    if(s->is_mutex) return pdTRUE;
+    if(s->count >= s->max_count) return pdFALSE;
+    s->count++;
+    if(native_sim::wall_us > s->given_us) s->given_us = native_sim::wall_us;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t timeout){
+    if(s->is_mutex) return pdTRUE;
+    if(s->count == 0){
+        // nothing else can give it on the host
+        if(timeout != portMAX_DELAY) native_sim::advance_us((uint64_t)timeout * portTICK_PERIOD_MS * 1000ULL);
+        return pdFALSE;
+    }
+    s->count--;
+    if(s->given_us > native_sim::wall_us) native_sim::wall_us = s->given_us;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t s){ return xSemaphoreGive(s); }
+inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t s, TickType_t timeout){ return xSemaphoreTake(s, timeout); }
+
+#endif
@@ -0,0 +1,47 @@
+/**
+ * @file task.h
+ * @brief Host-native stand-in for FreeRTOS tasks.
+ *
+ * There are no threads on the host. A created task runs to completion inside
+ * `xTaskCreatePinnedToCore()` and the simulated clock is then wound back to the
+ * moment it was created, as if it had run on the other core. The time it
+ * finished is carried by the semaphores it gives, so whoever waits for it
+ * resumes no earlier than that, see semphr.h.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_FREERTOS_TASK_H
+#define NATIVE_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void*);
+typedef void* TaskHandle_t;
+
+#define tskNO_AFFINITY 0x7fffffff
+
+inline void vTaskDelay(TickType_t ticks){ native_sim::advance_us((uint64_t)ticks * portTICK_PERIOD_MS * 1000ULL); }
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char*, uint32_t, void* arg,
+        UBaseType_t, TaskHandle_t* handle, BaseType_t){
+    uint64_t start_us = native_sim::wall_us;
+    native_sim::tasks_running++;
+    fn(arg);
+    native_sim::tasks_running--;
+    native_sim::wall_us = start_us;
+    if(handle) *handle = NULL;
+    return pdPASS;
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack, void* arg,
+        UBaseType_t prio, TaskHandle_t* handle){
+    return xTaskCreatePinnedToCore(fn, name, stack, arg, prio, handle, tskNO_AFFINITY);
+}
+
+/** The task function returns on its own once this is reached. */
+inline void vTaskDelete(TaskHandle_t){}
+
+inline BaseType_t xPortGetCoreID(){ return native_sim::tasks_running ? 0 : 1; }
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * @file native_sim.cpp
+ * @brief Storage for the simulated board state and the global peripheral objects.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include "native_sim.h"
+
+#include <Arduino.h>
+#include <HTTPUpdate.h>
+#include <SD.h>
+#include <SPI.h>
+#include <WiFi.h>
+#include <Wire.h>
+
+// bounds of the `RTC_NOINIT_ATTR` section, provided by the linker
+extern "C" char __start_rtc_noinit[] __attribute__((weak));
+extern "C" char __stop_rtc_noinit[] __attribute__((weak));
+
+namespace native_sim {
+
+bool wifi_available = true;
+uint32_t wifi_assoc_ms = 2500;
+bool broker_available = true;
+bool mqtt_acks = true;
+bool ntp_available = true;
+bool sd_present = true;
+bool fuel_gauge_present = true;
+float battery_percent = 87.5f;
+float battery_voltage = 3.98f;
+int16_t adc_raw[4] = {6100, 8200, 9100, 10400};
+std::map<int, std::string> i2c_devices;
+std::vector<Advert> adverts;
+std::vector<std::pair<std::string, std::string>> mqtt_inbox;
+bool serial_echo = false;
+int32_t rtc_drift_ppm = 0;
+uint64_t wdt_period_us = 0;
+bool wdt_keeps_rtc = true;
+
+uint64_t wall_us = 1690000000ULL * 1000000ULL;
+uint64_t boot_us = wall_us;
+uint64_t rtc_start_us = wall_us;
+uint32_t boot_count = 0;
+int tasks_running = 0;
+int ble_callbacks_running = 0;
+
+Counters counters;
+int alloc_pause = 0;
+std::map<std::string, std::vector<uint8_t>> nvs;
+std::map<std::string, std::string> sd_files;
+std::set<std::string> sd_dirs;
+std::vector<uint8_t> flash(0x18000, 0xFF);
+std::map<int, int> pins;
+std::vector<std::pair<std::string, std::string>> mqtt_outbox;
+uint64_t sleep_request_us = 0;
+bool slept = false;
+int wake_cause = 0;
+bool rtc_slow_mem_on = true;
+int reset_reason = 1;
+
+void rtc_power_on(){
+    rtc_start_us = wall_us;
+    uint32_t x = 2463534242UL + boot_count;
+    for(char* p = __start_rtc_noinit; p < __stop_rtc_noinit; p++){
+        // xorshift32
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *p = (char)x;
+    }
+}
+
+} // namespace native_sim
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+TwoWire Wire;
+SPIClass SPI;
+fs::SDFS SD;
+HTTPUpdate httpUpdate;
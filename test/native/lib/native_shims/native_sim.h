@@ -0,0 +1,172 @@
+/**
+ * @file native_sim.h
+ * @brief Simulated board state shared by the host-native hardware shims.
+ *
+ * The `[env:native]` build replaces the ESP32 Arduino core and the board
+ * peripherals with small fakes. All of those fakes read their behaviour
+ * (is WiFi reachable, is a uSD card inserted, what does the ADC return) and
+ * record their side effects (bytes published, NVS writes, simulated time)
+ * through the `native_sim` namespace defined here so that tests and the
+ * wake-cycle benchmark can drive and inspect a simulated Data Gator.
+ *
+ * Time is fully simulated. `delay()` advances the clock instead of sleeping
+ * so a wake that would take 40 s on the bench completes in microseconds.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef NATIVE_SIM_H
+#define NATIVE_SIM_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace native_sim {
+
+/**
+ * @brief Side effects recorded by the shims, reset at the start of every simulated wake.
+ */
+struct Counters {
+    uint64_t allocs = 0;            //!< calls to operator new made by firmware code
+    uint64_t alloc_bytes = 0;       //!< bytes requested from operator new by firmware code
+    uint64_t mqtt_publishes = 0;    //!< successful MQTT publish calls
+    uint64_t mqtt_bytes = 0;        //!< topic + payload bytes handed to the MQTT client
+    uint64_t mqtt_failed = 0;       //!< publish calls rejected by the client
+    uint64_t mqtt_dups = 0;         //!< QoS 1 publishes sent again with the DUP flag
+    uint64_t mqtt_received = 0;     //!< PUBLISH packets from the broker delivered to the callback
+    uint64_t mqtt_acks_dropped = 0; //!< PUBACKs read and dropped by PubSubClient
+    uint64_t nvs_reads = 0;         //!< Preferences get/isKey calls
+    uint64_t nvs_writes = 0;        //!< Preferences put/remove/clear calls
+    uint64_t sd_bytes_written = 0;  //!< bytes appended to files on the simulated uSD card
+    uint64_t sd_file_ops = 0;       //!< open/exists/close style FAT operations
+    uint64_t sd_bytes_read = 0;     //!< bytes read from files on the simulated uSD card
+    uint64_t flash_bytes_written = 0;   //!< bytes written to the flash queue partition
+    uint64_t flash_erases = 0;      //!< 4 KB sectors of the flash queue partition erased
+    uint64_t ble_adverts = 0;       //!< advertisements delivered to scan callbacks
+    uint64_t callback_io = 0;       //!< uSD, flash or network writes made from inside a scan callback
+};
+
+/**
+ * @brief A BLE advertisement replayed to the scan callback on every simulated scan.
+ */
+struct Advert {
+    std::string address;        //!< sensor MAC `aa:bb:cc:dd:ee:ff`
+    std::string name;           //!< advertised name, empty if none
+    std::string service_uuid;   //!< advertised service UUID, empty if none
+    std::string service_data;   //!< raw service data bytes
+};
+
+// ---------------------------------------------------------------------
+// environment knobs, set by the test/benchmark before a wake
+// ---------------------------------------------------------------------
+extern bool wifi_available;                     //!< access point reachable
+extern uint32_t wifi_assoc_ms;                  //!< simulated association time
+extern bool broker_available;                   //!< MQTT broker reachable
+extern bool mqtt_acks;                          //!< QoS 1 publishes reach the broker and are acknowledged, otherwise they are lost
+extern bool ntp_available;                      //!< NTP server answers
+extern bool sd_present;                         //!< uSD card inserted
+extern bool fuel_gauge_present;                 //!< MAX17048 answers on I2C
+extern float battery_percent;                   //!< fuel gauge state of charge
+extern float battery_voltage;                   //!< fuel gauge cell voltage
+extern int16_t adc_raw[4];                      //!< ADS1115 raw counts per channel
+extern std::map<int, std::string> i2c_devices;  //!< EZO address -> reading returned
+extern std::vector<Advert> adverts;             //!< advertisements seen by every scan
+extern std::vector<std::pair<std::string, std::string>> mqtt_inbox;  //!< messages the broker sends on the connection, delivered by `loop()`
+extern bool serial_echo;                        //!< forward `Serial` output to stdout
+extern int32_t rtc_drift_ppm;                   //!< deep sleep lasts this many ppm longer than programmed
+extern uint64_t wdt_period_us;                  //!< external watchdog resets the board this long into a sleep, 0 if not fitted
+extern bool wdt_keeps_rtc;                      //!< RTC slow memory survives a watchdog reset
+
+// ---------------------------------------------------------------------
+// simulated time
+// ---------------------------------------------------------------------
+extern uint64_t wall_us;                        //!< wall clock, us since 1970
+extern uint64_t boot_us;                        //!< wall clock at the last boot
+extern uint64_t rtc_start_us;                   //!< wall clock when the RTC timer started counting, reset with RTC memory
+extern uint32_t boot_count;                     //!< number of simulated boots so far
+extern int tasks_running;                       //!< >0 while a FreeRTOS task created by the firmware runs
+extern int ble_callbacks_running;               //!< >0 while a scan callback of the firmware runs
+
+// ---------------------------------------------------------------------
+// recorded state
+// ---------------------------------------------------------------------
+extern Counters counters;
+extern int alloc_pause;                         //!< >0 while shims allocate for their own bookkeeping
+extern std::map<std::string, std::vector<uint8_t>> nvs;  //!< "<namespace>/<key>" -> value
+extern std::map<std::string, std::string> sd_files;  //!< path -> contents
+extern std::set<std::string> sd_dirs;           //!< directories on the card, the root is implied
+extern std::vector<uint8_t> flash;              //!< flash queue partition, empty if the partition table has none
+extern std::map<int, int> pins;                 //!< gpio -> level
+extern std::vector<std::pair<std::string, std::string>> mqtt_outbox;  //!< topic/payload published this wake
+extern uint64_t sleep_request_us;               //!< duration passed to the deep sleep timer
+extern bool slept;                              //!< esp_deep_sleep_start() was reached
+extern int wake_cause;                          //!< value returned by esp_sleep_get_wakeup_cause()
+extern bool rtc_slow_mem_on;                    //!< RTC slow memory kept powered during the last sleep
+extern int reset_reason;                        //!< value returned by esp_reset_reason()
+
+/** @brief Microseconds since the simulated boot. */
+inline uint64_t uptime_us(){ return wall_us - boot_us; }
+
+/** @brief Advance the simulated clock. */
+inline void advance_us(uint64_t us){ wall_us += us; }
+
+/** @brief Called by every shim writing to the uSD card, flash or the network. */
+inline void note_io(){ if(ble_callbacks_running > 0) counters.callback_io++; }
+
+/** @brief Microseconds counted by the RTC timer, which runs `rtc_drift_ppm` slow. */
+inline uint64_t rtc_time_us(){ return (wall_us - rtc_start_us) * 1000000ULL / (1000000LL + rtc_drift_ppm); }
+
+/**
+ * @brief Suspend allocation counting while a shim does its own bookkeeping.
+ *
+ * Allocations made to emulate hardware (NVS maps, file contents) are not
+ * part of the firmware's heap footprint and should not show up in results.
+ */
+struct AllocPause {
+    AllocPause(){ alloc_pause++; }
+    ~AllocPause(){ alloc_pause--; }
+};
+
+/** @brief Fill the `RTC_NOINIT_ATTR` variables with random bytes and restart the RTC timer, as after a power-on. */
+void rtc_power_on();
+
+/**
+ * @brief Start a new simulated wake: RAM state that the real chip loses is cleared.
+ *
+ * NVS, the uSD card and RTC memory survive, as do the environment knobs.
+ * The reset reason is deep sleep if the previous wake slept with RTC slow
+ * memory powered, otherwise power-on and `RTC_NOINIT_ATTR` variables are filled
+ * with random bytes. Clear `slept` before booting to simulate a cold power-on.
+ *
+ * A sleep longer than `wdt_period_us` is cut short by the external watchdog, the
+ * firmware pats it right before sleeping. The reset reason is then an external
+ * reset, RTC memory and the RTC timer are lost unless `wdt_keeps_rtc` is set.
+ *
+ * @param[in] slept_us Time spent asleep before this wake, stretched by `rtc_drift_ppm` after a deep sleep.
+ */
+inline void boot(uint64_t slept_us){
+    bool wdt = slept && wdt_period_us > 0 && slept_us > wdt_period_us;
+    if(wdt) slept_us = wdt_period_us;
+    else if(slept) slept_us += (int64_t)slept_us * rtc_drift_ppm / 1000000LL;
+    advance_us(slept_us);
+    boot_us = wall_us;
+    boot_count++;
+    bool warm = slept && rtc_slow_mem_on && !wdt;
+    reset_reason = wdt ? 2 : warm ? 8 : 1;  // ESP_RST_EXT : ESP_RST_DEEPSLEEP : ESP_RST_POWERON
+    wake_cause = warm ? 4 : 0;              // ESP_SLEEP_WAKEUP_TIMER : ESP_SLEEP_WAKEUP_UNDEFINED
+    if(!warm && !(wdt && wdt_keeps_rtc && rtc_slow_mem_on)) rtc_power_on();
+    rtc_slow_mem_on = true;
+    counters = Counters();
+    sleep_request_us = 0;
+    slept = false;
+    AllocPause p;
+    pins.clear();
+    mqtt_outbox.clear();
+}
+
+} // namespace native_sim
+
+#endif
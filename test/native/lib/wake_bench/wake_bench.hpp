@@ -0,0 +1,356 @@
+/**
+ * @file wake_bench.hpp
+ * @brief Simulated wakes shared by the host-native test suites.
+ *
+ * Runs the firmware's `setup()` and `loop()` from src/main.cpp against the
+ * simulated board in test/native/lib/native_shims, once per simulated wake, and
+ * totals per scenario:
+ *
+ *  * CPU time spent on the host,
+ *  * heap allocations (count and bytes, through operator new),
+ *  * MQTT publishes and bytes published,
+ *  * NVS reads/writes, uSD bytes and FAT operations,
+ *  * simulated awake time (time from boot until deep sleep is entered),
+ *
+ * and the number of wakes per simulated hour.
+ *
+ * `report()` prints one `BENCH` line per scenario. Compare the lines of two
+ * releases to spot regressions; everything but CPU time is deterministic.
+ * Set `DG_BENCH_REPORT=<file>` to also append the results as CSV.
+ *
+ * Included by the `main.cpp` of one test suite only, it defines the operators
+ * counting heap allocations.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#ifndef WAKE_BENCH_HPP
+#define WAKE_BENCH_HPP
+
+#include <unity.h>
+#include <Arduino.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <config.hpp>
+#include <version.hpp>
+#include <TimeStamp.hpp>
+#include <SD.h>
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include <binlog_format.hpp>
+#include <lz_format.hpp>
+
+// firmware entry points, src/main.cpp
+void setup();
+void loop();
+extern bool log_binary;
+extern bool log_compress;
+extern bool logging_available;
+extern bool planner_from_rtc;
+extern bool mqtt_batch;
+extern bool mqtt_msgpack;
+extern uint32_t log_retention_bytes;
+extern uint32_t log_retention_days;
+extern uint8_t mqtt_inflight;
+extern PubSubClient mqtt_client;
+
+/** Fallback sleep between wakes if the firmware never programmed the timer. */
+#define DEFAULT_SLEEP_US (65ULL * 1000000ULL)
+/** Seconds per scheduler tick, `TICK_SECONDS` of scheduler.hpp. */
+#define TICK_S 65
+
+// ---------------------------------------------------------------------
+// heap accounting
+// ---------------------------------------------------------------------
+// new and delete are kept out of line, so the compiler cannot pair the malloc() and
+// free() inside them with the operators inlined into the callers
+__attribute__((noinline)) void* operator new(size_t size){
+    if(native_sim::alloc_pause == 0){
+        native_sim::counters.allocs++;
+        native_sim::counters.alloc_bytes += size;
+    }
+    void* p = malloc(size ? size : 1);
+    if(p == NULL) throw std::bad_alloc();
+    return p;
+}
+__attribute__((noinline)) void* operator new[](size_t size){ return operator new(size); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// ---------------------------------------------------------------------
+// simulated wakes
+// ---------------------------------------------------------------------
+/**
+ * @brief Totals collected over a number of simulated wakes.
+ */
+struct BenchTotals {
+    int wakes = 0;
+    int active_wakes = 0;       //!< wakes which logged or published anything
+    int idle_wakes = 0;         //!< wakes which went back to sleep from `setup()`, nothing due
+    uint64_t idle_nvs_writes = 0;   //!< NVS writes of the idle wakes which found the planner in RTC memory
+    uint64_t idle_awake_ms_max = 0;
+    uint64_t active_awake_ms_min = UINT64_MAX;
+    std::vector<uint64_t> active_at_us;    //!< when each active wake booted, from the start of the scenario
+    double cpu_us = 0;
+    double cpu_us_max = 0;
+    uint64_t awake_ms = 0;
+    uint64_t awake_ms_max = 0;
+    uint64_t simulated_us = 0;  //!< simulated time covered by all wakes and sleeps
+    native_sim::Counters c;
+};
+
+static double cpu_time_us(){
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+static uint64_t scenario_start_us = 0;    //!< simulated time the running scenario started
+static uint64_t logged_boot_us = 0;    //!< simulated time the last wake which wrote to the uSD card started
+static uint64_t logged_sleep_us = 0;   //!< simulated time it went to sleep
+
+/**
+ * @brief Boot the simulated board, run `setup()` and one `loop()`, and record the cost.
+ *
+ * @param[in] slept_us Time spent asleep before this wake.
+ * @param[inout] totals Accumulated results.
+ *
+ * @returns The sleep duration the firmware programmed before sleeping.
+ */
+static uint64_t simulate_wake(uint64_t slept_us, BenchTotals& totals){
+    native_sim::boot(slept_us);
+
+    double t0 = cpu_time_us();
+    setup();
+    // deep sleep doesn't return on the board, `loop()` never runs after `setup()` slept
+    bool idle = native_sim::slept;
+    if(!idle) loop();
+    double cpu = cpu_time_us() - t0;
+
+    TEST_ASSERT_TRUE_MESSAGE(native_sim::slept, "loop() returned without entering deep sleep");
+
+    const native_sim::Counters& c = native_sim::counters;
+    uint64_t awake_ms = native_sim::uptime_us() / 1000;
+
+    if(c.sd_bytes_written > 0){
+        logged_boot_us = native_sim::boot_us;
+        logged_sleep_us = native_sim::wall_us;
+    }
+
+    totals.wakes++;
+    if(c.mqtt_publishes > 0 || c.sd_bytes_written > 0 || c.flash_bytes_written > 0){
+        totals.active_wakes++;
+        totals.active_at_us.push_back(native_sim::boot_us - scenario_start_us);
+        if(awake_ms < totals.active_awake_ms_min) totals.active_awake_ms_min = awake_ms;
+    }
+    totals.cpu_us += cpu;
+    if(cpu > totals.cpu_us_max) totals.cpu_us_max = cpu;
+    totals.awake_ms += awake_ms;
+    if(awake_ms > totals.awake_ms_max) totals.awake_ms_max = awake_ms;
+    if(idle){
+        totals.idle_wakes++;
+        if(planner_from_rtc) totals.idle_nvs_writes += c.nvs_writes;
+        if(awake_ms > totals.idle_awake_ms_max) totals.idle_awake_ms_max = awake_ms;
+    }
+    totals.c.allocs += c.allocs;
+    totals.c.alloc_bytes += c.alloc_bytes;
+    totals.c.mqtt_publishes += c.mqtt_publishes;
+    totals.c.mqtt_bytes += c.mqtt_bytes;
+    totals.c.mqtt_failed += c.mqtt_failed;
+    totals.c.nvs_reads += c.nvs_reads;
+    totals.c.nvs_writes += c.nvs_writes;
+    totals.c.sd_bytes_written += c.sd_bytes_written;
+    totals.c.sd_file_ops += c.sd_file_ops;
+    totals.c.sd_bytes_read += c.sd_bytes_read;
+    totals.c.ble_adverts += c.ble_adverts;
+    totals.c.callback_io += c.callback_io;
+
+    return native_sim::sleep_request_us ? native_sim::sleep_request_us : DEFAULT_SLEEP_US;
+}
+
+/**
+ * @brief Run `wakes` consecutive wakes starting with a cold power-on, a blank NVS and uSD card.
+ *
+ * @param[in] wakes Number of wakes to simulate.
+ * @param[in] before_wake If not NULL, called with the wake number before each wake to change the environment.
+ */
+static BenchTotals run_scenario(int wakes, void (*before_wake)(int) = NULL){
+    native_sim::nvs.clear();
+    native_sim::sd_files.clear();
+    native_sim::sd_dirs.clear();
+    std::fill(native_sim::flash.begin(), native_sim::flash.end(), 0xFF);
+    native_sim::slept = false;
+
+    BenchTotals totals;
+    uint64_t start_us = native_sim::wall_us;
+    scenario_start_us = start_us;
+    uint64_t sleep_us = 0;
+    for(int i = 0; i < wakes; i++){
+        if(before_wake != NULL) before_wake(i);
+        sleep_us = simulate_wake(sleep_us, totals);
+    }
+    totals.simulated_us = native_sim::wall_us + sleep_us - start_us;
+    return totals;
+}
+
+/**
+ * @brief Print one comparable result line and optionally append it to `$DG_BENCH_REPORT`.
+ */
+static void report(const char* scenario, const BenchTotals& t){
+    double n = t.wakes ? t.wakes : 1;
+    double wakes_per_h = t.simulated_us ? t.wakes * 3600e6 / t.simulated_us : 0;
+    char line[512];
+    snprintf(line, sizeof(line),
+            "fw=v%d.%d.%d scenario=%s wakes=%d active=%d "
+            "cpu_us/loop=%.1f cpu_us_max=%.1f allocs/loop=%.1f alloc_bytes/loop=%.1f "
+            "publishes/loop=%.2f bytes_published/loop=%.1f publish_failures=%llu "
+            "nvs_reads/loop=%.2f nvs_writes/loop=%.2f sd_bytes/loop=%.1f sd_ops/loop=%.2f "
+            "awake_ms/loop=%.0f awake_ms_max=%llu wakes/h=%.1f",
+            VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, scenario, t.wakes, t.active_wakes,
+            t.cpu_us / n, t.cpu_us_max, t.c.allocs / n, t.c.alloc_bytes / n,
+            t.c.mqtt_publishes / n, t.c.mqtt_bytes / n, (unsigned long long)t.c.mqtt_failed,
+            t.c.nvs_reads / n, t.c.nvs_writes / n, t.c.sd_bytes_written / n, t.c.sd_file_ops / n,
+            t.awake_ms / n, (unsigned long long)t.awake_ms_max, wakes_per_h);
+    printf("BENCH %s\n", line);
+
+    const char* path = getenv("DG_BENCH_REPORT");
+    if(path == NULL) return;
+    FILE* f = fopen(path, "a");
+    if(f == NULL) return;
+    fprintf(f, "%d.%d.%d,%s,%d,%d,%.1f,%.1f,%.1f,%.2f,%.1f,%.2f,%.2f,%.1f,%.0f,%.1f\n",
+            VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, scenario, t.wakes, t.active_wakes,
+            t.cpu_us / n, t.c.allocs / n, t.c.alloc_bytes / n, t.c.mqtt_publishes / n, t.c.mqtt_bytes / n,
+            t.c.nvs_reads / n, t.c.nvs_writes / n, t.c.sd_bytes_written / n, t.awake_ms / n, wakes_per_h);
+    fclose(f);
+}
+
+// ---------------------------------------------------------------------
+// simulated field site
+// ---------------------------------------------------------------------
+/**
+ * @brief Populate the environment with the sensors of a typical vineyard site.
+ *
+ * Three Teros10 VWC probes on the ADC, two Atlas EZO pH probes on I2C and three
+ * BLE temperature/humidity sensors (two Minew S1, one KKM K6P) in range.
+ */
+static void setup_field_site(){
+    native_sim::i2c_devices = {{99, "7.02"}, {0x01, "6.85"}};
+
+    const std::string minew_uuid = "0000ffe1-0000-1000-8000-00805f9b34fb";
+    // Minew S1 HT frame: id, 2 bytes unused, temp, humidity, mac
+    const char s1_ht[] = {(char)0xa1, 0x01, 0x00, 0x17, 0x40, 0x3c, 0x20, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+    // Minew S1 Eddystone TLM frame: type, version, mV, temp, adv count, uptime
+    const char s1_tlm[] = {0x20, 0x00, 0x0b, (char)0xb8, 0x17, 0x40, 0, 0, 0x10, 0, 0, 0, 0x20, 0};
+    // KKM K6P TLM frame: type, version, mask, mV, temp, humidity, acc x/y/z
+    const char k6p_tlm[] = {0x21, 0x00, 0x07, 0x0b, (char)0xb8, 0x17, 0x32, 0x3c, 0x14, 0, 0, 0, 0, 0, 0};
+
+    native_sim::adverts = {
+        {"ac:23:3f:a1:00:01", "", minew_uuid, std::string(s1_ht, sizeof(s1_ht))},
+        {"ac:23:3f:a1:00:02", "", minew_uuid, std::string(s1_tlm, sizeof(s1_tlm))},
+        {"bc:57:29:00:00:03", "KBPro_203", "", std::string(k6p_tlm, sizeof(k6p_tlm))},
+    };
+}
+
+/**
+ * @brief Reset the environment knobs and firmware options to the defaults of a connected field site.
+ *
+ * Called by the `setUp()` of every suite before its own knobs.
+ */
+static void bench_defaults(){
+    setup_field_site();
+    native_sim::rtc_drift_ppm = 0;
+    native_sim::wdt_period_us = 0;
+    native_sim::wdt_keeps_rtc = true;
+    native_sim::adc_raw[0] = 6100;
+    native_sim::adc_raw[1] = 8200;
+    native_sim::adc_raw[2] = 9100;
+    native_sim::battery_percent = 87.5f;
+    native_sim::wifi_available = true;
+    native_sim::broker_available = true;
+    native_sim::ntp_available = true;
+    native_sim::sd_present = true;
+    log_binary = false;
+    log_compress = false;
+    mqtt_batch = false;
+    mqtt_msgpack = false;
+    mqtt_inflight = MQTT_INFLIGHT;
+    native_sim::mqtt_acks = true;
+    log_retention_bytes = SD_RETENTION_MB * 1048576UL;
+    log_retention_days = SD_RETENTION_DAYS;
+}
+
+/**
+ * @brief Decoded contents of a compressed stream, see lz_format.hpp.
+ */
+static std::string decompress(const std::string& packed){
+    struct {
+        const std::string* s;
+        size_t pos;
+        size_t read(uint8_t* buf, size_t len){
+            size_t n = std::min(len, s->size() - pos);
+            memcpy(buf, s->data() + pos, n);
+            pos += n;
+            return n;
+        }
+    } src = {&packed, 0};
+    LzReader<decltype(src)>* reader = new LzReader<decltype(src)>(src);
+    std::string out;
+    uint8_t buf[512];
+    size_t n;
+    TEST_ASSERT_TRUE(reader->begin());
+    while((n = reader->read(buf, sizeof(buf))) > 0) out.append((const char*)buf, n);
+    TEST_ASSERT_EQUAL(0, reader->bad_chunks);
+    delete reader;
+    return out;
+}
+
+/**
+ * @brief `topic;message` of every row in the log files ending in \p ext, sorted, `time;topic;message` \p with_time.
+ *
+ * Binary files are decoded with the same reader as the host tool, compressed
+ * files of past days are included with ".csv".
+ */
+static std::vector<std::string> logged_rows(const std::string& ext, bool with_time = false){
+    std::vector<std::string> rows;
+    for(const auto& f: native_sim::sd_files){
+        const std::string& name = f.first;
+        bool archived = ext == ".csv" && name.size() > 3 && name.compare(name.size() - 3, 3, ".lz") == 0;
+        if(!archived && (name.size() < ext.size() || name.compare(name.size() - ext.size(), ext.size(), ext) != 0)) continue;
+
+        std::vector<std::string> lines;
+        if(ext == ".bin"){
+            File file = SD.open(name.c_str(), FILE_READ);
+            BinlogReader<File> reader(file);
+            TEST_ASSERT_TRUE(reader.begin());
+            struct binlog_entry e;
+            std::string row;
+            while(reader.next_block()){
+                while(reader.next_record(e)){
+                    if(reader.row(e, row)) lines.push_back(row);
+                }
+            }
+            TEST_ASSERT_EQUAL(0, reader.bad_blocks);
+        }else{
+            std::string csv = archived ? decompress(f.second) : f.second;
+            size_t pos = csv.find('\n') + 1;  // skip header
+            while(pos < csv.size()){
+                size_t end = csv.find('\n', pos);
+                lines.push_back(csv.substr(pos, end - pos));
+                pos = end + 1;
+            }
+        }
+        for(const std::string& line: lines) rows.push_back(with_time ? line : line.substr(line.find(';') + 1));
+    }
+    std::sort(rows.begin(), rows.end());
+    return rows;
+}
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * @file main.cpp
+ * @brief Logged time on the host-native build: RTC drift, watchdog resets and power cycles.
+ *
+ * Each scenario runs the firmware once per simulated wake, see wake_bench.hpp,
+ * and prints one `BENCH` line.
+ *
+ * | Command | Description |
+ * | :-----: | :---------: |
+ * | `pio test -e native -f native/test_clock -v` | run the clock scenarios |
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include <wake_bench.hpp>
+
+void setUp(void){
+    bench_defaults();
+}
+
+void tearDown(void){}
+
+/**
+ * @brief Epoch of the newest row on the simulated uSD card, 0 if nothing was logged.
+ */
+static time_t last_logged_epoch(){
+    time_t newest = 0;
+    for(const auto& f: native_sim::sd_files){
+        const std::string& name = f.first;
+        if(name.size() < 4 || name.compare(name.size() - 4, 4, ".csv") != 0) continue;
+        const std::string& contents = f.second;
+        size_t start = contents.rfind('\n', contents.size() - 2);
+        std::string row = contents.substr(start == std::string::npos ? 0 : start + 1);
+        if(row.find(';') == std::string::npos || row.compare(0, 4, "TIME") == 0) continue;
+
+        time_t t = TimeStamp(row.substr(0, row.find(';'))).get_epoch();
+        if(t > newest) newest = t;
+    }
+    return newest;
+}
+
+/**
+ * @brief Seconds the newest row on the simulated uSD card is stamped before or after the wake which logged it.
+ */
+static long logged_clock_error_s(){
+    time_t t = last_logged_epoch();
+    time_t from = logged_boot_us / 1000000ULL;
+    time_t to = logged_sleep_us / 1000000ULL + 1;
+    return (long)(t < from ? t - from : t > to ? t - to : 0);
+}
+
+/**
+ * @brief Access point goes down after the first three hours.
+ */
+static void wifi_lost_after_3h(int){
+    native_sim::wifi_available = native_sim::wall_us - scenario_start_us < 3 * 3600ULL * 1000000ULL;
+}
+
+/**
+ * @brief WiFi is lost 30 minutes into the scenario.
+ */
+static void wifi_lost_after_30min(int){
+    native_sim::wifi_available = native_sim::wall_us - scenario_start_us < 1800ULL * 1000000ULL;
+}
+
+/**
+ * @brief RTC running 2% fast, three hours with NTP then an hour offline.
+ *
+ * The drift measured while NTP was available keeps the logged time within a tick
+ * of the real time, uncorrected it would be about 3.5 minutes behind.
+ */
+void bench_rtc_drift(void){
+    native_sim::rtc_drift_ppm = 20000;
+
+    BenchTotals t = run_scenario(66, wifi_lost_after_3h);
+    report("rtc_drift", t);
+
+    long error_s = logged_clock_error_s();
+    printf("rtc_drift: last record %ld s off\n", error_s);
+    TEST_ASSERT_LESS_THAN(TICK_S, labs(error_s));
+}
+
+/**
+ * @brief As `bench_rtc_drift` with the carrier board's watchdog, which keeps RTC memory, about twelve hours.
+ *
+ * The watchdog resets the board 64 s into every longer sleep. Those wakes take the
+ * time slept from the RTC timer, so the drift is measured while NTP is available
+ * and the logged time stays as accurate as without the watchdog.
+ */
+void bench_wdt_rtc_drift(void){
+    native_sim::rtc_drift_ppm = 20000;
+    native_sim::wdt_period_us = 64 * 1000000ULL;
+
+    BenchTotals t = run_scenario(660, wifi_lost_after_3h);
+    report("wdt_rtc_drift", t);
+
+    long error_s = logged_clock_error_s();
+    printf("wdt_rtc_drift: last record %ld s off\n", error_s);
+    TEST_ASSERT_LESS_THAN(TICK_S, labs(error_s));
+}
+
+/**
+ * @brief Watchdog resets which lose RTC memory every 64 s, half an hour with NTP then half an hour offline.
+ *
+ * Every wake is a cold boot and the RTC timer restarts, the clock restarts from the
+ * epoch saved to NVS plus the ticks counted since, each taken as `TICK_SECONDS`.
+ * The logged time stays within a tick of the real time. Without the ticks it fell
+ * about 4 minutes behind on every wake which ran a task.
+ */
+void bench_wdt_cold_drift(void){
+    native_sim::wdt_period_us = 64 * 1000000ULL;
+    native_sim::wdt_keeps_rtc = false;
+
+    BenchTotals t = run_scenario(57, wifi_lost_after_30min);
+    report("wdt_cold_drift", t);
+
+    long error_s = logged_clock_error_s();
+    printf("wdt_cold_drift: last record %ld s off\n", error_s);
+    TEST_ASSERT_LESS_THAN(TICK_S, labs(error_s));
+}
+
+/**
+ * @brief Three hours without a uSD card, past `MAX_COUNT` ticks, then a power cycle and offline logging to a card.
+ *
+ * The epoch is saved to NVS on every wake which ran a task, with or without a card,
+ * and when the scheduler restarts the reset count, so the cold boot keeps the time.
+ */
+void bench_clock_power_cycle(void){
+    native_sim::sd_present = false;
+    BenchTotals t = run_scenario(30);
+    TEST_ASSERT_TRUE(t.simulated_us > MAX_COUNT * TICK_S * 1000000ULL);
+
+    native_sim::sd_present = true;
+    native_sim::wifi_available = false;
+    // power cut for a tick, the clock can't know how long the board was off
+    native_sim::slept = false;
+    uint64_t sleep_us = TICK_S * 1000000ULL;
+    for(int i = 0; i < 6; i++) sleep_us = simulate_wake(sleep_us, t);
+    report("clock_power_cycle", t);
+
+    long error_s = logged_clock_error_s();
+    printf("clock_power_cycle: last record %ld s off\n", error_s);
+    TEST_ASSERT_LESS_THAN(TICK_S, labs(error_s));
+}
+
+int main(){
+    // timestamps are UTC on the device
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    UNITY_BEGIN();
+
+    RUN_TEST(bench_rtc_drift);
+    RUN_TEST(bench_wdt_rtc_drift);
+    RUN_TEST(bench_wdt_cold_drift);
+    RUN_TEST(bench_clock_power_cycle);
+
+    return UNITY_END();
+}
@@ -0,0 +1,125 @@
+/**
+ * @file main.cpp
+ * @brief Logging path on the host-native build: the log queue and allocations of `log_data()`.
+ *
+ * Each scenario runs the firmware once per simulated wake, see wake_bench.hpp,
+ * and prints one `BENCH` line.
+ *
+ * | Command | Description |
+ * | :-----: | :---------: |
+ * | `pio test -e native -f native/test_log_pipeline -v` | run the logging scenarios |
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include <atomic>
+#include <wake_bench.hpp>
+
+extern std::atomic<uint32_t> log_queue_overflows;
+uint32_t flash_queue_pending();
+void log_data(const char* topic, const char* message);
+
+void setUp(void){
+    bench_defaults();
+}
+
+void tearDown(void){}
+
+/**
+ * @brief A BLE scan finding more sensors than the log queue holds.
+ *
+ * Readings the queue cannot take are dropped and counted, the scan callback
+ * never writes to the uSD card or the network itself.
+ */
+void bench_ble_flood(void){
+    const std::string minew_uuid = "0000ffe1-0000-1000-8000-00805f9b34fb";
+    const char s1_tlm[] = {0x20, 0x00, 0x0b, (char)0xb8, 0x17, 0x40, 0, 0, 0x10, 0, 0, 0, 0x20, 0};
+    for(int i = 0; i < 4 * LOG_QUEUE_DEPTH; i++){
+        char mac[18];
+        snprintf(mac, sizeof(mac), "ac:23:3f:a1:01:%02x", i);
+        native_sim::adverts.push_back({mac, "", minew_uuid, std::string(s1_tlm, sizeof(s1_tlm))});
+    }
+    uint32_t overflows = log_queue_overflows;
+    BenchTotals t = run_scenario(2 * HT_FREQ, NULL);
+    report("ble_flood", t);
+
+    TEST_ASSERT_GREATER_THAN(4 * LOG_QUEUE_DEPTH, (int)t.c.ble_adverts);
+    TEST_ASSERT_EQUAL(0, (int)t.c.callback_io);
+    // without a logging task draining the queue during the scan the readings past its depth are dropped
+    TEST_ASSERT_GREATER_THAN(0, (int)(log_queue_overflows - overflows));
+    TEST_ASSERT_GREATER_THAN(0, t.c.mqtt_publishes);
+}
+
+/**
+ * @brief Heap allocations made by `log_data()` for readings formatted into a caller-owned buffer.
+ *
+ * Runs `setup()` of the first wake from a cold power-on which sets up logging, logs a
+ * few readings to warm up the destinations, eg. open the log file, then counts the
+ * allocations of the next ones.
+ */
+static uint64_t log_data_allocs(){
+    native_sim::nvs.clear();
+    native_sim::sd_files.clear();
+    native_sim::sd_dirs.clear();
+    std::fill(native_sim::flash.begin(), native_sim::flash.end(), 0xFF);
+    native_sim::slept = false;
+
+    uint64_t sleep_us = 0;
+    for(int wake = 0; ; wake++){
+        TEST_ASSERT_LESS_THAN(10, wake);
+        native_sim::boot(sleep_us);
+        logging_available = false;
+        setup();
+        if(logging_available == native_sim::sd_present) break;
+        if(!native_sim::slept) loop();
+        sleep_us = native_sim::sleep_request_us ? native_sim::sleep_request_us : DEFAULT_SLEEP_US;
+    }
+
+    const char* topic = "meter_teros10/0_shallow/24:6F:28:0A:1B:2C";
+    char msg[128];
+    uint64_t allocs = 0;
+    for(int i = 0; i < 40; i++){
+        if(i == 8) allocs = native_sim::counters.allocs;
+        snprintf(msg, sizeof(msg), "{\"MAC\": \"24:6F:28:0A:1B:2C\", \"DEPTH\": \"shallow\", \"VWC_RAW\":%f}", 0.5 + i * 0.01);
+        log_data(topic, msg);
+    }
+    allocs = native_sim::counters.allocs - allocs;
+    loop();
+    return allocs;
+}
+
+/**
+ * @brief `log_data()` does not allocate per reading, to MQTT and uSD, binary uSD files and the flash queue.
+ */
+void bench_log_data_allocs(void){
+    uint64_t connected = log_data_allocs();
+    TEST_ASSERT_TRUE(logging_available);
+    native_sim::wifi_available = false;
+    uint64_t offline_sd = log_data_allocs();
+    log_binary = true;
+    uint64_t offline_binary = log_data_allocs();
+    native_sim::sd_present = false;
+    uint64_t offline_flash = log_data_allocs();
+    TEST_ASSERT_GREATER_THAN(0, flash_queue_pending());
+
+    printf("log_data allocs per 32 readings: connected %llu, offline_sd %llu, offline_binary %llu, offline_flash %llu\n",
+            (unsigned long long)connected, (unsigned long long)offline_sd,
+            (unsigned long long)offline_binary, (unsigned long long)offline_flash);
+    TEST_ASSERT_EQUAL(0, (int)connected);
+    TEST_ASSERT_EQUAL(0, (int)offline_sd);
+    TEST_ASSERT_EQUAL(0, (int)offline_binary);
+    TEST_ASSERT_EQUAL(0, (int)offline_flash);
+}
+
+int main(){
+    // timestamps are UTC on the device
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    UNITY_BEGIN();
+
+    RUN_TEST(bench_ble_flood);
+    RUN_TEST(bench_log_data_allocs);
+
+    return UNITY_END();
+}
@@ -0,0 +1,234 @@
+/**
+ * @file main.cpp
+ * @brief MQTT on the host-native build: broker outages, batched, QoS 1 and MessagePack publishes.
+ *
+ * Each scenario runs the firmware once per simulated wake, see wake_bench.hpp,
+ * and prints one `BENCH` line.
+ *
+ * | Command | Description |
+ * | :-----: | :---------: |
+ * | `pio test -e native -f native/test_mqtt -v` | run the MQTT scenarios |
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include <set>
+#include <wake_bench.hpp>
+#include <batch_format.hpp>
+#include <msgpack_format.hpp>
+
+uint16_t mqtt_qos1_pending();
+
+void setUp(void){
+    bench_defaults();
+}
+
+void tearDown(void){}
+
+/**
+ * @brief Access point up but the broker down, every wake gives up within its budget and logs to the uSD card.
+ */
+void bench_broker_down(void){
+    BenchTotals connected = run_scenario(60);
+    native_sim::broker_available = false;
+    BenchTotals t = run_scenario(60);
+    report("broker_down", t);
+
+    TEST_ASSERT_EQUAL(0, t.c.mqtt_publishes);
+    TEST_ASSERT_GREATER_THAN(0, t.c.sd_bytes_written);
+    // no attempt outlasts the reconnect budget, the TCP connect and the CONNACK wait time out with what is left of it
+    TEST_ASSERT_LESS_OR_EQUAL(connected.awake_ms_max + MQTT_RECONNECT_MS, t.awake_ms_max);
+}
+
+static std::vector<std::string> batched;     //!< `topic;message` of every reading expanded from an envelope so far
+static int unbatched = 0;                   //!< live readings published on their own topic so far
+static int envelopes_most = 0;              //!< most envelopes published by one wake
+
+/**
+ * @brief Expand the envelopes published the wake before.
+ */
+static void expand_batches(int wake){
+    if(wake == 0){
+        // left by the scenario before
+        batched.clear();
+        unbatched = 0;
+        envelopes_most = 0;
+        return;
+    }
+    int envelopes = 0;
+    for(const auto& m: native_sim::mqtt_outbox){
+        if(m.first.compare(0, strlen(BATCH_TOPIC), BATCH_TOPIC) != 0){
+            // wired samples buffered with the radio off are uploaded as they were
+            if(m.second.find("\"AGE_S\"") == std::string::npos) unbatched++;
+            continue;
+        }
+        TEST_ASSERT_EQUAL_STRING((BATCH_TOPIC + std::string(WiFi.macAddress().c_str())).c_str(), m.first.c_str());
+        std::vector<struct batch_reading> readings;
+        TEST_ASSERT_TRUE(batch_expand(m.second, readings));
+        for(const auto& r: readings) batched.push_back(r.topic + ";" + r.message);
+        envelopes++;
+    }
+    if(envelopes > envelopes_most) envelopes_most = envelopes;
+}
+
+/**
+ * @brief One envelope per wake, expanding them gives back every reading logged to the uSD card.
+ */
+void bench_mqtt_batch(void){
+    BenchTotals single = run_scenario(60);
+    mqtt_batch = true;
+    BenchTotals t = run_scenario(60, expand_batches);
+    report("mqtt_batch", t);
+    expand_batches(60);
+
+    std::sort(batched.begin(), batched.end());
+    std::vector<std::string> logged = logged_rows(".csv");
+    printf("mqtt_batch: %.2f publishes per wake instead of %.2f, at most %d envelopes per wake, %zu readings\n",
+            (double)t.c.mqtt_publishes / t.wakes, (double)single.c.mqtt_publishes / single.wakes, envelopes_most, batched.size());
+    TEST_ASSERT_GREATER_THAN(0, batched.size());
+    TEST_ASSERT_TRUE(batched == logged);
+    TEST_ASSERT_EQUAL(0, unbatched);
+    TEST_ASSERT_EQUAL(1, envelopes_most);
+    TEST_ASSERT_EQUAL(0, t.c.mqtt_failed);
+}
+
+static std::set<std::string> delivered;     //!< `topic;message` of every reading the broker got so far, replayed ones as logged
+static int unacked_most = 0;                //!< most packets unacknowledged at the end of a wake while the broker lost them
+static uint64_t resent = 0;                 //!< packets sent again with the DUP flag so far
+static int commands = 0;                    //!< commands the broker sent so far
+static uint64_t received = 0;               //!< commands delivered to the callback so far
+static uint64_t acks_dropped = 0;           //!< PUBACKs PubSubClient read and dropped so far
+
+/**
+ * @brief Broker loses QoS 1 publishes for wakes 20 to 24, collects what it got the wake before.
+ *
+ * A command which does nothing is sent on every wake, between the acknowledgements.
+ */
+static void lose_publishes(int wake){
+    native_sim::mqtt_inbox.emplace_back(std::string("datagator/cmd/noop/") + WiFi.macAddress().c_str(), "{}");
+    commands++;
+    if(wake == 0){
+        delivered.clear();
+        unacked_most = 0;
+        resent = 0;
+        commands = 1;
+        received = 0;
+        acks_dropped = 0;
+        native_sim::mqtt_acks = true;
+        return;
+    }
+    received += native_sim::counters.mqtt_received;
+    acks_dropped += native_sim::counters.mqtt_acks_dropped;
+    for(const auto& m: native_sim::mqtt_outbox){
+        std::string message = m.second;
+        size_t at = message.rfind(", \"TIME\":\"");
+        if(at != std::string::npos && message.find(", \"BACKFILL\":true", at) != std::string::npos) message = message.substr(0, at) + "}";
+        delivered.insert(m.first + ";" + message);
+    }
+    resent += native_sim::counters.mqtt_dups;
+    if(!native_sim::mqtt_acks && mqtt_qos1_pending() > unacked_most) unacked_most = mqtt_qos1_pending();
+    native_sim::mqtt_acks = wake < 20 || wake >= 25;
+}
+
+/**
+ * @brief Readings published at QoS 1 and lost by the broker are sent again on the next wake.
+ *
+ * QoS 1 is off by default, four packets are kept unacknowledged here.
+ */
+void bench_mqtt_qos1(void){
+    mqtt_inflight = 4;
+    BenchTotals t = run_scenario(60, lose_publishes);
+    report("mqtt_qos1", t);
+    lose_publishes(60);
+
+    std::vector<std::string> logged = logged_rows(".csv");
+    int missing = 0;
+    for(const std::string& row: logged) if(delivered.count(row) == 0) missing++;
+    native_sim::mqtt_inbox.clear();
+    printf("mqtt_qos1: %zu readings, %d unacknowledged while the broker lost them, %llu sent again, %d missing\n",
+            logged.size(), unacked_most, (unsigned long long)resent, missing);
+    printf("mqtt_qos1: %llu of %d commands delivered, %llu acknowledgements dropped by the client\n",
+            (unsigned long long)received, commands - 1, (unsigned long long)acks_dropped);
+    TEST_ASSERT_GREATER_THAN(0, logged.size());
+    TEST_ASSERT_GREATER_THAN(0, unacked_most);
+    TEST_ASSERT_GREATER_THAN(0, (int)resent);
+    TEST_ASSERT_EQUAL(0, mqtt_qos1_pending());
+    TEST_ASSERT_EQUAL(0, missing);
+    // the last command is sent on a wake that was not simulated
+    TEST_ASSERT_EQUAL(commands - 1, (int)received);
+    TEST_ASSERT_EQUAL(0, (int)acks_dropped);
+}
+
+static std::set<std::string> packed;        //!< `topic;payload` of every MessagePack reading so far, topic without the prefix
+static size_t packed_bytes = 0;             //!< payload bytes of those readings
+static int unpacked = 0;                    //!< live readings published as JSON so far
+
+/**
+ * @brief Check the MessagePack readings published the wake before decode and encode to the same bytes.
+ */
+static void collect_packed(int wake){
+    if(wake == 0){
+        packed.clear();
+        packed_bytes = 0;
+        unpacked = 0;
+        return;
+    }
+    for(const auto& m: native_sim::mqtt_outbox){
+        if(m.first.compare(0, strlen(MSGPACK_TOPIC), MSGPACK_TOPIC) != 0){
+            // wired samples buffered with the radio off are uploaded as they were
+            if(m.second.find("\"AGE_S\"") == std::string::npos) unpacked++;
+            continue;
+        }
+        std::string json;
+        TEST_ASSERT_TRUE(msgpack_to_json((const uint8_t*)m.second.data(), m.second.size(), json));
+        uint8_t again[512];
+        size_t n = MsgpackEncoder(again, sizeof(again)).encode(json.c_str());
+        TEST_ASSERT_TRUE(std::string((const char*)again, n) == m.second);
+        packed.insert(m.first.substr(strlen(MSGPACK_TOPIC)) + ";" + m.second);
+        packed_bytes += m.second.size();
+    }
+}
+
+/**
+ * @brief Readings published as MessagePack are the readings logged to the uSD card, in fewer bytes.
+ */
+void bench_mqtt_msgpack(void){
+    BenchTotals json = run_scenario(60);
+    mqtt_msgpack = true;
+    BenchTotals t = run_scenario(60, collect_packed);
+    report("mqtt_msgpack", t);
+    collect_packed(60);
+
+    size_t json_bytes = 0;
+    int missing = 0;
+    std::vector<std::string> logged = logged_rows(".csv");
+    for(const std::string& row: logged){
+        size_t at = row.find(';');
+        uint8_t buf[512];
+        size_t n = MsgpackEncoder(buf, sizeof(buf)).encode(row.c_str() + at + 1);
+        json_bytes += row.size() - at - 1;
+        if(n == 0 || packed.count(row.substr(0, at + 1) + std::string((const char*)buf, n)) == 0) missing++;
+    }
+    printf("mqtt_msgpack: %zu readings, %zu payload bytes instead of %zu, %.2f bytes published per wake instead of %.2f\n",
+            logged.size(), packed_bytes, json_bytes, (double)t.c.mqtt_bytes / t.wakes, (double)json.c.mqtt_bytes / json.wakes);
+    TEST_ASSERT_GREATER_THAN(0, logged.size());
+    TEST_ASSERT_EQUAL(0, missing);
+    TEST_ASSERT_EQUAL(0, unpacked);
+    TEST_ASSERT_GREATER_THAN(packed_bytes, json_bytes);
+    TEST_ASSERT_EQUAL(0, t.c.mqtt_failed);
+}
+
+int main(){
+    // timestamps are UTC on the device
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    UNITY_BEGIN();
+
+    RUN_TEST(bench_broker_down);
+    RUN_TEST(bench_mqtt_batch);
+    RUN_TEST(bench_mqtt_qos1);
+    RUN_TEST(bench_mqtt_msgpack);
+
+    return UNITY_END();
+}
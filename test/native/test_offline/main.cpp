@@ -0,0 +1,182 @@
+/**
+ * @file main.cpp
+ * @brief Offline logging on the host-native build: uSD card, flash queue and backfill.
+ *
+ * Each scenario runs the firmware once per simulated wake, see wake_bench.hpp,
+ * and prints one `BENCH` line.
+ *
+ * | Command | Description |
+ * | :-----: | :---------: |
+ * | `pio test -e native -f native/test_offline -v` | run the offline scenarios |
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include <iterator>
+#include <wake_bench.hpp>
+
+void flash_queue_begin();
+uint32_t flash_queue_pending();
+
+/** Records logged less than this many seconds apart are replayed together, `BACKFILL_GROUP_S` in backfill.hpp. */
+#define BACKFILL_GROUP_S 30
+
+void setUp(void){
+    bench_defaults();
+}
+
+void tearDown(void){}
+
+static int replayed = 0;        //!< readings published from the flash queue so far
+static int aged = 0;            //!< readings uploaded from the wired sample buffer so far
+static uint32_t queued_most = 0;    //!< most readings waiting in the flash queue at the end of a wake
+
+/**
+ * @brief Access point down for the first hour, counts the replayed readings of the wake before.
+ */
+static void wifi_back_after_1h(int wake){
+    if(wake == 0){
+        replayed = aged = queued_most = 0;
+    }else{
+        // mounted again as on a wake, the wake before may not have used the queue
+        flash_queue_begin();
+        if(flash_queue_pending() > queued_most) queued_most = flash_queue_pending();
+    }
+    for(const auto& m: native_sim::mqtt_outbox){
+        if(m.second.find("\"TIME\":") != std::string::npos) replayed++;
+        if(m.second.find("\"AGE_S\":") != std::string::npos) aged++;
+    }
+    native_sim::wifi_available = native_sim::wall_us - scenario_start_us >= 3600ULL * 1000000ULL;
+}
+
+static std::vector<std::string> logged_offline;   //!< `time;topic;message` of every reading logged while the access point was down
+static std::vector<std::string> backfilled;       //!< `time;topic;message` of every replayed reading so far
+static size_t backfill_most = 0;                  //!< most message bytes replayed by one wake
+static size_t group_most = 0;                     //!< most message bytes of one group of records replayed together
+
+/**
+ * @brief Access point down for six hours after the first half hour, sorts the readings of the wake before.
+ */
+static void wifi_outage_6h(int wake){
+    static std::vector<std::string> seen;
+    if(wake == 0){
+        aged = 0;
+        seen.clear();
+        logged_offline.clear();
+        backfilled.clear();
+        backfill_most = group_most = 0;
+    }
+
+    std::vector<std::string> rows = logged_rows(".csv", true);
+    if(!native_sim::wifi_available) std::set_difference(rows.begin(), rows.end(), seen.begin(), seen.end(), std::back_inserter(logged_offline));
+    seen.swap(rows);
+
+    const std::string tag = ", \"BACKFILL\":true";
+    size_t bytes = 0, group = 0;
+    time_t newest = 0;
+    for(const auto& m: native_sim::mqtt_outbox){
+        if(m.second.find("\"AGE_S\":") != std::string::npos) aged++;
+        size_t at = m.second.rfind(", \"TIME\":\"");
+        if(at == std::string::npos || m.second.find(tag, at) == std::string::npos) continue;
+        size_t end = m.second.find('"', at + 10);
+        std::string time = m.second.substr(at + 10, end - at - 10);
+        backfilled.push_back(time + ";" + m.first + ";" + m.second.substr(0, at) + "}");
+        bytes += m.second.size();
+
+        // in the order replayed, as grouped by backfill.hpp
+        time_t epoch = TimeStamp(time).get_epoch();
+        if(newest == 0 || epoch > newest + BACKFILL_GROUP_S) group = 0;
+        if(epoch > newest) newest = epoch;
+        group += m.second.size();
+        if(group > group_most) group_most = group;
+    }
+    if(bytes > backfill_most) backfill_most = bytes;
+
+    uint64_t t = native_sim::wall_us - scenario_start_us;
+    native_sim::wifi_available = t < 1800ULL * 1000000ULL || t >= (1800ULL + 6 * 3600ULL) * 1000000ULL;
+}
+
+/**
+ * @brief Access point down, everything goes to the uSD card.
+ */
+void bench_offline_sd(void){
+    native_sim::wifi_available = false;
+
+    BenchTotals t = run_scenario(60);
+    report("offline_sd", t);
+
+    TEST_ASSERT_EQUAL(0, t.c.mqtt_publishes);
+    TEST_ASSERT_GREATER_THAN(0, t.c.sd_bytes_written);
+}
+
+/**
+ * @brief Broker reachable but no uSD card inserted.
+ */
+void bench_connected_no_sd(void){
+    native_sim::sd_present = false;
+
+    BenchTotals t = run_scenario(60);
+    report("connected_no_sd", t);
+
+    TEST_ASSERT_GREATER_THAN(0, t.c.mqtt_publishes);
+    TEST_ASSERT_EQUAL(0, t.c.sd_bytes_written);
+}
+
+/**
+ * @brief No uSD card and the access point down for an hour, readings wait in the flash queue.
+ *
+ * Every reading queued while offline is replayed once the access point is back.
+ */
+void bench_no_sd_wifi_outage(void){
+    native_sim::sd_present = false;
+
+    BenchTotals t = run_scenario(120, wifi_back_after_1h);
+    report("no_sd_wifi_outage", t);
+    wifi_back_after_1h(120);
+
+    printf("no_sd_wifi_outage: %u readings queued, %d replayed, %u left in flash\n", queued_most, replayed, flash_queue_pending());
+    TEST_ASSERT_GREATER_THAN(0, (int)queued_most);
+    TEST_ASSERT_EQUAL((int)queued_most, replayed);
+    // wired samples taken offline are in the flash queue, uploading them from the buffer too sent them twice
+    TEST_ASSERT_EQUAL(0, aged);
+    TEST_ASSERT_EQUAL(0, flash_queue_pending());
+    TEST_ASSERT_EQUAL(0, t.c.mqtt_failed);
+}
+
+/**
+ * @brief uSD card and the access point down for six hours, the logged readings are replayed within the budget.
+ *
+ * A wake only starts a group of records if it fits what is left of `BACKFILL_BYTES`,
+ * so it replays at most the budget plus one group.
+ */
+void bench_sd_wifi_outage(void){
+    BenchTotals t = run_scenario(600, wifi_outage_6h);
+    report("sd_wifi_outage", t);
+    wifi_outage_6h(600);
+
+    std::sort(logged_offline.begin(), logged_offline.end());
+    std::sort(backfilled.begin(), backfilled.end());
+    printf("sd_wifi_outage: %zu readings logged offline, %zu replayed, at most %zu bytes per wake and %zu per group\n",
+            logged_offline.size(), backfilled.size(), backfill_most, group_most);
+    TEST_ASSERT_GREATER_THAN(0, logged_offline.size());
+    TEST_ASSERT_TRUE(backfilled == logged_offline);
+    // wired samples taken offline are replayed by the backfill, uploading them from the buffer too sent them twice
+    TEST_ASSERT_EQUAL(0, aged);
+    TEST_ASSERT_LESS_OR_EQUAL(BACKFILL_BYTES + group_most, backfill_most);
+    TEST_ASSERT_EQUAL(0, t.c.mqtt_failed);
+}
+
+int main(){
+    // timestamps are UTC on the device
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    UNITY_BEGIN();
+
+    RUN_TEST(bench_offline_sd);
+    RUN_TEST(bench_connected_no_sd);
+    RUN_TEST(bench_no_sd_wifi_outage);
+    RUN_TEST(bench_sd_wifi_outage);
+
+    return UNITY_END();
+}
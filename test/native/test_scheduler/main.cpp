@@ -0,0 +1,141 @@
+/**
+ * @file main.cpp
+ * @brief Wake scheduling on the host-native build: task periods, the watchdog and adaptive rates.
+ *
+ * Each scenario runs the firmware once per simulated wake, see wake_bench.hpp,
+ * and prints one `BENCH` line.
+ *
+ * | Command | Description |
+ * | :-----: | :---------: |
+ * | `pio test -e native -f native/test_scheduler -v` | run the scheduling scenarios |
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include <atomic>
+#include <wake_bench.hpp>
+
+extern std::atomic<uint32_t> log_queue_records;
+extern std::atomic<uint32_t> log_queue_overflows;
+int adaptive_period(int period, bool wired);
+
+void setUp(void){
+    bench_defaults();
+}
+
+void tearDown(void){}
+
+static int profiled_sleep = 0;  //!< telemetry messages timing the sleep entry so far
+
+/**
+ * @brief Counts the telemetry published by the wake before with a `sleep` phase in `PROFILE_MS`.
+ */
+static void count_profiled_sleep(int){
+    for(const auto& m: native_sim::mqtt_outbox){
+        if(m.first.compare(0, 14, "datagator/tlm/") == 0 && m.second.find("\"sleep\": [") != std::string::npos) profiled_sleep++;
+    }
+}
+
+/**
+ * @brief Gateway with WiFi, broker and a uSD card, one hour of wakes.
+ */
+void bench_connected(void){
+    uint32_t queued = log_queue_records;
+    uint32_t overflows = log_queue_overflows;
+    profiled_sleep = 0;
+    BenchTotals t = run_scenario(60, count_profiled_sleep);
+    report("connected", t);
+    printf("connected: %d telemetry messages time the sleep entry\n", profiled_sleep);
+
+    TEST_ASSERT_GREATER_THAN(0, t.active_wakes);
+    TEST_ASSERT_GREATER_THAN(0, t.c.mqtt_publishes);
+    TEST_ASSERT_EQUAL(0, t.c.mqtt_failed);
+    // readings of the BLE scan and the wired sensors go through the log queue
+    TEST_ASSERT_GREATER_THAN(0, (int)(log_queue_records - queued));
+    TEST_ASSERT_EQUAL(0, (int)(log_queue_overflows - overflows));
+    TEST_ASSERT_GREATER_THAN(0, profiled_sleep);
+}
+
+/**
+ * @brief As `bench_connected` with the carrier board's watchdog, about six hours.
+ *
+ * The watchdog resets the board 64 s into every longer sleep. Those wakes find
+ * nothing due and go back to sleep from `setup()` on the state in RTC memory,
+ * without writing NVS or waiting for the sensors, then sleep the rest of the
+ * planned sleep. Readings are taken at the same times as without the watchdog.
+ */
+void bench_wdt(void){
+    BenchTotals plain = run_scenario(60);
+    native_sim::wdt_period_us = 64 * 1000000ULL;
+    BenchTotals t = run_scenario(400);
+    report("wdt", t);
+
+    long long late_us = 0;
+    TEST_ASSERT_GREATER_OR_EQUAL(plain.active_wakes, t.active_wakes);
+    for(int i = 0; i < std::min(plain.active_wakes, t.active_wakes); i++){
+        long long off_us = llabs((long long)t.active_at_us[i] - (long long)plain.active_at_us[i]);
+        if(off_us > late_us) late_us = off_us;
+    }
+    printf("wdt: %d of %d wakes with nothing due, %llu NVS writes and at most %llu ms awake on them, readings at most %lld ms off\n",
+            t.idle_wakes, t.wakes, (unsigned long long)t.idle_nvs_writes, (unsigned long long)t.idle_awake_ms_max, late_us / 1000);
+    TEST_ASSERT_GREATER_THAN(0, t.idle_wakes);
+    TEST_ASSERT_EQUAL(0, t.idle_nvs_writes);
+    // none of the waits of an active wake, eg. the sensors warming up
+    TEST_ASSERT_GREATER_THAN((int)t.idle_awake_ms_max, (int)t.active_awake_ms_min);
+    // the wakes of the hours without the watchdog happen on the same tick with it
+    TEST_ASSERT_TRUE(late_us < TICK_S * 1000000LL);
+    // the planner and everything else come from RTC memory after a watchdog reset
+    TEST_ASSERT_LESS_OR_EQUAL((int)plain.c.nvs_reads, (int)t.c.nvs_reads);
+}
+
+/**
+ * @brief Soil wetting up after irrigation starts, the VWC probes rise on every wake.
+ */
+static void irrigate(int wake){
+    for(int i = 0; i < 3; i++) native_sim::adc_raw[i] = 6100 + 1000 * i + 400 * wake;
+}
+
+/**
+ * @brief VWC changing on every wake, wired sensors are read more often.
+ */
+void bench_irrigation(void){
+    BenchTotals flat = run_scenario(60);
+    BenchTotals t = run_scenario(60, irrigate);
+    report("irrigation", t);
+
+    TEST_ASSERT_GREATER_THAN(flat.c.mqtt_publishes, t.c.mqtt_publishes);
+
+    // the shorter period is kept in NVS through watchdog resets which lose RTC memory
+    native_sim::wdt_period_us = 64 * 1000000ULL;
+    native_sim::wdt_keeps_rtc = false;
+    run_scenario(60, irrigate);
+    printf("irrigation: wired period %d ticks after cold watchdog resets, %d configured\n", adaptive_period(VWC_FREQ, true), VWC_FREQ);
+    TEST_ASSERT_LESS_THAN(VWC_FREQ, adaptive_period(VWC_FREQ, true));
+}
+
+/**
+ * @brief Battery below BATT_CRITICAL_PERCENT, every period is stretched.
+ */
+void bench_low_battery(void){
+    BenchTotals charged = run_scenario(60);
+    native_sim::battery_percent = BATT_CRITICAL_PERCENT - 5;
+    BenchTotals t = run_scenario(60);
+    report("low_battery", t);
+
+    TEST_ASSERT_GREATER_THAN(t.wakes * 3600e6 / t.simulated_us, charged.wakes * 3600e6 / charged.simulated_us);
+}
+
+int main(){
+    // timestamps are UTC on the device
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    UNITY_BEGIN();
+
+    RUN_TEST(bench_connected);
+    RUN_TEST(bench_wdt);
+    RUN_TEST(bench_irrigation);
+    RUN_TEST(bench_low_battery);
+
+    return UNITY_END();
+}
@@ -0,0 +1,256 @@
+/**
+ * @file main.cpp
+ * @brief uSD log files on the host-native build: binary and compressed logs, time ranges and retention.
+ *
+ * Each scenario runs the firmware once per simulated wake, see wake_bench.hpp,
+ * and prints one `BENCH` line.
+ *
+ * | Command | Description |
+ * | :-----: | :---------: |
+ * | `pio test -e native -f native/test_sd_log -v` | run the uSD log scenarios |
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include <wake_bench.hpp>
+
+/** Wakes of the `get_time_range` scenario, the request arrives on the last. */
+#define RANGE_WAKES 240
+static uint32_t range_to = 0;   //!< end of the range requested by `request_last_10min`
+static uint32_t range_back = 0; //!< seconds the requested range ends before the last wake
+static bool range_compress = false; //!< ask for compressed pages
+
+void setUp(void){
+    bench_defaults();
+    range_back = 0;
+    range_compress = false;
+}
+
+void tearDown(void){}
+
+/**
+ * @brief Ask for ten minutes of logged rows, ending `range_back` before the last wake, on the last wake.
+ */
+static void request_last_10min(int wake){
+    if(wake != RANGE_WAKES - 1) return;
+    range_to = native_sim::wall_us / 1000000 - range_back;
+    std::string msg = "{\"page_size\":20, \"compress\":" + std::string(range_compress ? "1" : "0") +
+        ", \"time_range\":\"" + std::to_string(range_to - 600) + "&" + std::to_string(range_to) + "\"}";
+    native_sim::mqtt_inbox.emplace_back(std::string("datagator/cmd/get_time_range/") + WiFi.macAddress().c_str(), msg);
+}
+
+/**
+ * @brief Rows published in answer to `get_time_range` this wake.
+ */
+static std::vector<std::string> published_rows(){
+    std::vector<std::string> rows;
+    for(const auto& m: native_sim::mqtt_outbox){
+        bool packed = m.first.compare(0, 29, "datagator/data/time_range_lz/") == 0;
+        if(!packed && m.first.compare(0, 26, "datagator/data/time_range/") != 0) continue;
+        std::string p = packed ? decompress(m.second) : m.second;
+        size_t i = p.find("\"data\":[") + 8;
+        while(i < p.size() && p[i] == '"'){
+            std::string row;
+            for(i++; i < p.size() && p[i] != '"'; i++){
+                if(p[i] == '\\') i++;
+                row += p[i];
+            }
+            rows.push_back(row);
+            i += 2;     // closing quote and comma
+        }
+    }
+    return rows;
+}
+
+/**
+ * @brief Bytes of the log files, without their time index, of the days from \p from to \p to.
+ */
+static size_t day_file_bytes(time_t from, time_t to){
+    size_t bytes = 0;
+    for(time_t day = from - from % 86400; day <= to; day += 86400){
+        struct tm* t = gmtime(&day);
+        std::string name = "/log_" + std::to_string(t->tm_mon + 1) + "-" + std::to_string(t->tm_mday) + "-" + std::to_string(t->tm_year + 1900) + ".";
+        for(const auto& f: native_sim::sd_files){
+            const std::string& file = f.first;
+            if(file.find(name) == std::string::npos || file.compare(file.size() - 4, 4, ".idx") == 0) continue;
+            bytes += f.second.size();
+        }
+    }
+    return bytes;
+}
+
+/**
+ * @brief Ask for ten minutes out of a day of CSV and binary logs.
+ *
+ * The time index of each file lets the reader seek to the range instead of
+ * reading the files of its days.
+ */
+static void time_range(const char* name, const std::string& ext){
+    BenchTotals t = run_scenario(RANGE_WAKES, request_last_10min);
+    report(name, t);
+    uint64_t read = native_sim::counters.sd_bytes_read;    // last wake, before the files are checked here
+
+    std::vector<std::string> expected;
+    for(const std::string& row: logged_rows(ext, true)){
+        int month, day, year, hour, minutes, seconds;
+        TEST_ASSERT_EQUAL(6, sscanf(row.c_str(), "%d-%d-%dT%d:%d:%d", &month, &day, &year, &hour, &minutes, &seconds));
+        time_t epoch = TimeStamp(day, month, year, hour, minutes, seconds, 0).get_epoch();
+        if(epoch >= range_to - 600 && epoch <= range_to) expected.push_back(row);
+    }
+    size_t days = day_file_bytes(range_to - 600, range_to);
+
+    printf("%s: %zu rows, read %llu of the %zu bytes logged on their days\n", name, expected.size(), (unsigned long long)read, days);
+    TEST_ASSERT_GREATER_THAN(0, expected.size());
+    std::vector<std::string> published = published_rows();
+    std::sort(published.begin(), published.end());
+    TEST_ASSERT_TRUE(published == expected);
+    TEST_ASSERT_TRUE(read < days);
+
+    // pages longer than the client's buffer are streamed
+    size_t page = 0;
+    for(const auto& m: native_sim::mqtt_outbox){
+        if(m.first.compare(0, 20, "datagator/data/time_") == 0) page = std::max(page, m.second.size());
+    }
+    printf("%s: longest page %zu bytes, MQTT buffer %u bytes\n", name, page, mqtt_client.getBufferSize());
+    TEST_ASSERT_GREATER_THAN(mqtt_client.getBufferSize(), page);
+    TEST_ASSERT_EQUAL(0, t.c.mqtt_failed);
+}
+
+/**
+ * @brief Access point down, everything goes to the uSD card in the binary format.
+ *
+ * Decoding the binary files must give back the rows of the CSV files, in fewer bytes.
+ */
+void bench_offline_binary(void){
+    native_sim::wifi_available = false;
+    BenchTotals csv = run_scenario(60);
+    std::vector<std::string> csv_rows = logged_rows(".csv");
+
+    log_binary = true;
+    BenchTotals t = run_scenario(60);
+    report("offline_binary", t);
+    std::vector<std::string> bin_rows = logged_rows(".bin");
+
+    printf("offline_binary: %.1fx less written than CSV\n", (double)csv.c.sd_bytes_written / t.c.sd_bytes_written);
+    TEST_ASSERT_GREATER_THAN(0, bin_rows.size());
+    TEST_ASSERT_TRUE(csv_rows == bin_rows);
+    TEST_ASSERT_GREATER_THAN(t.c.sd_bytes_written, csv.c.sd_bytes_written);
+}
+
+/**
+ * @brief `get_time_range` for the last ten minutes, CSV then binary log files.
+ */
+void bench_time_range(void){
+    time_range("time_range_csv", ".csv");
+    log_binary = true;
+    time_range("time_range_binary", ".bin");
+}
+
+/**
+ * @brief A day of CSV logs compressed after midnight, ten minutes of it requested as compressed pages.
+ */
+void bench_log_archive(void){
+    log_compress = true;
+    range_back = 14 * 3600;
+    range_compress = true;
+    // start at noon, the day is over half way through the scenario
+    native_sim::wall_us += (86400 + 43200 - native_sim::wall_us / 1000000 % 86400) * 1000000ULL;
+    time_range("log_archive", ".csv");
+
+    size_t packed = 0, raw = 0;
+    for(const auto& f: native_sim::sd_files){
+        if(f.first.size() < 3 || f.first.compare(f.first.size() - 3, 3, ".lz") != 0) continue;
+        packed += f.second.size();
+        raw += decompress(f.second).size();
+        TEST_ASSERT_EQUAL(0, native_sim::sd_files.count(f.first.substr(0, f.first.size() - 3) + ".csv"));
+    }
+    printf("log_archive: %zu of %zu bytes after compression\n", packed, raw);
+    TEST_ASSERT_GREATER_THAN(0, packed);
+    TEST_ASSERT_GREATER_THAN(packed, raw);
+}
+
+/** Wakes of the retention scenarios, about four days. */
+#define RETENTION_WAKES 1000
+
+/**
+ * @brief Log file left in the root directory of the card by older firmware.
+ */
+static void legacy_log_file(int wake){
+    if(wake == 0) native_sim::sd_files["/log_7-1-2023.csv"] = "TIME;MQTT TOPIC;MQTT MESSAGE\n7-1-2023T12:0:0+0;bench/legacy;{}\n";
+}
+
+/**
+ * @brief Check that every log file is in the directory of its month and the manifest counts the past days.
+ *
+ * @param[out] oldest Midnight of the oldest day on the card.
+ *
+ * @returns bytes of the days counted by the manifest
+ */
+static uint32_t check_log_dirs(uint32_t& oldest){
+    const std::string& manifest = native_sim::sd_files["/log_manifest.dat"];
+    TEST_ASSERT_GREATER_THAN(19, manifest.size());
+    uint32_t through, count, counted = 0;
+    memcpy(&through, manifest.data() + 8, 4);
+    memcpy(&count, manifest.data() + 12, 4);
+    TEST_ASSERT_EQUAL(20 + count * 8, manifest.size());
+    for(uint32_t i = 0; i < count; i++){
+        uint32_t bytes;
+        memcpy(&bytes, manifest.data() + 20 + i * 8 + 4, 4);
+        counted += bytes;
+    }
+
+    uint32_t past = 0;
+    oldest = UINT32_MAX;
+    for(const auto& f: native_sim::sd_files){
+        if(f.first == "/log_manifest.dat") continue;
+        int year, month, m, d, y;
+        TEST_ASSERT_EQUAL(5, sscanf(f.first.c_str(), "/%4d-%2d/log_%d-%d-%d.", &year, &month, &m, &d, &y));
+        TEST_ASSERT_TRUE(year == y && month == m);
+        TEST_ASSERT_TRUE(native_sim::sd_dirs.count(f.first.substr(0, 8)) > 0);
+        uint32_t day = TimeStamp(d, m, y, 0, 0, 0, 0).get_epoch();
+        if(day < oldest) oldest = day;
+        if(day < through) past += f.second.size();
+    }
+    TEST_ASSERT_EQUAL(counted, past);
+    return past;
+}
+
+/**
+ * @brief Four days of logs on a card from older firmware, kept to two days, then to 300 KB.
+ */
+void bench_log_retention(void){
+    log_retention_days = 2;
+    BenchTotals t = run_scenario(RETENTION_WAKES, legacy_log_file);
+    report("log_retention_days", t);
+    uint32_t now = native_sim::wall_us / 1000000;
+    uint32_t oldest;
+    uint32_t kept = check_log_dirs(oldest);
+    printf("log_retention_days: %u bytes of past days kept, oldest %u days back\n", kept, (now - oldest) / 86400);
+    TEST_ASSERT_EQUAL(0, native_sim::sd_files.count("/2023-07/log_7-1-2023.csv"));
+    TEST_ASSERT_TRUE(oldest >= now - now % 86400 - 2 * 86400);
+
+    log_retention_days = 0;
+    log_retention_bytes = 300000;
+    t = run_scenario(RETENTION_WAKES);
+    report("log_retention_bytes", t);
+    kept = check_log_dirs(oldest);
+    now = native_sim::wall_us / 1000000;
+    printf("log_retention_bytes: %u bytes of past days kept, oldest %u days back\n", kept, (now - oldest) / 86400);
+    TEST_ASSERT_GREATER_THAN(0, kept);
+    TEST_ASSERT_LESS_OR_EQUAL(log_retention_bytes, kept);
+}
+
+int main(){
+    // timestamps are UTC on the device
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    UNITY_BEGIN();
+
+    RUN_TEST(bench_offline_binary);
+    RUN_TEST(bench_time_range);
+    RUN_TEST(bench_log_archive);
+    RUN_TEST(bench_log_retention);
+
+    return UNITY_END();
+}
@@ -0,0 +1,86 @@
+/**
+ * @file batch_expand.cpp
+ * @brief Host tool splitting the envelopes of batch_format.hpp back into readings.
+ *
+ * Reads envelopes published to `datagator/batch/<MAC>`, one per line, and prints one
+ * line `<topic> <message>` per reading, the topic and message it was published with
+ * before `MQTT_BATCH`. Feed it from the broker and republish to restore the
+ * per-topic view for ingest scripts which subscribe to the legacy topics:
+ *
+ *     mosquitto_sub -t 'datagator/batch/#' | batch_expand | \
+ *         while read -r topic message; do mosquitto_pub -t "$topic" -m "$message"; done
+ *
+ * With `-t` the time of each reading is printed first, as seconds since 1970.
+ *
+ * Build from the repository root:
+ *
+ *     g++ -std=c++11 -O2 -Iinclude tools/batch_expand/batch_expand.cpp -o batch_expand
+ *
+ * Usage: `batch_expand [-t] [file]...`, standard input without files
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <batch_format.hpp>
+
+static bool with_time = false;  //!< print the epoch of each reading
+
+/**
+ * @brief Print the readings of every envelope in \p f.
+ *
+ * @returns `false` if a line is not an envelope
+ */
+static bool expand(FILE* f, const char* name){
+    bool ok = true;
+    std::string line;
+    int c;
+    unsigned long n = 0;
+    do{
+        c = fgetc(f);
+        if(c != '\n' && c != EOF){
+            line += (char)c;
+            continue;
+        }
+        n++;
+        if(line.empty()) continue;
+
+        std::vector<struct batch_reading> readings;
+        if(!batch_expand(line, readings)){
+            fprintf(stderr, "%s:%lu: not an envelope\n", name, n);
+            ok = false;
+        }
+        for(size_t i = 0; i < readings.size(); i++){
+            if(with_time) printf("%lu ", (unsigned long)readings[i].epoch);
+            printf("%s %s\n", readings[i].topic.c_str(), readings[i].message.c_str());
+        }
+        fflush(stdout);
+        line.clear();
+    }while(c != EOF);
+    return ok;
+}
+
+int main(int argc, char** argv){
+    int first = 1;
+    if(argc > 1 && strcmp(argv[1], "-t") == 0){
+        with_time = true;
+        first++;
+    }
+    if(first >= argc) return expand(stdin, "stdin") ? 0 : 1;
+
+    bool ok = true;
+    for(int i = first; i < argc; i++){
+        FILE* f = fopen(argv[i], "r");
+        if(f == NULL){
+            fprintf(stderr, "%s: can not open\n", argv[i]);
+            ok = false;
+            continue;
+        }
+        ok = expand(f, argv[i]) && ok;
+        fclose(f);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file binlog2csv.cpp
+ * @brief Host tool converting binary uSD card log files back to the CSV log format.
+ *
+ * Prints the rows of each file, with the CSV header, to stdout in the same
+ * `time;topic;message` form the firmware writes with `SD_LOG_BINARY` off.
+ *
+ * Build from the repository root:
+ *
+ *     g++ -std=c++11 -O2 -Iinclude tools/binlog2csv/binlog2csv.cpp -o binlog2csv
+ *
+ * Usage: `binlog2csv [-s <sensor>] <log_m-d-y.bin>...`, `-s` keeps only rows of
+ * one sensor type, eg. `meter_teros10`, see `BINLOG_SENSORS`.
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <binlog_format.hpp>
+
+/**
+ * @brief `BinlogReader` source reading a file with stdio.
+ */
+struct StdioSource {
+    FILE* f;
+    size_t read(uint8_t* buf, size_t len){ return fread(buf, 1, len, f); }
+    bool seek(uint32_t pos){ return fseek(f, pos, SEEK_SET) == 0; }
+    size_t position(){ return ftell(f); }
+};
+
+/**
+ * @brief Print the rows of one file.
+ *
+ * @returns `false` if the file could not be read
+ */
+static bool convert(const char* path, int sensor){
+    FILE* f = fopen(path, "rb");
+    if(f == NULL){
+        fprintf(stderr, "%s: can not open\n", path);
+        return false;
+    }
+
+    StdioSource src = {f};
+    BinlogReader<StdioSource>* reader = new BinlogReader<StdioSource>(src);
+    if(!reader->begin()){
+        fprintf(stderr, "%s: not a binary log file\n", path);
+        delete reader;
+        fclose(f);
+        return false;
+    }
+
+    struct binlog_entry e;
+    std::string row;
+    unsigned long rows = 0, undecodable = 0;
+    while(reader->next_block()){
+        while(reader->next_record(e)){
+            if(e.kind == BINLOG_TOPIC) continue;
+            if(sensor >= 0 && e.sensor != sensor) continue;
+            if(!reader->row(e, row)){
+                undecodable++;
+                continue;
+            }
+            printf("%s\n", row.c_str());
+            rows++;
+        }
+    }
+    fprintf(stderr, "%s: %lu rows, %lu undecodable, %lu bad blocks\n", path, rows, undecodable, (unsigned long)reader->bad_blocks);
+
+    delete reader;
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char** argv){
+    int sensor = -1;
+    int first = 1;
+    if(argc > 2 && strcmp(argv[1], "-s") == 0){
+        sensor = 0;
+        for(size_t i = 0; i < BINLOG_NUM_SENSORS; i++){
+            if(strcmp(argv[2], BINLOG_SENSORS[i]) == 0) sensor = i + 1;
+        }
+        first = 3;
+    }
+    if(first >= argc){
+        fprintf(stderr, "usage: %s [-s <sensor>] <log_m-d-y.bin>...\n", argv[0]);
+        return 2;
+    }
+
+    printf("TIME;MQTT TOPIC;MQTT MESSAGE\n");
+    bool ok = true;
+    for(int i = first; i < argc; i++) ok = convert(argv[i], sensor) && ok;
+    return ok ? 0 : 1;
+}
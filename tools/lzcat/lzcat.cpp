@@ -0,0 +1,76 @@
+/**
+ * @file lzcat.cpp
+ * @brief Host tool decompressing the streams of lz_format.hpp.
+ *
+ * Prints the decoded contents of each file to stdout: the CSV rows of a
+ * compressed uSD card log file "log_<m-d-y>.lz", or the JSON page of a
+ * `get_time_range` response published compressed to `datagator/data/time_range_lz/<MAC>`
+ * and saved to a file, eg. with `mosquitto_sub -N ... > page.lz`.
+ *
+ * Build from the repository root:
+ *
+ *     g++ -std=c++11 -O2 -Iinclude tools/lzcat/lzcat.cpp -o lzcat
+ *
+ * Usage: `lzcat <file>...`
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include <cstdio>
+#include <cstring>
+#include <lz_format.hpp>
+
+/**
+ * @brief `LzReader` source reading a file with stdio.
+ */
+struct StdioSource {
+    FILE* f;
+    size_t read(uint8_t* buf, size_t len){ return fread(buf, 1, len, f); }
+};
+
+/**
+ * @brief Print the decoded contents of one file.
+ *
+ * @returns `false` if the file could not be read or has damaged chunks
+ */
+static bool decompress(const char* path){
+    FILE* f = fopen(path, "rb");
+    if(f == NULL){
+        fprintf(stderr, "%s: can not open\n", path);
+        return false;
+    }
+
+    StdioSource src = {f};
+    LzReader<StdioSource>* reader = new LzReader<StdioSource>(src);
+    if(!reader->begin()){
+        fprintf(stderr, "%s: not a compressed file\n", path);
+        delete reader;
+        fclose(f);
+        return false;
+    }
+
+    uint8_t buf[LZ_CHUNK_LEN];
+    size_t n;
+    unsigned long bytes = 0;
+    while((n = reader->read(buf, sizeof(buf))) > 0){
+        fwrite(buf, 1, n, stdout);
+        bytes += n;
+    }
+    bool ok = reader->bad_chunks == 0 && feof(f);
+    if(!ok) fprintf(stderr, "%s: damaged chunk after %lu bytes\n", path, bytes);
+
+    delete reader;
+    fclose(f);
+    return ok;
+}
+
+int main(int argc, char** argv){
+    if(argc < 2){
+        fprintf(stderr, "usage: %s <file>...\n", argv[0]);
+        return 2;
+    }
+
+    bool ok = true;
+    for(int i = 1; i < argc; i++) ok = decompress(argv[i]) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file msgpack2json.cpp
+ * @brief Host tool decoding the MessagePack readings of msgpack_format.hpp into JSON.
+ *
+ * Reads one message per line as printed by `mosquitto_sub -F '%t %x'`, the topic and
+ * the payload in hex, and prints one line `<topic> <message>` per message with the
+ * `msgpack/` prefix taken off the topic. Feed it from the broker and republish to
+ * restore the JSON view for ingest scripts which subscribe to the legacy topics:
+ *
+ *     mosquitto_sub -t 'msgpack/#' -F '%t %x' | msgpack2json | \
+ *         while read -r topic message; do mosquitto_pub -t "$topic" -m "$message"; done
+ *
+ * Build from the repository root:
+ *
+ *     g++ -std=c++11 -O2 -Iinclude tools/msgpack2json/msgpack2json.cpp -o msgpack2json
+ *
+ * Usage: `msgpack2json [file]...`, standard input without files
+ *
+ * @author Garrett Wells
+ * @date 2023
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <msgpack_format.hpp>
+
+/**
+ * @brief Value of the hex digit \p c, -1 if it is none.
+ */
+static int hex_digit(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Decode `<topic> <hex payload>` in \p line and print it.
+ *
+ * @returns `false` if \p line is not a MessagePack message
+ */
+static bool decode(const std::string& line){
+    size_t space = line.find(' ');
+    if(space == std::string::npos || (line.size() - space - 1) % 2 != 0) return false;
+
+    std::vector<uint8_t> payload;
+    for(size_t i = space + 1; i + 1 < line.size(); i += 2){
+        int hi = hex_digit(line[i]), lo = hex_digit(line[i + 1]);
+        if(hi < 0 || lo < 0) return false;
+        payload.push_back(hi << 4 | lo);
+    }
+    std::string json;
+    if(payload.empty() || !msgpack_to_json(payload.data(), payload.size(), json)) return false;
+
+    std::string topic = line.substr(0, space);
+    if(topic.compare(0, strlen(MSGPACK_TOPIC), MSGPACK_TOPIC) == 0) topic.erase(0, strlen(MSGPACK_TOPIC));
+    printf("%s %s\n", topic.c_str(), json.c_str());
+    fflush(stdout);
+    return true;
+}
+
+/**
+ * @brief Decode every line of \p f.
+ *
+ * @returns `false` if a line is not a MessagePack message
+ */
+static bool decode_file(FILE* f, const char* name){
+    bool ok = true;
+    std::string line;
+    int c;
+    unsigned long n = 0;
+    do{
+        c = fgetc(f);
+        if(c != '\n' && c != EOF){
+            line += (char)c;
+            continue;
+        }
+        n++;
+        if(!line.empty() && !decode(line)){
+            fprintf(stderr, "%s:%lu: not a MessagePack message\n", name, n);
+            ok = false;
+        }
+        line.clear();
+    }while(c != EOF);
+    return ok;
+}
+
+int main(int argc, char** argv){
+    if(argc < 2) return decode_file(stdin, "stdin") ? 0 : 1;
+
+    bool ok = true;
+    for(int i = 1; i < argc; i++){
+        FILE* f = fopen(argv[i], "r");
+        if(f == NULL){
+            fprintf(stderr, "%s: can not open\n", argv[i]);
+            ok = false;
+            continue;
+        }
+        ok = decode_file(f, argv[i]) && ok;
+        fclose(f);
+    }
+    return ok ? 0 : 1;
+}